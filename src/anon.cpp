@@ -20,7 +20,78 @@
 #include <txmempool.h>
 
 
-bool VerifyMLSAG(const CTransaction &tx, CValidationState &state)
+/** Checks of the sizes in an anon input, done for all inputs before any ring member is read. */
+static bool CheckAnonInputSizes(const CTxIn &txin, bool fSplitCommitments, CValidationState &state)
+{
+    if (!txin.IsAnonInput()) {
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anon-input");
+    }
+
+    uint32_t nInputs, nRingSize;
+    txin.GetAnonInfo(nInputs, nRingSize);
+
+    if (nInputs < 1 || nInputs > MAX_ANON_INPUTS) { // TODO: Select max inputs size
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-anon-num-inputs");
+    }
+    if (nRingSize < MIN_RINGSIZE || nRingSize > MAX_RINGSIZE) {
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-anon-ringsize");
+    }
+
+    if (txin.scriptData.stack.size() != 1) {
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-dstack-size");
+    }
+    if (txin.scriptWitness.stack.size() != 2) {
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-wstack-size");
+    }
+
+    if (txin.scriptData.stack[0].size() != nInputs * 33) {
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-keyimages-size");
+    }
+    if (txin.scriptWitness.stack[1].size() != (1 + (nInputs+1) * nRingSize) * 32 + (fSplitCommitments ? 33 : 0)) {
+        return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-sig-size");
+    }
+    return true;
+}
+
+static size_t PrefetchRingOutputs(const CTxIn &txin, std::map<int64_t, CAnonOutput> &mapOutputs)
+{
+    // Collect the ring members of the input so they can be resolved in one pass,
+    // the input sizes were checked by CheckAnonInputSizes.
+    uint32_t nInputs, nRingSize;
+    txin.GetAnonInfo(nInputs, nRingSize);
+
+    std::vector<int64_t> vIndices;
+    const std::vector<uint8_t> &vMI = txin.scriptWitness.stack[0];
+    size_t ofs = 0, nB = 0;
+    for (size_t k = 0; k < nInputs * nRingSize; ++k) {
+        uint64_t nIndex = 0;
+        if (0 != GetVarInt(vMI, ofs, nIndex, nB)) {
+            break;
+        }
+        ofs += nB;
+        vIndices.push_back((int64_t)nIndex);
+    }
+
+    if (vIndices.empty()) {
+        return 0;
+    }
+    return pblocktree->ReadRCTOutputs(vIndices, mapOutputs);
+}
+
+bool CMLSAGCheck::operator()()
+{
+    const CTxIn &txin = ptxTo->vin[nIn];
+    const std::vector<uint8_t> &vKeyImages = txin.scriptData.stack[0];
+    const std::vector<uint8_t> &vDL = txin.scriptWitness.stack[1];
+    const uint256 txhash = ptxTo->GetHash();
+
+    error = secp256k1_verify_mlsag(secp256k1_ctx_blind,
+        txhash.begin(), nCols, nRows,
+        &vM[0], &vKeyImages[0], &vDL[0], &vDL[32]);
+    return error == 0;
+};
+
+bool VerifyMLSAG(const CTransaction &tx, CValidationState &state, std::vector<CMLSAGCheck> *pvChecks)
 {
     const Consensus::Params &consensus = Params().GetConsensus();
     int rv;
@@ -54,43 +125,32 @@ bool VerifyMLSAG(const CTransaction &tx, CValidationState &state)
     }
 
     for (const auto &txin : tx.vin) {
-        if (!txin.IsAnonInput()) {
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anon-input");
+        if (!CheckAnonInputSizes(txin, fSplitCommitments, state)) {
+            return false;
         }
+    }
+
+    if (pvChecks) {
+        pvChecks->reserve(tx.vin.size());
+    }
 
+    for (size_t nIn = 0; nIn < tx.vin.size(); ++nIn) {
+        const CTxIn &txin = tx.vin[nIn];
         uint32_t nInputs, nRingSize;
         txin.GetAnonInfo(nInputs, nRingSize);
 
-        if (nInputs < 1 || nInputs > MAX_ANON_INPUTS) { // TODO: Select max inputs size
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-anon-num-inputs");
-        }
-        if (nRingSize < MIN_RINGSIZE || nRingSize > MAX_RINGSIZE) {
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-anon-ringsize");
-        }
-
         uint256 txhash = tx.GetHash();
 
         size_t nCols = nRingSize;
         size_t nRows = nInputs + 1;
 
-        if (txin.scriptData.stack.size() != 1) {
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-dstack-size");
-        }
-        if (txin.scriptWitness.stack.size() != 2) {
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-wstack-size");
-        }
-
         const std::vector<uint8_t> &vKeyImages = txin.scriptData.stack[0];
         const std::vector<uint8_t> &vMI = txin.scriptWitness.stack[0];
         const std::vector<uint8_t> &vDL = txin.scriptWitness.stack[1];
 
-        if (vKeyImages.size() != nInputs * 33) {
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-keyimages-size");
-        }
-
-        if (vDL.size() != (1 + (nInputs+1) * nRingSize) * 32 + (fSplitCommitments ? 33 : 0)) {
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-sig-size");
-        }
+        // Read when the input is reached, a txn rejected at an earlier input costs no reads for the later ones
+        std::map<int64_t, CAnonOutput> mapRingOutputs;
+        PrefetchRingOutputs(txin, mapRingOutputs);
 
         std::vector<uint8_t> vM(nCols * nRows * 33);
 
@@ -129,6 +189,10 @@ bool VerifyMLSAG(const CTransaction &tx, CValidationState &state)
             }
 
             CAnonOutput ao;
+            const auto mi = mapRingOutputs.find(nIndex);
+            if (mi != mapRingOutputs.end()) {
+                ao = mi->second;
+            } else
             if (!pblocktree->ReadRCTOutput(nIndex, ao)) {
                 LogPrintf("%s: ReadRCTOutput failed: %ld\n", __func__, nIndex);
                 return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_MALFORMED, "bad-anonin-unknown-i");
@@ -178,10 +242,14 @@ bool VerifyMLSAG(const CTransaction &tx, CValidationState &state)
             &vpInCommits[0], &vpOutCommits[0], nullptr))) {
             return state.Invalid(ValidationInvalidReason::CONSENSUS, error("%s: prepare-mlsag-failed %d", __func__, rv), REJECT_INVALID, "prepare-mlsag-failed");
         }
-        if (0 != (rv = secp256k1_verify_mlsag(secp256k1_ctx_blind,
-            txhash.begin(), nCols, nRows,
-            &vM[0], &vKeyImages[0], &vDL[0], &vDL[32]))) {
-            return state.Invalid(ValidationInvalidReason::CONSENSUS, error("%s: verify-mlsag-failed %d", __func__, rv), REJECT_INVALID, "verify-mlsag-failed");
+
+        CMLSAGCheck check(tx, nIn, nCols, nRows, vM);
+        if (pvChecks) {
+            pvChecks->push_back(CMLSAGCheck());
+            check.swap(pvChecks->back());
+        } else
+        if (!check()) {
+            return state.Invalid(ValidationInvalidReason::CONSENSUS, error("%s: verify-mlsag-failed %d", __func__, check.GetError()), REJECT_INVALID, "verify-mlsag-failed");
         }
     }
 
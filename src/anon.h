@@ -26,7 +26,46 @@ const size_t DEFAULT_RING_SIZE = 5;
 const size_t DEFAULT_INPUTS_PER_SIG = 1;
 
 
-bool VerifyMLSAG(const CTransaction &tx, CValidationState &state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/** Closure representing the ring signature verification of one anon input.
+ *  The ring matrix is resolved and prepared by VerifyMLSAG, so the check can
+ *  run on the script check queue without database or mempool access.
+ */
+class CMLSAGCheck
+{
+private:
+    const CTransaction *ptxTo;
+    unsigned int nIn;
+    size_t nCols;
+    size_t nRows;
+    std::vector<uint8_t> vM;
+    int error;
+
+public:
+    CMLSAGCheck() : ptxTo(nullptr), nIn(0), nCols(0), nRows(0), error(0) {}
+    CMLSAGCheck(const CTransaction &txToIn, unsigned int nInIn, size_t nColsIn, size_t nRowsIn, std::vector<uint8_t> &vMIn) :
+        ptxTo(&txToIn), nIn(nInIn), nCols(nColsIn), nRows(nRowsIn), error(0)
+    {
+        vM.swap(vMIn);
+    };
+
+    bool operator()();
+
+    void swap(CMLSAGCheck &check) {
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(nCols, check.nCols);
+        std::swap(nRows, check.nRows);
+        std::swap(vM, check.vM);
+        std::swap(error, check.error);
+    }
+
+    bool IsNull() const { return ptxTo == nullptr; }
+    int GetError() const { return error; }
+};
+
+/** If pvChecks is not nullptr the ring signatures are pushed onto it instead of being verified inline,
+ *  key images, ring member depths and commitment sums are always checked serially. */
+bool VerifyMLSAG(const CTransaction &tx, CValidationState &state, std::vector<CMLSAGCheck> *pvChecks = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 bool AddKeyImagesToMempool(const CTransaction &tx, CTxMemPool &pool);
 bool RemoveKeyImagesFromMempool(const uint256 &hash, const CTxIn &txin, CTxMemPool &pool);
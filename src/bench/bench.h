@@ -130,6 +130,11 @@ private:
     int64_t m_width;
     int64_t m_height;
 };
+
+// Size of the synthetic message store built by the smsg benchmarks
+static const int64_t DEFAULT_SMSG_BUCKETS = 48;
+static const int64_t DEFAULT_SMSG_MESSAGES = 100; // per bucket
+static const int64_t DEFAULT_SMSG_PAYLOAD = 1024;
 }
 
 
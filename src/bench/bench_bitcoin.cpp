@@ -29,6 +29,9 @@ static void SetupBenchArgs()
     gArgs.AddArg("-plot-plotlyurl=<uri>", strprintf("URL to use for plotly.js (default: %s)", DEFAULT_PLOT_PLOTLYURL), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-plot-width=<x>", strprintf("Plot width in pixel (default: %u)", DEFAULT_PLOT_WIDTH), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-plot-height=<x>", strprintf("Plot height in pixel (default: %u)", DEFAULT_PLOT_HEIGHT), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-smsgbuckets=<n>", strprintf("Number of buckets in the message store used by the smsg benchmarks (default: %u)", benchmark::DEFAULT_SMSG_BUCKETS), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-smsgmessages=<n>", strprintf("Number of messages in each bucket of the smsg benchmark store (default: %u)", benchmark::DEFAULT_SMSG_MESSAGES), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-smsgpayload=<n>", strprintf("Payload size in bytes of the smsg benchmark messages (default: %u)", benchmark::DEFAULT_SMSG_PAYLOAD), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 }
 
 int main(int argc, char** argv)
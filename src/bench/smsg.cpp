@@ -0,0 +1,325 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <smsg/smessage.h>
+#include <smsg/db.h>
+#include <crypto/hmac_sha256.h>
+#include <crypto/sha512.h>
+#include <key.h>
+#include <net.h>
+#include <random.h>
+#include <timedata.h>
+#include <util/system.h>
+#include <util/time.h>
+
+#include <secp256k1.h>
+#include <secp256k1_ecdh.h>
+
+#include <boost/thread.hpp>
+
+// Build a message to keyTo, only the fields checked by SecMsgTrialKeys::Match are set
+static void MakeTestMessage(const secp256k1_context *ctx, const CKey &keyTo, smsg::SecureMessage &smsg, std::vector<uint8_t> &vchPayload)
+{
+    smsg.timestamp = GetTime();
+    GetRandBytes(smsg.iv, 16);
+    vchPayload = FastRandomContext().randbytes(1024);
+
+    CKey keyR;
+    keyR.MakeNewKey(true);
+    CPubKey cpkR = keyR.GetPubKey();
+    memcpy(smsg.cpkR, cpkR.begin(), 33);
+
+    CPubKey cpkTo = keyTo.GetPubKey();
+    secp256k1_pubkey pubkey;
+    assert(secp256k1_ec_pubkey_parse(ctx, &pubkey, cpkTo.begin(), cpkTo.size()));
+    uint256 P;
+    assert(secp256k1_ecdh(ctx, P.begin(), &pubkey, keyR.begin(), nullptr, nullptr));
+
+    uint8_t hashed[64];
+    CSHA512().Write(P.begin(), 32).Finalize(hashed);
+    CHMAC_SHA256 ctx_mac(&hashed[32], 32);
+    ctx_mac.Write((uint8_t*) &smsg.timestamp, sizeof(smsg.timestamp));
+    ctx_mac.Write((uint8_t*) smsg.iv, sizeof(smsg.iv));
+    ctx_mac.Write(vchPayload.data(), vchPayload.size());
+    ctx_mac.Finalize(smsg.mac);
+}
+
+// Time to find the receiving key of one message, the last key in the set is the worst case
+static void SmsgTrialDecrypt(benchmark::State& state, size_t nKeys, int nThreads)
+{
+    secp256k1_context *ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN);
+
+    smsg::SecMsgTrialKeys trial_keys;
+    for (size_t i = 0; i < nKeys; ++i) {
+        CKey key;
+        key.MakeNewKey(true);
+        trial_keys.Add(key.GetPubKey().GetID(), key, true);
+    }
+
+    smsg::SecureMessage smsg;
+    std::vector<uint8_t> vchPayload;
+    MakeTestMessage(ctx, trial_keys.vKeys.back().key, smsg, vchPayload);
+
+    CCheckQueue<smsg::SecMsgTrialCheck> queue(1);
+    boost::thread_group tg;
+    for (int i = 1; i < nThreads; ++i) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+
+    while (state.KeepRunning()) {
+        int nMatch = trial_keys.Match(ctx, smsg.data(), vchPayload.data(), vchPayload.size(), nThreads > 1 ? &queue : nullptr);
+        assert(nMatch == (int)nKeys - 1);
+    }
+
+    tg.interrupt_all();
+    tg.join_all();
+    secp256k1_context_destroy(ctx);
+}
+
+static void SmsgTrialDecrypt16(benchmark::State& state) { SmsgTrialDecrypt(state, 16, 1); }
+static void SmsgTrialDecrypt256(benchmark::State& state) { SmsgTrialDecrypt(state, 256, 1); }
+static void SmsgTrialDecrypt2048(benchmark::State& state) { SmsgTrialDecrypt(state, 2048, 1); }
+static void SmsgTrialDecrypt2048Threads(benchmark::State& state) { SmsgTrialDecrypt(state, 2048, std::min(GetNumCores(), smsg::SMSG_MAX_SCAN_THREADS)); }
+
+BENCHMARK(SmsgTrialDecrypt16, 2000);
+BENCHMARK(SmsgTrialDecrypt256, 100);
+BENCHMARK(SmsgTrialDecrypt2048, 10);
+BENCHMARK(SmsgTrialDecrypt2048Threads, 40);
+
+static size_t GetSizeArg(const std::string &arg, int64_t nDefault)
+{
+    return std::max(gArgs.GetArg(arg, nDefault), (int64_t)1);
+}
+
+static std::string MakeTestText(size_t nLen)
+{
+    std::vector<uint8_t> vch = FastRandomContext().randbytes(nLen);
+    std::string sText(nLen, ' ');
+    for (size_t i = 0; i < nLen; ++i) {
+        sText[i] = 'a' + vch[i] % 26;
+    }
+    return sText;
+}
+
+// Add a receiving key to the smsg keystore, Encrypt looks up the public key of the destination there
+static CKeyID AddRecipientKey(CKey &key)
+{
+    key.MakeNewKey(true);
+    smsg::SecMsgKey smsg_key;
+    smsg_key.key = key;
+    smsg_key.pubkey = key.GetPubKey();
+    CKeyID id = smsg_key.pubkey.GetID();
+    smsgModule.keyStore.AddKey(id, smsg_key);
+    return id;
+}
+
+// Encrypt an anonymous message of -smsgpayload characters to idTo
+static void EncryptTestMessage(const CKeyID &idTo, smsg::SecureMessage &smsg)
+{
+    size_t nLen = std::min(GetSizeArg("-smsgpayload", benchmark::DEFAULT_SMSG_PAYLOAD), (size_t)smsg::SMSG_MAX_MSG_BYTES);
+    smsg.m_ttl = smsg::SMSG_SECONDS_IN_DAY;
+    int rv = smsgModule.Encrypt(smsg, CKeyID(), idTo, MakeTestText(nLen));
+    assert(rv == smsg::SMSG_NO_ERROR);
+}
+
+/** Fill the bucket store with -smsgbuckets buckets of -smsgmessages random messages each,
+ *  spaced one bucket apart back from now and limited to the retention period. */
+static void BuildTestStore(std::vector<smsg::SecMsgToken> *pTokens = nullptr)
+{
+    size_t nBuckets = std::min(GetSizeArg("-smsgbuckets", benchmark::DEFAULT_SMSG_BUCKETS), (size_t)(smsg::SMSG_RETENTION / smsg::SMSG_BUCKET_LEN));
+    size_t nMessages = GetSizeArg("-smsgmessages", benchmark::DEFAULT_SMSG_MESSAGES);
+    size_t nPayload = std::max(GetSizeArg("-smsgpayload", benchmark::DEFAULT_SMSG_PAYLOAD), (size_t)8);
+
+    int64_t now = GetAdjustedTime();
+    FastRandomContext insecure_rand;
+    std::vector<uint8_t> vchPayload;
+
+    LOCK(smsgModule.cs_smsg);
+    for (size_t b = 0; b < nBuckets; ++b) {
+        for (size_t i = 0; i < nMessages; ++i) {
+            smsg::SecureMessage smsg;
+            smsg.timestamp = now - b * smsg::SMSG_BUCKET_LEN;
+            smsg.m_ttl = smsg::SMSG_RETENTION;
+            vchPayload = insecure_rand.randbytes(nPayload);
+            int rv = smsgModule.Store(smsg.data(), vchPayload.data(), vchPayload.size(), true);
+            assert(rv == smsg::SMSG_NO_ERROR);
+        }
+    }
+
+    if (pTokens) {
+        for (const auto &it : smsgModule.buckets) {
+            pTokens->insert(pTokens->end(), it.second.setTokens.begin(), it.second.setTokens.end());
+        }
+    }
+}
+
+// Drop the in-memory bucket set, the files are removed with the datadir of the benchmark
+static void ClearTestStore()
+{
+    {
+        LOCK(smsgModule.cs_smsg);
+        smsgModule.buckets.clear();
+        smsgModule.m_changed_buckets.clear();
+        smsgModule.m_change_seq = 0;
+        smsgModule.m_bucket_store.Clear();
+    }
+    smsgModule.keyStore.Clear();
+
+    // Store opens the db to check for purged messages
+    LOCK(smsg::cs_smsgDB);
+    if (smsg::smsgDB) {
+        delete smsg::smsgDB;
+        smsg::smsgDB = nullptr;
+    }
+}
+
+static void SmsgEncrypt(benchmark::State& state)
+{
+    CKey keyTo;
+    CKeyID idTo = AddRecipientKey(keyTo);
+
+    while (state.KeepRunning()) {
+        smsg::SecureMessage smsg;
+        EncryptTestMessage(idTo, smsg);
+    }
+
+    ClearTestStore();
+}
+
+static void SmsgDecrypt(benchmark::State& state)
+{
+    CKey keyTo;
+    CKeyID idTo = AddRecipientKey(keyTo);
+    smsg::SecureMessage smsg;
+    EncryptTestMessage(idTo, smsg);
+
+    while (state.KeepRunning()) {
+        smsg::MessageData msg;
+        int rv = smsgModule.Decrypt(false, keyTo, idTo, smsg, msg);
+        assert(rv == smsg::SMSG_NO_ERROR);
+    }
+
+    ClearTestStore();
+}
+
+// Proof of work of a free message, the payload changes every iteration so each search starts afresh
+static void SmsgSetHash(benchmark::State& state, int nThreads)
+{
+    CKey keyTo;
+    CKeyID idTo = AddRecipientKey(keyTo);
+    smsg::SecureMessage smsg;
+    EncryptTestMessage(idTo, smsg);
+
+    smsg::fSecMsgEnabled = true; // SetHash stops when smsg is disabled
+    smsgModule.m_pow_threads = nThreads;
+    while (state.KeepRunning()) {
+        smsg.pPayload[0]++;
+        memset(smsg.nonce, 0, 4);
+        int rv = smsgModule.SetHash(smsg.data(), smsg.pPayload, smsg.nPayload);
+        assert(rv == smsg::SMSG_NO_ERROR);
+    }
+    smsgModule.m_pow_threads = 1;
+    smsg::fSecMsgEnabled = false;
+
+    ClearTestStore();
+}
+
+// Append one message to the current bucket
+static void SmsgStore(benchmark::State& state)
+{
+    size_t nPayload = std::max(GetSizeArg("-smsgpayload", benchmark::DEFAULT_SMSG_PAYLOAD), (size_t)8);
+    std::vector<uint8_t> vchPayload = FastRandomContext().randbytes(nPayload);
+
+    smsg::SecureMessage smsg;
+    smsg.timestamp = GetAdjustedTime();
+    smsg.m_ttl = smsg::SMSG_SECONDS_IN_DAY;
+
+    uint64_t n = 0;
+    while (state.KeepRunning()) {
+        memcpy(vchPayload.data(), &(++n), 8); // Tokens are unique by timestamp and payload sample
+        LOCK(smsgModule.cs_smsg);
+        int rv = smsgModule.Store(smsg.data(), vchPayload.data(), vchPayload.size(), true);
+        assert(rv == smsg::SMSG_NO_ERROR);
+    }
+
+    ClearTestStore();
+}
+
+// Read back messages spread over the whole store
+static void SmsgRetrieve(benchmark::State& state)
+{
+    std::vector<smsg::SecMsgToken> vTokens;
+    BuildTestStore(&vTokens);
+    Shuffle(vTokens.begin(), vTokens.end(), FastRandomContext(true));
+
+    size_t i = 0;
+    std::vector<uint8_t> vchData;
+    while (state.KeepRunning()) {
+        LOCK(smsgModule.cs_smsg);
+        int rv = smsgModule.Retrieve(vTokens[i++ % vTokens.size()], vchData);
+        assert(rv == smsg::SMSG_NO_ERROR);
+    }
+
+    ClearTestStore();
+}
+
+// Load the bucket set from the store files, as done at startup
+static void SmsgBuildBucketSet(benchmark::State& state)
+{
+    BuildTestStore();
+
+    while (state.KeepRunning()) {
+        {
+            LOCK(smsgModule.cs_smsg);
+            smsgModule.buckets.clear();
+            smsgModule.m_changed_buckets.clear();
+            smsgModule.m_bucket_store.Clear();
+        }
+        int rv = smsgModule.BuildBucketSet();
+        assert(rv == smsg::SMSG_NO_ERROR);
+    }
+
+    ClearTestStore();
+}
+
+// Build the smsgInv of every bucket in the store for a peer that has seen none of them
+static void SmsgSendDataInv(benchmark::State& state)
+{
+    BuildTestStore();
+
+    CAddress addr;
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, addr, "", false);
+    node.smsgData.fEnabled = true;
+    node.smsgData.m_version = smsg::SMSG_VERSION_SUM_HASH;
+
+    while (state.KeepRunning()) {
+        {
+            LOCK(node.smsgData.cs_smsg_net);
+            node.smsgData.lastSeen = GetTime() - smsg::SMSG_SEND_DELAY;
+            node.smsgData.m_inv_seq = 0;
+        }
+        smsgModule.SendData(&node, false);
+
+        LOCK(node.cs_vSend);
+        assert(node.vSendMsg.size() > 0);
+        node.vSendMsg.clear();
+        node.nSendSize = 0;
+    }
+
+    ClearTestStore();
+}
+
+static void SmsgSetHash1Thread(benchmark::State& state) { SmsgSetHash(state, 1); }
+static void SmsgSetHashThreads(benchmark::State& state) { SmsgSetHash(state, std::max(1, std::min(GetNumCores(), smsg::SMSG_MAX_POW_THREADS))); }
+
+BENCHMARK(SmsgEncrypt, 2000);
+BENCHMARK(SmsgDecrypt, 2000);
+BENCHMARK(SmsgSetHash1Thread, 10);
+BENCHMARK(SmsgSetHashThreads, 40);
+BENCHMARK(SmsgStore, 5000);
+BENCHMARK(SmsgRetrieve, 100000);
+BENCHMARK(SmsgBuildBucketSet, 20);
+BENCHMARK(SmsgSendDataInv, 20000);
@@ -8,14 +8,184 @@
 #include <secp256k1_rangeproof.h>
 
 #include <support/allocators/secure.h>
+#include <crypto/sha256.h>
+#include <cuckoocache.h>
 #include <random.h>
+#include <script/sigcache.h>
+#include <sync.h>
 #include <util/system.h>
 
+#include <map>
+
+#include <boost/thread.hpp>
+
 
 secp256k1_context *secp256k1_ctx_blind = nullptr;
 secp256k1_scratch_space *blind_scratch = nullptr;
 secp256k1_bulletproof_generators *blind_gens = nullptr;
 
+//! Size of pooled scratch spaces, large enough for a MAX_BULLETPROOF_BATCH batch in few ecmult passes
+static const size_t BLIND_SCRATCH_POOL_SIZE = 2 * 1024 * 1024;
+
+static Mutex cs_blind_scratch_pool;
+static std::vector<secp256k1_scratch_space*> vBlindScratchPool GUARDED_BY(cs_blind_scratch_pool);
+
+CBlindScratchLease::CBlindScratchLease()
+{
+    {
+        LOCK(cs_blind_scratch_pool);
+        if (!vBlindScratchPool.empty()) {
+            m_scratch = vBlindScratchPool.back();
+            vBlindScratchPool.pop_back();
+            return;
+        }
+    }
+    m_scratch = secp256k1_scratch_space_create(secp256k1_ctx_blind, BLIND_SCRATCH_POOL_SIZE);
+    assert(m_scratch);
+};
+
+CBlindScratchLease::~CBlindScratchLease()
+{
+    LOCK(cs_blind_scratch_pool);
+    vBlindScratchPool.push_back(m_scratch);
+};
+
+namespace {
+/**
+ * Valid rangeproof cache, entries are SHA256(nonce || type || data)
+ */
+class CProofCache
+{
+private:
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_proofcache;
+
+public:
+    CProofCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        setValid.setup(2);
+    }
+
+    CSHA256 Hasher(uint8_t type) const
+    {
+        CSHA256 hasher;
+        hasher.Write(nonce.begin(), 32).Write(&type, 1);
+        return hasher;
+    }
+
+    bool Get(const uint256 &entry, const bool erase)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.contains(entry, erase);
+    }
+
+    void Set(const uint256 &entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.setup_bytes(n);
+    }
+};
+
+static CProofCache proofCache;
+
+enum ProofCacheEntryType : uint8_t
+{
+    PROOF_CACHE_RANGEPROOF = 1,
+};
+} // namespace
+
+void InitProofCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = proofCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for rangeproof cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+};
+
+void ComputeRangeProofCacheEntry(uint256 &entry, const secp256k1_pedersen_commitment &commitment, const std::vector<uint8_t> &vRangeproof)
+{
+    proofCache.Hasher(PROOF_CACHE_RANGEPROOF)
+        .Write(commitment.data, 33)
+        .Write(vRangeproof.data(), vRangeproof.size())
+        .Finalize(entry.begin());
+};
+
+bool ProofCacheGet(const uint256 &entry, bool erase)
+{
+    return proofCache.Get(entry, erase);
+};
+
+void ProofCacheSet(const uint256 &entry)
+{
+    proofCache.Set(entry);
+};
+
+void CBulletproofBatch::Add(const secp256k1_pedersen_commitment *commitment, const std::vector<uint8_t> &vRangeproof)
+{
+    uint256 entry;
+    ComputeRangeProofCacheEntry(entry, *commitment, vRangeproof);
+    if (ProofCacheGet(entry, false)) {
+        return;
+    }
+    m_entries.emplace_back(commitment, &vRangeproof);
+};
+
+void CBulletproofCheck::Add(const secp256k1_pedersen_commitment *commitment, const std::vector<uint8_t> &vRangeproof)
+{
+    assert(vProofs.empty() || vRangeproof.size() == nProofLen);
+    nProofLen = vRangeproof.size();
+    vProofs.push_back(vRangeproof.data());
+    vCommitments.push_back(commitment);
+    vValueGens.push_back(secp256k1_generator_const_h);
+};
+
+bool CBulletproofCheck::operator()()
+{
+    if (vProofs.empty()) {
+        return true;
+    }
+    CBlindScratchLease scratch;
+    return 1 == secp256k1_bulletproof_rangeproof_verify_multi(secp256k1_ctx_blind,
+        scratch.get(), blind_gens, vProofs.data(), vProofs.size(), nProofLen,
+        nullptr, vCommitments.data(), 1, 64, vValueGens.data(), nullptr, nullptr);
+};
+
+void CBulletproofBatch::Split(std::vector<CBulletproofCheck> &vChecks, size_t nMaxProofs, size_t nMinChecks) const
+{
+    // Proofs verified together must all be the same length
+    std::map<size_t, std::vector<size_t> > mapByLength;
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        mapByLength[m_entries[i].second->size()].push_back(i);
+    }
+
+    nMinChecks = std::max(nMinChecks, (size_t)1);
+    size_t nPerCheck = std::max((size_t)1, std::min(nMaxProofs, (m_entries.size() + nMinChecks - 1) / nMinChecks));
+
+    for (const auto &it : mapByLength) {
+        CBulletproofCheck check;
+        for (const auto i : it.second) {
+            if (check.size() >= nPerCheck) {
+                vChecks.push_back(CBulletproofCheck());
+                check.swap(vChecks.back());
+            }
+            check.Add(m_entries[i].first, *m_entries[i].second);
+        }
+        if (!check.IsNull()) {
+            vChecks.push_back(CBulletproofCheck());
+            check.swap(vChecks.back());
+        }
+    }
+};
+
 static int CountLeadingZeros(uint64_t nValueIn)
 {
     int nZeros = 0;
@@ -150,6 +320,13 @@ void ECC_Stop_Blinding()
 {
     secp256k1_bulletproof_generators_destroy(secp256k1_ctx_blind, blind_gens);
     secp256k1_scratch_space_destroy(blind_scratch);
+    {
+        LOCK(cs_blind_scratch_pool);
+        for (auto scratch : vBlindScratchPool) {
+            secp256k1_scratch_space_destroy(scratch);
+        }
+        vBlindScratchPool.clear();
+    }
 
     secp256k1_context *ctx = secp256k1_ctx_blind;
     secp256k1_ctx_blind = nullptr;
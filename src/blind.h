@@ -11,11 +11,90 @@
 #include <vector>
 
 #include <amount.h>
+#include <uint256.h>
 
 extern secp256k1_context *secp256k1_ctx_blind;
 extern secp256k1_scratch_space *blind_scratch;
 extern secp256k1_bulletproof_generators *blind_gens;
 
+//! Max number of bulletproofs verified together in one secp256k1_bulletproof_rangeproof_verify_multi call
+static const size_t MAX_BULLETPROOF_BATCH = 64;
+
+//! -maxproofcachesize default (MiB)
+static const unsigned int DEFAULT_MAX_PROOF_CACHE_SIZE = 16;
+
+/** Salted cache of verified bulletproofs, analogous to the signature cache, so the rangeproofs
+ *  of transactions accepted to the mempool are not verified again when their block is connected.
+ *  Ring signatures need no entries here, the script execution cache skips CheckInputs for them.
+ */
+void InitProofCache();
+void ComputeRangeProofCacheEntry(uint256 &entry, const secp256k1_pedersen_commitment &commitment, const std::vector<uint8_t> &vRangeproof);
+bool ProofCacheGet(const uint256 &entry, bool erase);
+void ProofCacheSet(const uint256 &entry);
+
+/** Borrows a scratch space from a shared pool for the lifetime of the object,
+ *  allowing rangeproofs to be verified on several threads at once.
+ */
+class CBlindScratchLease
+{
+private:
+    secp256k1_scratch_space *m_scratch;
+
+public:
+    CBlindScratchLease();
+    ~CBlindScratchLease();
+    CBlindScratchLease(const CBlindScratchLease&) = delete;
+    CBlindScratchLease& operator=(const CBlindScratchLease&) = delete;
+
+    secp256k1_scratch_space *get() const { return m_scratch; }
+};
+
+/** Closure verifying a batch of equal length single-commitment bulletproofs. */
+class CBulletproofCheck
+{
+private:
+    std::vector<const uint8_t*> vProofs;
+    std::vector<const secp256k1_pedersen_commitment*> vCommitments;
+    std::vector<secp256k1_generator> vValueGens;
+    size_t nProofLen;
+
+public:
+    CBulletproofCheck() : nProofLen(0) {}
+
+    void Add(const secp256k1_pedersen_commitment *commitment, const std::vector<uint8_t> &vRangeproof);
+
+    bool operator()();
+
+    void swap(CBulletproofCheck &check) {
+        std::swap(vProofs, check.vProofs);
+        std::swap(vCommitments, check.vCommitments);
+        std::swap(vValueGens, check.vValueGens);
+        std::swap(nProofLen, check.nProofLen);
+    }
+
+    bool IsNull() const { return vProofs.empty(); }
+    size_t size() const { return vProofs.size(); }
+    size_t GetProofLen() const { return nProofLen; }
+};
+
+/** Bulletproofs collected from the outputs of many transactions, see CValidationState::m_bulletproofs.
+ *  Proofs found in the proof cache are skipped, the entries are left for the cache to age out
+ *  so that checking a block that fails later can't empty the cache.
+ */
+class CBulletproofBatch
+{
+private:
+    std::vector<std::pair<const secp256k1_pedersen_commitment*, const std::vector<uint8_t>*> > m_entries;
+
+public:
+    void Add(const secp256k1_pedersen_commitment *commitment, const std::vector<uint8_t> &vRangeproof);
+    size_t size() const { return m_entries.size(); }
+
+    /** Group the collected proofs by length into checks of at most nMaxProofs,
+     *  nMinChecks allows splitting smaller batches to keep that many threads busy. */
+    void Split(std::vector<CBulletproofCheck> &vChecks, size_t nMaxProofs = MAX_BULLETPROOF_BATCH, size_t nMinChecks = 1) const;
+};
+
 int SelectRangeProofParameters(uint64_t nValueIn, uint64_t &minValue, int &exponent, int &nBits);
 
 int GetRangeProofInfo(const std::vector<uint8_t> &vRangeproof, int &rexp, int &rmantissa, CAmount &min_value, CAmount &max_value);
@@ -218,6 +218,35 @@ bool CheckStandardOutput(CValidationState &state, const Consensus::Params& conse
     return true;
 }
 
+/** Returns 1 if the rangeproof is valid or was deferred to state.m_bulletproofs */
+static int VerifyRangeProof(CValidationState &state, const secp256k1_pedersen_commitment &commitment, const std::vector<uint8_t> &vRangeproof,
+                            uint64_t &min_value, uint64_t &max_value)
+{
+    if (state.fBulletproofsActive && state.m_bulletproofs) {
+        state.m_bulletproofs->Add(&commitment, vRangeproof);
+        return 1;
+    }
+
+    if (!state.fBulletproofsActive) {
+        return secp256k1_rangeproof_verify(secp256k1_ctx_blind, &min_value, &max_value,
+            &commitment, vRangeproof.data(), vRangeproof.size(),
+            nullptr, 0,
+            secp256k1_generator_h);
+    }
+
+    // Only bulletproofs are cached, entries are added once the transaction is accepted to the mempool
+    uint256 cache_entry;
+    ComputeRangeProofCacheEntry(cache_entry, commitment, vRangeproof);
+    if (ProofCacheGet(cache_entry, false)) {
+        return 1;
+    }
+
+    CBlindScratchLease scratch;
+    return secp256k1_bulletproof_rangeproof_verify(secp256k1_ctx_blind,
+        scratch.get(), blind_gens, vRangeproof.data(), vRangeproof.size(),
+        nullptr, &commitment, 1, 64, &secp256k1_generator_const_h, nullptr, 0);
+}
+
 bool CheckBlindOutput(CValidationState &state, const CTxOutCT *p)
 {
     if (p->vData.size() < 33 || p->vData.size() > 33 + 5 + 33) {
@@ -233,18 +262,7 @@ bool CheckBlindOutput(CValidationState &state, const CTxOutCT *p)
     }
 
     uint64_t min_value = 0, max_value = 0;
-    int rv = 0;
-
-    if (state.fBulletproofsActive) {
-        rv = secp256k1_bulletproof_rangeproof_verify(secp256k1_ctx_blind,
-            blind_scratch, blind_gens, p->vRangeproof.data(), p->vRangeproof.size(),
-            nullptr, &p->commitment, 1, 64, &secp256k1_generator_const_h, nullptr, 0);
-    } else {
-        rv = secp256k1_rangeproof_verify(secp256k1_ctx_blind, &min_value, &max_value,
-            &p->commitment, p->vRangeproof.data(), p->vRangeproof.size(),
-            nullptr, 0,
-            secp256k1_generator_h);
-    }
+    int rv = VerifyRangeProof(state, p->commitment, p->vRangeproof, min_value, max_value);
 
     if (LogAcceptCategory(BCLog::RINGCT)) {
         LogPrintf("%s: rv, min_value, max_value %d, %s, %s\n", __func__,
@@ -277,18 +295,7 @@ bool CheckAnonOutput(CValidationState &state, const CTxOutRingCT *p)
     }
 
     uint64_t min_value = 0, max_value = 0;
-    int rv = 0;
-
-    if (state.fBulletproofsActive) {
-        rv = secp256k1_bulletproof_rangeproof_verify(secp256k1_ctx_blind,
-            blind_scratch, blind_gens, p->vRangeproof.data(), p->vRangeproof.size(),
-            nullptr, &p->commitment, 1, 64, &secp256k1_generator_const_h, nullptr, 0);
-    } else {
-        rv = secp256k1_rangeproof_verify(secp256k1_ctx_blind, &min_value, &max_value,
-            &p->commitment, p->vRangeproof.data(), p->vRangeproof.size(),
-            nullptr, 0,
-            secp256k1_generator_h);
-    }
+    int rv = VerifyRangeProof(state, p->commitment, p->vRangeproof, min_value, max_value);
 
     if (LogAcceptCategory(BCLog::RINGCT)) {
         LogPrintf("%s: rv, min_value, max_value %d, %s, %s\n", __func__,
@@ -14,6 +14,8 @@
 
 #include <consensus/params.h>
 
+class CBulletproofBatch;
+
 /** "reject" message codes */
 static const unsigned char REJECT_MALFORMED = 0x01;
 static const unsigned char REJECT_INVALID = 0x10;
@@ -166,6 +168,8 @@ public:
     bool fHasAnonInput = false; // per tx
     bool fIncDataOutputs = false; // per block
     int m_spend_height = 0;
+    CBulletproofBatch *m_bulletproofs = nullptr; // If set, bulletproofs are collected for batch verification instead of verified inline
+    uint256 m_bulletproofs_verified; // Witness hash of a transaction whose bulletproofs were verified before AcceptToMemoryPool
 
     void SetStateInfo(int64_t time, int spend_height, const Consensus::Params& consensusParams)
     {
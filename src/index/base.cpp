@@ -292,11 +292,12 @@ bool BaseIndex::BlockUntilSyncedToCurrentChain()
 
     {
         // Skip the queue-draining stuff if we know we're caught up with
-        // ::ChainActive().Tip().
+        // ::ChainActive().Tip(). An index ahead of the tip still has
+        // BlockDisconnected notifications to process.
         LOCK(cs_main);
         const CBlockIndex* chain_tip = ::ChainActive().Tip();
         const CBlockIndex* best_block_index = m_best_block_index.load();
-        if (best_block_index->GetAncestor(chain_tip->nHeight) == chain_tip) {
+        if (best_block_index == chain_tip) {
             return true;
         }
     }
@@ -0,0 +1,277 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/insightindex.h>
+
+#include <chainparams.h>
+#include <insight/insight.h>
+#include <insight/timestampindex.h>
+#include <txdb.h>
+#include <undo.h>
+#include <util/system.h>
+#include <validation.h>
+
+constexpr char DB_INSIGHT_INDEXES = 'i';
+
+std::unique_ptr<InsightIndex> g_insight_index;
+
+InsightIndex::InsightIndex(size_t n_cache_size, uint8_t indexes, bool f_memory, bool f_wipe)
+    : m_indexes(indexes)
+{
+    fs::path path = GetDataDir() / "indexes" / "insight";
+    m_db = MakeUnique<BaseIndex::DB>(path, n_cache_size, f_memory, f_wipe);
+
+    uint8_t db_indexes = 0;
+    if (m_db->Read(DB_INSIGHT_INDEXES, db_indexes) && db_indexes != m_indexes) {
+        LogPrintf("%s: Indexes changed, rebuilding %s from the genesis block\n", __func__, GetName());
+        m_db.reset();
+        m_db = MakeUnique<BaseIndex::DB>(path, n_cache_size, f_memory, true);
+    }
+    m_db->Write(DB_INSIGHT_INDEXES, m_indexes);
+}
+
+InsightIndex::~InsightIndex() {}
+
+bool InsightIndex::Init()
+{
+    // Undo the blocks written that left the active chain while the index wasn't running,
+    // BaseIndex::Init only moves the best block back to the fork.
+    CBlockLocator locator;
+    if (m_db->ReadBestBlock(locator) && !locator.IsNull()) {
+        const CBlockIndex *pindex_written, *pindex_fork;
+        {
+            LOCK(cs_main);
+            pindex_written = LookupBlockIndex(locator.vHave.front());
+            pindex_fork = FindForkInGlobalIndex(::ChainActive(), locator);
+        }
+        if (pindex_written && pindex_fork && pindex_written != pindex_fork
+            && pindex_written->GetAncestor(pindex_fork->nHeight) == pindex_fork) {
+            m_best_block_index = pindex_written;
+            if (!Rewind(pindex_written, pindex_fork)) {
+                return error("%s: Failed to rewind %s to block %s", __func__, GetName(), pindex_fork->GetBlockHash().ToString());
+            }
+        }
+    }
+    return BaseIndex::Init();
+}
+
+bool InsightIndex::GetBlockEntries(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex, bool fDisconnect,
+    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex,
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &spentIndex)
+{
+    bool fAddressIndex = HasIndex(ADDRESS_INDEX);
+    bool fSpentIndex = HasIndex(SPENT_INDEX);
+    if (!fAddressIndex && !fSpentIndex) {
+        return true;
+    }
+
+    size_t nTxUndo = 0;
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction &tx = *block.vtx[i];
+        const uint256 &txhash = tx.GetHash();
+
+        if (!tx.IsCoinBase()) {
+            if (nTxUndo >= blockundo.vtxundo.size()) {
+                return error("%s: Block %s and undo data inconsistent", __func__, pindex->GetBlockHash().ToString());
+            }
+            const CTxUndo &txundo = blockundo.vtxundo[nTxUndo++];
+
+            size_t nPrevout = 0;
+            for (size_t j = 0; j < tx.vin.size() && tx.IsFalconVersion(); ++j) {
+                const CTxIn &input = tx.vin[j];
+                if (input.IsAnonInput()) {
+                    continue;
+                }
+                if (nPrevout >= txundo.vprevout.size()) {
+                    return error("%s: Txn %s and undo data inconsistent", __func__, txhash.ToString());
+                }
+                const Coin &coin = txundo.vprevout[nPrevout++];
+                const CScript *pScript = &coin.out.scriptPubKey;
+
+                std::vector<uint8_t> hashBytes;
+                int scriptType = 0;
+                if (!ExtractIndexInfo(pScript, scriptType, hashBytes)
+                    || scriptType == 0) {
+                    continue;
+                }
+                uint256 hashAddress(hashBytes.data(), hashBytes.size());
+
+                if (fAddressIndex) {
+                    CAmount nValue = coin.nType == OUTPUT_CT ? 0 : coin.out.nValue;
+                    // Spending activity
+                    addressIndex.push_back(std::make_pair(CAddressIndexKey(scriptType, hashAddress, pindex->nHeight, i, txhash, j, true), nValue * -1));
+                    // Spent outputs leave the unspent index, restored on disconnect
+                    addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(scriptType, hashAddress, input.prevout.hash, input.prevout.n),
+                        fDisconnect ? CAddressUnspentValue(nValue, *pScript, coin.nHeight) : CAddressUnspentValue()));
+                }
+
+                if (fSpentIndex) {
+                    CAmount nValue = coin.nType == OUTPUT_CT ? -1 : coin.out.nValue;
+                    spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                        fDisconnect ? CSpentIndexValue() : CSpentIndexValue(txhash, j, pindex->nHeight, nValue, scriptType, hashAddress)));
+                }
+            }
+        }
+
+        if (!fAddressIndex) {
+            continue;
+        }
+        for (size_t k = 0; k < tx.vpout.size(); ++k) {
+            const CTxOutBase *out = tx.vpout[k].get();
+            if (!out->IsType(OUTPUT_STANDARD)
+                && !out->IsType(OUTPUT_CT)) {
+                continue;
+            }
+
+            const CScript *pScript;
+            std::vector<uint8_t> hashBytes;
+            int scriptType = 0;
+            CAmount nValue;
+            if (!ExtractIndexInfo(out, scriptType, hashBytes, nValue, pScript)
+                || scriptType == 0) {
+                continue;
+            }
+            uint256 hashAddress(hashBytes.data(), hashBytes.size());
+
+            // Receiving activity
+            addressIndex.push_back(std::make_pair(CAddressIndexKey(scriptType, hashAddress, pindex->nHeight, i, txhash, k, false), nValue));
+            addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(scriptType, hashAddress, txhash, k),
+                fDisconnect ? CAddressUnspentValue() : CAddressUnspentValue(nValue, *pScript, pindex->nHeight)));
+        }
+    }
+
+    return true;
+}
+
+bool InsightIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo blockundo;
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(blockundo, pindex)) {
+        return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    if (!GetBlockEntries(block, blockundo, pindex, false, addressIndex, addressUnspentIndex, spentIndex)) {
+        return false;
+    }
+
+    CDBBatch batch(*m_db);
+    insightdb::WriteAddressIndex(*m_db, batch, addressIndex);
+    insightdb::UpdateAddressUnspentIndex(batch, addressUnspentIndex);
+    insightdb::UpdateSpentIndex(batch, spentIndex);
+
+    if (HasIndex(TIMESTAMP_INDEX)) {
+        unsigned int logicalTS = pindex->nTime;
+        unsigned int prevLogicalTS = 0;
+        if (pindex->pprev) {
+            insightdb::ReadTimestampBlockIndex(*m_db, pindex->pprev->GetBlockHash(), prevLogicalTS);
+        }
+        if (logicalTS <= prevLogicalTS) {
+            logicalTS = prevLogicalTS + 1;
+        }
+        insightdb::WriteTimestampIndex(batch, CTimestampIndexKey(logicalTS, pindex->GetBlockHash()));
+        insightdb::WriteTimestampBlockIndex(batch, CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS));
+    }
+
+    // Entries and best block are written together, replayed blocks don't count twice in the address totals
+    {
+        LOCK(cs_main);
+        m_db->WriteBestBlock(batch, ::ChainActive().GetLocator(pindex));
+    }
+    return m_db->WriteBatch(batch);
+}
+
+bool InsightIndex::DisconnectBlock(const CBlock &block, const CBlockIndex *pindex)
+{
+    CBlockUndo blockundo;
+    if (pindex->nHeight > 0 && !UndoReadFromDisk(blockundo, pindex)) {
+        return error("%s: Failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    if (!GetBlockEntries(block, blockundo, pindex, true, addressIndex, addressUnspentIndex, spentIndex)) {
+        return false;
+    }
+
+    // Timestamp entries are kept, queries of the active chain skip blocks not in it
+    CDBBatch batch(*m_db);
+    insightdb::EraseAddressIndex(*m_db, batch, addressIndex);
+    insightdb::UpdateAddressUnspentIndex(batch, addressUnspentIndex);
+    insightdb::UpdateSpentIndex(batch, spentIndex);
+    {
+        LOCK(cs_main);
+        m_db->WriteBestBlock(batch, ::ChainActive().GetLocator(pindex->pprev));
+    }
+    if (!m_db->WriteBatch(batch)) {
+        return false;
+    }
+    m_best_block_index = pindex->pprev;
+    return true;
+}
+
+bool InsightIndex::DisconnectBlock(const CBlock& block)
+{
+    const CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        pindex = LookupBlockIndex(block.GetHash());
+    }
+    // Nothing to undo if the index hasn't reached the block
+    if (!pindex || m_best_block_index.load() != pindex) {
+        return true;
+    }
+    return DisconnectBlock(block, pindex);
+}
+
+bool InsightIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip == m_best_block_index);
+    assert(current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    for (const CBlockIndex *pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            return error("%s: Failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (!DisconnectBlock(block, pindex)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool InsightIndex::ReadAddressIndex(uint256 addressHash, int type,
+                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                    int start, int end,
+                                    const CAddressIndexPosition *pAfter, size_t nMaxTxns) const
+{
+    return HasIndex(ADDRESS_INDEX) && insightdb::ReadAddressIndex(*m_db, addressHash, type, addressIndex, start, end, pAfter, nMaxTxns);
+}
+
+bool InsightIndex::ReadAddressBalance(uint256 addressHash, int type, CAddressBalanceValue &balance) const
+{
+    return HasIndex(ADDRESS_INDEX) && insightdb::ReadAddressBalance(*m_db, addressHash, type, balance);
+}
+
+bool InsightIndex::ReadAddressUnspentIndex(uint256 addressHash, int type,
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) const
+{
+    return HasIndex(ADDRESS_INDEX) && insightdb::ReadAddressUnspentIndex(*m_db, addressHash, type, unspentOutputs);
+}
+
+bool InsightIndex::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) const
+{
+    return HasIndex(SPENT_INDEX) && insightdb::ReadSpentIndex(*m_db, key, value);
+}
+
+bool InsightIndex::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly,
+                                      std::vector<std::pair<uint256, unsigned int> > &hashes) const
+{
+    return HasIndex(TIMESTAMP_INDEX) && insightdb::ReadTimestampIndex(*m_db, high, low, fActiveOnly, hashes);
+}
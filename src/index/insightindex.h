@@ -0,0 +1,78 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PARTICL_INDEX_INSIGHTINDEX_H
+#define PARTICL_INDEX_INSIGHTINDEX_H
+
+#include <chain.h>
+#include <index/base.h>
+#include <insight/addressindex.h>
+#include <insight/spentindex.h>
+
+class CBlockUndo;
+
+/**
+ * InsightIndex keeps the address, spent and timestamp indexes in their own database.
+ * Entries are built from each block and its undo data in the background, so the indexes can be
+ * enabled on a synced node without a reindex and don't add to the time taken to connect a block.
+ * Used for the indexes that weren't enabled when the block tree database was created,
+ * those are still written to the block tree database while connecting blocks.
+ * The indexes share one database and best block, so enabling or disabling any of them
+ * wipes the database and rebuilds all of them from the genesis block.
+ */
+class InsightIndex final : public BaseIndex
+{
+public:
+    enum {
+        ADDRESS_INDEX       = (1 << 0),
+        SPENT_INDEX         = (1 << 1),
+        TIMESTAMP_INDEX     = (1 << 2),
+    };
+
+private:
+    std::unique_ptr<BaseIndex::DB> m_db;
+    uint8_t m_indexes;
+
+    /** Get the entries added by pindex, as they must be written or, if fDisconnect, erased. */
+    bool GetBlockEntries(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex, bool fDisconnect,
+        std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex,
+        std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &spentIndex);
+    bool DisconnectBlock(const CBlock &block, const CBlockIndex *pindex);
+
+protected:
+    bool Init() override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    bool DisconnectBlock(const CBlock& block) override;
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override { return *m_db; }
+
+    const char* GetName() const override { return "insightindex"; }
+
+public:
+    /** The database is wiped and rebuilt when the set of indexes differs from the one it was built with. */
+    explicit InsightIndex(size_t n_cache_size, uint8_t indexes, bool f_memory = false, bool f_wipe = false);
+
+    virtual ~InsightIndex() override;
+
+    bool HasIndex(uint8_t index) const { return m_indexes & index; }
+
+    bool ReadAddressIndex(uint256 addressHash, int type,
+                          std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                          int start = 0, int end = 0,
+                          const CAddressIndexPosition *pAfter = nullptr, size_t nMaxTxns = 0) const;
+    bool ReadAddressBalance(uint256 addressHash, int type, CAddressBalanceValue &balance) const;
+    bool ReadAddressUnspentIndex(uint256 addressHash, int type,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) const;
+    bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) const;
+    bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly,
+                            std::vector<std::pair<uint256, unsigned int> > &hashes) const;
+};
+
+/// The global insight index, used for the indexes not in the block tree database. May be null.
+extern std::unique_ptr<InsightIndex> g_insight_index;
+
+#endif // PARTICL_INDEX_INSIGHTINDEX_H
@@ -0,0 +1,333 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/stealthindex.h>
+
+#include <chainparams.h>
+#include <key_io.h>
+#include <script/standard.h>
+#include <shutdown.h>
+#include <util/system.h>
+#include <validation.h>
+
+constexpr char DB_STEALTH_WATCH = 'w';
+constexpr char DB_STEALTH_OUTPUT = 'o';
+
+std::unique_ptr<StealthIndex> g_stealth_index;
+
+static CKeyID GetScanId(const CStealthAddress &sx)
+{
+    return CPubKey(sx.scan_pubkey).GetID();
+}
+
+StealthIndex::StealthIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+{
+    fs::path path = GetDataDir() / "indexes" / "stealth";
+    m_db = MakeUnique<BaseIndex::DB>(path, n_cache_size, f_memory, false);
+
+    LOCK(m_cs_watches);
+    std::unique_ptr<CDBIterator> pcursor(m_db->NewIterator());
+    pcursor->Seek(DB_STEALTH_WATCH);
+    while (pcursor->Valid()) {
+        std::pair<char, CKeyID> key;
+        CStealthAddress sx;
+        if (!pcursor->GetKey(key) || key.first != DB_STEALTH_WATCH
+            || !pcursor->GetValue(sx)) {
+            break;
+        }
+        m_watches.push_back(sx);
+        pcursor->Next();
+    }
+    pcursor.reset();
+
+    if (f_wipe) {
+        m_db.reset();
+        m_db = MakeUnique<BaseIndex::DB>(path, n_cache_size, f_memory, true);
+        CDBBatch batch(*m_db);
+        for (const auto &sx : m_watches) {
+            batch.Write(std::make_pair(DB_STEALTH_WATCH, GetScanId(sx)), sx);
+        }
+        m_db->WriteBatch(batch);
+    }
+    LogPrintf("%s: Watching %u stealth addresses\n", GetName(), m_watches.size());
+}
+
+StealthIndex::~StealthIndex() {}
+
+std::vector<CStealthAddress>::const_iterator StealthIndex::FindWatch(const CKeyID &scanId) const
+{
+    return std::find_if(m_watches.begin(), m_watches.end(),
+        [&scanId](const CStealthAddress &sx) { return GetScanId(sx) == scanId; });
+}
+
+void StealthIndex::GetBlockEntries(const CBlock &block, const CBlockIndex *pindex, const std::vector<CStealthAddress> &watches,
+    std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > &entries) const
+{
+    if (watches.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction &tx = *block.vtx[i];
+        if (!tx.IsFalconVersion()) {
+            continue;
+        }
+        for (size_t k = 0; k < tx.vpout.size(); ++k) {
+            const CTxOutBase *out = tx.vpout[k].get();
+
+            CKeyID idDest;
+            const std::vector<uint8_t> *pvData;
+            if (out->IsType(OUTPUT_CT)) {
+                const CTxOutCT *ctout = (const CTxOutCT*) out;
+                CTxDestination address;
+                if (!ExtractDestination(ctout->scriptPubKey, address)
+                    || address.type() != typeid(PKHash)) {
+                    continue;
+                }
+                idDest = CKeyID(boost::get<PKHash>(address));
+                pvData = &ctout->vData;
+            } else
+            if (out->IsType(OUTPUT_RINGCT)) {
+                const CTxOutRingCT *rctout = (const CTxOutRingCT*) out;
+                idDest = rctout->pk.GetID();
+                pvData = &rctout->vData;
+            } else {
+                continue;
+            }
+
+            // First 33 bytes are the ephemeral pubkey, can be followed by the stealth prefix
+            const std::vector<uint8_t> &vData = *pvData;
+            if (vData.size() < 33) {
+                continue;
+            }
+            uint32_t prefix = 0;
+            bool fHavePrefix = false;
+            if (vData.size() >= 38
+                && vData[33] == DO_STEALTH_PREFIX) {
+                fHavePrefix = true;
+                memcpy(&prefix, &vData[34], 4);
+            }
+            ec_point vchEphemPK(vData.begin(), vData.begin() + 33);
+
+            for (const auto &sx : watches) {
+                if (!MatchPrefix(sx.prefix.number_bits, sx.prefix.bitfield, prefix, fHavePrefix)) {
+                    continue;
+                }
+                CKey sShared;
+                ec_point pkExtracted;
+                if (StealthSecret(sx.scan_secret, vchEphemPK, sx.spend_pubkey, sShared, pkExtracted) != 0) {
+                    continue;
+                }
+                CPubKey pkE(pkExtracted);
+                if (!pkE.IsValid() || pkE.GetID() != idDest) {
+                    continue;
+                }
+                entries.push_back(std::make_pair(CStealthIndexKey(GetScanId(sx), pindex->nHeight, i, tx.GetHash(), k),
+                    CStealthIndexValue(out->GetType(), pkExtracted)));
+                break;
+            }
+        }
+    }
+}
+
+bool StealthIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    LOCK(m_cs_watches);
+    std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > entries;
+    GetBlockEntries(block, pindex, m_watches, entries);
+
+    if (!entries.empty()) {
+        CDBBatch batch(*m_db);
+        for (const auto &entry : entries) {
+            batch.Write(std::make_pair(DB_STEALTH_OUTPUT, entry.first), entry.second);
+        }
+        if (!m_db->WriteBatch(batch)) {
+            return false;
+        }
+    }
+    m_last_scanned = pindex;
+    return true;
+}
+
+bool StealthIndex::DisconnectBlock(const CBlock &block, const CBlockIndex *pindex)
+{
+    CBlockLocator locator;
+    {
+        LOCK(cs_main);
+        locator = ::ChainActive().GetLocator(pindex->pprev);
+    }
+
+    LOCK(m_cs_watches);
+    std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > entries;
+    GetBlockEntries(block, pindex, m_watches, entries);
+
+    CDBBatch batch(*m_db);
+    for (const auto &entry : entries) {
+        batch.Erase(std::make_pair(DB_STEALTH_OUTPUT, entry.first));
+    }
+    m_db->WriteBestBlock(batch, locator);
+    if (!m_db->WriteBatch(batch)) {
+        return false;
+    }
+    m_best_block_index = pindex->pprev;
+    m_last_scanned = pindex->pprev;
+    return true;
+}
+
+bool StealthIndex::DisconnectBlock(const CBlock& block)
+{
+    const CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        pindex = LookupBlockIndex(block.GetHash());
+    }
+    // Nothing to undo if the index hasn't reached the block
+    if (!pindex || m_best_block_index.load() != pindex) {
+        return true;
+    }
+    return DisconnectBlock(block, pindex);
+}
+
+bool StealthIndex::Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip)
+{
+    assert(current_tip == m_best_block_index);
+    assert(current_tip->GetAncestor(new_tip->nHeight) == new_tip);
+
+    for (const CBlockIndex *pindex = current_tip; pindex != new_tip; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            return error("%s: Failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (!DisconnectBlock(block, pindex)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StealthIndex::AddWatch(const CStealthAddress &sx, int nRescanFrom, size_t &nFound, std::string &sError)
+{
+    nFound = 0;
+    if (!sx.scan_secret.IsValid() || sx.spend_pubkey.size() != EC_COMPRESSED_SIZE) {
+        sError = "Stealth address needs the scan secret and one spend public key";
+        return false;
+    }
+    CKeyID scanId = GetScanId(sx);
+
+    // Blocks scanned from here on include the new watch, earlier blocks are rescanned below
+    const CBlockIndex *pindexScanned;
+    {
+        LOCK(m_cs_watches);
+        if (FindWatch(scanId) != m_watches.end()) {
+            sError = "Stealth address is already watched";
+            return false;
+        }
+        if (!m_db->Write(std::make_pair(DB_STEALTH_WATCH, scanId), sx)) {
+            sError = "Failed to write watch";
+            return false;
+        }
+        m_watches.push_back(sx);
+        pindexScanned = m_last_scanned ? m_last_scanned : m_best_block_index.load();
+    }
+
+    if (nRescanFrom < 0 || !pindexScanned) {
+        return true;
+    }
+
+    const std::vector<CStealthAddress> watch{sx};
+    for (int nHeight = nRescanFrom; nHeight <= pindexScanned->nHeight; ++nHeight) {
+        if (ShutdownRequested()) {
+            sError = "Shutdown requested";
+            return false;
+        }
+        const CBlockIndex *pindex = pindexScanned->GetAncestor(nHeight);
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            sError = strprintf("Failed to read block %s from disk", pindex->GetBlockHash().ToString());
+            return false;
+        }
+        std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > entries;
+        GetBlockEntries(block, pindex, watch, entries);
+        if (entries.empty()) {
+            continue;
+        }
+
+        LOCK(m_cs_watches);
+        if (FindWatch(scanId) == m_watches.end()) {
+            sError = "Watch was removed";
+            return false;
+        }
+        // Skip blocks disconnected since, they were undone without the entries
+        const CBlockIndex *pindexLast = m_last_scanned ? m_last_scanned : m_best_block_index.load();
+        if (!pindexLast || pindexLast->GetAncestor(nHeight) != pindex) {
+            continue;
+        }
+        CDBBatch batch(*m_db);
+        for (const auto &entry : entries) {
+            batch.Write(std::make_pair(DB_STEALTH_OUTPUT, entry.first), entry.second);
+        }
+        if (!m_db->WriteBatch(batch)) {
+            sError = "Failed to write outputs";
+            return false;
+        }
+        nFound += entries.size();
+    }
+    return true;
+}
+
+bool StealthIndex::RemoveWatch(const CKeyID &scanId)
+{
+    LOCK(m_cs_watches);
+    auto it = FindWatch(scanId);
+    if (it == m_watches.end()) {
+        return false;
+    }
+    m_watches.erase(it);
+
+    CDBBatch batch(*m_db);
+    batch.Erase(std::make_pair(DB_STEALTH_WATCH, scanId));
+    std::unique_ptr<CDBIterator> pcursor(m_db->NewIterator());
+    pcursor->Seek(std::make_pair(DB_STEALTH_OUTPUT, CStealthIndexKey(scanId, 0, 0, uint256(), 0)));
+    while (pcursor->Valid()) {
+        std::pair<char, CStealthIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_STEALTH_OUTPUT || key.second.scanId != scanId) {
+            break;
+        }
+        batch.Erase(key);
+        pcursor->Next();
+    }
+    return m_db->WriteBatch(batch);
+}
+
+void StealthIndex::GetWatches(std::vector<CStealthAddress> &watches) const
+{
+    LOCK(m_cs_watches);
+    watches = m_watches;
+}
+
+bool StealthIndex::HaveWatch(const CKeyID &scanId) const
+{
+    LOCK(m_cs_watches);
+    return FindWatch(scanId) != m_watches.end();
+}
+
+bool StealthIndex::ReadOutputs(const CKeyID &scanId, std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > &outputs,
+                               int start, int end) const
+{
+    std::unique_ptr<CDBIterator> pcursor(m_db->NewIterator());
+    pcursor->Seek(std::make_pair(DB_STEALTH_OUTPUT, CStealthIndexKey(scanId, start > 0 ? start : 0, 0, uint256(), 0)));
+    while (pcursor->Valid()) {
+        std::pair<char, CStealthIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_STEALTH_OUTPUT || key.second.scanId != scanId
+            || (end > 0 && key.second.blockHeight > end)) {
+            break;
+        }
+        CStealthIndexValue value;
+        if (!pcursor->GetValue(value)) {
+            return error("%s: Failed to read output", __func__);
+        }
+        outputs.push_back(std::make_pair(key.second, value));
+        pcursor->Next();
+    }
+    return true;
+}
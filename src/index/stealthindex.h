@@ -0,0 +1,131 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PARTICL_INDEX_STEALTHINDEX_H
+#define PARTICL_INDEX_STEALTHINDEX_H
+
+#include <chain.h>
+#include <index/base.h>
+#include <key/stealth.h>
+#include <pubkey.h>
+#include <sync.h>
+
+/** Blinded or anon output received by a watched stealth address. Ordered by chain position per address. */
+struct CStealthIndexKey {
+    CKeyID scanId;
+    int blockHeight;
+    unsigned int txindex;
+    uint256 txhash;
+    uint32_t n;
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        scanId.Serialize(s);
+        // Heights are stored big-endian for key sorting in LevelDB
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+        txhash.Serialize(s);
+        ser_writedata32(s, n);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        scanId.Unserialize(s);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+        txhash.Unserialize(s);
+        n = ser_readdata32(s);
+    }
+
+    CStealthIndexKey(const CKeyID &id, int height, unsigned int blockindex, const uint256 &hash, uint32_t output) {
+        scanId = id;
+        blockHeight = height;
+        txindex = blockindex;
+        txhash = hash;
+        n = output;
+    }
+
+    CStealthIndexKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        scanId.SetNull();
+        blockHeight = 0;
+        txindex = 0;
+        txhash.SetNull();
+        n = 0;
+    }
+};
+
+struct CStealthIndexValue {
+    uint8_t nType;
+    ec_point pkDest; // R', the destination of the output derived from the spend public key
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nType);
+        READWRITE(pkDest);
+    }
+
+    CStealthIndexValue(uint8_t type, const ec_point &pk) : nType(type), pkDest(pk) {}
+    CStealthIndexValue() : nType(0) {}
+};
+
+/**
+ * StealthIndex finds the blinded and anon outputs received by registered stealth addresses.
+ * Each watch holds the scan secret of an address, outputs of new blocks are matched against
+ * all watches in the background so services without a wallet needn't scan every block.
+ */
+class StealthIndex final : public BaseIndex
+{
+private:
+    std::unique_ptr<BaseIndex::DB> m_db;
+
+    /** Guards the watches and the entries written for them. */
+    mutable Mutex m_cs_watches;
+    std::vector<CStealthAddress> m_watches GUARDED_BY(m_cs_watches);
+    /** Last block scanned with the current watches, may be ahead of m_best_block_index. */
+    const CBlockIndex *m_last_scanned GUARDED_BY(m_cs_watches) = nullptr;
+
+    std::vector<CStealthAddress>::const_iterator FindWatch(const CKeyID &scanId) const EXCLUSIVE_LOCKS_REQUIRED(m_cs_watches);
+
+    /** Get the entries of the outputs in block received by watches. */
+    void GetBlockEntries(const CBlock &block, const CBlockIndex *pindex, const std::vector<CStealthAddress> &watches,
+        std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > &entries) const;
+    bool DisconnectBlock(const CBlock &block, const CBlockIndex *pindex);
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    bool DisconnectBlock(const CBlock& block) override;
+    bool Rewind(const CBlockIndex* current_tip, const CBlockIndex* new_tip) override;
+
+    BaseIndex::DB& GetDB() const override { return *m_db; }
+
+    const char* GetName() const override { return "stealthindex"; }
+
+public:
+    /** Watches are kept when the database is wiped. */
+    explicit StealthIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    virtual ~StealthIndex() override;
+
+    /** Start watching sx, which must hold the scan secret.
+     *  Blocks already indexed from nRescanFrom are scanned for sx, nRescanFrom < 0 skips them.
+     *  Returns false with sError set on failure. */
+    bool AddWatch(const CStealthAddress &sx, int nRescanFrom, size_t &nFound, std::string &sError);
+    /** Stop watching the address with scan key scanId and erase its entries. */
+    bool RemoveWatch(const CKeyID &scanId);
+    void GetWatches(std::vector<CStealthAddress> &watches) const;
+    bool HaveWatch(const CKeyID &scanId) const;
+
+    bool ReadOutputs(const CKeyID &scanId, std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > &outputs,
+                     int start = 0, int end = 0) const;
+};
+
+/// The global stealth index, used by the stealth watch RPCs. May be null.
+extern std::unique_ptr<StealthIndex> g_stealth_index;
+
+#endif // PARTICL_INDEX_STEALTHINDEX_H
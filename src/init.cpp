@@ -21,6 +21,8 @@
 #include <httprpc.h>
 #include <httpserver.h>
 #include <index/blockfilterindex.h>
+#include <index/insightindex.h>
+#include <index/stealthindex.h>
 #include <index/txindex.h>
 #include <interfaces/chain.h>
 #include <key.h>
@@ -88,6 +90,7 @@
 #if ENABLE_ZMQ
 #include <zmq/zmqabstractnotifier.h>
 #include <zmq/zmqnotificationinterface.h>
+#include <zmq/zmqpublishnotifier.h>
 #include <zmq/zmqrpc.h>
 #endif
 
@@ -258,6 +261,12 @@ void Interrupt()
     if (g_txindex) {
         g_txindex->Interrupt();
     }
+    if (g_insight_index) {
+        g_insight_index->Interrupt();
+    }
+    if (g_stealth_index) {
+        g_stealth_index->Interrupt();
+    }
     ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Interrupt(); });
 }
 
@@ -343,6 +352,14 @@ void Shutdown(InitInterfaces& interfaces)
         g_txindex->Stop();
         g_txindex.reset();
     }
+    if (g_insight_index) {
+        g_insight_index->Stop();
+        g_insight_index.reset();
+    }
+    if (g_stealth_index) {
+        g_stealth_index->Stop();
+        g_stealth_index.reset();
+    }
     ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Stop(); });
     DestroyAllBlockFilterIndexes();
 
@@ -470,6 +487,7 @@ void SetupServerArgs()
 #if HAVE_SYSTEM
     gArgs.AddArg("-alertnotify=<cmd>", "Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #endif
+    gArgs.AddArg("-anonoutputcache=<n>", strprintf("Keep up to <n> MiB of recently used anon outputs in memory for ring signature verification (default: %u)", DEFAULT_ANON_OUTPUT_CACHE), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-assumevalid=<hex>", strprintf("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)", defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-blocksdir=<dir>", "Specify directory to hold blocks subdirectory for *.dat files (default: <datadir>)", ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 #if HAVE_SYSTEM
@@ -513,6 +531,7 @@ void SetupServerArgs()
     gArgs.AddArg("-addressindex", strprintf("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)", DEFAULT_ADDRESSINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-timestampindex", strprintf("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)", DEFAULT_TIMESTAMPINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-spentindex", strprintf("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)", DEFAULT_SPENTINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
+    gArgs.AddArg("-stealthindex", strprintf("Maintain an index of the blinded and anon outputs received by stealth addresses registered with addstealthwatch (default: %u)", DEFAULT_STEALTHINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-csindex", strprintf("Maintain an index of outputs by coldstaking address (default: %u)", DEFAULT_CSINDEX), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
     gArgs.AddArg("-cswhitelist", strprintf("Only index coldstaked outputs with matching stake address. Can be specified multiple times."), ArgsManager::ALLOW_ANY, OptionsCategory::OPTIONS);
 
@@ -596,6 +615,11 @@ void SetupServerArgs()
 
     gArgs.AddArg("-zmqpubhashwtx=<address>", "Enable publish hash transaction received by wallets in <address>", ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
     gArgs.AddArg("-zmqpubsmsg=<address>", "Enable publish secure message in <address>", ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
+    gArgs.AddArg("-zmqpubsmsginbox=<address>", "Enable publish decrypted secure messages received into the inbox in <address>", ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
+    gArgs.AddArg("-zmqpubrawsmsg=<address>", "Enable publish raw secure messages stored in <address>", ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
+    gArgs.AddArg("-zmqpubsmsginboxhwm=<n>", strprintf("Set publish inbox secure message outbound message high water mark (default: %d)", CZMQAbstractNotifier::DEFAULT_ZMQ_SNDHWM), ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
+    gArgs.AddArg("-zmqpubrawsmsghwm=<n>", strprintf("Set publish raw secure message outbound message high water mark (default: %d)", CZMQAbstractNotifier::DEFAULT_ZMQ_SNDHWM), ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
+    gArgs.AddArg("-zmqsmsgbacklog=<n>", strprintf("Number of published inbox and raw secure messages kept to be resent with resendzmqsmsg (default: %d)", CZMQAbstractPublishSMSGNotifier::DEFAULT_ZMQ_SMSG_BACKLOG), ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
     gArgs.AddArg("-serverkeyzmq=<secret_key>", "Base64 encoded string of the z85 encoded secret key for CurveZMQ.", ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
     gArgs.AddArg("-newserverkeypairzmq", "Generate new key pair for CurveZMQ, print and exit.", ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
     gArgs.AddArg("-whitelistzmq=<IP address or network>", "Whitelist peers connecting from the given IP address (e.g. 1.2.3.4) or CIDR notated network (e.g. 1.2.3.0/24). Can be specified multiple times.", ArgsManager::ALLOW_ANY, OptionsCategory::ZMQ);
@@ -612,6 +636,11 @@ void SetupServerArgs()
 
     hidden_args.emplace_back("-zmqpubhashwtx=<address>");
     hidden_args.emplace_back("-zmqpubsmsg=<address>");
+    hidden_args.emplace_back("-zmqpubsmsginbox=<address>");
+    hidden_args.emplace_back("-zmqpubrawsmsg=<address>");
+    hidden_args.emplace_back("-zmqpubsmsginboxhwm=<n>");
+    hidden_args.emplace_back("-zmqpubrawsmsghwm=<n>");
+    hidden_args.emplace_back("-zmqsmsgbacklog=<n>");
     hidden_args.emplace_back("-serverkeyzmq=<secret_key>");
     hidden_args.emplace_back("-newserverkeypairzmq");
     hidden_args.emplace_back("-whitelistzmq=<IP address or network>");
@@ -646,6 +675,7 @@ void SetupServerArgs()
     gArgs.AddArg("-logthreadnames", strprintf("Prepend debug output with name of the originating thread (only available on platforms supporting thread_local) (default: %u)", DEFAULT_LOGTHREADNAMES), ArgsManager::ALLOW_ANY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)", ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
+    gArgs.AddArg("-maxproofcachesize=<n>", strprintf("Limit the cache of verified rangeproofs to <n> MiB (default: %u)", DEFAULT_MAX_PROOF_CACHE_SIZE), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
     gArgs.AddArg("-printpriority", strprintf("Log transaction fee per kB when mining blocks (default: %u)", DEFAULT_PRINTPRIORITY), ArgsManager::ALLOW_ANY | ArgsManager::DEBUG_ONLY, OptionsCategory::DEBUG_TEST);
@@ -1135,6 +1165,14 @@ bool AppInitParameterInteraction()
         if (!g_enabled_filter_types.empty()) {
             return InitError(_("Prune mode is incompatible with -blockfilterindex.").translated);
         }
+        if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)
+            || gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)
+            || gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX)) {
+            return InitError(_("Prune mode is incompatible with -addressindex, -spentindex and -timestampindex.").translated);
+        }
+        if (gArgs.GetBoolArg("-stealthindex", DEFAULT_STEALTHINDEX)) {
+            return InitError(_("Prune mode is incompatible with -stealthindex.").translated);
+        }
     }
 
     // -bind and -whitebind can't be set when not listening
@@ -1431,12 +1469,15 @@ bool AppInitMain(InitInterfaces& interfaces)
     }
 
     InitSignatureCache();
+    InitProofCache();
     InitScriptExecutionCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread([i]() { return ThreadMempoolCheck(i); });
     }
 
     // Start the lightweight task scheduler thread
@@ -1640,6 +1681,13 @@ bool AppInitMain(InitInterfaces& interfaces)
     nTotalCache -= nBlockTreeDBCache;
     int64_t nTxIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxTxIndexCache << 20 : 0);
     nTotalCache -= nTxIndexCache;
+    bool fInsightIndexes = gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)
+                        || gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)
+                        || gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+    int64_t nInsightIndexCache = std::min(nTotalCache / 8, fInsightIndexes ? nMaxTxIndexCache << 20 : 0);
+    nTotalCache -= nInsightIndexCache;
+    int64_t nStealthIndexCache = std::min(nTotalCache / 8, gArgs.GetBoolArg("-stealthindex", DEFAULT_STEALTHINDEX) ? nMaxBlockDBCache << 20 : 0);
+    nTotalCache -= nStealthIndexCache;
     int64_t filter_index_cache = 0;
     if (!g_enabled_filter_types.empty()) {
         size_t n_indexes = g_enabled_filter_types.size();
@@ -1658,6 +1706,12 @@ bool AppInitMain(InitInterfaces& interfaces)
     if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
         LogPrintf("* Using %.1f MiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
     }
+    if (fInsightIndexes) {
+        LogPrintf("* Using %.1f MiB for insight index database\n", nInsightIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (gArgs.GetBoolArg("-stealthindex", DEFAULT_STEALTHINDEX)) {
+        LogPrintf("* Using %.1f MiB for stealth index database\n", nStealthIndexCache * (1.0 / 1024 / 1024));
+    }
     for (BlockFilterType filter_type : g_enabled_filter_types) {
         LogPrintf("* Using %.1f MiB for %s block filter index database\n",
                   filter_index_cache * (1.0 / 1024 / 1024), BlockFilterTypeName(filter_type));
@@ -1722,23 +1776,28 @@ bool AppInitMain(InitInterfaces& interfaces)
                 }
 
                 // Check for changed -addressindex state
-                if (fAddressIndex != gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+                if (fLegacyAddressIndex && !gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -addressindex").translated;
                     break;
                 }
 
                 // Check for changed -spentindex state
-                if (fSpentIndex != gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)) {
+                if (fLegacySpentIndex && !gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -spentindex").translated;
                     break;
                 }
 
                 // Check for changed -timestampindex state
-                if (fTimestampIndex != gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX)) {
+                if (fLegacyTimestampIndex && !gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -timestampindex").translated;
                     break;
                 }
 
+                // Indexes not in the block tree database are built by g_insight_index
+                fAddressIndex = gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+                fSpentIndex = gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+                fTimestampIndex = gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1900,6 +1959,27 @@ bool AppInitMain(InitInterfaces& interfaces)
         g_txindex->Start();
     }
 
+    uint8_t nInsightIndexes = 0;
+    if (fAddressIndex && !fLegacyAddressIndex) {
+        nInsightIndexes |= InsightIndex::ADDRESS_INDEX;
+    }
+    if (fSpentIndex && !fLegacySpentIndex) {
+        nInsightIndexes |= InsightIndex::SPENT_INDEX;
+    }
+    if (fTimestampIndex && !fLegacyTimestampIndex) {
+        nInsightIndexes |= InsightIndex::TIMESTAMP_INDEX;
+    }
+    if (nInsightIndexes) {
+        // A different set of indexes than the last run rebuilds all of them
+        g_insight_index = MakeUnique<InsightIndex>(nInsightIndexCache, nInsightIndexes, false, fReindex);
+        g_insight_index->Start();
+    }
+
+    if (gArgs.GetBoolArg("-stealthindex", DEFAULT_STEALTHINDEX)) {
+        g_stealth_index = MakeUnique<StealthIndex>(nStealthIndexCache, false, fReindex);
+        g_stealth_index->Start();
+    }
+
     for (const auto& filter_type : g_enabled_filter_types) {
         InitBlockFilterIndex(filter_type, filter_index_cache, false, fReindex);
         GetBlockFilterIndex(filter_type)->Start();
@@ -1986,6 +2066,13 @@ bool AppInitMain(InitInterfaces& interfaces)
         smsgModule.Start(nullptr, empty, gArgs.GetBoolArg("-smsgscanchain", false));
 #endif
     }
+    if (fParticlMode) {
+        // Runs while smsg is enabled, smsg can be enabled at runtime
+        scheduler.scheduleEvery([]{
+            smsgModule.CompactBuckets();
+        }, smsg::SMSG_COMPACT_INTERVAL * 1000);
+        RegisterValidationInterface(&smsgModule.m_funding_cache);
+    }
 
     if (ShutdownRequestedMainThread()) {
         return false;
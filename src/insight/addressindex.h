@@ -160,6 +160,35 @@ struct CAddressIndexKey {
     }
 };
 
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+    uint32_t txCount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(txCount);
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+        txCount = 0;
+    }
+
+    bool IsNull() const {
+        return balance == 0 && received == 0 && txCount == 0;
+    }
+};
+
 struct CAddressIndexIteratorKey {
     unsigned int type;
     uint256 hashBytes;
@@ -231,6 +260,55 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+/** Position of a transaction in the chain, address index entries of all addresses are ordered by it. */
+struct CAddressIndexPosition {
+    int blockHeight;
+    unsigned int txindex;
+
+    size_t GetSerializeSize() const {
+        return 8;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+    }
+
+    CAddressIndexPosition(int height, unsigned int blockindex) {
+        blockHeight = height;
+        txindex = blockindex;
+    }
+
+    explicit CAddressIndexPosition(const CAddressIndexKey &key) {
+        blockHeight = key.blockHeight;
+        txindex = key.txindex;
+    }
+
+    CAddressIndexPosition() {
+        SetNull();
+    }
+
+    void SetNull() {
+        blockHeight = 0;
+        txindex = 0;
+    }
+
+    friend bool operator<(const CAddressIndexPosition &a, const CAddressIndexPosition &b) {
+        return a.blockHeight < b.blockHeight || (a.blockHeight == b.blockHeight && a.txindex < b.txindex);
+    }
+    friend bool operator==(const CAddressIndexPosition &a, const CAddressIndexPosition &b) {
+        return a.blockHeight == b.blockHeight && a.txindex == b.txindex;
+    }
+    friend bool operator!=(const CAddressIndexPosition &a, const CAddressIndexPosition &b) {
+        return !(a == b);
+    }
+};
+
 struct CMempoolAddressDelta
 {
     int64_t time;
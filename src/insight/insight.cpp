@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <insight/insight.h>
+#include <index/insightindex.h>
 #include <insight/addressindex.h>
 #include <insight/spentindex.h>
 #include <insight/timestampindex.h>
@@ -21,6 +22,9 @@
 bool fAddressIndex = false;
 bool fTimestampIndex = false;
 bool fSpentIndex = false;
+bool fLegacyAddressIndex = false;
+bool fLegacyTimestampIndex = false;
+bool fLegacySpentIndex = false;
 
 bool ExtractIndexInfo(const CScript *pScript, int &scriptType, std::vector<uint8_t> &hashBytes)
 {
@@ -79,7 +83,8 @@ bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const
     if (!fTimestampIndex) {
         return error("Timestamp index not enabled");
     }
-    if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes)) {
+    if (!(fLegacyTimestampIndex ? pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes)
+          : (g_insight_index && g_insight_index->ReadTimestampIndex(high, low, fActiveOnly, hashes)))) {
         return error("Unable to get hashes for timestamps");
     }
 
@@ -94,7 +99,8 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     if (mempool.getSpentIndex(key, value)) {
         return true;
     }
-    if (!pblocktree->ReadSpentIndex(key, value)) {
+    if (!(fLegacySpentIndex ? pblocktree->ReadSpentIndex(key, value)
+          : (g_insight_index && g_insight_index->ReadSpentIndex(key, value)))) {
         return false;
     }
 
@@ -113,25 +119,41 @@ bool HashOnchainActive(const uint256 &hash)
 };
 
 bool GetAddressIndex(uint256 addressHash, int type,
-                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end,
+                     const CAddressIndexPosition *pAfter, size_t nMaxTxns)
 {
     if (!fAddressIndex) {
         return error("Address index not enabled");
     }
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end)) {
+    if (!(fLegacyAddressIndex ? pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end, pAfter, nMaxTxns)
+          : (g_insight_index && g_insight_index->ReadAddressIndex(addressHash, type, addressIndex, start, end, pAfter, nMaxTxns)))) {
         return error("Unable to get txids for address");
     }
 
     return true;
 };
 
+bool GetAddressBalance(uint256 addressHash, int type, CAddressBalanceValue &balance)
+{
+    if (!fAddressIndex) {
+        return error("Address index not enabled");
+    }
+    if (!(fLegacyAddressIndex ? pblocktree->ReadAddressBalance(addressHash, type, balance)
+          : (g_insight_index && g_insight_index->ReadAddressBalance(addressHash, type, balance)))) {
+        return error("Unable to get balance for address");
+    }
+
+    return true;
+};
+
 bool GetAddressUnspent(uint256 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
 {
     if (!fAddressIndex) {
         return error("Address index not enabled");
     }
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs)) {
+    if (!(fLegacyAddressIndex ? pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs)
+          : (g_insight_index && g_insight_index->ReadAddressUnspentIndex(addressHash, type, unspentOutputs)))) {
         return error("Unable to get txids for address");
     }
 
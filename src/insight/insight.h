@@ -21,10 +21,17 @@ extern bool fAddressIndex;
 extern bool fSpentIndex;
 extern bool fTimestampIndex;
 
+/** Set when the index is written to the block tree database while connecting blocks, else it's kept by g_insight_index. */
+extern bool fLegacyAddressIndex;
+extern bool fLegacySpentIndex;
+extern bool fLegacyTimestampIndex;
+
 class CTxOutBase;
 class CScript;
 class uint256;
 struct CAddressIndexKey;
+struct CAddressIndexPosition;
+struct CAddressBalanceValue;
 struct CAddressUnspentKey;
 struct CAddressUnspentValue;
 struct CSpentIndexKey;
@@ -39,7 +46,9 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool HashOnchainActive(const uint256 &hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 bool GetAddressIndex(uint256 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                     int start = 0, int end = 0);
+                     int start = 0, int end = 0,
+                     const CAddressIndexPosition *pAfter = nullptr, size_t nMaxTxns = 0);
+bool GetAddressBalance(uint256 addressHash, int type, CAddressBalanceValue &balance);
 bool GetAddressUnspent(uint256 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
 
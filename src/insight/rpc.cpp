@@ -9,15 +9,22 @@
 #include <util/strencodings.h>
 #include <insight/insight.h>
 #include <insight/csindex.h>
+#include <index/insightindex.h>
+#include <index/stealthindex.h>
 #include <index/txindex.h>
+#include <node/coinstats.h>
 #include <validation.h>
 #include <txmempool.h>
 #include <key_io.h>
 #include <core_io.h>
 #include <script/standard.h>
+#include <streams.h>
+#include <version.h>
 
 #include <univalue.h>
 
+#include <array>
+
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 static bool GetIndexKey(const CTxDestination &dest, uint256 &hashBytes, int &type) {
@@ -107,6 +114,16 @@ bool timestampSort(std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> a,
     return a.second.time < b.second.time;
 }
 
+/** Wait for the asynchronous insight index to catch up with the chain, the caller must not hold cs_main.
+ *  Returns false while g_insight_index is still being built for index, reads would return partial results. */
+static bool BlockUntilInsightIndexSynced(uint8_t index)
+{
+    if (g_insight_index && g_insight_index->HasIndex(index)) {
+        return g_insight_index->BlockUntilSyncedToCurrentChain();
+    }
+    return true;
+}
+
 UniValue getaddressmempool(const JSONRPCRequest& request)
 {
             RPCHelpMan{"getaddressmempool",
@@ -215,6 +232,10 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled.");
     }
 
+    if (!BlockUntilInsightIndexSynced(InsightIndex::ADDRESS_INDEX)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is still being built.");
+    }
+
     bool includeChainInfo = false;
     if (request.params[0].isObject()) {
         UniValue chainInfo = find_value(request.params[0].get_obj(), "chainInfo");
@@ -268,6 +289,96 @@ UniValue getaddressutxos(const JSONRPCRequest& request)
     }
 }
 
+/** Position after the last transaction of a page, as returned to the client. */
+static std::string EncodeAddressIndexCursor(const CAddressIndexPosition &position)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << position;
+    return HexStr(ss.begin(), ss.end());
+}
+
+static CAddressIndexPosition DecodeAddressIndexCursor(const UniValue &cursor)
+{
+    if (!cursor.isStr() || !IsHex(cursor.get_str())) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    std::vector<uint8_t> data = ParseHex(cursor.get_str());
+    if (data.size() != CAddressIndexPosition().GetSerializeSize()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    CAddressIndexPosition position;
+    CDataStream ss(data, SER_NETWORK, PROTOCOL_VERSION);
+    ss >> position;
+    return position;
+}
+
+/** Read the address index entries of addresses.
+ *  If nLimit is set the entries are sorted by chain position and cut after nLimit transactions,
+ *  fMore is set when entries remain. Each address reads at most nLimit + 1 transactions from the database.
+ */
+static void ReadAddressIndexPage(const std::vector<std::pair<uint256, int> > &addresses, int start, int end,
+    const CAddressIndexPosition *pAfter, size_t nLimit,
+    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, bool &fMore)
+{
+    fMore = false;
+    if (!(start > 0 && end > 0)) {
+        start = end = 0;
+    }
+    for (const auto &address : addresses) {
+        if (!GetAddressIndex(address.first, address.second, addressIndex, start, end, pAfter, nLimit > 0 ? nLimit + 1 : 0)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+    }
+    if (nLimit < 1) {
+        return;
+    }
+
+    std::stable_sort(addressIndex.begin(), addressIndex.end(),
+        [](const std::pair<CAddressIndexKey, CAmount> &a, const std::pair<CAddressIndexKey, CAmount> &b) {
+            return CAddressIndexPosition(a.first) < CAddressIndexPosition(b.first);
+        });
+
+    size_t nTxns = 0;
+    CAddressIndexPosition lastPosition(-1, 0);
+    for (size_t i = 0; i < addressIndex.size(); ++i) {
+        CAddressIndexPosition position(addressIndex[i].first);
+        if (position == lastPosition) {
+            continue;
+        }
+        if (nTxns >= nLimit) {
+            addressIndex.resize(i);
+            fMore = true;
+            break;
+        }
+        nTxns++;
+        lastPosition = position;
+    }
+}
+
+/** Paging options of getaddresstxids and getaddressdeltas, returns the page size or 0 if not paging. */
+static size_t GetAddressIndexPageParams(const UniValue &params, CAddressIndexPosition &after, bool &fAfter)
+{
+    fAfter = false;
+    if (!params[0].isObject()) {
+        return 0;
+    }
+    size_t nLimit = 0;
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    if (!limitValue.isNull()) {
+        int limit = limitValue.get_int();
+        if (limit < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be positive");
+        }
+        nLimit = limit;
+    }
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (!cursorValue.isNull()) {
+        after = DecodeAddressIndexCursor(cursorValue);
+        fAfter = true;
+    }
+    return nLimit;
+}
+
 UniValue getaddressdeltas(const JSONRPCRequest& request)
 {
             RPCHelpMan{"getaddressdeltas",
@@ -281,6 +392,8 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
                     {"start", RPCArg::Type::NUM, /* default */ "0", "The start block height."},
                     {"end", RPCArg::Type::NUM, /* default */ "0", "The end block height."},
                     {"chainInfo", RPCArg::Type::BOOL, /* default */ "false", "Include chain info in results, only applies if start and end specified."},
+                    {"limit", RPCArg::Type::NUM, /* default */ "0", "Return the deltas of at most limit transactions and a cursor to continue from, 0 returns all deltas."},
+                    {"cursor", RPCArg::Type::STR, RPCArg::Optional::OMITTED, "Continue after the cursor returned by the previous call."},
                 },
                 RPCResult{
             "[\n"
@@ -292,9 +405,17 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "If limit is set, or chainInfo with start and end:\n"
+            "{\n"
+            "  \"deltas\": [...],  (array) As above\n"
+            "  \"start\": {...},   (object) Start block hash and height, if chainInfo\n"
+            "  \"end\": {...},     (object) End block hash and height, if chainInfo\n"
+            "  \"cursor\": \"xxx\"  (string) Pass to the next call to continue, if more deltas remain\n"
+            "}\n"
                 },
                 RPCExamples{
             HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"Pb7FLL3DyaAVP2eGfRiEkj4U8ZJ3RHLY9g\"]}'") +
+            HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"Pb7FLL3DyaAVP2eGfRiEkj4U8ZJ3RHLY9g\"], \"limit\": 100}'") +
             "\nAs a JSON-RPC call\n"
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"Pb7FLL3DyaAVP2eGfRiEkj4U8ZJ3RHLY9g\"]}")
                 },
@@ -304,6 +425,10 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled.");
     }
 
+    if (!BlockUntilInsightIndexSynced(InsightIndex::ADDRESS_INDEX)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is still being built.");
+    }
+
     UniValue startValue = find_value(request.params[0].get_obj(), "start");
     UniValue endValue = find_value(request.params[0].get_obj(), "end");
 
@@ -333,19 +458,13 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    CAddressIndexPosition after;
+    bool fAfter;
+    size_t nLimit = GetAddressIndexPageParams(request.params, after, fAfter);
 
-    for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex(it->first, it->second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex(it->first, it->second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
-    }
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    bool fMore;
+    ReadAddressIndexPage(addresses, start, end, fAfter ? &after : nullptr, nLimit, addressIndex, fMore);
 
     UniValue deltas(UniValue::VARR);
 
@@ -389,11 +508,16 @@ UniValue getaddressdeltas(const JSONRPCRequest& request)
         result.pushKV("deltas", deltas);
         result.pushKV("start", startInfo);
         result.pushKV("end", endInfo);
-
-        return result;
+    } else
+    if (nLimit > 0) {
+        result.pushKV("deltas", deltas);
     } else {
         return deltas;
     }
+    if (fMore) {
+        result.pushKV("cursor", EncodeAddressIndexCursor(CAddressIndexPosition(addressIndex.back().first)));
+    }
+    return result;
 }
 
 UniValue getaddressbalance(const JSONRPCRequest& request)
@@ -424,28 +548,26 @@ UniValue getaddressbalance(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled.");
     }
 
+    if (!BlockUntilInsightIndexSynced(InsightIndex::ADDRESS_INDEX)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is still being built.");
+    }
+
     std::vector<std::pair<uint256, int> > addresses;
 
     if (!getAddressesFromParams(request.params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-
-    for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex(it->first, it->second, addressIndex)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
-
     CAmount balance = 0;
     CAmount received = 0;
 
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
+    for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+        CAddressBalanceValue addressBalance;
+        if (!GetAddressBalance(it->first, it->second, addressBalance)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-        balance += it->second;
+        balance += addressBalance.balance;
+        received += addressBalance.received;
     }
 
     UniValue result(UniValue::VOBJ);
@@ -467,15 +589,23 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
                     },
                     {"start", RPCArg::Type::NUM, /* default */ "0", "The start block height."},
                     {"end", RPCArg::Type::NUM, /* default */ "0", "The end block height."},
+                    {"limit", RPCArg::Type::NUM, /* default */ "0", "Return at most limit txids and a cursor to continue from, 0 returns all txids."},
+                    {"cursor", RPCArg::Type::STR, RPCArg::Optional::OMITTED, "Continue after the cursor returned by the previous call."},
                 },
                 RPCResult{
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "If limit is set:\n"
+            "{\n"
+            "  \"txids\": [...],   (array) As above, in chain order\n"
+            "  \"cursor\": \"xxx\"  (string) Pass to the next call to continue, if more txids remain\n"
+            "}\n"
                 },
                 RPCExamples{
             HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"Pb7FLL3DyaAVP2eGfRiEkj4U8ZJ3RHLY9g\"]}'") +
+            HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"Pb7FLL3DyaAVP2eGfRiEkj4U8ZJ3RHLY9g\"], \"limit\": 100}'") +
             "\nAs a JSON-RPC call\n"
             + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"Pb7FLL3DyaAVP2eGfRiEkj4U8ZJ3RHLY9g\"]}")
                 },
@@ -485,6 +615,10 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_MISC_ERROR, "Address index is not enabled.");
     }
 
+    if (!BlockUntilInsightIndexSynced(InsightIndex::ADDRESS_INDEX)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index is still being built.");
+    }
+
     std::vector<std::pair<uint256, int> > addresses;
 
     if (!getAddressesFromParams(request.params, addresses)) {
@@ -502,18 +636,29 @@ UniValue getaddresstxids(const JSONRPCRequest& request)
         }
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    CAddressIndexPosition after;
+    bool fAfter;
+    size_t nLimit = GetAddressIndexPageParams(request.params, after, fAfter);
 
-    for (std::vector<std::pair<uint256, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex(it->first, it->second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex(it->first, it->second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    bool fMore;
+    ReadAddressIndexPage(addresses, start, end, fAfter ? &after : nullptr, nLimit, addressIndex, fMore);
+
+    if (nLimit > 0) {
+        // Entries are sorted by position, the entries of a transaction are adjacent
+        UniValue txids(UniValue::VARR);
+        for (size_t i = 0; i < addressIndex.size(); ++i) {
+            if (i > 0 && addressIndex[i].first.txhash == addressIndex[i - 1].first.txhash) {
+                continue;
             }
+            txids.push_back(addressIndex[i].first.txhash.GetHex());
+        }
+        UniValue result(UniValue::VOBJ);
+        result.pushKV("txids", txids);
+        if (fMore) {
+            result.pushKV("cursor", EncodeAddressIndexCursor(CAddressIndexPosition(addressIndex.back().first)));
         }
+        return result;
     }
 
     std::set<std::pair<int, std::string> > txids;
@@ -580,6 +725,9 @@ UniValue getspentinfo(const JSONRPCRequest& request)
     CSpentIndexKey key(txid, outputIndex);
     CSpentIndexValue value;
 
+    if (!BlockUntilInsightIndexSynced(InsightIndex::SPENT_INDEX)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index is still being built.");
+    }
     if (!GetSpentIndex(key, value)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
     }
@@ -750,6 +898,9 @@ static UniValue getblockdeltas(const JSONRPCRequest& request)
         },
     }.Check(request);
 
+    if (!BlockUntilInsightIndexSynced(InsightIndex::SPENT_INDEX)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index is still being built.");
+    }
     LOCK(cs_main);
 
     std::string strHash = request.params[0].get_str();
@@ -827,6 +978,9 @@ static UniValue getblockhashes(const JSONRPCRequest& request)
 
     std::vector<std::pair<uint256, unsigned int> > blockHashes;
 
+    if (!BlockUntilInsightIndexSynced(InsightIndex::TIMESTAMP_INDEX)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Timestamp index is still being built.");
+    }
     if (fActiveOnly) {
         LOCK(cs_main);
     }
@@ -876,14 +1030,11 @@ UniValue gettxoutsetinfobyscript(const JSONRPCRequest& request)
     int nHeight;
     uint256 hashBlock;
 
-    std::unique_ptr<CCoinsViewCursor> pcursor;
+    CCoinsView *coins_view;
     {
         LOCK(cs_main);
         ::ChainstateActive().ForceFlushStateToDisk();
-        pcursor = std::unique_ptr<CCoinsViewCursor>(::ChainstateActive().CoinsDB().Cursor());
-        assert(pcursor);
-        hashBlock = pcursor->GetBestBlock();
-        nHeight = ::BlockIndex().find(hashBlock)->second->nHeight;
+        coins_view = &::ChainstateActive().CoinsDB();
     }
 
     class PerScriptTypeStats {
@@ -892,6 +1043,13 @@ UniValue gettxoutsetinfobyscript(const JSONRPCRequest& request)
         int64_t nBlinded = 0;
         int64_t nPlainValue = 0;
 
+        void Add(const PerScriptTypeStats &other)
+        {
+            nPlain += other.nPlain;
+            nBlinded += other.nBlinded;
+            nPlainValue += other.nPlainValue;
+        }
+
         UniValue ToUV()
         {
             UniValue ret(UniValue::VOBJ);
@@ -902,39 +1060,48 @@ UniValue gettxoutsetinfobyscript(const JSONRPCRequest& request)
         }
     };
 
+    enum {PKH, SH, CSPKH, CSSH, OTHER, NUM_SCRIPT_TYPES};
+    std::vector<std::array<PerScriptTypeStats, NUM_SCRIPT_TYPES> > ranges(UTXO_SCAN_RANGES);
+
+    bool fScanned = ScanUTXOSet(coins_view, hashBlock, [&ranges](size_t nRange, const COutPoint &key, Coin &&coin) {
+        PerScriptTypeStats *ps = &ranges[nRange][OTHER];
+        if (coin.out.scriptPubKey.IsPayToPublicKeyHash())
+            ps = &ranges[nRange][PKH];
+        else if (coin.out.scriptPubKey.IsPayToScriptHash())
+            ps = &ranges[nRange][SH];
+        else if (coin.out.scriptPubKey.IsPayToPublicKeyHash256_CS())
+            ps = &ranges[nRange][CSPKH];
+        else if (coin.out.scriptPubKey.IsPayToScriptHash256_CS() || coin.out.scriptPubKey.IsPayToScriptHash_CS() )
+            ps = &ranges[nRange][CSSH];
+
+        if (coin.nType == OUTPUT_STANDARD) {
+            ps->nPlain++;
+            ps->nPlainValue += coin.out.nValue;
+        } else
+        if (coin.nType == OUTPUT_CT) {
+            ps->nBlinded++;
+        }
+        return true;
+    });
+    if (!fScanned) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+    }
+    {
+        LOCK(cs_main);
+        nHeight = LookupBlockIndex(hashBlock)->nHeight;
+    }
+
     PerScriptTypeStats statsPKH;
     PerScriptTypeStats statsSH;
     PerScriptTypeStats statsCSPKH;
     PerScriptTypeStats statsCSSH;
     PerScriptTypeStats statsOther;
-
-    uint256 prevkey;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            PerScriptTypeStats *ps = &statsOther;
-            if (coin.out.scriptPubKey.IsPayToPublicKeyHash())
-                ps = &statsPKH;
-            else if (coin.out.scriptPubKey.IsPayToScriptHash())
-                ps = &statsSH;
-            else if (coin.out.scriptPubKey.IsPayToPublicKeyHash256_CS())
-                ps = &statsCSPKH;
-            else if (coin.out.scriptPubKey.IsPayToScriptHash256_CS() || coin.out.scriptPubKey.IsPayToScriptHash_CS() )
-                ps = &statsCSSH;
-
-            if (coin.nType == OUTPUT_STANDARD) {
-                ps->nPlain++;
-                ps->nPlainValue += coin.out.nValue;
-            } else
-            if (coin.nType == OUTPUT_CT) {
-                ps->nBlinded++;
-            }
-        } else {
-            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
-        }
-        pcursor->Next();
+    for (const auto &range : ranges) {
+        statsPKH.Add(range[PKH]);
+        statsSH.Add(range[SH]);
+        statsCSPKH.Add(range[CSPKH]);
+        statsCSSH.Add(range[CSSH]);
+        statsOther.Add(range[OTHER]);
     }
 
     ret.pushKV("height", (int64_t)nHeight);
@@ -1275,6 +1442,198 @@ UniValue listcoldstakeunspent(const JSONRPCRequest& request)
     return rv;
 }
 
+static CStealthAddress GetWatchedStealthAddress(const UniValue &address)
+{
+    if (!g_stealth_index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Stealth index is not enabled.");
+    }
+    CStealthAddress sx;
+    if (!sx.SetEncoded(address.get_str())) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid stealth address");
+    }
+    return sx;
+}
+
+UniValue addstealthwatch(const JSONRPCRequest& request)
+{
+            RPCHelpMan{"addstealthwatch",
+                "\nIndex the blinded and anon outputs received by a stealth address (requires stealthindex to be enabled).\n"
+                "The scan secret is stored unencrypted in the index database.\n",
+                {
+                    {"address", RPCArg::Type::STR, RPCArg::Optional::NO, "The stealth address."},
+                    {"scan_secret", RPCArg::Type::STR, RPCArg::Optional::NO, "The hex or WIF encoded scan secret of the address."},
+                    {"rescan_from", RPCArg::Type::NUM, /* default */ "0", "Scan the indexed blocks from this height, negative number to skip."},
+                },
+                RPCResult{
+            "{\n"
+            "  \"address\"  (string) The stealth address\n"
+            "  \"found\"  (number) The number of outputs found by the rescan\n"
+            "}\n"
+                },
+                RPCExamples{
+            HelpExampleCli("addstealthwatch", "\"stealthaddress\" \"scan_secret\" 0") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("addstealthwatch", "\"stealthaddress\", \"scan_secret\", 0")
+                },
+        }.Check(request);
+
+    CStealthAddress sx = GetWatchedStealthAddress(request.params[0]);
+
+    std::string sScanSecret = request.params[1].get_str();
+    CKey skScan;
+    if (IsHex(sScanSecret)) {
+        std::vector<uint8_t> vchScanSecret = ParseHex(sScanSecret);
+        if (vchScanSecret.size() != 32) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan secret is not 32 bytes.");
+        }
+        skScan.Set(vchScanSecret.begin(), vchScanSecret.end(), true);
+    } else {
+        skScan = DecodeSecret(sScanSecret);
+    }
+    if (!skScan.IsValid()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Could not decode scan secret as WIF or hex.");
+    }
+    ec_point pkScan;
+    if (0 != SecretToPublicKey(skScan, pkScan) || pkScan != sx.scan_pubkey) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan secret does not match the stealth address.");
+    }
+    sx.scan_secret = skScan;
+
+    int nRescanFrom = request.params[2].isNull() ? 0 : request.params[2].get_int();
+
+    g_stealth_index->BlockUntilSyncedToCurrentChain();
+
+    size_t nFound;
+    std::string sError;
+    if (!g_stealth_index->AddWatch(sx, nRescanFrom, nFound, sError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, sError);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("address", sx.Encoded());
+    result.pushKV("found", (int)nFound);
+
+    return result;
+}
+
+UniValue removestealthwatch(const JSONRPCRequest& request)
+{
+            RPCHelpMan{"removestealthwatch",
+                "\nStop indexing the outputs of a stealth address and erase the outputs found (requires stealthindex to be enabled).\n",
+                {
+                    {"address", RPCArg::Type::STR, RPCArg::Optional::NO, "The stealth address."},
+                },
+                RPCResult{
+            "true|false    (boolean) True if the address was watched\n"
+                },
+                RPCExamples{
+            HelpExampleCli("removestealthwatch", "\"stealthaddress\"") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("removestealthwatch", "\"stealthaddress\"")
+                },
+        }.Check(request);
+
+    CStealthAddress sx = GetWatchedStealthAddress(request.params[0]);
+
+    return g_stealth_index->RemoveWatch(CPubKey(sx.scan_pubkey).GetID());
+}
+
+UniValue liststealthwatches(const JSONRPCRequest& request)
+{
+            RPCHelpMan{"liststealthwatches",
+                "\nList the stealth addresses indexed by the stealth index (requires stealthindex to be enabled).\n",
+                {
+                },
+                RPCResult{
+            "[\n"
+            "  \"address\"  (string) The stealth address\n"
+            "  ,...\n"
+            "]\n"
+                },
+                RPCExamples{
+            HelpExampleCli("liststealthwatches", "") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("liststealthwatches", "")
+                },
+        }.Check(request);
+
+    if (!g_stealth_index) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Stealth index is not enabled.");
+    }
+
+    std::vector<CStealthAddress> watches;
+    g_stealth_index->GetWatches(watches);
+
+    UniValue result(UniValue::VARR);
+    for (const auto &sx : watches) {
+        result.push_back(sx.Encoded());
+    }
+
+    return result;
+}
+
+UniValue getstealthwatchoutputs(const JSONRPCRequest& request)
+{
+            RPCHelpMan{"getstealthwatchoutputs",
+                "\nReturns the blinded and anon outputs received by a watched stealth address (requires stealthindex to be enabled).\n",
+                {
+                    {"address", RPCArg::Type::STR, RPCArg::Optional::NO, "The stealth address."},
+                    {"start", RPCArg::Type::NUM, /* default */ "0", "The start block height."},
+                    {"end", RPCArg::Type::NUM, /* default */ "0", "The end block height."},
+                },
+                RPCResult{
+            "[\n"
+            "  {\n"
+            "    \"txid\"  (string) The output txid\n"
+            "    \"n\"  (number) The output index\n"
+            "    \"type\"  (string) blind or anon\n"
+            "    \"height\"  (number) The block height\n"
+            "    \"blockindex\"  (number) The index of the transaction in the block\n"
+            "    \"pubkey\"  (string) The destination public key of the output\n"
+            "  }\n"
+            "]\n"
+                },
+                RPCExamples{
+            HelpExampleCli("getstealthwatchoutputs", "\"stealthaddress\"") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("getstealthwatchoutputs", "\"stealthaddress\"")
+                },
+        }.Check(request);
+
+    CStealthAddress sx = GetWatchedStealthAddress(request.params[0]);
+    CKeyID scanId = CPubKey(sx.scan_pubkey).GetID();
+    if (!g_stealth_index->HaveWatch(scanId)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Stealth address is not watched");
+    }
+
+    int start = request.params[1].isNull() ? 0 : request.params[1].get_int();
+    int end = request.params[2].isNull() ? 0 : request.params[2].get_int();
+    if (end > 0 && end < start) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "End value is expected to be greater than start");
+    }
+
+    g_stealth_index->BlockUntilSyncedToCurrentChain();
+
+    std::vector<std::pair<CStealthIndexKey, CStealthIndexValue> > outputs;
+    if (!g_stealth_index->ReadOutputs(scanId, outputs, start, end)) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read outputs");
+    }
+
+    UniValue result(UniValue::VARR);
+    for (const auto &output : outputs) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("txid", output.first.txhash.GetHex());
+        entry.pushKV("n", (int)output.first.n);
+        entry.pushKV("type", output.second.nType == OUTPUT_RINGCT ? "anon" : "blind");
+        entry.pushKV("height", output.first.blockHeight);
+        entry.pushKV("blockindex", (int)output.first.txindex);
+        entry.pushKV("pubkey", HexStr(output.second.pkDest));
+        result.push_back(entry);
+    }
+
+    return result;
+}
+
 UniValue getindexinfo(const JSONRPCRequest& request)
 {
             RPCHelpMan{"getindexinfo",
@@ -1288,6 +1647,7 @@ UniValue getindexinfo(const JSONRPCRequest& request)
             "  \"spentindex\":  xxx         (bool) Is the spentindex enabled.\n"
             "  \"timestampindex\":  xxx     (bool) Is the timestampindex enabled.\n"
             "  \"coldstakeindex\":  xxx     (bool) Is the coldstakeindex enabled.\n"
+            "  \"stealthindex\":  xxx       (bool) Is the stealthindex enabled.\n"
             "}\n"
                 },
                 RPCExamples{
@@ -1304,6 +1664,7 @@ UniValue getindexinfo(const JSONRPCRequest& request)
     ret.pushKV("spentindex", fSpentIndex);
     ret.pushKV("timestampindex", fTimestampIndex);
     ret.pushKV("coldstakeindex", (bool) (g_txindex && g_txindex->m_cs_index));
+    ret.pushKV("stealthindex", (bool) g_stealth_index);
 
     return ret;
 }
@@ -1327,6 +1688,11 @@ static const CRPCCommand commands[] =
 
     { "csindex",            "listcoldstakeunspent",   &listcoldstakeunspent,   {"stakeaddress","height","options"} },
 
+    { "stealthindex",       "addstealthwatch",        &addstealthwatch,        {"address","scan_secret","rescan_from"} },
+    { "stealthindex",       "removestealthwatch",     &removestealthwatch,     {"address"} },
+    { "stealthindex",       "liststealthwatches",     &liststealthwatches,     {} },
+    { "stealthindex",       "getstealthwatchoutputs", &getstealthwatchoutputs, {"address","start","end"} },
+
     { "blockchain",         "getindexinfo",           &getindexinfo,           {} },
 };
 
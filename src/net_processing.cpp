@@ -2790,8 +2790,18 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         LOCK2(cs_main, g_cs_orphans);
 
-        bool fMissingInputs = false;
+        // Verify rangeproofs of new blinded transactions with cs_main released, AcceptToMemoryPool then skips them.
+        // Resending known or rejected transactions costs no proof checks.
         CValidationState state;
+        if (HasBlindedOutputs(tx) && !AlreadyHave(inv)) {
+            LEAVE_CRITICAL_SECTION(g_cs_orphans);
+            LEAVE_CRITICAL_SECTION(cs_main);
+            PreVerifyBlindedTransaction(tx, state);
+            ENTER_CRITICAL_SECTION(cs_main);
+            ENTER_CRITICAL_SECTION(g_cs_orphans);
+        }
+
+        bool fMissingInputs = false;
 
         CNodeState* nodestate = State(pfrom->GetId());
         nodestate->m_tx_download.m_tx_announced.erase(inv.hash);
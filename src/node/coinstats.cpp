@@ -10,13 +10,14 @@
 #include <chain.h>
 #include <hash.h>
 #include <serialize.h>
+#include <shutdown.h>
 #include <validation.h>
 #include <uint256.h>
 #include <util/system.h>
 
+#include <atomic>
 #include <map>
-
-#include <boost/thread.hpp>
+#include <thread>
 
 
 static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
@@ -50,39 +51,118 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
     ss << VARINT(0u);
 }
 
+bool ScanUTXOSet(CCoinsView *view, uint256 &hashBlock, const std::function<bool(size_t nRange, const COutPoint &key, Coin &&coin)> &fn)
+{
+    // Cursors are created together, the coins database is only written while holding cs_main
+    std::vector<std::unique_ptr<CCoinsViewCursor> > cursors;
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < UTXO_SCAN_RANGES; ++i) {
+            uint256 hashFrom;
+            *hashFrom.begin() = (i * 256 + UTXO_SCAN_RANGES - 1) / UTXO_SCAN_RANGES;
+            std::unique_ptr<CCoinsViewCursor> pcursor(view->CursorAt(hashFrom));
+            if (!pcursor) {
+                // Scan all ranges with one cursor
+                cursors.clear();
+                cursors.emplace_back(view->Cursor());
+                break;
+            }
+            cursors.push_back(std::move(pcursor));
+        }
+    }
+    assert(cursors[0]);
+    hashBlock = cursors[0]->GetBestBlock();
+
+    std::atomic<size_t> nNextRange{0};
+    std::atomic<bool> fFailed{false};
+    auto worker = [&]() {
+        try {
+            size_t i;
+            while (!fFailed && (i = nNextRange++) < cursors.size()) {
+                CCoinsViewCursor *pcursor = cursors[i].get();
+                size_t nEndRange = cursors.size() > 1 ? i + 1 : UTXO_SCAN_RANGES;
+                for (; pcursor->Valid(); pcursor->Next()) {
+                    if (fFailed || ShutdownRequested()) {
+                        fFailed = true;
+                        return;
+                    }
+                    COutPoint key;
+                    Coin coin;
+                    if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                        LogPrintf("%s: unable to read value\n", __func__);
+                        fFailed = true;
+                        return;
+                    }
+                    size_t nRange = GetUTXOScanRange(key.hash);
+                    if (nRange >= nEndRange) {
+                        break;
+                    }
+                    if (!fn(nRange, key, std::move(coin))) {
+                        fFailed = true;
+                        return;
+                    }
+                }
+            }
+        } catch (const std::exception &e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            fFailed = true;
+        }
+    };
+
+    size_t nThreads = std::min(cursors.size(), (size_t)std::max(GetNumCores(), 1));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nThreads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    return !fFailed;
+}
+
 //! Calculate statistics about the unspent transaction output set
 bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
+    struct RangeStats {
+        CCoinsStats stats;
+        CHashWriter ss{SER_GETHASH, PROTOCOL_VERSION};
+        uint256 prevkey;
+        std::map<uint32_t, Coin> outputs;
+    };
+    std::vector<RangeStats> ranges(UTXO_SCAN_RANGES);
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
+    bool fScanned = ScanUTXOSet(view, stats.hashBlock, [&ranges](size_t nRange, const COutPoint &key, Coin &&coin) {
+        RangeStats &range = ranges[nRange];
+        if (!range.outputs.empty() && key.hash != range.prevkey) {
+            ApplyStats(range.stats, range.ss, range.prevkey, range.outputs);
+            range.outputs.clear();
+        }
+        range.prevkey = key.hash;
+        range.outputs[key.n] = std::move(coin);
+        return true;
+    });
+    if (!fScanned) {
+        return error("%s: unable to read UTXO set", __func__);
+    }
     {
         LOCK(cs_main);
         stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
     }
+
+    // The hash commits to the hash of each range in key order
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
+    for (auto &range : ranges) {
+        if (!range.outputs.empty()) {
+            ApplyStats(range.stats, range.ss, range.prevkey, range.outputs);
         }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+        ss << range.ss.GetHash();
+        stats.nTransactions += range.stats.nTransactions;
+        stats.nTransactionOutputs += range.stats.nTransactionOutputs;
+        stats.nBlindTransactionOutputs += range.stats.nBlindTransactionOutputs;
+        stats.nTotalAmount += range.stats.nTotalAmount;
+        stats.nBogoSize += range.stats.nBogoSize;
     }
     stats.hashSerialized = ss.GetHash();
     stats.nDiskSize = view->EstimateSize();
@@ -10,8 +10,14 @@
 #include <uint256.h>
 
 #include <cstdint>
+#include <functional>
 
 class CCoinsView;
+class COutPoint;
+class Coin;
+
+//! Number of txid ranges ScanUTXOSet splits the UTXO set into, results kept per range don't depend on the number of threads
+static constexpr size_t UTXO_SCAN_RANGES = 16;
 
 struct CCoinsStats
 {
@@ -28,6 +34,16 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0), nBlindTransactionOutputs(0) {}
 };
 
+//! Range of the UTXO set the coins of txid hash are in
+inline size_t GetUTXOScanRange(const uint256 &hash) { return *hash.begin() * UTXO_SCAN_RANGES / 256; }
+
+/**
+ * Visit every coin of view, the ranges of the UTXO set are scanned on parallel threads.
+ * fn is called with the range of the coin, the coins of a range are visited in key order on a single thread.
+ * Stops when fn returns false. hashBlock is set to the best block of the coins scanned.
+ */
+bool ScanUTXOSet(CCoinsView *view, uint256 &hashBlock, const std::function<bool(size_t nRange, const COutPoint &key, Coin &&coin)> &fn);
+
 //! Calculate statistics about the unspent transaction output set
 bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats);
 
@@ -24,6 +24,12 @@ TransactionError BroadcastTransaction(const CTransactionRef tx, std::string& err
     uint256 hashTx = tx->GetHash();
     bool callback_set = false;
 
+    // Verify rangeproofs of blinded transactions before taking cs_main
+    CValidationState state;
+    if (!mempool.exists(hashTx)) {
+        PreVerifyBlindedTransaction(*tx, state);
+    }
+
     { // cs_main scope
     LOCK(cs_main);
     // If the transaction is already confirmed in the chain, don't do anything
@@ -37,7 +43,6 @@ TransactionError BroadcastTransaction(const CTransactionRef tx, std::string& err
     }
     if (!mempool.exists(hashTx)) {
         // Transaction is not already in the mempool. Submit it.
-        CValidationState state;
         bool fMissingInputs;
         if (!AcceptToMemoryPool(mempool, state, std::move(tx), &fMissingInputs,
                 nullptr /* plTxnReplaced */, false /* bypass_limits */, max_tx_fee)) {
@@ -10,6 +10,7 @@
 #include <serialize.h>
 #include <streams.h>
 #include <hash.h>
+#include <crypto/common.h>
 #include <util/system.h>
 #include <script/interpreter.h>
 #include <script/script.h>
@@ -18,6 +19,7 @@
 #include <coins.h>
 #include <insight/insight.h>
 #include <txmempool.h>
+#include <undo.h>
 
 /**
  * Stake Modifier (hash modifier of proof-of-stake):
@@ -89,10 +91,10 @@ bool CheckStakeKernelHash(const CBlockIndex *pindexPrev,
     int nStakeModifierHeight = pindexPrev->nHeight;
     int64_t nStakeModifierTime = pindexPrev->nTime;
 
-    CDataStream ss(SER_GETHASH, 0);
+    CHashWriter ss(SER_GETHASH, 0);
     ss << bnStakeModifier;
     ss << nBlockFromTime << prevout.hash << prevout.n << nTime;
-    hashProofOfStake = Hash(ss.begin(), ss.end());
+    hashProofOfStake = ss.GetHash();
 
     if (fPrintProofOfStake) {
         LogPrintf("%s: using modifier=%s at height=%d timestamp=%s\n",
@@ -181,12 +183,103 @@ static bool CheckAge(const CBlockIndex *pindexTip, const uint256 &hashKernelBloc
 }
 
 int MAX_REORG_DEPTH = 1024;
+CStakeKernelCache g_stake_kernel_cache;
+
+void CStakeKernelCache::ConnectBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex)
+{
+    if (!m_tip || m_tip != pindex->pprev) {
+        Clear();
+        m_lowest_height = pindex->nHeight;
+    }
+
+    std::vector<COutPoint> &vSpent = m_spent_by_height[pindex->nHeight];
+    size_t nTxUndo = 0;
+    for (const auto &tx : block.vtx) {
+        if (tx->IsCoinBase()) {
+            continue;
+        }
+        if (nTxUndo >= blockundo.vtxundo.size()) {
+            Clear();
+            return;
+        }
+        const CTxUndo &txundo = blockundo.vtxundo[nTxUndo++];
+        size_t nPrevout = 0;
+        for (const auto &txin : tx->vin) {
+            if (txin.IsAnonInput()) {
+                continue;
+            }
+            if (nPrevout >= txundo.vprevout.size()) {
+                Clear();
+                return;
+            }
+            const Coin &coin = txundo.vprevout[nPrevout++];
+            if (coin.nType != OUTPUT_STANDARD) {
+                continue;
+            }
+            m_spent[txin.prevout] = SpentKernel{coin.out.nValue, (int)coin.nHeight, pindex->nHeight, coin.out.scriptPubKey};
+            vSpent.push_back(txin.prevout);
+        }
+    }
+    m_tip = pindex;
+
+    // Spends deeper than MAX_REORG_DEPTH make the output invalid as a kernel
+    int nEvictBelow = pindex->nHeight - MAX_REORG_DEPTH + 1;
+    while (!m_spent_by_height.empty() && m_spent_by_height.begin()->first < nEvictBelow) {
+        for (const auto &prevout : m_spent_by_height.begin()->second) {
+            m_spent.erase(prevout);
+        }
+        m_spent_by_height.erase(m_spent_by_height.begin());
+    }
+    m_lowest_height = std::max(m_lowest_height, nEvictBelow);
+};
+
+void CStakeKernelCache::DisconnectBlock(const CBlockIndex *pindex)
+{
+    if (!m_tip || m_tip != pindex
+        || pindex->nHeight <= m_lowest_height) {
+        Clear();
+        return;
+    }
+
+    auto it = m_spent_by_height.find(pindex->nHeight);
+    if (it != m_spent_by_height.end()) {
+        for (const auto &prevout : it->second) {
+            m_spent.erase(prevout);
+        }
+        m_spent_by_height.erase(it);
+    }
+    m_tip = pindex->pprev;
+};
+
+void CStakeKernelCache::Clear()
+{
+    m_tip = nullptr;
+    m_lowest_height = 0;
+    m_spent.clear();
+    m_spent_by_height.clear();
+};
+
+int CStakeKernelCache::GetLowestHeight(const CBlockIndex *pindexTip) const
+{
+    if (!m_tip || m_tip != pindexTip) {
+        return -1;
+    }
+    return m_lowest_height;
+};
+
+const CStakeKernelCache::SpentKernel *CStakeKernelCache::GetSpent(const COutPoint &prevout) const
+{
+    auto it = m_spent.find(prevout);
+    return it == m_spent.end() ? nullptr : &it->second;
+};
+
 static bool SpendTooDeep(const COutPoint &prevout) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     LogPrint(BCLog::POS, "%s: SpendTooDeep %s.\n", __func__, prevout.ToString());
     CBlockIndex *pindexTip = ::ChainActive().Tip();
 
-    if (fSpentIndex) {
+    // The asynchronous insight index can lag the tip, only the block tree spent index is known to be current
+    if (fLegacySpentIndex) {
         CSpentIndexKey key(prevout.hash, prevout.n);
         CSpentIndexValue value;
         if (GetSpentIndex(key, value)) {
@@ -197,24 +290,20 @@ static bool SpendTooDeep(const COutPoint &prevout) EXCLUSIVE_LOCKS_REQUIRED(cs_m
         return true;
     }
 
+    // Spends in the blocks from nLowestCached to the tip are in the kernel cache
+    int nLowestCached = g_stake_kernel_cache.GetLowestHeight(pindexTip);
+    const CStakeKernelCache::SpentKernel *pspent;
+    if (nLowestCached >= 0 && (pspent = g_stake_kernel_cache.GetSpent(prevout))) {
+        return pindexTip->nHeight - pspent->nSpendHeight >= MAX_REORG_DEPTH;
+    }
+
     // Check for spend in mempool
-    {
-        LOCK(::mempool.cs);
-        auto iters = ::mempool.GetSortedDepthAndScore();
-        for (auto it : iters) {
-            for (const CTxIn &txin : it->GetSharedTx()->vin) {
-                if (txin.IsAnonInput()) {
-                    continue;
-                }
-                if (txin.prevout == prevout) {
-                    return false;
-                }
-            }
-        }
+    if (::mempool.isSpent(prevout)) {
+        return false;
     }
 
     // Check for spend in blocks
-    CBlockIndex *pindex = pindexTip;
+    CBlockIndex *pindex = nLowestCached >= 0 ? ::ChainActive()[nLowestCached - 1] : pindexTip;
     CBlock block;
     while (pindex && pindexTip->nHeight - pindex->nHeight < MAX_REORG_DEPTH) {
         if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), Params().GetConsensus())) {
@@ -261,23 +350,38 @@ bool CheckProofOfStake(CValidationState &state, const CBlockIndex *pindexPrev, c
 
     Coin coin;
     if (!::ChainstateActive().CoinsTip().GetCoin(txin.prevout, coin) || coin.IsSpent()) {
-        // Find the prevout in the txdb / blocks
+        const CStakeKernelCache::SpentKernel *pspent = nullptr;
+        const CBlockIndex *pindexKernel = nullptr;
+        if (g_stake_kernel_cache.GetLowestHeight(::ChainActive().Tip()) >= 0
+            && (pspent = g_stake_kernel_cache.GetSpent(txin.prevout))
+            && (pindexKernel = ::ChainActive()[pspent->nHeight])) {
+            // Spent recently in the active chain
+            hashBlock = pindexKernel->GetBlockHash();
+            kernelPubKey = pspent->scriptPubKey;
+            amount = pspent->nValue;
+            nBlockFromTime = pindexKernel->nTime;
+        } else {
+            // Find the prevout in the txdb / blocks
+            CBlock blockKernel; // block containing stake kernel, GetTransaction should only fill the header.
+            if (!GetTransaction(txin.prevout.hash, txPrev, Params().GetConsensus(), blockKernel)
+                || txin.prevout.n >= txPrev->vpout.size()) {
+                return state.Invalid(ValidationInvalidReason::DOS_20, error("%s: prevout-not-in-chain", __func__), REJECT_INVALID, "prevout-not-in-chain");
+            }
 
-        CBlock blockKernel; // block containing stake kernel, GetTransaction should only fill the header.
-        if (!GetTransaction(txin.prevout.hash, txPrev, Params().GetConsensus(), blockKernel)
-            || txin.prevout.n >= txPrev->vpout.size()) {
-            return state.Invalid(ValidationInvalidReason::DOS_20, error("%s: prevout-not-in-chain", __func__), REJECT_INVALID, "prevout-not-in-chain");
-        }
+            const CTxOutBase *outPrev = txPrev->vpout[txin.prevout.n].get();
+            if (!outPrev->IsStandardOutput()) {
+                return state.Invalid(ValidationInvalidReason::DOS_100, error("%s: invalid-prevout", __func__), REJECT_INVALID, "invalid-prevout");
+            }
 
-        const CTxOutBase *outPrev = txPrev->vpout[txin.prevout.n].get();
-        if (!outPrev->IsStandardOutput()) {
-            return state.Invalid(ValidationInvalidReason::DOS_100, error("%s: invalid-prevout", __func__), REJECT_INVALID, "invalid-prevout");
-        }
+            hashBlock = blockKernel.GetHash();
+            BlockMap::iterator mi = ::BlockIndex().find(hashBlock);
+            if (mi == ::BlockIndex().end() || !::ChainActive().Contains(mi->second)) {
+                return state.Invalid(ValidationInvalidReason::DOS_20, error("%s: prevout-not-in-chain", __func__), REJECT_INVALID, "prevout-not-in-chain");
+            }
 
-        hashBlock = blockKernel.GetHash();
-        BlockMap::iterator mi = ::BlockIndex().find(hashBlock);
-        if (mi == ::BlockIndex().end() || !::ChainActive().Contains(mi->second)) {
-            return state.Invalid(ValidationInvalidReason::DOS_20, error("%s: prevout-not-in-chain", __func__), REJECT_INVALID, "prevout-not-in-chain");
+            kernelPubKey = *outPrev->GetPScriptPubKey();
+            amount = outPrev->GetValue();
+            nBlockFromTime = blockKernel.nTime;
         }
 
         int nDepth;
@@ -289,9 +393,6 @@ bool CheckProofOfStake(CValidationState &state, const CBlockIndex *pindexPrev, c
             return state.Invalid(ValidationInvalidReason::DOS_100, error("%s: Tried to stake spent kernel", __func__), REJECT_INVALID, "invalid-prevout");
         }
 
-        kernelPubKey = *outPrev->GetPScriptPubKey();
-        amount = outPrev->GetValue();
-        nBlockFromTime = blockKernel.nTime;
         state.nFlags |= BLOCK_STAKE_KERNEL_SPENT;
     } else {
         if (coin.nType != OUTPUT_STANDARD) {
@@ -438,3 +539,75 @@ bool CheckKernel(const CBlockIndex *pindexPrev, unsigned int nBits, int64_t nTim
         amount, prevout, nTime, hashProofOfStake, targetProofOfStake);
 }
 
+
+bool CStakeKernelSearch::Init(const CBlockIndex *pindexPrev, uint32_t nBits)
+{
+    static std::atomic<uint64_t> nLastId{0};
+    Clear();
+    m_id = ++nLastId;
+
+    bool fNegative;
+    bool fOverflow;
+    m_target.SetCompact(nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || m_target == 0) {
+        return error("%s: SetCompact failed.", __func__);
+    }
+
+    m_pindex_prev = pindexPrev;
+    m_bits = nBits;
+    return true;
+}
+
+void CStakeKernelSearch::Clear()
+{
+    m_pindex_prev = nullptr;
+    m_bits = 0;
+    m_coins.clear(); // Keeps capacity for the next snapshot
+}
+
+void CStakeKernelSearch::AddCoin(const COutPoint &prevout, CAmount nValue, uint32_t nBlockFromTime)
+{
+    assert(m_pindex_prev);
+    m_coins.emplace_back();
+    KernelCoin &coin = m_coins.back();
+
+    // Same serialisation as CheckStakeKernelHash, nTime is appended in CheckCoin
+    uint8_t data[4];
+    coin.midstate.Write(m_pindex_prev->bnStakeModifier.begin(), 32);
+    WriteLE32(data, nBlockFromTime);
+    coin.midstate.Write(data, 4);
+    coin.midstate.Write(prevout.hash.begin(), 32);
+    WriteLE32(data, prevout.n);
+    coin.midstate.Write(data, 4);
+
+    coin.target = m_target * arith_uint256(nValue);
+    coin.prevout = prevout;
+    coin.nBlockFromTime = nBlockFromTime;
+}
+
+bool CStakeKernelSearch::CheckCoin(size_t i, uint32_t nTime, uint256 &hashProofOfStake) const
+{
+    const KernelCoin &coin = m_coins[i];
+    if (nTime < coin.nBlockFromTime) {
+        return false;
+    }
+
+    uint8_t data[4];
+    WriteLE32(data, nTime);
+    uint256 hash;
+    CSHA256(coin.midstate).Write(data, 4).Finalize(hash.begin());
+    CSHA256().Write(hash.begin(), 32).Finalize(hashProofOfStake.begin());
+
+    return UintToArith256(hashProofOfStake) <= coin.target;
+}
+
+int CStakeKernelSearch::Search(uint32_t nTime, size_t nStart) const
+{
+    uint256 hashProofOfStake;
+    for (size_t i = nStart; i < m_coins.size(); ++i) {
+        if (CheckCoin(i, nTime, hashProofOfStake)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
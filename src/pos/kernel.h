@@ -8,7 +8,14 @@
 #define PARTICL_POS_KERNEL_H
 
 #include <validation.h>
+#include <arith_uint256.h>
+#include <crypto/sha256.h>
 
+#include <map>
+
+class CBlockUndo;
+
+extern int MAX_REORG_DEPTH;
 
 // Compute the hash modifier for proof-of-stake
 uint256 ComputeStakeModifierV2(const CBlockIndex *pindexPrev, const uint256 &kernel);
@@ -46,4 +53,82 @@ bool CheckCoinStakeTimestamp(int nHeight, int64_t nTimeBlock);
  */
 bool CheckKernel(const CBlockIndex *pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint &prevout, int64_t* pBlockTime = nullptr);
 
+/**
+ * Kernel search over a snapshot of stakeable coins
+ * The part of the kernel hash that doesn't depend on nTime is hashed once per coin when the coin is added,
+ * searching a timestamp slot only completes the hash for each coin, without locks or allocations.
+ * Must be rebuilt when the tip or the set of coins changes.
+ */
+class CStakeKernelSearch
+{
+public:
+    /** Clear the coins and set the tip and difficulty kernels are checked against. */
+    bool Init(const CBlockIndex *pindexPrev, uint32_t nBits);
+    void Clear();
+
+    void AddCoin(const COutPoint &prevout, CAmount nValue, uint32_t nBlockFromTime);
+
+    /** Return the index of the first coin from nStart that meets the target at nTime, -1 if none. */
+    int Search(uint32_t nTime, size_t nStart = 0) const;
+    bool CheckCoin(size_t i, uint32_t nTime, uint256 &hashProofOfStake) const;
+
+    /** Unique for each Init, to tell a rebuilt snapshot from the previous one. */
+    uint64_t GetId() const { return m_id; };
+    const CBlockIndex *GetTip() const { return m_pindex_prev; };
+    uint32_t GetBits() const { return m_bits; };
+    size_t Size() const { return m_coins.size(); };
+    const COutPoint &GetPrevout(size_t i) const { return m_coins[i].prevout; };
+
+private:
+    struct KernelCoin
+    {
+        CSHA256 midstate;       // stake modifier, block time, prevout
+        arith_uint256 target;   // target weighted by the coin value
+        COutPoint prevout;
+        uint32_t nBlockFromTime;
+    };
+
+    uint64_t m_id = 0;
+    const CBlockIndex *m_pindex_prev = nullptr;
+    uint32_t m_bits = 0;
+    arith_uint256 m_target;
+    std::vector<KernelCoin> m_coins;
+};
+
+/**
+ * Standard outputs spent in the last MAX_REORG_DEPTH blocks of the active chain,
+ * with what is needed to check them as the kernel of a coinstake.
+ * Kernels spent within reorg depth are still valid, the cache saves reading the kernel transaction
+ * and scanning the recent blocks for the spend.
+ * Only trusted when updated up to the current tip, a block connected out of sequence resets it.
+ */
+class CStakeKernelCache
+{
+public:
+    struct SpentKernel
+    {
+        CAmount nValue;
+        int nHeight;            // height of the block containing the output
+        int nSpendHeight;       // height of the block spending the output
+        CScript scriptPubKey;
+    };
+
+    void ConnectBlock(const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    void DisconnectBlock(const CBlockIndex *pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    void Clear() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Height of the lowest block with spends recorded, -1 if the cache isn't up to pindexTip. */
+    int GetLowestHeight(const CBlockIndex *pindexTip) const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    const SpentKernel *GetSpent(const COutPoint &prevout) const EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    size_t Size() const EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return m_spent.size(); };
+
+private:
+    const CBlockIndex *m_tip = nullptr;
+    int m_lowest_height = 0;
+    std::map<COutPoint, SpentKernel> m_spent;
+    std::map<int, std::vector<COutPoint> > m_spent_by_height;
+};
+
+extern CStakeKernelCache g_stake_kernel_cache;
+
 #endif // PARTICL_POS_KERNEL_H
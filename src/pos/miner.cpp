@@ -6,6 +6,7 @@
 #include <pos/miner.h>
 
 #include <pos/kernel.h>
+#include <pos/diffalgo.h>
 #include <miner.h>
 #include <chainparams.h>
 #include <util/moneystr.h>
@@ -23,6 +24,8 @@
 
 typedef CWallet* CWalletRef;
 std::vector<StakeThread*> vStakeThreads;
+StakeSearchPool g_stake_search_pool;
+StakeBlockTemplateCache g_stake_template;
 
 void StakeThread::condWaitFor(int ms)
 {
@@ -212,6 +215,301 @@ bool ImportOutputs(CBlockTemplate *pblocktemplate, int nHeight)
     return true;
 };
 
+void StakeSearchPool::Start(size_t nThreads)
+{
+    Stop();
+
+    nThreads = std::max(nThreads, (size_t)1);
+    m_stop = false;
+    m_queues.clear();
+    for (size_t i = 0; i < nThreads; ++i) {
+        m_queues.emplace_back(new Queue());
+    }
+    for (size_t i = 0; i < nThreads - 1; ++i) {
+        std::string sName = strprintf("stakesearch%d", i);
+        m_threads.emplace_back(&TraceThread<std::function<void()> >, sName.c_str(), std::function<void()>(std::bind(&StakeSearchPool::ThreadWorker, this, i)));
+    }
+};
+
+void StakeSearchPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_cond_work.notify_all();
+    for (auto &t : m_threads) {
+        t.join();
+    }
+    m_threads.clear();
+};
+
+bool StakeSearchPool::TakeChunk(size_t nWorker, Chunk &chunk)
+{
+    {
+        Queue &q = *m_queues[nWorker];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.chunks.empty()) {
+            chunk = q.chunks.front();
+            q.chunks.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < m_queues.size(); ++i) {
+        Queue &q = *m_queues[(nWorker + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.chunks.empty()) {
+            chunk = q.chunks.back();
+            q.chunks.pop_back();
+            return true;
+        }
+    }
+    return false;
+};
+
+void StakeSearchPool::RunChunks(size_t nWorker)
+{
+    Chunk chunk;
+    uint256 hashProofOfStake;
+    while (!m_found.load(std::memory_order_relaxed)
+        && !fStopMinerProc
+        && TakeChunk(nWorker, chunk)) {
+        const CStakeKernelSearch *search = (*m_search)[chunk.nSearch];
+        for (size_t i = chunk.nBegin; i < chunk.nEnd; ++i) {
+            if (!search->CheckCoin(i, m_time, hashProofOfStake)) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_found) {
+                m_found = true;
+                m_found_search = chunk.nSearch;
+                m_found_kernel = i;
+            }
+            break;
+        }
+    }
+};
+
+void StakeSearchPool::ThreadWorker(size_t nWorker)
+{
+    uint64_t nGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond_work.wait(lock, [&] { return m_stop || m_generation != nGeneration; });
+            if (m_stop) {
+                return;
+            }
+            nGeneration = m_generation;
+        }
+
+        RunChunks(nWorker);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_active--;
+        }
+        m_cond_done.notify_all();
+    }
+};
+
+int StakeSearchPool::Search(const std::vector<const CStakeKernelSearch*> &vSearch, uint32_t nTime, size_t &nKernel)
+{
+    std::lock_guard<std::mutex> search_lock(m_search_mtx);
+    if (m_queues.empty()) {
+        Start(1);
+    }
+
+    size_t nQueue = 0;
+    for (size_t s = 0; s < vSearch.size(); ++s) {
+        for (size_t i = 0; i < vSearch[s]->Size(); i += CHUNK_SIZE) {
+            Chunk chunk{s, i, std::min(i + CHUNK_SIZE, vSearch[s]->Size())};
+            Queue &q = *m_queues[nQueue++ % m_queues.size()];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            q.chunks.push_back(chunk);
+        }
+    }
+
+    // A single chunk is searched by this thread alone
+    bool fWakeWorkers = m_threads.size() > 0 && nQueue > 1;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_search = &vSearch;
+        m_time = nTime;
+        m_found = false;
+        m_found_search = -1;
+        if (fWakeWorkers) {
+            m_active = m_threads.size();
+            m_generation++;
+        }
+    }
+    if (fWakeWorkers) {
+        m_cond_work.notify_all();
+    }
+
+    RunChunks(m_queues.size() - 1);
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_cond_done.wait(lock, [&] { return m_active == 0; });
+
+    for (auto &q : m_queues) { // Chunks left after a kernel was found
+        std::lock_guard<std::mutex> queue_lock(q->mtx);
+        q->chunks.clear();
+    }
+    m_search = nullptr;
+
+    nKernel = m_found_kernel;
+    return m_found_search;
+};
+
+bool StakeLookahead::Update(const CBlockIndex *pindexPrev_, uint32_t nBits_, const std::vector<uint64_t> &vSnapshotIds_, int64_t nSearchTime)
+{
+    if (pindexPrev != pindexPrev_
+        || nBits != nBits_
+        || vSnapshotIds != vSnapshotIds_) {
+        pindexPrev = pindexPrev_;
+        nBits = nBits_;
+        vSnapshotIds = vSnapshotIds_;
+        nSearchedTo = nSearchTime;
+        vWins.clear();
+        pblocktemplate.reset();
+        nBuiltTime = 0;
+        return true;
+    }
+
+    while (!vWins.empty() && vWins.front().nTime < nSearchTime) {
+        if (nBuiltTime == vWins.front().nTime) { // Slot missed
+            pblocktemplate.reset();
+            nBuiltTime = 0;
+        }
+        vWins.pop_front();
+    }
+    return false;
+};
+
+void StakeLookahead::Search(StakeSearchPool &pool, const std::vector<CHDWallet*> &vWallets, const std::vector<const CStakeKernelSearch*> &vSearch, int64_t nHorizon, int64_t nSlotLen)
+{
+    assert(vWallets.size() == vSearch.size() && vSearch.size() == vSnapshotIds.size());
+    for (; nSearchedTo < nHorizon && !fStopMinerProc; nSearchedTo += nSlotLen) {
+        size_t nKernel = 0;
+        int nFound = pool.Search(vSearch, nSearchedTo, nKernel);
+        if (nFound >= 0) {
+            vWins.push_back(StakeSlotWin{nSearchedTo, vWallets[nFound], nKernel, vSnapshotIds[nFound]});
+            LogPrint(BCLog::POS, "%s: Wallet %s has a kernel at %d.\n", __func__, vWallets[nFound]->GetName(), nSearchedTo);
+        }
+    }
+};
+
+bool StakeLookahead::SignNext(std::unique_ptr<CBlockTemplate> pblocktemplate_, int nHeight)
+{
+    assert(!vWins.empty());
+    const StakeSlotWin &win = vWins.front();
+    if (pblocktemplate_
+        && win.pwallet->SignBlock(pblocktemplate_.get(), nHeight, win.nTime, win.nKernel, win.nSnapshotId)) {
+        pblocktemplate = std::move(pblocktemplate_);
+        nBuiltTime = win.nTime;
+        return true;
+    }
+    pblocktemplate.reset();
+    nBuiltTime = 0;
+    vWins.pop_front();
+    return false;
+};
+
+int64_t StakeLookahead::GetWakeTime(int64_t nSearchTime, int64_t nSlotLen) const
+{
+    // Search ahead again from the last slot searched
+    int64_t nWakeTime = std::max(nSearchedTo - nSlotLen, nSearchTime + nSlotLen);
+    if (!vWins.empty()) {
+        // Sign the block a slot early, submit it when the slot starts
+        const StakeSlotWin &win = vWins.front();
+        nWakeTime = std::min(nWakeTime, (pblocktemplate && nBuiltTime == win.nTime) ? win.nTime : win.nTime - nSlotLen);
+    }
+    return nWakeTime;
+};
+
+bool StakeBlockTemplateCache::Build(const CBlockIndex *pindexPrev)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    m_stale = false;
+    m_tip = nullptr;
+    m_template = BlockAssembler(Params()).CreateNewBlock(CScript(), false);
+    if (!m_template) {
+        return error("%s: Couldn't create new block.", __func__);
+    }
+    if (m_template->block.hashPrevBlock != pindexPrev->GetBlockHash()) {
+        // Tip changed while building
+        m_template.reset();
+        return false;
+    }
+
+    int nHeight = pindexPrev->nHeight + 1;
+    if (nHeight <= (int)Params().GetLastImportHeight()
+        && !ImportOutputs(m_template.get(), nHeight)) {
+        m_template.reset();
+        return error("%s: ImportOutputs failed.", __func__);
+    }
+    m_tip = pindexPrev;
+
+    LogPrint(BCLog::POS, "%s: Height %d, %u txns, %.2fms\n", __func__,
+        nHeight, m_template->block.vtx.size(), (GetTimeMicros() - nTimeStart) * 0.001);
+    return true;
+};
+
+std::unique_ptr<CBlockTemplate> StakeBlockTemplateCache::Get(const CBlockIndex *pindexPrev, bool fRefresh)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if ((!m_template || m_tip != pindexPrev || (fRefresh && m_stale))
+        && !Build(pindexPrev)) {
+        return nullptr;
+    }
+    return MakeUnique<CBlockTemplate>(*m_template);
+};
+
+void StakeBlockTemplateCache::Refresh(const CBlockIndex *pindexPrev)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_template && m_tip == pindexPrev && !m_stale) {
+        return;
+    }
+    Build(pindexPrev);
+};
+
+void StakeBlockTemplateCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_template.reset();
+    m_tip = nullptr;
+    m_stale = true;
+};
+
+void StakeBlockTemplateCache::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    m_stale = true;
+    if (fInitialDownload || fStopMinerProc) {
+        return;
+    }
+
+    // The staking threads sleep until their next winning slot, wake them to search the new tip
+    for (auto t : vStakeThreads) {
+        {
+            std::lock_guard<std::mutex> lock(t->mtxMinerProc);
+            t->fWakeMinerProc = true;
+        }
+        t->condMinerProc.notify_all();
+    }
+};
+
+void StakeBlockTemplateCache::TransactionAddedToMempool(const CTransactionRef &ptxn)
+{
+    m_stale = true;
+};
+
+void StakeBlockTemplateCache::TransactionRemovedFromMempool(const CTransactionRef &ptx)
+{
+    m_stale = true;
+};
+
 void StartThreadStakeMiner()
 {
     nMinStakeInterval = gArgs.GetArg("-minstakeinterval", 0);
@@ -228,13 +526,22 @@ void StartThreadStakeMiner()
         }
         size_t nThreads = std::min(nWallets, (size_t)gArgs.GetArg("-stakingthreads", 1));
 
+        int nSearchThreads = gArgs.GetArg("-stakesearchthreads", 1);
+        if (nSearchThreads <= 0) {
+            nSearchThreads = GetNumCores();
+        }
+        g_stake_search_pool.Start(std::max(nSearchThreads, 1));
+        RegisterValidationInterface(&g_stake_template);
+
         size_t nPerThread = nWallets / nThreads;
         for (size_t i = 0; i < nThreads; ++i) {
             size_t nStart = nPerThread * i;
             size_t nEnd = (i == nThreads-1) ? nWallets : nPerThread * (i+1);
             StakeThread *t = new StakeThread();
             vStakeThreads.push_back(t);
-            GetParticlWallet(vpwallets[i].get())->nStakeThread = i;
+            for (size_t k = nStart; k < nEnd; ++k) {
+                GetParticlWallet(vpwallets[k].get())->nStakeThread = i;
+            }
             t->sName = strprintf("miner%d", i);
             t->thread = std::thread(&TraceThread<std::function<void()> >, t->sName.c_str(), std::function<void()>(std::bind(&ThreadStakeMiner, i, vpwallets, nStart, nEnd)));
         }
@@ -251,6 +558,7 @@ void StopThreadStakeMiner()
     }
     LogPrint(BCLog::POS, "StopThreadStakeMiner\n");
     fStopMinerProc = true;
+    UnregisterValidationInterface(&g_stake_template);
 
     for (auto t : vStakeThreads) {
         {
@@ -262,6 +570,8 @@ void StopThreadStakeMiner()
         delete t;
     }
     vStakeThreads.clear();
+    g_stake_search_pool.Stop();
+    g_stake_template.Clear();
 };
 
 void WakeThreadStakeMiner(CHDWallet *pwallet)
@@ -299,18 +609,19 @@ void ThreadStakeMiner(size_t nThreadID, std::vector<std::shared_ptr<CWallet>> &v
 {
     LogPrintf("Starting staking thread %d, %d wallet%s.\n", nThreadID, nEnd - nStart, (nEnd - nStart) > 1 ? "s" : "");
 
+    const CBlockIndex *pindexBest;
     int nBestHeight; // TODO: set from new block signal?
     int64_t nBestTime;
     //Bypass peer connection check if we are on testnet or regtest
     bool fShouldBypasspeercheck = gArgs.GetBoolArg("-skippeerchecks",false);
-    int nLastImportHeight = Params().GetLastImportHeight();
+    int64_t nStakeLookahead = std::max(gArgs.GetArg("-stakelookahead", DEFAULT_STAKE_LOOKAHEAD), (int64_t)1);
+    StakeLookahead lookahead;
 
     if (!gArgs.GetBoolArg("-staking", true)) {
         LogPrint(BCLog::POS, "%s: -staking is false.\n", __func__);
         return;
     }
 
-    CScript coinbaseScript;
     while (!fStopMinerProc) {
         if (fReindex || fImporting || fBusyImporting) {
             fIsStaking = false;
@@ -322,8 +633,9 @@ void ThreadStakeMiner(size_t nThreadID, std::vector<std::shared_ptr<CWallet>> &v
         int num_blocks_of_peers, num_nodes;
         {
             LOCK(cs_main);
-            nBestHeight = ::ChainActive().Height();
-            nBestTime = ::ChainActive().Tip()->nTime;
+            pindexBest = ::ChainActive().Tip();
+            nBestHeight = pindexBest->nHeight;
+            nBestTime = pindexBest->nTime;
             num_blocks_of_peers = GetNumBlocksOfPeers();
             num_nodes = GetNumPeers();
         }
@@ -380,6 +692,7 @@ void ThreadStakeMiner(size_t nThreadID, std::vector<std::shared_ptr<CWallet>> &v
 
         size_t nWaitFor = 60000;
         CAmount reserve_balance;
+        std::vector<CHDWallet*> vStakeWallets;
         for (size_t i = nStart; i < nEnd; ++i) {
             auto pwallet = GetParticlWallet(vpwallets[i].get());
 
@@ -420,47 +733,95 @@ void ThreadStakeMiner(size_t nThreadID, std::vector<std::shared_ptr<CWallet>> &v
             }
 
             if (!pblocktemplate.get()) {
-                pblocktemplate = BlockAssembler(Params()).CreateNewBlock(coinbaseScript, false);
+                // Copy of the template refreshed while waiting, rebuilt here only for a new tip
+                pblocktemplate = g_stake_template.Get(pindexBest, false);
                 if (!pblocktemplate.get()) {
                     fIsStaking = false;
                     nWaitFor = std::min(nWaitFor, (size_t)nMinerSleep);
                     LogPrint(BCLog::POS, "%s: Couldn't create new block.\n", __func__);
                     continue;
                 }
-
-                if (nBestHeight + 1 <= nLastImportHeight
-                    && !ImportOutputs(pblocktemplate.get(), nBestHeight + 1)) {
-                    fIsStaking = false;
-                    nWaitFor = std::min(nWaitFor, (size_t)30000);
-                    LogPrint(BCLog::POS, "%s: ImportOutputs failed.\n", __func__);
-                    continue;
-                }
             }
 
             pwallet->m_is_staking = CHDWallet::IS_STAKING;
 
-            nWaitFor = nMinerSleep;
             fIsStaking = true;
-            if (pwallet->SignBlock(pblocktemplate.get(), nBestHeight + 1, nSearchTime)) {
-                CBlock *pblock = &pblocktemplate->block;
-                if (CheckStake(pblock)) {
-                     nTimeLastStake = GetTime();
-                     break;
+            vStakeWallets.push_back(pwallet);
+        }
+
+        if (vStakeWallets.size() > 0) {
+            // Search the coins of all wallets together, the block is signed by the wallet owning the kernel
+            const CBlockIndex *pindexPrev = pindexBest;
+            uint32_t nBits;
+            {
+                LOCK(cs_main);
+                nBits = GetNextTargetRequired(pindexPrev, &pblocktemplate->block);
+            }
+
+            std::vector<CHDWallet*> vSearchWallets;
+            std::vector<const CStakeKernelSearch*> vSearch;
+            std::vector<uint64_t> vSnapshotIds;
+            for (auto pwallet : vStakeWallets) {
+                if (pwallet->PrepareStakeSearch(pindexPrev, nBits, nSearchTime, nBestHeight + 1)) {
+                    vSearchWallets.push_back(pwallet);
+                    vSearch.push_back(&pwallet->GetStakeSearch());
+                    vSnapshotIds.push_back(pwallet->GetStakeSearch().GetId());
+                }
+            }
+
+            lookahead.Update(pindexPrev, nBits, vSnapshotIds, nSearchTime);
+
+            // Search the slots up to nStakeLookahead ahead that weren't searched yet for this tip
+            int64_t nSlotLen = nMask + 1;
+            lookahead.Search(g_stake_search_pool, vSearchWallets, vSearch, nSearchTime + nStakeLookahead * nSlotLen, nSlotLen);
+
+            CHDWallet *pwalletStaked = nullptr;
+            if (!lookahead.vWins.empty()) {
+                const StakeSlotWin &win = lookahead.vWins.front();
+                if (win.nTime == nSearchTime) {
+                    bool fStaked = false;
+                    if (lookahead.pblocktemplate && lookahead.nBuiltTime == win.nTime) {
+                        fStaked = CheckStake(&lookahead.pblocktemplate->block);
+                    } else
+                    if (win.pwallet->SignBlock(pblocktemplate.get(), nBestHeight + 1, nSearchTime, win.nKernel, win.nSnapshotId)) {
+                        fStaked = CheckStake(&pblocktemplate->block);
+                    }
+                    if (fStaked) {
+                        nTimeLastStake = GetTime();
+                        pwalletStaked = win.pwallet;
+                    }
+                    lookahead.pblocktemplate.reset();
+                    lookahead.vWins.pop_front();
+                } else
+                if (!lookahead.pblocktemplate && win.nTime - nTime <= nSlotLen) {
+                    // Sign the block of the next winning slot now, it is submitted as soon as the slot starts
+                    lookahead.SignNext(g_stake_template.Get(pindexPrev, true), nBestHeight + 1);
+                }
+            }
+            // Sleep until the next slot with work, a new tip wakes the thread
+            int64_t nWaitSlot = (lookahead.GetWakeTime(nSearchTime, nSlotLen) - GetAdjustedTime()) * 1000;
+            nWaitFor = std::min(nWaitFor, (size_t)std::max(nWaitSlot, (int64_t)0));
+
+            for (auto pwallet : vStakeWallets) {
+                if (pwallet == pwalletStaked) {
+                    continue;
                 }
-            } else {
                 int nRequiredDepth = std::min((int)(Params().GetStakeMinConfirmations() - 1), (int)(nBestHeight / 2));
                 LOCK(pwallet->cs_wallet);
+                pwallet->nLastCoinStakeSearchTime = std::max(pwallet->nLastCoinStakeSearchTime, nSearchTime);
                 if (pwallet->m_greatest_txn_depth < nRequiredDepth - 4) {
                     pwallet->m_is_staking = CHDWallet::NOT_STAKING_DEPTH;
                     size_t nSleep = (nRequiredDepth - pwallet->m_greatest_txn_depth) / 4;
                     nWaitFor = std::min(nWaitFor, (size_t)(nSleep * 1000));
                     pwallet->nLastCoinStakeSearchTime = nSearchTime + nSleep;
-                    LogPrint(BCLog::POS, "%s: Wallet %d, no outputs with required depth, sleeping for %ds.\n", __func__, i, nSleep);
-                    continue;
+                    LogPrint(BCLog::POS, "%s: Wallet %s, no outputs with required depth, sleeping for %ds.\n", __func__, pwallet->GetName(), nSleep);
                 }
             }
         }
 
+        if (fIsStaking) {
+            g_stake_template.Refresh(pindexBest);
+        }
         condWaitFor(nThreadID, nWaitFor);
     }
 };
@@ -5,15 +5,23 @@
 #ifndef PARTICL_POS_MINER_H
 #define PARTICL_POS_MINER_H
 
+#include <validationinterface.h>
+
 #include <thread>
 #include <condition_variable>
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 
 class CHDWallet;
 class CWallet;
 class CBlock;
+class CBlockIndex;
+class CStakeKernelSearch;
+struct CBlockTemplate;
 
 class StakeThread
 {
@@ -30,8 +38,135 @@ public:
 
 extern std::vector<StakeThread*> vStakeThreads;
 
+/**
+ * Kernel search of one timestamp slot over the coin snapshots of several wallets.
+ * The coins are split into chunks dealt evenly to the queues of the workers and the searching thread,
+ * a worker with an empty queue steals chunks from the back of the others.
+ * The first kernel found stops the search.
+ */
+class StakeSearchPool
+{
+public:
+    static const size_t CHUNK_SIZE = 512; // coins per chunk
+
+    ~StakeSearchPool() { Stop(); };
+
+    /** Start nThreads - 1 workers, the thread calling Search is the last worker. */
+    void Start(size_t nThreads);
+    void Stop();
+    size_t NumThreads() const { return m_threads.size() + 1; };
+
+    /** Returns the index in vSearch of the first snapshot found to have a kernel at nTime, -1 if none.
+     *  nKernel is set to the index of the kernel in the snapshot. */
+    int Search(const std::vector<const CStakeKernelSearch*> &vSearch, uint32_t nTime, size_t &nKernel);
+
+private:
+    struct Chunk
+    {
+        size_t nSearch;
+        size_t nBegin;
+        size_t nEnd;
+    };
+    struct Queue
+    {
+        std::mutex mtx;
+        std::deque<Chunk> chunks;
+    };
+
+    void ThreadWorker(size_t nWorker);
+    bool TakeChunk(size_t nWorker, Chunk &chunk);
+    void RunChunks(size_t nWorker);
+
+    std::mutex m_search_mtx; // one search at a time
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<Queue> > m_queues;
+
+    std::mutex m_mtx;
+    std::condition_variable m_cond_work;
+    std::condition_variable m_cond_done;
+    uint64_t m_generation = 0;
+    size_t m_active = 0;
+    bool m_stop = false;
+
+    const std::vector<const CStakeKernelSearch*> *m_search = nullptr;
+    uint32_t m_time = 0;
+    std::atomic<bool> m_found{false};
+    int m_found_search = -1;
+    size_t m_found_kernel = 0;
+};
+
+extern StakeSearchPool g_stake_search_pool;
+
+struct StakeSlotWin
+{
+    int64_t nTime;
+    CHDWallet *pwallet;
+    size_t nKernel;
+    uint64_t nSnapshotId; // snapshot nKernel indexes into
+};
+
+/** Slots with a kernel found ahead for the current tip, searched again when the tip,
+ *  the difficulty or a wallet snapshot changes. */
+class StakeLookahead
+{
+public:
+    /** Drop everything found if the tip, the difficulty or a snapshot changed, else the slots before nSearchTime.
+     *  Returns true if everything was dropped. */
+    bool Update(const CBlockIndex *pindexPrev_, uint32_t nBits_, const std::vector<uint64_t> &vSnapshotIds_, int64_t nSearchTime);
+    /** Search the slots before nHorizon not searched yet, the kernels in vSearch[i] are staked by vWallets[i]. */
+    void Search(StakeSearchPool &pool, const std::vector<CHDWallet*> &vWallets, const std::vector<const CStakeKernelSearch*> &vSearch, int64_t nHorizon, int64_t nSlotLen);
+    /** Sign the block of vWins.front() into pblocktemplate_ before its slot, the slot is dropped if signing fails. */
+    bool SignNext(std::unique_ptr<CBlockTemplate> pblocktemplate_, int nHeight);
+    /** Time of the next slot the staking thread has work in: signing or submitting a block, or searching further ahead. */
+    int64_t GetWakeTime(int64_t nSearchTime, int64_t nSlotLen) const;
+
+    const CBlockIndex *pindexPrev = nullptr;
+    uint32_t nBits = 0;
+    std::vector<uint64_t> vSnapshotIds;
+    int64_t nSearchedTo = 0; // first slot not searched yet
+    std::deque<StakeSlotWin> vWins;
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate; // block of vWins.front() signed before its slot
+    int64_t nBuiltTime = 0;
+};
+
+/**
+ * Block template kept ready for the staking threads.
+ * Mempool and tip notifications mark it stale, the staking threads rebuild it while they wait
+ * so that a kernel found can be signed into a block without selecting transactions first.
+ */
+class StakeBlockTemplateCache : public CValidationInterface
+{
+public:
+    /** Returns a copy of the template built on pindexPrev, rebuilt if stale and fRefresh is set.
+     *  Returns null if no template could be built. */
+    std::unique_ptr<CBlockTemplate> Get(const CBlockIndex *pindexPrev, bool fRefresh);
+    /** Rebuild the template if the mempool changed since it was built. */
+    void Refresh(const CBlockIndex *pindexPrev);
+    void Clear();
+    bool IsStale() const { return m_stale; };
+
+protected:
+    // CValidationInterface
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+    void TransactionAddedToMempool(const CTransactionRef &ptxn) override;
+    void TransactionRemovedFromMempool(const CTransactionRef &ptx) override;
+
+private:
+    bool Build(const CBlockIndex *pindexPrev);
+
+    std::mutex m_mtx;
+    std::unique_ptr<CBlockTemplate> m_template;
+    const CBlockIndex *m_tip = nullptr; // block the template builds on
+    std::atomic<bool> m_stale{true};
+};
+
+extern StakeBlockTemplateCache g_stake_template;
+
 extern std::atomic<bool> fIsStaking;
 
+static const int64_t DEFAULT_STAKE_LOOKAHEAD = 8; // timestamp slots searched after a new block
+
 extern int nMinStakeInterval;
 extern int nMinerSleep;
 
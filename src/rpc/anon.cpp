@@ -83,10 +83,52 @@ UniValue anonoutput(const JSONRPCRequest &request)
     return result;
 };
 
+UniValue getanonoutputcacheinfo(const JSONRPCRequest &request)
+{
+            RPCHelpMan{"getanonoutputcacheinfo",
+                "\nReturns statistics of the in-memory anon output cache used to resolve ring members.\n",
+                {},
+                RPCResult{
+            "{\n"
+            "  \"entries\" : num,               (numeric) Number of cached anon outputs.\n"
+            "  \"usage\" : num,                 (numeric) Approximate memory used by the cache in bytes.\n"
+            "  \"maxusage\" : num,              (numeric) Configured limit in bytes (see -anonoutputcache).\n"
+            "  \"hits\" : num,                  (numeric) Lookups served from the cache.\n"
+            "  \"misses\" : num,                (numeric) Lookups that required a database read.\n"
+            "  \"prefetched\" : num,            (numeric) Outputs read in batches ahead of ring signature verification.\n"
+            "  \"hitrate\" : n.nnn,             (numeric) hits / (hits + misses).\n"
+            "}\n"
+                },
+                RPCExamples{
+            HelpExampleCli("getanonoutputcacheinfo", "")
+            + HelpExampleRpc("getanonoutputcacheinfo", "")
+            },
+        }.Check(request);
+
+    if (!pblocktree) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block tree db not loaded.");
+    }
+
+    AnonOutputCacheStats stats = pblocktree->AnonOutputCache().GetStats();
+    uint64_t nLookups = stats.nHits + stats.nMisses;
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("entries", (uint64_t)stats.nEntries);
+    result.pushKV("usage", (uint64_t)stats.nUsage);
+    result.pushKV("maxusage", (uint64_t)stats.nMaxUsage);
+    result.pushKV("hits", stats.nHits);
+    result.pushKV("misses", stats.nMisses);
+    result.pushKV("prefetched", stats.nPrefetched);
+    result.pushKV("hitrate", nLookups > 0 ? (double)stats.nHits / (double)nLookups : 0.0);
+
+    return result;
+};
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
     { "anon",               "anonoutput",             &anonoutput,             {"output"} },
+    { "anon",               "getanonoutputcacheinfo", &getanonoutputcacheinfo, {} },
 };
 
 void RegisterAnonRPCCommands(CRPCTable &tableRPC)
@@ -168,6 +168,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listcoldstakeunspent", 1, "height"},
     { "listcoldstakeunspent", 2, "options"},
     { "getblockreward", 0, "height"},
+    { "addstealthwatch", 2, "rescan_from"},
+    { "getstealthwatchoutputs", 1, "start"},
+    { "getstealthwatchoutputs", 2, "end"},
     { "bumpfee", 1, "options" },
 
 
@@ -278,6 +281,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "smsgscanbuckets", 0, "options" },
     { "smsgpeers", 0, "index" },
     { "smsgzmqpush", 0, "options" },
+    { "resendzmqsmsg", 1, "sequence" },
 
 
     { "devicesignrawtransaction", 1, "prevtxs" },
@@ -0,0 +1,524 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <smsg/bucketstore.h>
+
+#include <smsg/smessage.h>
+#include <crypto/common.h>
+#include <logging.h>
+#include <util/system.h>
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <errno.h>
+#include <limits>
+#include <string.h>
+
+namespace smsg {
+
+void SecMsgIndexRecord::Write(uint8_t *p) const
+{
+    WriteLE64(p, timestamp);
+    memcpy(p + 8, sample, 8);
+    WriteLE64(p + 16, offset);
+    WriteLE32(p + 24, ttl);
+    WriteLE32(p + 28, nPayload);
+}
+
+void SecMsgIndexRecord::Read(const uint8_t *p)
+{
+    timestamp = ReadLE64(p);
+    memcpy(sample, p + 8, 8);
+    offset = ReadLE64(p + 16);
+    ttl = ReadLE32(p + 24);
+    nPayload = ReadLE32(p + 28);
+}
+
+int64_t SecMsgIndexRecord::End() const
+{
+    return offset + SMSG_HDR_LEN + nPayload;
+}
+
+bool CBucketMap::Map(const fs::path &path)
+{
+    Unmap();
+#ifdef WIN32
+    HANDLE hFile = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return error("%s: CreateFile failed %s, %d.", __func__, path.string(), GetLastError());
+    }
+    LARGE_INTEGER nFileSize;
+    if (!GetFileSizeEx(hFile, &nFileSize)) {
+        CloseHandle(hFile);
+        return error("%s: GetFileSizeEx failed %s, %d.", __func__, path.string(), GetLastError());
+    }
+    if (nFileSize.QuadPart == 0) {
+        CloseHandle(hFile);
+        return true; // Nothing to map
+    }
+    HANDLE hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(hFile);
+    if (!hMap) {
+        return error("%s: CreateFileMapping failed %s, %d.", __func__, path.string(), GetLastError());
+    }
+    void *p = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!p) {
+        CloseHandle(hMap);
+        return error("%s: MapViewOfFile failed %s, %d.", __func__, path.string(), GetLastError());
+    }
+    m_hmap = hMap;
+    m_data = (uint8_t*) p;
+    m_size = (size_t) nFileSize.QuadPart;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0) {
+        return error("%s: open failed %s, %s.", __func__, path.string(), strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return error("%s: fstat failed %s, %s.", __func__, path.string(), strerror(errno));
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true; // Nothing to map
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return error("%s: mmap failed %s, %s.", __func__, path.string(), strerror(errno));
+    }
+    m_data = (uint8_t*) p;
+    m_size = st.st_size;
+#endif
+    return true;
+}
+
+void CBucketMap::Unmap()
+{
+    if (m_data) {
+#ifdef WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_hmap);
+        m_hmap = nullptr;
+#else
+        munmap(m_data, m_size);
+#endif
+    }
+    m_data = nullptr;
+    m_size = 0;
+}
+
+fs::path CBucketStore::DataPath(int64_t bucket_time, int nFile)
+{
+    return GetDataDir() / STORE_DIR / strprintf("%d_%02d.dat", bucket_time, nFile);
+}
+
+fs::path CBucketStore::IndexPath(int64_t bucket_time, int nFile)
+{
+    return GetDataDir() / STORE_DIR / strprintf("%d_%02d.idx", bucket_time, nFile);
+}
+
+fs::path CBucketStore::TempPath(const fs::path &path)
+{
+    return fs::path(path.string() + ".tmp");
+}
+
+CBucketMap *CBucketStore::GetMap(int64_t bucket_time, int nFile, size_t nMinSize)
+{
+    auto key = std::make_pair(bucket_time, nFile);
+    CBucketMap &map = m_maps[key];
+    if (map.data() && map.size() >= nMinSize) {
+        return &map;
+    }
+
+    // The file has grown since it was mapped
+    if (!map.Map(DataPath(bucket_time, nFile))) {
+        m_maps.erase(key);
+        return nullptr;
+    }
+    if (map.size() < nMinSize) {
+        LogPrintf("%s: Bucket %d file %d is too short, %u < %u.\n", __func__, bucket_time, nFile, map.size(), nMinSize);
+        return nullptr;
+    }
+    return &map;
+}
+
+bool CBucketStore::Get(int64_t bucket_time, int nFile, int64_t offset, std::vector<uint8_t> &vchData)
+{
+    if (offset < 0) {
+        return false;
+    }
+    CBucketMap *pmap = GetMap(bucket_time, nFile, offset + SMSG_HDR_LEN);
+    if (!pmap) {
+        return false;
+    }
+
+    SecureMessage smsg;
+    memcpy(smsg.data(), pmap->data() + offset, SMSG_HDR_LEN);
+    size_t nLen = SMSG_HDR_LEN + smsg.nPayload;
+
+    if (!(pmap = GetMap(bucket_time, nFile, offset + nLen))) {
+        return false;
+    }
+    vchData.insert(vchData.end(), pmap->data() + offset, pmap->data() + offset + nLen);
+    return true;
+}
+
+std::vector<int64_t> *CBucketStore::GetIndexOffsets(int64_t bucket_time, int nFile)
+{
+    auto key = std::make_pair(bucket_time, nFile);
+    auto it = m_index_offsets.find(key);
+    if (it != m_index_offsets.end()) {
+        return &it->second;
+    }
+
+    fs::path path = IndexPath(bucket_time, nFile);
+    FILE *fp;
+    errno = 0;
+    if (!(fp = fsbridge::fopen(path, "rb"))) {
+        error("%s: fopen failed %s, %s.", __func__, path.string(), strerror(errno));
+        return nullptr;
+    }
+    std::vector<int64_t> &vOffsets = m_index_offsets[key];
+    uint8_t buf[SMSG_INDEX_RECORD_LEN];
+    while (fread(buf, 1, SMSG_INDEX_RECORD_LEN, fp) == SMSG_INDEX_RECORD_LEN) {
+        SecMsgIndexRecord record;
+        record.Read(buf);
+        vOffsets.push_back(record.offset);
+    }
+    fclose(fp);
+    return &vOffsets;
+}
+
+bool CBucketStore::ParseRecords(int64_t bucket_time, int nFile, int64_t nFrom, std::vector<SecMsgIndexRecord> &vRecords)
+{
+    Close(bucket_time, nFile);
+    CBucketMap *pmap = GetMap(bucket_time, nFile, 0);
+    if (!pmap) {
+        return false;
+    }
+
+    const uint8_t *pData = pmap->data();
+    size_t nSize = pmap->size();
+    SecureMessage smsg;
+    for (size_t ofs = nFrom; ofs + SMSG_HDR_LEN <= nSize; ) {
+        memcpy(smsg.data(), pData + ofs, SMSG_HDR_LEN);
+        if (ofs + SMSG_HDR_LEN + smsg.nPayload > nSize) {
+            LogPrintf("%s: Bucket %d file %d, message at %u is truncated.\n", __func__, bucket_time, nFile, ofs);
+            break;
+        }
+
+        SecMsgIndexRecord record;
+        record.timestamp = smsg.timestamp;
+        record.offset = ofs;
+        record.ttl = smsg.version[0] == 0 && smsg.version[1] == 0 ? 0  // Purged message header
+            : smsg.m_ttl;
+        record.nPayload = smsg.nPayload;
+        if (smsg.nPayload >= 8) {
+            memcpy(record.sample, pData + ofs + SMSG_HDR_LEN, 8);
+        }
+        vRecords.push_back(record);
+
+        ofs += SMSG_HDR_LEN + smsg.nPayload;
+    }
+
+    return true;
+}
+
+bool CBucketStore::WriteIndex(const fs::path &path, const std::vector<SecMsgIndexRecord> &vRecords, bool fAppend)
+{
+    FILE *fp;
+    errno = 0;
+    if (!(fp = fsbridge::fopen(path, fAppend ? "ab" : "wb"))) {
+        return error("%s: fopen failed %s, %s.", __func__, path.string(), strerror(errno));
+    }
+
+    uint8_t buf[SMSG_INDEX_RECORD_LEN];
+    for (const auto &record : vRecords) {
+        record.Write(buf);
+        if (fwrite(buf, 1, SMSG_INDEX_RECORD_LEN, fp) != SMSG_INDEX_RECORD_LEN) {
+            fclose(fp);
+            return error("%s: fwrite failed %s, %s.", __func__, path.string(), strerror(errno));
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+bool CBucketStore::LoadIndex(int64_t bucket_time, int nFile, std::vector<SecMsgIndexRecord> &vRecords)
+{
+    vRecords.clear();
+
+    uint64_t nDataSize = 0;
+    try {
+        nDataSize = fs::file_size(DataPath(bucket_time, nFile));
+    } catch (const fs::filesystem_error &ex) {
+        return error("%s: Bucket %d file %d, %s.", __func__, bucket_time, nFile, ex.what());
+    }
+
+    fs::path pathIndex = IndexPath(bucket_time, nFile);
+    std::vector<uint8_t> vIndex;
+    bool fRebuild = true;
+    FILE *fp;
+    if ((fp = fsbridge::fopen(pathIndex, "rb"))) {
+        if (fseek(fp, 0, SEEK_END) == 0) {
+            long nIndexSize = ftell(fp);
+            if (nIndexSize >= 0 && nIndexSize % SMSG_INDEX_RECORD_LEN == 0) {
+                vIndex.resize(nIndexSize);
+                rewind(fp);
+                fRebuild = nIndexSize > 0 && fread(vIndex.data(), 1, nIndexSize, fp) != (size_t)nIndexSize;
+            }
+        }
+        fclose(fp);
+    }
+
+    // Records must follow each other and may not point past the end of the .dat file
+    int64_t nEnd = 0;
+    for (size_t i = 0; !fRebuild && i < vIndex.size(); i += SMSG_INDEX_RECORD_LEN) {
+        SecMsgIndexRecord record;
+        record.Read(&vIndex[i]);
+        if (record.offset != nEnd) {
+            fRebuild = true;
+            break;
+        }
+        nEnd = record.End();
+        vRecords.push_back(record);
+    }
+    if (!fRebuild && (uint64_t)nEnd > nDataSize) {
+        fRebuild = true;
+    }
+
+    if (fRebuild) {
+        LogPrint(BCLog::SMSG, "Rebuilding index for bucket %d file %d.\n", bucket_time, nFile);
+        vRecords.clear();
+        if (!ParseRecords(bucket_time, nFile, 0, vRecords)) {
+            return false;
+        }
+        if (!WriteIndex(pathIndex, vRecords, false)) {
+            LogPrintf("%s: Failed to write index for bucket %d file %d.\n", __func__, bucket_time, nFile);
+            m_index_offsets.erase(std::make_pair(bucket_time, nFile));
+            return true;
+        }
+    } else
+    if ((uint64_t)nEnd < nDataSize) {
+        std::vector<SecMsgIndexRecord> vTail;
+        if (!ParseRecords(bucket_time, nFile, nEnd, vTail)) {
+            return false;
+        }
+        vRecords.insert(vRecords.end(), vTail.begin(), vTail.end());
+        if (!WriteIndex(pathIndex, vTail, true)) {
+            LogPrintf("%s: Failed to append index for bucket %d file %d.\n", __func__, bucket_time, nFile);
+            m_index_offsets.erase(std::make_pair(bucket_time, nFile));
+            return true;
+        }
+    }
+
+    std::vector<int64_t> &vOffsets = m_index_offsets[std::make_pair(bucket_time, nFile)];
+    vOffsets.clear();
+    for (const auto &record : vRecords) {
+        vOffsets.push_back(record.offset);
+    }
+    return true;
+}
+
+bool CBucketStore::AppendIndex(int64_t bucket_time, int nFile, const SecMsgIndexRecord &record)
+{
+    if (!WriteIndex(IndexPath(bucket_time, nFile), std::vector<SecMsgIndexRecord>{record}, true)) {
+        m_index_offsets.erase(std::make_pair(bucket_time, nFile));
+        return false;
+    }
+    auto it = m_index_offsets.find(std::make_pair(bucket_time, nFile));
+    if (it != m_index_offsets.end()) {
+        it->second.push_back(record.offset);
+    }
+    return true;
+}
+
+bool CBucketStore::SetIndexTTL(int64_t bucket_time, int nFile, int64_t offset, uint32_t ttl)
+{
+    const std::vector<int64_t> *pOffsets = GetIndexOffsets(bucket_time, nFile);
+    if (!pOffsets) {
+        return false;
+    }
+    // Records are written in .dat file order
+    auto it = std::lower_bound(pOffsets->begin(), pOffsets->end(), offset);
+    if (it == pOffsets->end() || *it != offset) {
+        return error("%s: Offset %d not found in bucket %d file %d index.", __func__, offset, bucket_time, nFile);
+    }
+    long pos = (it - pOffsets->begin()) * SMSG_INDEX_RECORD_LEN;
+
+    fs::path path = IndexPath(bucket_time, nFile);
+    FILE *fp;
+    errno = 0;
+    if (!(fp = fsbridge::fopen(path, "rb+"))) {
+        return error("%s: fopen failed %s, %s.", __func__, path.string(), strerror(errno));
+    }
+    uint8_t ttl_le[4];
+    WriteLE32(ttl_le, ttl);
+    bool rv = fseek(fp, pos + 24, SEEK_SET) == 0
+        && fwrite(ttl_le, 1, 4, fp) == 4;
+    fclose(fp);
+    return rv;
+}
+
+bool CBucketStore::WriteCompacted(int64_t bucket_time, int nFile, const std::vector<int64_t> &vOffsets, std::vector<int64_t> &vNewOffsets)
+{
+    fs::path pathData = DataPath(bucket_time, nFile);
+    fs::path pathTemp = TempPath(pathData);
+    vNewOffsets.clear();
+
+    FILE *fpIn, *fpOut;
+    errno = 0;
+    if (!(fpIn = fsbridge::fopen(pathData, "rb"))) {
+        return error("%s: fopen failed %s, %s.", __func__, pathData.string(), strerror(errno));
+    }
+    if (!(fpOut = fsbridge::fopen(pathTemp, "wb"))) {
+        fclose(fpIn);
+        return error("%s: fopen failed %s, %s.", __func__, pathTemp.string(), strerror(errno));
+    }
+
+    bool rv = true;
+    int64_t nNewOffset = 0;
+    std::vector<uint8_t> vchMessage;
+    std::vector<SecMsgIndexRecord> vRecords;
+    SecureMessage smsg;
+    for (const auto offset : vOffsets) {
+        if (fseek(fpIn, offset, SEEK_SET) != 0
+            || fread(smsg.data(), 1, SMSG_HDR_LEN, fpIn) != SMSG_HDR_LEN) {
+            rv = error("%s: Read header failed %s, offset %d.", __func__, pathData.string(), offset);
+            break;
+        }
+        vchMessage.resize(SMSG_HDR_LEN + smsg.nPayload);
+        memcpy(vchMessage.data(), smsg.data(), SMSG_HDR_LEN);
+        if (fread(vchMessage.data() + SMSG_HDR_LEN, 1, smsg.nPayload, fpIn) != smsg.nPayload) {
+            rv = error("%s: Read payload failed %s, offset %d.", __func__, pathData.string(), offset);
+            break;
+        }
+        if (fwrite(vchMessage.data(), 1, vchMessage.size(), fpOut) != vchMessage.size()) {
+            rv = error("%s: fwrite failed %s, %s.", __func__, pathTemp.string(), strerror(errno));
+            break;
+        }
+
+        SecMsgIndexRecord record;
+        record.timestamp = smsg.timestamp;
+        record.offset = nNewOffset;
+        record.ttl = smsg.m_ttl;
+        record.nPayload = smsg.nPayload;
+        if (smsg.nPayload >= 8) {
+            memcpy(record.sample, vchMessage.data() + SMSG_HDR_LEN, 8);
+        }
+        vRecords.push_back(record);
+        vNewOffsets.push_back(nNewOffset);
+        nNewOffset = record.End();
+    }
+
+    fclose(fpIn);
+    if (fflush(fpOut) != 0 || !FileCommit(fpOut)) {
+        rv = false;
+    }
+    fclose(fpOut);
+
+    if (rv && !WriteIndex(TempPath(IndexPath(bucket_time, nFile)), vRecords, false)) {
+        rv = false;
+    }
+    if (!rv) {
+        RemoveCompacted(bucket_time, nFile);
+    }
+    return rv;
+}
+
+bool CBucketStore::SwapCompacted(int64_t bucket_time, int nFile)
+{
+    Close(bucket_time, nFile);
+    m_index_offsets.erase(std::make_pair(bucket_time, nFile));
+
+    // Remove the old index first, if interrupted the index is rebuilt from the .dat file on the next start
+    fs::path pathData = DataPath(bucket_time, nFile), pathIndex = IndexPath(bucket_time, nFile);
+    try {
+        fs::remove(pathIndex);
+        fs::rename(TempPath(pathData), pathData);
+        fs::rename(TempPath(pathIndex), pathIndex);
+    } catch (const fs::filesystem_error &ex) {
+        RemoveCompacted(bucket_time, nFile);
+        return error("%s: Bucket %d file %d, %s.", __func__, bucket_time, nFile, ex.what());
+    }
+    return true;
+}
+
+void CBucketStore::RemoveCompacted(int64_t bucket_time, int nFile)
+{
+    for (const auto &path : {TempPath(DataPath(bucket_time, nFile)), TempPath(IndexPath(bucket_time, nFile))}) {
+        try {
+            fs::remove(path);
+        } catch (const fs::filesystem_error &ex) {
+            LogPrintf("Error removing file %s.\n", ex.what());
+        }
+    }
+}
+
+void CBucketStore::Close(int64_t bucket_time)
+{
+    m_maps.erase(m_maps.lower_bound(std::make_pair(bucket_time, 0)),
+                 m_maps.upper_bound(std::make_pair(bucket_time, std::numeric_limits<int>::max())));
+}
+
+void CBucketStore::Close(int64_t bucket_time, int nFile)
+{
+    m_maps.erase(std::make_pair(bucket_time, nFile));
+}
+
+void CBucketStore::Clear()
+{
+    m_maps.clear();
+    m_index_offsets.clear();
+}
+
+bool CBucketStore::EraseFiles(int64_t bucket_time)
+{
+    Close(bucket_time);
+    m_index_offsets.erase(m_index_offsets.lower_bound(std::make_pair(bucket_time, 0)),
+                          m_index_offsets.upper_bound(std::make_pair(bucket_time, std::numeric_limits<int>::max())));
+
+    bool rv = true;
+    for (int nFile = 1; ; ++nFile) {
+        fs::path pathData = DataPath(bucket_time, nFile), pathIndex = IndexPath(bucket_time, nFile);
+        try {
+            bool fData = fs::exists(pathData), fIndex = fs::exists(pathIndex);
+            if (!fData && !fIndex) {
+                break;
+            }
+            if (fData) {
+                fs::remove(pathData);
+            }
+            if (fIndex) {
+                fs::remove(pathIndex);
+            }
+        } catch (const fs::filesystem_error &ex) {
+            LogPrintf("Error removing bucket file %s.\n", ex.what());
+            rv = false;
+            break;
+        }
+    }
+    return rv;
+}
+
+} // namespace smsg
@@ -0,0 +1,111 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PARTICL_SMSG_BUCKETSTORE_H
+#define PARTICL_SMSG_BUCKETSTORE_H
+
+#include <fs.h>
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+namespace smsg {
+
+const size_t SMSG_INDEX_RECORD_LEN = 32; // 8 + 8 + 8 + 4 + 4
+
+/** Position of a message in a bucket file, kept in the <bucket>_<file>.idx sidecar.
+ *  Records are appended in the same order as the messages in the .dat file.
+ */
+class SecMsgIndexRecord
+{
+public:
+    int64_t timestamp = 0;
+    uint8_t sample[8] = {0, 0, 0, 0, 0, 0, 0, 0};   // first 8 bytes of payload
+    int64_t offset = 0;                             // offset in .dat file
+    uint32_t ttl = 0;                               // 0 if purged
+    uint32_t nPayload = 0;
+
+    void Write(uint8_t *p) const;
+    void Read(const uint8_t *p);
+
+    int64_t End() const;                            // offset of the next message
+};
+
+/** Read only mapping of a bucket file, remapped when the file grows. */
+class CBucketMap
+{
+public:
+    CBucketMap() {};
+    CBucketMap(const CBucketMap&) = delete;
+    CBucketMap &operator=(const CBucketMap&) = delete;
+    ~CBucketMap() { Unmap(); };
+
+    bool Map(const fs::path &path);
+    void Unmap();
+
+    const uint8_t *data() const { return m_data; };
+    size_t size() const { return m_size; };
+
+private:
+    uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef WIN32
+    void *m_hmap = nullptr;
+#endif
+};
+
+/** Serves messages from the bucket files through read only mappings and maintains their index sidecars.
+ *  A bucket is stored in one or more files, <bucket>_01.dat, <bucket>_02.dat, ..., a new file is started
+ *  when the last one reaches the size limit.
+ *  Callers must hold CSMSG::cs_smsg, except for the static functions.
+ */
+class CBucketStore
+{
+public:
+    static fs::path DataPath(int64_t bucket_time, int nFile);
+    static fs::path IndexPath(int64_t bucket_time, int nFile);
+    static fs::path TempPath(const fs::path &path);
+
+    /** Append a copy of the message at offset to vchData.
+     *  The mapping can be replaced by any later call, so no pointers into it are handed out. */
+    bool Get(int64_t bucket_time, int nFile, int64_t offset, std::vector<uint8_t> &vchData);
+
+    /** Load the index for a bucket file, messages missing from the index are parsed from the .dat file
+     *  and appended to it. The index is rebuilt if it does not match the .dat file. */
+    bool LoadIndex(int64_t bucket_time, int nFile, std::vector<SecMsgIndexRecord> &vRecords);
+
+    bool AppendIndex(int64_t bucket_time, int nFile, const SecMsgIndexRecord &record);
+    /** Rewrite the ttl of the record at offset in place, the record is found in the loaded offsets. */
+    bool SetIndexTTL(int64_t bucket_time, int nFile, int64_t offset, uint32_t ttl);
+
+    /** Copy the messages at vOffsets into temporary .dat and .idx files, vNewOffsets receives their offsets in the new file.
+     *  Reads the bucket file directly, cs_smsg need not be held. */
+    static bool WriteCompacted(int64_t bucket_time, int nFile, const std::vector<int64_t> &vOffsets, std::vector<int64_t> &vNewOffsets);
+    /** Replace the bucket file and its index with the files written by WriteCompacted. */
+    bool SwapCompacted(int64_t bucket_time, int nFile);
+    static void RemoveCompacted(int64_t bucket_time, int nFile);
+
+    /** Unmap the bucket, must be called before its files are removed or rewritten. */
+    void Close(int64_t bucket_time);
+    void Close(int64_t bucket_time, int nFile);
+    void Clear();
+
+    /** Close the bucket and remove all its .dat and .idx files. */
+    bool EraseFiles(int64_t bucket_time);
+
+private:
+    CBucketMap *GetMap(int64_t bucket_time, int nFile, size_t nMinSize);
+    /** Offsets of the messages in the index of a bucket file, in record order. Read from the .idx file if not loaded. */
+    std::vector<int64_t> *GetIndexOffsets(int64_t bucket_time, int nFile);
+    bool ParseRecords(int64_t bucket_time, int nFile, int64_t nFrom, std::vector<SecMsgIndexRecord> &vRecords);
+    static bool WriteIndex(const fs::path &path, const std::vector<SecMsgIndexRecord> &vRecords, bool fAppend);
+
+    std::map<std::pair<int64_t, int>, CBucketMap> m_maps;
+    std::map<std::pair<int64_t, int>, std::vector<int64_t> > m_index_offsets;
+};
+
+} // namespace smsg
+
+#endif // PARTICL_SMSG_BUCKETSTORE_H
@@ -19,10 +19,25 @@ const std::string DBK_INBOX         = "IM";
 const std::string DBK_OUTBOX        = "SM";
 const std::string DBK_QUEUED        = "QM";
 const std::string DBK_PURGED_TOKEN  = "pm";
+const std::string DBK_INBOX_META    = "Im";
+const std::string DBK_OUTBOX_META   = "Sm";
 
 CCriticalSection cs_smsgDB;
 leveldb::DB *smsgDB = nullptr;
 
+static bool GetMetaKey(const uint8_t *chKey, CDataStream &ssKey)
+{
+    if (chKey[1] != 'M'
+        || (chKey[0] != DBK_INBOX[0] && chKey[0] != DBK_OUTBOX[0])) {
+        return false;
+    }
+    uint8_t chMetaKey[30];
+    memcpy(chMetaKey, chKey, 30);
+    chMetaKey[1] = 'm';
+    ssKey.write((const char*)chMetaKey, 30);
+    return true;
+};
+
 bool SecMsgDB::Open(const char *pszMode)
 {
     if (smsgDB) {
@@ -417,6 +432,13 @@ bool SecMsgDB::WriteSmesg(const uint8_t *chKey, SecMsgStored &smsgStored)
         return false;
     }
 
+    SecMsgMeta meta;
+    if (ReadMeta(chKey, meta)
+        && meta.status != smsgStored.status) {
+        meta.status = smsgStored.status;
+        WriteMeta(chKey, meta);
+    }
+
     CDataStream ssKey(SER_DISK, CLIENT_VERSION);
     ssKey.write((const char*)chKey, 30);
     CDataStream ssValue(SER_DISK, CLIENT_VERSION);
@@ -461,6 +483,8 @@ bool SecMsgDB::ExistsSmesg(const uint8_t *chKey)
 
 bool SecMsgDB::EraseSmesg(const uint8_t *chKey)
 {
+    EraseMeta(chKey);
+
     CDataStream ssKey(SER_DISK, CLIENT_VERSION);
     ssKey.write((const char*)chKey, 30);
 
@@ -479,6 +503,142 @@ bool SecMsgDB::EraseSmesg(const uint8_t *chKey)
     return error("SecMsgDB erase failed: %s\n", s.ToString());
 };
 
+bool SecMsgDB::ReadMeta(const uint8_t *chKey, SecMsgMeta &meta)
+{
+    if (!pdb) {
+        return false;
+    }
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    if (!GetMetaKey(chKey, ssKey)) {
+        return false;
+    }
+    std::string strValue;
+
+    bool readFromDb = true;
+    if (activeBatch) {
+        bool deleted = false;
+        readFromDb = ScanBatch(ssKey, &strValue, &deleted) == false;
+        if (deleted) {
+            return false;
+        }
+    }
+
+    if (readFromDb) {
+        leveldb::Status s = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &strValue);
+        if (!s.ok()) {
+            if (s.IsNotFound()) {
+                return false;
+            }
+            return error("LevelDB read failure: %s\n", s.ToString());
+        }
+    }
+
+    try {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> meta;
+    } catch (std::exception &e) {
+        LogPrintf("%s unserialize threw: %s.\n", __func__, e.what());
+        return false;
+    };
+
+    return true;
+};
+
+bool SecMsgDB::WriteMeta(const uint8_t *chKey, const SecMsgMeta &meta)
+{
+    if (!pdb) {
+        return false;
+    }
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    if (!GetMetaKey(chKey, ssKey)) {
+        return false;
+    }
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << meta;
+
+    if (activeBatch) {
+        activeBatch->Put(ssKey.str(), ssValue.str());
+        return true;
+    }
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status s = pdb->Put(writeOptions, ssKey.str(), ssValue.str());
+    if (!s.ok()) {
+        return error("SecMsgDB write failed: %s\n", s.ToString());
+    }
+
+    return true;
+};
+
+bool SecMsgDB::EraseMeta(const uint8_t *chKey)
+{
+    if (!pdb) {
+        return false;
+    }
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    if (!GetMetaKey(chKey, ssKey)) {
+        return true;
+    }
+
+    if (activeBatch) {
+        activeBatch->Delete(ssKey.str());
+        return true;
+    }
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status s = pdb->Delete(writeOptions, ssKey.str());
+
+    if (s.ok() || s.IsNotFound()) {
+        return true;
+    }
+    return error("SecMsgDB erase failed: %s\n", s.ToString());
+};
+
+bool SecMsgDB::NextMeta(leveldb::Iterator *it, const std::string &prefix, uint8_t *chKey, SecMsgMeta &meta, const uint8_t *pAfter)
+{
+    if (!pdb) {
+        return false;
+    }
+
+    if (!it->Valid()) { // First run
+        if (pAfter) {
+            std::string sStart = prefix.substr(0, 2) + std::string((const char*)pAfter, 28);
+            it->Seek(sStart);
+            if (it->Valid() && it->key().ToString() == sStart) {
+                it->Next();
+            }
+        } else {
+            it->Seek(prefix);
+        }
+    } else {
+        it->Next();
+    }
+
+    if (!(it->Valid()
+        && it->key().size() == 30
+        && memcmp(it->key().data(), prefix.data(), 2) == 0)) {
+        return false;
+    }
+
+    memcpy(chKey, it->key().data(), 30);
+    chKey[1] = 'M';
+
+    try {
+        CDataStream ssValue(it->value().data(), it->value().data() + it->value().size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> meta;
+    } catch (std::exception &e) {
+        LogPrintf("%s unserialize threw: %s.\n", __func__, e.what());
+        return false;
+    };
+
+    return true;
+};
+
 bool SecMsgDB::ReadPurged(const uint8_t *chKey, SecMsgPurged &smsgPurged)
 {
     if (!pdb) {
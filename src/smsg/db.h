@@ -18,6 +18,7 @@ namespace smsg {
 class SecMsgKey;
 class SecMsgStored;
 class SecMsgPurged;
+class SecMsgMeta;
 
 extern CCriticalSection cs_smsgDB;
 extern leveldb::DB *smsgDB;
@@ -28,6 +29,8 @@ extern const std::string DBK_INBOX;
 extern const std::string DBK_OUTBOX;
 extern const std::string DBK_QUEUED;
 extern const std::string DBK_PURGED_TOKEN;
+extern const std::string DBK_INBOX_META;
+extern const std::string DBK_OUTBOX_META;
 
 class SecMsgDB
 {
@@ -67,6 +70,14 @@ public:
     bool ExistsSmesg(const uint8_t *chKey);
     bool EraseSmesg(const uint8_t *chKey);
 
+    /** Metadata of inbox and outbox messages, chKey is the key of the message.
+     *  Kept in sync by WriteSmesg and EraseSmesg once written. */
+    bool ReadMeta(const uint8_t *chKey, SecMsgMeta &meta);
+    bool WriteMeta(const uint8_t *chKey, const SecMsgMeta &meta);
+    bool EraseMeta(const uint8_t *chKey);
+    /** Iterate the metadata index in message order, chKey is set to the key of the message.
+     *  If pAfter is set, iteration starts after the 28 byte msgid it points to. */
+    bool NextMeta(leveldb::Iterator *it, const std::string &prefix, uint8_t *chKey, SecMsgMeta &meta, const uint8_t *pAfter=nullptr);
 
     bool ReadPurged(const uint8_t *chKey, SecMsgPurged &smsgPurged);
     bool WritePurged(const uint8_t *chKey, SecMsgPurged &smsgPurged);
@@ -0,0 +1,130 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <smsg/fundingcache.h>
+
+#include <primitives/block.h>
+
+#include <string.h>
+
+namespace smsg {
+
+void SecMsgFundingTx::AddFundedMessages(const CTransaction &tx)
+{
+    // Message funding is enforced in tx_verify.cpp
+    for (const auto &v : tx.vpout) {
+        if (!v->IsType(OUTPUT_DATA)) {
+            continue;
+        }
+        const std::vector<uint8_t> &vData = *v->GetPData();
+        if (vData.size() < 25 || vData[0] != DO_FUND_MSG) {
+            continue;
+        }
+
+        size_t n = (vData.size()-1) / 24;
+        for (size_t k = 0; k < n; ++k) {
+            uint160 fundedId;
+            uint32_t nAmount;
+            memcpy(fundedId.begin(), &vData[1+k*24], 20);
+            memcpy(&nAmount, &vData[1+k*24+20], 4);
+
+            auto ret = mapFunded.emplace(fundedId, nAmount);
+            if (!ret.second && nAmount < ret.first->second) {
+                ret.first->second = nAmount;
+            }
+        }
+    }
+}
+
+void CFundingTxCache::EvictExcess()
+{
+    while (m_lru.size() > m_max_entries) {
+        m_index.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+}
+
+void CFundingTxCache::SetMaxEntries(size_t nMaxEntries)
+{
+    LOCK(cs);
+    m_max_entries = nMaxEntries;
+    EvictExcess();
+}
+
+std::shared_ptr<const SecMsgFundingTx> CFundingTxCache::Get(const uint256 &txid)
+{
+    LOCK(cs);
+    auto mi = m_index.find(txid);
+    if (mi == m_index.end()) {
+        m_misses++;
+        return nullptr;
+    }
+    m_hits++;
+    m_lru.splice(m_lru.begin(), m_lru, mi->second);
+    return mi->second->second;
+}
+
+void CFundingTxCache::Insert(const uint256 &txid, std::shared_ptr<const SecMsgFundingTx> funding_tx)
+{
+    LOCK(cs);
+    if (m_max_entries < 1) {
+        return;
+    }
+    auto mi = m_index.find(txid);
+    if (mi != m_index.end()) {
+        mi->second->second = std::move(funding_tx);
+        m_lru.splice(m_lru.begin(), m_lru, mi->second);
+        return;
+    }
+    m_lru.emplace_front(txid, std::move(funding_tx));
+    m_index.emplace(txid, m_lru.begin());
+    EvictExcess();
+}
+
+void CFundingTxCache::Erase(const uint256 &txid)
+{
+    LOCK(cs);
+    auto mi = m_index.find(txid);
+    if (mi == m_index.end()) {
+        return;
+    }
+    m_lru.erase(mi->second);
+    m_index.erase(mi);
+}
+
+void CFundingTxCache::Clear()
+{
+    LOCK(cs);
+    m_lru.clear();
+    m_index.clear();
+}
+
+void CFundingTxCache::BlockDisconnected(const std::shared_ptr<const CBlock> &block)
+{
+    LOCK(cs);
+    if (m_index.empty()) {
+        return;
+    }
+    for (const auto &tx : block->vtx) {
+        auto mi = m_index.find(tx->GetHash());
+        if (mi == m_index.end()) {
+            continue;
+        }
+        m_lru.erase(mi->second);
+        m_index.erase(mi);
+    }
+}
+
+FundingCacheStats CFundingTxCache::GetStats() const
+{
+    FundingCacheStats stats;
+    LOCK(cs);
+    stats.nEntries = m_lru.size();
+    stats.nMaxEntries = m_max_entries;
+    stats.nHits = m_hits;
+    stats.nMisses = m_misses;
+    return stats;
+}
+
+} // namespace smsg
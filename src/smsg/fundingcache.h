@@ -0,0 +1,79 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PARTICL_SMSG_FUNDINGCACHE_H
+#define PARTICL_SMSG_FUNDINGCACHE_H
+
+#include <sync.h>
+#include <uint256.h>
+#include <validationinterface.h>
+
+#include <list>
+#include <map>
+#include <memory>
+
+class CBlockIndex;
+class CTransaction;
+
+namespace smsg {
+
+const size_t SMSG_DEFAULT_FUNDING_CACHE = 4096; // Number of funding transactions cached
+
+/** Funding transaction of paid messages, parsed once its block is in the active chain. */
+class SecMsgFundingTx
+{
+public:
+    const CBlockIndex *pindex = nullptr;    // block containing the transaction
+    int64_t nFeeRate = 0;                   // smsg fee rate at pindex
+    int64_t nFeeRateLast = 0;               // fee rate of the previous period, set when pindex is in the grace period
+    std::map<uint160, uint32_t> mapFunded;  // message id -> amount paid, lowest if funded more than once
+
+    /** Add the messages funded by the DO_FUND_MSG data outputs of tx. */
+    void AddFundedMessages(const CTransaction &tx);
+};
+
+struct FundingCacheStats
+{
+    size_t nEntries = 0;
+    size_t nMaxEntries = 0;
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+};
+
+/** LRU cache of funding transactions keyed by txid.
+ *  Entries are erased when their block is disconnected, as the notification arrives asynchronously
+ *  callers must still check that the block is in the active chain.
+ */
+class CFundingTxCache : public CValidationInterface
+{
+private:
+    typedef std::list<std::pair<uint256, std::shared_ptr<const SecMsgFundingTx> > > lru_list;
+
+    mutable Mutex cs;
+    lru_list m_lru GUARDED_BY(cs);
+    std::map<uint256, lru_list::iterator> m_index GUARDED_BY(cs);
+    size_t m_max_entries GUARDED_BY(cs) = SMSG_DEFAULT_FUNDING_CACHE;
+    uint64_t m_hits GUARDED_BY(cs) = 0;
+    uint64_t m_misses GUARDED_BY(cs) = 0;
+
+    void EvictExcess() EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+protected:
+    // CValidationInterface
+    void BlockDisconnected(const std::shared_ptr<const CBlock> &block) override;
+
+public:
+    void SetMaxEntries(size_t nMaxEntries);
+
+    std::shared_ptr<const SecMsgFundingTx> Get(const uint256 &txid);
+    void Insert(const uint256 &txid, std::shared_ptr<const SecMsgFundingTx> funding_tx);
+    void Erase(const uint256 &txid);
+    void Clear();
+
+    FundingCacheStats GetStats() const;
+};
+
+} // namespace smsg
+
+#endif // PARTICL_SMSG_FUNDINGCACHE_H
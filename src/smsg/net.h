@@ -34,7 +34,7 @@ class SecMsgNode
 public:
     CCriticalSection cs_smsg_net;
     int64_t lastSeen = 0;
-    int64_t lastMatched = 0;
+    uint64_t m_inv_seq = 0;     // CSMSG::m_change_seq when buckets were last sent in smsgInv
     int64_t ignoreUntil = 0;
     uint16_t misbehaving = 0;
     uint16_t m_num_want_sent = 0;
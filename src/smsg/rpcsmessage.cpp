@@ -19,6 +19,7 @@
 #include <timedata.h>
 #include <anon.h>
 #include <validationinterface.h>
+#include <crypto/common.h>
 
 #include <leveldb/db.h>
 
@@ -997,10 +998,172 @@ static UniValue smsgsendanon(const JSONRPCRequest &request)
     return result;
 }
 
+struct MessageListParams
+{
+    bool inbox = true;
+    bool unread_only = false;
+    bool update_status = false;
+    std::string filter;
+    std::string encoding = "text";
+    std::string from;
+    std::string to;
+    std::vector<uint8_t> cursor;
+    size_t count = 0;
+};
+
+static void ParseMessageListOptions(const UniValue &options, MessageListParams &params)
+{
+    if (options["encoding"].isStr()) {
+        params.encoding = options["encoding"].get_str();
+    }
+    if (options["from"].isStr()) {
+        params.from = options["from"].get_str();
+    }
+    if (options["to"].isStr()) {
+        params.to = options["to"].get_str();
+    }
+    if (options["count"].isNum()) {
+        int count = options["count"].get_int();
+        if (count < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "count must be positive.");
+        }
+        params.count = count;
+    }
+    if (options["cursor"].isStr()) {
+        std::string sCursor = options["cursor"].get_str();
+        if (!IsHex(sCursor) || sCursor.size() != 56) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "cursor must be 28 bytes in hex string.");
+        }
+        params.cursor = ParseHex(sCursor);
+    }
+};
+
+/** List inbox or outbox messages from the metadata index.
+ *  Messages are only read and decrypted when their text is displayed or matched against the filter.
+ *  Called with cs_smsgDB held. */
+static void ListIndexedMessages(smsg::SecMsgDB &db, const MessageListParams &params, UniValue &result)
+{
+    smsgModule.IndexMessages(db);
+
+    const std::string &prefix = params.inbox ? smsg::DBK_INBOX_META : smsg::DBK_OUTBOX_META;
+    const uint8_t *pAfter = params.cursor.size() == 28 ? params.cursor.data() : nullptr;
+
+    uint32_t nMessages = 0;
+    uint8_t chKey[30];
+    smsg::SecMsgMeta meta;
+    smsg::SecMsgStored smsgStored;
+    smsg::MessageData msg;
+    UniValue messageList(UniValue::VARR);
+
+    db.TxnBegin();
+
+    leveldb::Iterator *it = db.pdb->NewIterator(leveldb::ReadOptions());
+    while (db.NextMeta(it, prefix, chKey, meta, pAfter)) {
+        if (params.unread_only
+            && !(meta.status & SMSG_MASK_UNREAD)) {
+            continue;
+        }
+        std::string sAddrTo = EncodeDestination(PKHash(meta.addrTo));
+        if ((!params.from.empty() && meta.sFromAddress != params.from)
+            || (!params.to.empty() && sAddrTo != params.to)) {
+            continue;
+        }
+        if (meta.nDecryptError != 0
+            && params.filter.size() > 0) {
+            continue;
+        }
+
+        bool fMatchedAddress = params.filter.empty()
+            || part::stringsMatchI(meta.sFromAddress, params.filter, 3)
+            || part::stringsMatchI(sAddrTo, params.filter, 3);
+
+        int rv = meta.nDecryptError;
+        bool fRead = false;
+        std::string sText;
+        if (rv == 0
+            && (!fMatchedAddress || params.encoding != "none")) {
+            if (!db.ReadSmesg(chKey, smsgStored)
+                || smsgStored.vchMessage.size() < smsg::SMSG_HDR_LEN) {
+                continue;
+            }
+            fRead = true;
+            const uint8_t *pHeader = smsgStored.vchMessage.data();
+            uint32_t nPayload = smsgStored.vchMessage.size() - smsg::SMSG_HDR_LEN;
+            rv = smsgModule.Decrypt(false, params.inbox ? smsgStored.addrTo : smsgStored.addrOutbox,
+                pHeader, pHeader + smsg::SMSG_HDR_LEN, nPayload, msg);
+            if (rv == 0) {
+                sText = std::string((char*)msg.vchMessage.data());
+            }
+        }
+        if (!fMatchedAddress
+            && (rv != 0 || !part::stringsMatchI(sText, params.filter, 3))) {
+            continue;
+        }
+
+        UniValue objM(UniValue::VOBJ);
+        objM.pushKV("msgid", HexStr(&chKey[2], &chKey[2] + 28)); // timestamp+hash
+        objM.pushKV("version", strprintf("%02x%02x", meta.version[0], meta.version[1]));
+
+        if (rv == 0) {
+            if (params.inbox) {
+                PushTime(objM, "received", meta.timeReceived);
+            }
+            PushTime(objM, "sent", meta.timeSent);
+            objM.pushKV("paid", UniValue(meta.IsPaidVersion()));
+
+            int64_t ttl = meta.ttl;
+            objM.pushKV("ttl", ttl);
+            int nDaysRetention = ttl / smsg::SMSG_SECONDS_IN_DAY;
+            objM.pushKV("daysretention", nDaysRetention);
+            PushTime(objM, "expiration", (int64_t)ReadBE64(&chKey[2]) + ttl);
+
+            objM.pushKV("payloadsize", (int)meta.nPayload);
+
+            objM.pushKV("from", meta.sFromAddress);
+            objM.pushKV("to", sAddrTo);
+            if (params.encoding == "none") {
+            } else
+            if (params.encoding == "text") {
+                objM.pushKV("text", sText);
+            } else
+            if (params.encoding == "hex") {
+                objM.pushKV("hex", HexStr(sText));
+            } else {
+                objM.pushKV("unknown_encoding", params.encoding);
+            }
+        } else {
+            objM.pushKV("status", "Decrypt failed");
+            objM.pushKV("error", smsg::GetString(rv));
+        }
+
+        messageList.push_back(objM);
+
+        // Only set 'read' status if the message decrypted successfully and update_status is set
+        if (params.unread_only && rv == 0 && params.update_status) {
+            if (fRead || db.ReadSmesg(chKey, smsgStored)) {
+                smsgStored.status &= ~SMSG_MASK_UNREAD;
+                db.WriteSmesg(chKey, smsgStored);
+            }
+        }
+        nMessages++;
+
+        if (params.count > 0 && nMessages >= params.count) {
+            result.pushKV("cursor", HexStr(&chKey[2], &chKey[2] + 28));
+            break;
+        }
+    }
+    delete it;
+    db.TxnCommit();
+
+    result.pushKV("messages", messageList);
+    result.pushKV("result", strprintf("%u", nMessages));
+};
+
 static UniValue smsginbox(const JSONRPCRequest &request)
 {
             RPCHelpMan{"smsginbox",
                 "\nDecrypt and display received messages.\n"
+                "When count messages are listed the result includes a cursor to list the next page from.\n"
                 "Warning: clear will delete all messages.\n",
                 {
                     {"mode", RPCArg::Type::STR, /* default */ "unread", "\"all|unread|clear\" List all messages, unread messages or clear all messages."},
@@ -1009,6 +1172,10 @@ static UniValue smsginbox(const JSONRPCRequest &request)
                         {
                             {"updatestatus", RPCArg::Type::BOOL, /* default */ "true", "Update read status if true."},
                             {"encoding", RPCArg::Type::STR, /* default */ "text", "Display message data in encoding, values: \"text\", \"hex\", \"none\"."},
+                            {"from", RPCArg::Type::STR, /* default */ "", "Only list messages sent from address."},
+                            {"to", RPCArg::Type::STR, /* default */ "", "Only list messages sent to address."},
+                            {"count", RPCArg::Type::NUM, /* default */ "0", "Maximum number of messages to list, 0 for all."},
+                            {"cursor", RPCArg::Type::STR, /* default */ "", "List messages after msgid, pass the cursor returned by the previous page."},
                         },
                         "options"},
                 },
@@ -1041,16 +1208,15 @@ static UniValue smsginbox(const JSONRPCRequest &request)
     std::string mode = request.params[0].isStr() ? request.params[0].get_str() : "unread";
     std::string filter = request.params[1].isStr() ? request.params[1].get_str() : "";
 
-    std::string sEnc = "text";
-    bool update_status = true;
+    MessageListParams params;
+    params.filter = filter;
+    params.update_status = true;
     if (request.params[2].isObject()) {
         UniValue options = request.params[2].get_obj();
         if (options["updatestatus"].isBool()) {
-            update_status = options["updatestatus"].get_bool();
-        }
-        if (options["encoding"].isStr()) {
-            sEnc = options["encoding"].get_str();
+            params.update_status = options["updatestatus"].get_bool();
         }
+        ParseMessageListOptions(options, params);
     }
 
     UniValue result(UniValue::VOBJ);
@@ -1081,88 +1247,8 @@ static UniValue smsginbox(const JSONRPCRequest &request)
         } else
         if (mode == "all"
             || mode == "unread") {
-            int fCheckReadStatus = mode == "unread" ? 1 : 0;
-
-            smsg::SecMsgStored smsgStored;
-            smsg::MessageData msg;
-
-            dbInbox.TxnBegin();
-
-            leveldb::Iterator *it = dbInbox.pdb->NewIterator(leveldb::ReadOptions());
-            UniValue messageList(UniValue::VARR);
-
-            while (dbInbox.NextSmesg(it, smsg::DBK_INBOX, chKey, smsgStored)) {
-                if (fCheckReadStatus
-                    && !(smsgStored.status & SMSG_MASK_UNREAD)) {
-                    continue;
-                }
-                uint8_t *pHeader = &smsgStored.vchMessage[0];
-                const smsg::SecureMessage *psmsg = (smsg::SecureMessage*) pHeader;
-
-                UniValue objM(UniValue::VOBJ);
-                objM.pushKV("msgid", HexStr(&chKey[2], &chKey[2] + 28)); // timestamp+hash
-                objM.pushKV("version", strprintf("%02x%02x", psmsg->version[0], psmsg->version[1]));
-
-                uint32_t nPayload = smsgStored.vchMessage.size() - smsg::SMSG_HDR_LEN;
-                int rv = smsgModule.Decrypt(false, smsgStored.addrTo, pHeader, pHeader + smsg::SMSG_HDR_LEN, nPayload, msg);
-                if (rv == 0) {
-                    std::string sAddrTo = EncodeDestination(PKHash(smsgStored.addrTo));
-                    std::string sText = std::string((char*)msg.vchMessage.data());
-                    if (filter.size() > 0
-                        && !(part::stringsMatchI(msg.sFromAddress, filter, 3) ||
-                            part::stringsMatchI(sAddrTo, filter, 3) ||
-                            part::stringsMatchI(sText, filter, 3))) {
-                        continue;
-                    }
-
-                    PushTime(objM, "received", smsgStored.timeReceived);
-                    PushTime(objM, "sent", msg.timestamp);
-                    objM.pushKV("paid", UniValue(psmsg->IsPaidVersion()));
-
-                    int64_t ttl = psmsg->m_ttl;
-                    objM.pushKV("ttl", ttl);
-                    int nDaysRetention = ttl / smsg::SMSG_SECONDS_IN_DAY;
-                    objM.pushKV("daysretention", nDaysRetention);
-                    PushTime(objM, "expiration", psmsg->timestamp + ttl);
-
-                    uint32_t nPayload = smsgStored.vchMessage.size() - smsg::SMSG_HDR_LEN;
-                    objM.pushKV("payloadsize", (int)nPayload);
-
-                    objM.pushKV("from", msg.sFromAddress);
-                    objM.pushKV("to", sAddrTo);
-                    if (sEnc == "none") {
-                    } else
-                    if (sEnc == "text") {
-                        objM.pushKV("text", sText);
-                    } else
-                    if (sEnc == "hex") {
-                        objM.pushKV("hex", HexStr(sText));
-                    } else {
-                        objM.pushKV("unknown_encoding", sEnc);
-                    }
-                } else {
-                    if (filter.size() > 0) {
-                        continue;
-                    }
-
-                    objM.pushKV("status", "Decrypt failed");
-                    objM.pushKV("error", smsg::GetString(rv));
-                }
-
-                messageList.push_back(objM);
-
-                // Only set 'read' status if the message decrypted successfully and update_status is set
-                if (fCheckReadStatus && rv == 0 && update_status) {
-                    smsgStored.status &= ~SMSG_MASK_UNREAD;
-                    dbInbox.WriteSmesg(chKey, smsgStored);
-                }
-                nMessages++;
-            }
-            delete it;
-            dbInbox.TxnCommit();
-
-            result.pushKV("messages", messageList);
-            result.pushKV("result", strprintf("%u", nMessages));
+            params.unread_only = mode == "unread";
+            ListIndexedMessages(dbInbox, params, result);
         } else {
             result.pushKV("result", "Unknown Mode.");
             result.pushKV("expected", "all|unread|clear.");
@@ -1176,6 +1262,7 @@ static UniValue smsgoutbox(const JSONRPCRequest &request)
 {
             RPCHelpMan{"smsgoutbox",
                 "\nDecrypt and display all sent messages.\n"
+                "When count messages are listed the result includes a cursor to list the next page from.\n"
                 "Warning: \"mode\"=\"clear\" will delete all sent messages.\n",
                 {
                     {"mode", RPCArg::Type::STR, /* default */ "all", "all|clear, List or clear messages."},
@@ -1183,7 +1270,11 @@ static UniValue smsgoutbox(const JSONRPCRequest &request)
                     {"options", RPCArg::Type::OBJ, /* default */ "", "",
                         {
                             {"encoding", RPCArg::Type::STR, /* default */ "text", "Display message data in encoding, values: \"text\", \"hex\", \"none\"."},
-                            {"sending", RPCArg::Type::BOOL, /* default */ "false", "Display messages in sending queue."},
+                            {"sending", RPCArg::Type::BOOL, /* default */ "false", "Display messages in sending queue, from, to, count and cursor are ignored."},
+                            {"from", RPCArg::Type::STR, /* default */ "", "Only list messages sent from address."},
+                            {"to", RPCArg::Type::STR, /* default */ "", "Only list messages sent to address."},
+                            {"count", RPCArg::Type::NUM, /* default */ "0", "Maximum number of messages to list, 0 for all."},
+                            {"cursor", RPCArg::Type::STR, /* default */ "", "List messages after msgid, pass the cursor returned by the previous page."},
                         },
                         "options"},
                 },
@@ -1211,16 +1302,17 @@ static UniValue smsgoutbox(const JSONRPCRequest &request)
     std::string filter = request.params[1].isStr() ? request.params[1].get_str() : "";
 
     bool show_sending = false;
-    std::string sEnc = "text";
+    MessageListParams params;
+    params.inbox = false;
+    params.filter = filter;
     if (request.params[2].isObject()) {
         UniValue options = request.params[2].get_obj();
-        if (options["encoding"].isStr()) {
-            sEnc = options["encoding"].get_str();
-        }
         if (options["sending"].isBool()) {
             show_sending = options["sending"].get_bool();
         }
+        ParseMessageListOptions(options, params);
     }
+    const std::string &sEnc = params.encoding;
 
     UniValue result(UniValue::VOBJ);
 
@@ -1251,6 +1343,9 @@ static UniValue smsgoutbox(const JSONRPCRequest &request)
 
             result.pushKV("result", strprintf("Deleted %u messages.", nMessages));
         } else
+        if (mode == "all" && !show_sending) {
+            ListIndexedMessages(dbOutbox, params, result);
+        } else
         if (mode == "all") {
             smsg::SecMsgStored smsgStored;
             smsg::MessageData msg;
@@ -1363,7 +1458,6 @@ static UniValue smsgbuckets(const JSONRPCRequest &request)
                 const std::set<smsg::SecMsgToken> &tokenSet = it->second.setTokens;
 
                 std::string sBucket = std::to_string(it->first);
-                std::string sFile = sBucket + "_01.dat";
                 std::string sHash = std::to_string(it->second.hash);
 
                 size_t nActiveMessages = it->second.CountActive();
@@ -1381,7 +1475,7 @@ static UniValue smsgbuckets(const JSONRPCRequest &request)
                     objM.pushKV("last changed", part::GetTimeString(it->second.timeChanged, cbuf, sizeof(cbuf)));
                 }
 
-                fs::path fullPath = GetDataDir() / smsg::STORE_DIR / sFile;
+                fs::path fullPath = smsg::CBucketStore::DataPath(it->first, 1);
                 if (!fs::exists(fullPath)) {
                     if (tokenSet.size() == 0) {
                         objM.pushKV("file size", "Empty bucket.");
@@ -1391,10 +1485,18 @@ static UniValue smsgbuckets(const JSONRPCRequest &request)
                 } else {
                     try {
                         uint64_t nFBytes = 0;
-                        nFBytes = fs::file_size(fullPath);
+                        for (int nFile = 1; nFile <= it->second.nLastFile; ++nFile) {
+                            fullPath = smsg::CBucketStore::DataPath(it->first, nFile);
+                            if (fs::exists(fullPath)) {
+                                nFBytes += fs::file_size(fullPath);
+                            }
+                        }
                         nBytes += nFBytes;
                         if (show_buckets) {
                             objM.pushKV("file size", part::BytesReadable(nFBytes));
+                            if (it->second.nLastFile > 1) {
+                                objM.pushKV("files", it->second.nLastFile);
+                            }
                         }
                     } catch (const fs::filesystem_error& ex) {
                         objM.pushKV("file size, error", ex.what());
@@ -1421,17 +1523,11 @@ static UniValue smsgbuckets(const JSONRPCRequest &request)
             LOCK(smsgModule.cs_smsg);
             std::map<int64_t, smsg::SecMsgBucket>::iterator it;
             for (it = smsgModule.buckets.begin(); it != smsgModule.buckets.end(); ++it) {
-                std::string sFile = std::to_string(it->first) + "_01.dat";
-
-                try {
-                    fs::path fullPath = GetDataDir() / smsg::STORE_DIR / sFile;
-                    fs::remove(fullPath);
-                } catch (const fs::filesystem_error& ex) {
-                    //objM.push_back(Pair("file size, error", ex.what()));
-                    LogPrintf("Error removing bucket file %s.\n", ex.what());
-                }
+                smsgModule.m_bucket_store.EraseFiles(it->first);
             }
+            smsgModule.m_bucket_store.Clear();
             smsgModule.buckets.clear();
+            smsgModule.m_changed_buckets.clear();
             smsgModule.start_time = GetAdjustedTime();
         } // cs_smsg
 
@@ -1909,12 +2005,14 @@ static UniValue smsgimport(const JSONRPCRequest &request)
                         {
                             {"submitmsg", RPCArg::Type::BOOL, /* default */ "false", "Submit msg to network if true."},
                             {"setread", RPCArg::Type::BOOL, /* default */ "false", "Set read status to value."},
+                            {"async", RPCArg::Type::BOOL, /* default */ "false", "Return without waiting for the proof of work, the msg is queued for sending."},
                         },
                         "options"},
                 },
                 RPCResult{
             "{\n"
             "  \"msgid\": \"...\"                    (string) The message identifier\n"
+            "  \"queued\": true|false              (boolean) True if the msg was queued for the proof of work thread\n"
             "}\n"
                 },
                 RPCExamples{
@@ -1954,12 +2052,17 @@ static UniValue smsgimport(const JSONRPCRequest &request)
     if (options.isObject() && options["submitmsg"].isBool()) {
         submitmsg = options["submitmsg"].get_bool();
     }
+    bool async = false;
+    if (options.isObject() && options["async"].isBool()) {
+        async = options["async"].get_bool();
+    }
 
-    if (smsgModule.Import(&smsg, str_error, setread, submitmsg) != 0) {
+    if (smsgModule.Import(&smsg, str_error, setread, submitmsg, async) != 0) {
         smsg.pPayload = nullptr;
         throw JSONRPCError(RPC_MISC_ERROR, "Import failed: " + str_error);
     }
     result.pushKV("msgid", HexStr(smsgModule.GetMsgID(smsg)));
+    result.pushKV("queued", submitmsg && async);
 
     smsg.pPayload = nullptr;
 
@@ -2101,6 +2204,7 @@ static UniValue smsggetinfo(const JSONRPCRequest &request)
             "{\n"
             "  \"enabled\": true|false,         (boolean) if SMSG is enabled or not\n"
             "  \"wallet\": \"...\"              (string) name of the currently active wallet or \"None set\"\n"
+            "  \"fundingcache\": {...}        (object) entries, maxentries, hits and misses of the paid message funding transaction cache\n"
             "}\n"
                 },
                 RPCExamples{
@@ -2122,6 +2226,13 @@ static UniValue smsggetinfo(const JSONRPCRequest &request)
         }
         obj.pushKV("enabled_wallets", wallet_names);
 #endif
+        smsg::FundingCacheStats stats = smsgModule.m_funding_cache.GetStats();
+        UniValue cache(UniValue::VOBJ);
+        cache.pushKV("entries", (uint64_t)stats.nEntries);
+        cache.pushKV("maxentries", (uint64_t)stats.nMaxEntries);
+        cache.pushKV("hits", stats.nHits);
+        cache.pushKV("misses", stats.nMisses);
+        obj.pushKV("fundingcache", cache);
     }
 
     return obj;
@@ -2249,6 +2360,11 @@ static UniValue smsgzmqpush(const JSONRPCRequest &request)
             uint160 hash(vchUint160);
 
             GetMainSignals().NewSecureMessage(psmsg, hash);
+            uint32_t nPayload = smsgStored.vchMessage.size() - smsg::SMSG_HDR_LEN;
+            smsg::MessageData msg;
+            bool fDecrypted = smsgModule.Decrypt(false, smsgStored.addrTo, pHeader, pHeader + smsg::SMSG_HDR_LEN, nPayload, msg) == 0;
+            GetMainSignals().NewSecureMessageData(pHeader, pHeader + smsg::SMSG_HDR_LEN, nPayload,
+                &smsgStored.addrTo, fDecrypted ? &msg : nullptr);
             num_sent++;
         }
         delete it;
@@ -27,7 +27,9 @@ Notes:
 #include <secp256k1.h>
 #include <secp256k1_ecdh.h>
 #include <crypto/hmac_sha256.h>
+#include <crypto/sha256.h>
 #include <crypto/sha512.h>
+#include <crypto/common.h>
 #include <wallet/ismine.h>
 #include <support/allocators/secure.h>
 #include <util/strencodings.h>
@@ -54,7 +56,10 @@ Notes:
 
 #include <stdint.h>
 #include <time.h>
+#include <atomic>
+#include <algorithm>
 #include <map>
+#include <thread>
 #include <stdexcept>
 #include <errno.h>
 #include <limits>
@@ -117,37 +122,94 @@ std::string SecMsgToken::ToString() const
     return strprintf("%d-%08x", timestamp, *((uint64_t*)sample));
 }
 
-void SecMsgBucket::hashBucket(int64_t bucket_time)
+static uint32_t TokenHash(const SecMsgToken &token)
 {
-    XXH32_state_t *state = XXH32_createState();
-    XXH32_reset(state, 1);
+    uint8_t buf[16];
+    WriteLE64(buf, token.timestamp);
+    memcpy(buf + 8, token.sample, 8);
+    return XXH32(buf, 16, 1);
+};
 
-    int64_t now = GetAdjustedTime();
+void SecMsgBucket::Activate(const SecMsgToken &token)
+{
+    if (!m_expiry.emplace(token.timestamp + token.ttl, &token).second) {
+        return;
+    }
+    hash += TokenHash(token);
+    nActive++;
+    m_hash_legacy_valid = false;
+    timeChanged = GetTime();
+};
 
-    nActive = 0;
-    nLeastTTL = 0;
-    for (auto it = setTokens.begin(); it != setTokens.end(); ++it) {
-        if (it->timestamp + it->ttl < now) {
-            continue;
-        }
+void SecMsgBucket::Deactivate(const SecMsgToken &token)
+{
+    if (m_expiry.erase(std::make_pair(token.timestamp + token.ttl, &token)) == 0) {
+        return;
+    }
+    hash -= TokenHash(token);
+    nActive--;
+    m_hash_legacy_valid = false;
+    timeChanged = GetTime();
+};
 
-        XXH32_update(state, it->sample, 8);
-        if (it->ttl > 0 && (nLeastTTL == 0 || it->ttl < nLeastTTL)) {
-            nLeastTTL = it->ttl;
-        }
-        nActive++;
+bool SecMsgBucket::InsertToken(const SecMsgToken &token, int64_t now)
+{
+    auto ret = setTokens.insert(token);
+    if (!ret.second) {
+        return false;
+    }
+    if (token.timestamp + token.ttl >= now) {
+        Activate(*ret.first);
     }
+    return true;
+};
 
-    uint32_t hash_new = XXH32_digest(state);
-    XXH32_freeState(state);
+std::set<SecMsgToken>::iterator SecMsgBucket::EraseToken(std::set<SecMsgToken>::iterator it)
+{
+    Deactivate(*it);
+    return setTokens.erase(it);
+};
 
-    if (hash != hash_new) {
-        LogPrint(BCLog::SMSG, "Bucket %d hashed %u messages updated from %u to %u.\n", bucket_time, nActive, hash, hash_new);
+void SecMsgBucket::PurgeToken(std::set<SecMsgToken>::iterator it)
+{
+    Deactivate(*it);
+    it->ttl = 0;
+};
 
-        hash = hash_new;
-        timeChanged = GetTime();
+bool SecMsgBucket::ExpireTokens(int64_t now)
+{
+    bool fChanged = false;
+    while (!m_expiry.empty() && m_expiry.begin()->first < now) {
+        Deactivate(*m_expiry.begin()->second);
+        fChanged = true;
     }
-    return;
+    return fChanged;
+};
+
+uint32_t SecMsgBucket::LegacyHash() const
+{
+    if (m_hash_legacy_valid) {
+        return m_hash_legacy;
+    }
+
+    // Older peers hash the samples of the active tokens in set order
+    XXH32_state_t *state = XXH32_createState();
+    XXH32_reset(state, 1);
+    for (const auto &token : setTokens) {
+        if (m_expiry.count(std::make_pair(token.timestamp + token.ttl, &token))) {
+            XXH32_update(state, token.sample, 8);
+        }
+    }
+    m_hash_legacy = XXH32_digest(state);
+    XXH32_freeState(state);
+
+    m_hash_legacy_valid = true;
+    return m_hash_legacy;
+};
+
+uint32_t SecMsgBucket::GetHash(int nVersion) const
+{
+    return nVersion >= SMSG_VERSION_SUM_HASH ? hash : LegacyHash();
 };
 
 size_t SecMsgBucket::CountActive() const
@@ -182,11 +244,11 @@ void ThreadSecureMsg()
             for (std::map<int64_t, SecMsgBucket>::iterator it(smsgModule.buckets.begin()); it != smsgModule.buckets.end(); ) {
                 bool fErase = it->first < cutoffTime;
 
-                if (!fErase
-                    && it->first + it->second.nLeastTTL < now) {
-                    it->second.hashBucket(it->first);
+                if (!fErase) {
+                    if (it->second.ExpireTokens(now)) {
+                        smsgModule.SetBucketChanged(it->first, it->second);
+                    }
 
-                    // TODO: periodically prune files
                     if (it->second.nActive < 1) {
                         fErase = true;
                     }
@@ -197,18 +259,10 @@ void ThreadSecureMsg()
 
                     std::string fileName = std::to_string(it->first);
 
-                    fs::path fullPath = GetDataDir() / STORE_DIR / (fileName + "_01.dat");
-                    if (fs::exists(fullPath)) {
-                        try { fs::remove(fullPath);
-                        } catch (const fs::filesystem_error &ex) {
-                            LogPrintf("Error removing bucket file %s.\n", ex.what());
-                        }
-                    } else {
-                        LogPrintf("Path %s does not exist.\n", fullPath.string());
-                    }
+                    smsgModule.m_bucket_store.EraseFiles(it->first);
 
                     // Look for a wl file, it stores incoming messages when wallet is locked
-                    fullPath = GetDataDir() / STORE_DIR / (fileName + "_01_wl.dat");
+                    fs::path fullPath = GetDataDir() / STORE_DIR / (fileName + "_01_wl.dat");
                     if (fs::exists(fullPath)) {
                         try { fs::remove(fullPath);
                         } catch (const fs::filesystem_error &ex) {
@@ -216,7 +270,7 @@ void ThreadSecureMsg()
                         }
                     }
 
-                    smsgModule.buckets.erase(it++);
+                    smsgModule.EraseBucket(it++);
                 } else {
                     if (it->second.nLockCount > 0) { // Tick down nLockCount, to eventually expire if peer never sends data
                         it->second.nLockCount--;
@@ -301,6 +355,13 @@ void ThreadSecureMsg()
     return;
 };
 
+/** Receiving key scan thread
+  */
+static void ThreadSecureMsgScan()
+{
+    smsgModule.m_scan_queue.Thread();
+};
+
 /** Proof of work thread
   */
 void ThreadSecureMsgPow()
@@ -440,6 +501,10 @@ void AddOptions()
     gArgs.AddArg("-smsgsaddnewkeys", "Scan for incoming messages on new wallet keys. (default: false)", ArgsManager::ALLOW_ANY, OptionsCategory::SMSG);
     gArgs.AddArg("-smsgbantime=<n>", strprintf("Number of seconds to ignore misbehaving peers for (default: %u)", SMSG_DEFAULT_BANTIME), ArgsManager::ALLOW_ANY, OptionsCategory::SMSG);
     gArgs.AddArg("-smsgmaxreceive=<n>", strprintf("Max number of data messages to tolerate from peers, counter decreases over time (default: %u)", SMSG_DEFAULT_MAXRCV), ArgsManager::ALLOW_ANY, OptionsCategory::SMSG);
+    gArgs.AddArg("-smsgscanthreads=<n>", strprintf("Number of threads used to test receiving keys against incoming messages, 0 = number of cores, up to %d (default: %d)", SMSG_MAX_SCAN_THREADS, SMSG_DEFAULT_SCAN_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::SMSG);
+    gArgs.AddArg("-smsgpowthreads=<n>", strprintf("Number of threads used to find the proof of work for outgoing messages, 0 = number of cores, up to %d (default: %d)", SMSG_MAX_POW_THREADS, SMSG_DEFAULT_POW_THREADS), ArgsManager::ALLOW_ANY, OptionsCategory::SMSG);
+    gArgs.AddArg("-smsgfundingcache=<n>", strprintf("Number of paid message funding transactions to cache (default: %u)", SMSG_DEFAULT_FUNDING_CACHE), ArgsManager::ALLOW_ANY, OptionsCategory::SMSG);
+    gArgs.AddArg("-smsgmaxfilesize=<n>", strprintf("Size in MiB at which a new message store file is started for a bucket (default: %u)", SMSG_DEFAULT_MAX_FILE_SIZE), ArgsManager::ALLOW_ANY, OptionsCategory::SMSG);
     gArgs.AddArg("-smsgsregtestadjust", "Adjust durations in regtest (default: true)", ArgsManager::ALLOW_ANY, OptionsCategory::HIDDEN);
     return;
 };
@@ -523,17 +588,42 @@ int CSMSG::BuildBucketSet()
         }
 
         std::string fileType = itd->path().extension().string();
+        std::string fileName = itd->path().filename().string();
+
+        if (fileType.compare(".tmp") == 0) {
+            // Remove files left by an interrupted compaction
+            LogPrintf("Dropping file %s, incomplete.\n", fileName);
+            try {
+                fs::remove(itd->path());
+            } catch (const fs::filesystem_error &ex) {
+                LogPrintf("Error removing file %s, %s.\n", fileName, ex.what());
+            }
+            continue;
+        }
+
+        if (fileType.compare(".idx") == 0) {
+            // Remove index files left behind by removed buckets
+            fs::path pathData = itd->path();
+            pathData.replace_extension(".dat");
+            if (!fs::exists(pathData)) {
+                LogPrintf("Dropping file %s, no bucket file.\n", fileName);
+                try {
+                    fs::remove(itd->path());
+                } catch (const fs::filesystem_error &ex) {
+                    LogPrintf("Error removing index file %s, %s.\n", fileName, ex.what());
+                }
+            }
+            continue;
+        }
 
         if (fileType.compare(".dat") != 0) {
             continue;
         }
 
         nFiles++;
-        std::string fileName = itd->path().filename().string();
 
         LogPrint(BCLog::SMSG, "Processing file: %s.\n", fileName);
 
-        // TODO files must be split if > 2GB
         // time_noFile.dat
         size_t sep = fileName.find_first_of("_");
         if (sep == std::string::npos) {
@@ -551,6 +641,11 @@ int CSMSG::BuildBucketSet()
             LogPrintf("Dropping file %s, expired.\n", fileName);
             try {
                 fs::remove(itd->path());
+                fs::path pathIndex = itd->path();
+                pathIndex.replace_extension(".idx");
+                if (fs::exists(pathIndex)) {
+                    fs::remove(pathIndex);
+                }
             } catch (const fs::filesystem_error &ex) {
                 LogPrintf("Error removing bucket file %s, %s.\n", fileName, ex.what());
             }
@@ -562,67 +657,187 @@ int CSMSG::BuildBucketSet()
             continue;
         }
 
+        int nFile;
+        if (!ParseInt32(fileName.substr(sep + 1, fileName.size() - (sep + 1) - fileType.size()), &nFile) || nFile < 1) {
+            LogPrintf("%s: Bad file number %s.\n", __func__, fileName);
+            continue;
+        }
+
         size_t nTokenSetSize = 0;
-        SecureMessage smsg;
         {
             LOCK(cs_smsg);
 
-            SecMsgBucket &bucket = buckets[fileTime];
-            std::set<SecMsgToken> &tokenSet = bucket.setTokens;
-
-            FILE *fp;
-            if (!(fp = fopen(itd->path().string().c_str(), "rb"))) {
-                LogPrintf("Error opening file: %s\n", strerror(errno));
+            std::vector<SecMsgIndexRecord> vRecords;
+            if (!m_bucket_store.LoadIndex(fileTime, nFile, vRecords)) {
+                LogPrintf("Error loading bucket file: %s\n", fileName);
                 continue;
             }
 
-            for (;;) {
-                long int ofs = ftell(fp);
-                SecMsgToken token;
-                token.offset = ofs;
-                errno = 0;
-                if (fread(smsg.data(), sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN) {
-                    if (errno != 0) {
-                        LogPrintf("fread header failed: %s\n", strerror(errno));
-                    } else {
-                        //LogPrintf("End of file.\n");
-                    }
-                    break;
-                }
-                token.timestamp = smsg.timestamp;
-                token.ttl = smsg.version[0] == 0 && smsg.version[1] == 0 ? 0  // Purged message header
-                    : smsg.m_ttl;
-                token.m_changed = now - fileTime;
-                if (smsg.m_ttl > 0 && (bucket.nLeastTTL == 0 || smsg.m_ttl < bucket.nLeastTTL)) {
-                    bucket.nLeastTTL = smsg.m_ttl;
-                }
-                if (smsg.nPayload < 8) {
+            SecMsgBucket &bucket = buckets[fileTime];
+            std::set<SecMsgToken> &tokenSet = bucket.setTokens;
+            bucket.nLastFile = std::max(bucket.nLastFile, nFile);
+            nTokenSetSize = tokenSet.size();
+
+            for (const auto &record : vRecords) {
+                if (record.nPayload < 8) {
                     continue;
                 }
-                if (fread(token.sample, sizeof(uint8_t), 8, fp) != 8) {
-                    LogPrintf("fread failed: %s\n", strerror(errno));
-                    break;
-                }
-                if (fseek(fp, smsg.nPayload-8, SEEK_CUR) != 0) {
-                    LogPrintf("fseek failed: %s.\n", strerror(errno));
-                    break;
-                }
-                tokenSet.insert(token);
+                SecMsgToken token(record.timestamp, record.sample, record.nPayload, record.offset, record.ttl);
+                token.m_changed = now - fileTime;
+                token.m_file = nFile;
+                bucket.InsertToken(token, now);
             }
 
-            fclose(fp);
-            bucket.hashBucket(fileTime);
-            nTokenSetSize = tokenSet.size();
+            SetBucketChanged(fileTime, bucket);
+            nTokenSetSize = tokenSet.size() - nTokenSetSize;
         } // cs_smsg
 
         nMessages += nTokenSetSize;
-        LogPrint(BCLog::SMSG, "Bucket %d contains %u messages.\n", fileTime, nTokenSetSize);
+        LogPrint(BCLog::SMSG, "Bucket %d file %d contains %u messages.\n", fileTime, nFile, nTokenSetSize);
     }
 
     LogPrintf("Processed %u files, loaded %u buckets containing %u messages.\n", nFiles, buckets.size(), nMessages);
     return SMSG_NO_ERROR;
 };
 
+void CSMSG::SetBucketChanged(int64_t bucket_time, SecMsgBucket &bucket)
+{
+    AssertLockHeld(cs_smsg);
+    if (bucket.nChangeSeq != 0) {
+        m_changed_buckets.erase(bucket.nChangeSeq);
+    }
+    bucket.nChangeSeq = ++m_change_seq;
+    m_changed_buckets[bucket.nChangeSeq] = bucket_time;
+};
+
+void CSMSG::EraseBucket(std::map<int64_t, SecMsgBucket>::iterator it)
+{
+    AssertLockHeld(cs_smsg);
+    m_changed_buckets.erase(it->second.nChangeSeq);
+    buckets.erase(it);
+};
+
+int CSMSG::CompactBuckets()
+{
+    if (!fSecMsgEnabled) {
+        return SMSG_DISABLED;
+    }
+
+    // Find bucket files where removed and expired messages take up enough space
+    std::vector<std::pair<int64_t, int> > vFiles;
+    {
+        LOCK(cs_smsg);
+        int64_t now = GetAdjustedTime();
+        for (const auto &b : buckets) {
+            if (b.first < now - SMSG_RETENTION || b.second.nActive < 1) {
+                continue; // The whole bucket will be removed by ThreadSecureMsg
+            }
+            std::map<int, std::pair<uint64_t, uint64_t> > mapSizes; // file, (live bytes, dead bytes)
+            for (const auto &token : b.second.setTokens) {
+                auto &sizes = mapSizes[token.m_file];
+                (token.timestamp + token.ttl < now ? sizes.second : sizes.first) += SMSG_HDR_LEN + token.nPayload;
+            }
+            for (const auto &f : mapSizes) {
+                uint64_t nDead = f.second.second, nTotal = f.second.first + f.second.second;
+                if (nDead >= SMSG_COMPACT_MIN_BYTES
+                    && nDead * 100 >= nTotal * SMSG_COMPACT_MIN_PERCENT) {
+                    vFiles.emplace_back(b.first, f.first);
+                }
+            }
+        }
+    }
+
+    for (const auto &f : vFiles) {
+        if (!fSecMsgEnabled) {
+            return SMSG_DISABLED;
+        }
+        int64_t bucket_time = f.first;
+        int nFile = f.second;
+        fs::path pathData = CBucketStore::DataPath(bucket_time, nFile);
+
+        std::vector<SecMsgToken> vLive;
+        uint64_t nFileSize;
+        {
+            LOCK(cs_smsg);
+            auto itb = buckets.find(bucket_time);
+            if (itb == buckets.end()) {
+                continue;
+            }
+            int64_t now = GetAdjustedTime();
+            for (const auto &token : itb->second.setTokens) {
+                if (token.m_file == nFile && token.timestamp + token.ttl >= now) {
+                    vLive.push_back(token);
+                }
+            }
+            try {
+                nFileSize = fs::file_size(pathData);
+            } catch (const fs::filesystem_error &ex) {
+                LogPrintf("%s: Bucket %d file %d, %s.\n", __func__, bucket_time, nFile, ex.what());
+                continue;
+            }
+        }
+
+        // Copy the live messages without holding cs_smsg
+        std::sort(vLive.begin(), vLive.end(), [](const SecMsgToken &a, const SecMsgToken &b) { return a.offset < b.offset; });
+        std::vector<int64_t> vOffsets, vNewOffsets;
+        for (const auto &token : vLive) {
+            vOffsets.push_back(token.offset);
+        }
+        if (!CBucketStore::WriteCompacted(bucket_time, nFile, vOffsets, vNewOffsets)) {
+            LogPrintf("%s: Failed to compact bucket %d file %d.\n", __func__, bucket_time, nFile);
+            continue;
+        }
+
+        LOCK(cs_smsg);
+        // Abort if a message was added to or removed from the file while copying
+        auto itb = buckets.find(bucket_time);
+        bool fChanged = itb == buckets.end();
+        try {
+            fChanged = fChanged || fs::file_size(pathData) != nFileSize;
+        } catch (const fs::filesystem_error &ex) {
+            fChanged = true;
+        }
+        for (size_t i = 0; !fChanged && i < vLive.size(); ++i) {
+            auto it = itb->second.setTokens.find(vLive[i]);
+            fChanged = it == itb->second.setTokens.end()
+                || it->m_file != nFile || it->offset != vLive[i].offset || it->ttl != vLive[i].ttl;
+        }
+        if (fChanged) {
+            LogPrint(BCLog::SMSG, "Bucket %d file %d changed during compaction.\n", bucket_time, nFile);
+            CBucketStore::RemoveCompacted(bucket_time, nFile);
+            continue;
+        }
+
+        if (!m_bucket_store.SwapCompacted(bucket_time, nFile)) {
+            continue;
+        }
+
+        SecMsgBucket &bucket = itb->second;
+        for (size_t i = 0; i < vLive.size(); ++i) {
+            bucket.setTokens.find(vLive[i])->offset = vNewOffsets[i];
+        }
+        std::set<SecMsgToken> setLive(vLive.begin(), vLive.end());
+        size_t nDropped = 0;
+        uint32_t nActive = bucket.nActive;
+        for (auto it = bucket.setTokens.begin(); it != bucket.setTokens.end(); ) {
+            if (it->m_file == nFile && setLive.count(*it) == 0) {
+                it = bucket.EraseToken(it);
+                nDropped++;
+            } else {
+                ++it;
+            }
+        }
+        if (bucket.nActive != nActive) {
+            SetBucketChanged(bucket_time, bucket);
+        }
+
+        LogPrint(BCLog::SMSG, "Compacted bucket %d file %d, kept %u messages, dropped %u, %u -> %u bytes.\n",
+            bucket_time, nFile, vLive.size(), nDropped, nFileSize, vLive.empty() ? 0 : vNewOffsets.back() + SMSG_HDR_LEN + vLive.back().nPayload);
+    }
+
+    return SMSG_NO_ERROR;
+};
+
 int CSMSG::BuildPurgedSets()
 {
     LogPrint(BCLog::SMSG, "%s\n", __func__);
@@ -890,6 +1105,18 @@ bool CSMSG::Start(std::shared_ptr<CWallet> pwalletIn, std::vector<std::shared_pt
     }
 
     m_smsg_max_receive_count = gArgs.GetArg("-smsgmaxreceive", SMSG_DEFAULT_MAXRCV);
+    m_scan_threads = gArgs.GetArg("-smsgscanthreads", SMSG_DEFAULT_SCAN_THREADS);
+    if (m_scan_threads <= 0) {
+        m_scan_threads = GetNumCores();
+    }
+    m_scan_threads = std::max(1, std::min(m_scan_threads, SMSG_MAX_SCAN_THREADS));
+    m_pow_threads = gArgs.GetArg("-smsgpowthreads", SMSG_DEFAULT_POW_THREADS);
+    if (m_pow_threads <= 0) {
+        m_pow_threads = GetNumCores();
+    }
+    m_pow_threads = std::max(1, std::min(m_pow_threads, SMSG_MAX_POW_THREADS));
+    m_max_file_size = std::max((int64_t)1, gArgs.GetArg("-smsgmaxfilesize", SMSG_DEFAULT_MAX_FILE_SIZE)) * 1024 * 1024;
+    m_funding_cache.SetMaxEntries(std::max((int64_t)0, gArgs.GetArg("-smsgfundingcache", SMSG_DEFAULT_FUNDING_CACHE)));
 
 #ifdef ENABLE_WALLET
     UnloadAllWallets();
@@ -960,6 +1187,9 @@ bool CSMSG::Start(std::shared_ptr<CWallet> pwalletIn, std::vector<std::shared_pt
 
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg", &ThreadSecureMsg));
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg-pow", &ThreadSecureMsgPow));
+    for (int i = 1; i < m_scan_threads; ++i) { // The thread scanning a message works through the queue too
+        threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg-scan", &ThreadSecureMsgScan));
+    }
 
 #ifdef ENABLE_WALLET
     m_wallet_load_handler = interfaces::MakeHandler(NotifyWalletAdded.connect(boost::bind(&ListenWalletAdded, this, _1)));
@@ -993,6 +1223,14 @@ bool CSMSG::Shutdown()
     }
 
     keyStore.Clear();
+    {
+        LOCK(cs_trial_keys);
+        m_trial_keys.Clear();
+    }
+    {
+        LOCK(cs_smsg);
+        m_bucket_store.Clear();
+    }
 
     if (secp256k1_context_smsg) {
         secp256k1_context_destroy(secp256k1_context_smsg);
@@ -1022,6 +1260,7 @@ bool CSMSG::Enable(std::shared_ptr<CWallet> pactive_wallet, std::vector<std::sha
 
         addresses.clear(); // should be empty already
         buckets.clear(); // should be empty already
+        m_changed_buckets.clear();
 
         if (!Start(pactive_wallet, vpwallets, false)) {
             return error("%s: SecureMsgStart failed.\n", __func__);
@@ -1038,7 +1277,7 @@ bool CSMSG::Enable(std::shared_ptr<CWallet> pactive_wallet, std::vector<std::sha
             g_connman->PushMessage(pnode,
                 CNetMsgMaker(INIT_PROTO_VERSION).Make(SMSGMsgType::PING)); // smsgData.fEnabled will be set on receiving smsgPong response from peer
             g_connman->PushMessage(pnode,
-                CNetMsgMaker(INIT_PROTO_VERSION).Make(SMSGMsgType::PONG)); // Send pong as have missed initial ping sent by peer when it connected
+                CNetMsgMaker(INIT_PROTO_VERSION).Make(SMSGMsgType::PONG, SMSG_VERSION)); // Send pong as have missed initial ping sent by peer when it connected
         }
     }
 
@@ -1062,11 +1301,8 @@ bool CSMSG::Disable()
         }
 
         // Clear buckets
-        std::map<int64_t, SecMsgBucket>::iterator it;
-        for (it = buckets.begin(); it != buckets.end(); ++it) {
-            it->second.setTokens.clear();
-        }
         buckets.clear();
+        m_changed_buckets.clear();
         addresses.clear();
     }
 
@@ -1108,6 +1344,7 @@ bool CSMSG::LoadWallet(std::shared_ptr<CWallet> pwallet_in)
     if (i != m_vpwallets.end()) return true;
     m_wallet_unload_handlers[pwallet_in.get()] = interfaces::MakeHandler(pwallet_in->NotifyUnload.connect(boost::bind(&NotifyUnload, this, pwallet_in.get())));
     m_vpwallets.push_back(pwallet_in);
+    m_meta_keys_changed = true;
 #endif
     return true;
 };
@@ -1133,6 +1370,10 @@ bool CSMSG::WalletUnloaded(CWallet *pwallet_removed)
         it->second->disconnect();
         m_wallet_unload_handlers.erase(it);
     }
+    if (removed) {
+        LOCK(cs_trial_keys);
+        m_trial_keys.Clear();
+    }
 #endif
     return removed;
 };
@@ -1388,7 +1629,7 @@ int CSMSG::ReceiveData(CNode *pfrom, const std::string &strCommand, CDataStream
                 if (LogAcceptCategory(BCLog::SMSG)) {
                     LogPrintf("Peer bucket %d %u %u.\n", time, ncontent, hash);
                     if (it_lb != buckets.end()) {
-                        LogPrintf("This bucket %d %u %u.\n", time, it_lb->second.setTokens.size(), it_lb->second.hash);
+                        LogPrintf("This bucket %d %u %u.\n", time, it_lb->second.setTokens.size(), it_lb->second.GetHash(pfrom->smsgData.m_version));
                     }
                 }
 
@@ -1404,7 +1645,7 @@ int CSMSG::ReceiveData(CNode *pfrom, const std::string &strCommand, CDataStream
                 if (it_lb == buckets.end()
                     || it_lb->second.nActive < ncontent
                     || (it_lb->second.nActive == ncontent
-                        && it_lb->second.hash != hash)) { // if same amount in buckets check hash
+                        && it_lb->second.GetHash(pfrom->smsgData.m_version) != hash)) { // if same amount in buckets check hash
                         auto nv = PeerBucket(ncontent, hash);
                         auto ret = pfrom->smsgData.m_buckets.insert(std::pair<int64_t, PeerBucket>(time, nv));
                         if (!ret.second) {
@@ -1600,7 +1841,7 @@ int CSMSG::ReceiveData(CNode *pfrom, const std::string &strCommand, CDataStream
             return SMSG_GENERAL_ERROR;
         }
 
-        std::vector<uint8_t> vchOne, vchBunch;
+        std::vector<uint8_t> vchBunch;
 
         vchBunch.resize(4 + 8); // nMessages + bucketTime
 
@@ -1630,21 +1871,22 @@ int CSMSG::ReceiveData(CNode *pfrom, const std::string &strCommand, CDataStream
                 if (it == tokenSet.end()) {
                     LogPrint(BCLog::SMSG, "Don't have wanted message %d.\n", token.timestamp);
                 } else {
-                    token.offset = it->offset;
-
-                    // Place in vchOne so if SecureMsgRetrieve fails it won't corrupt vchBunch
-                    if (Retrieve(token, vchOne) != SMSG_NO_ERROR) {
+                    if (nBunch >= MAX_BUNCH_MESSAGES) {
+                        LogPrint(BCLog::SMSG, "Break bunch %u, %u.\n", nBunch, vchBunch.size());
+                        break; // end here, peer will send more want messages if needed.
+                    }
+                    // Copy straight from the mapped bucket file
+                    size_t nPrevSize = vchBunch.size();
+                    if (!m_bucket_store.Get(time, it->m_file, it->offset, vchBunch)) {
                         LogPrintf("SecureMsgRetrieve failed %d.\n", token.timestamp);
                         continue;
                     }
-
-                    if (nBunch >= MAX_BUNCH_MESSAGES
-                        || vchBunch.size() + vchOne.size() >= MAX_BUNCH_BYTES) {
+                    if (vchBunch.size() >= MAX_BUNCH_BYTES) {
+                        vchBunch.resize(nPrevSize);
                         LogPrint(BCLog::SMSG, "Break bunch %u, %u.\n", nBunch, vchBunch.size());
-                        break; // end here, peer will send more want messages if needed.
+                        break;
                     }
                     nBunch++;
-                    vchBunch.insert(vchBunch.end(), vchOne.begin(), vchOne.end()); // append
                 }
                 p += 16;
             }
@@ -1756,7 +1998,7 @@ bool CSMSG::SendData(CNode *pto, bool fSendTrickle)
         // Send smsgPong message if received smsgPing from peer while syncing chain
         if (pto->smsgData.lastSeen < 0) {
             g_connman->PushMessage(pto,
-                CNetMsgMaker(INIT_PROTO_VERSION).Make(SMSGMsgType::PONG));
+                CNetMsgMaker(INIT_PROTO_VERSION).Make(SMSGMsgType::PONG, SMSG_VERSION));
         }
 
         pto->smsgData.lastSeen = GetTime();
@@ -1772,62 +2014,42 @@ bool CSMSG::SendData(CNode *pto, bool fSendTrickle)
     std::vector<uint8_t> vchData;
     {
         LOCK(cs_smsg);
-        if (pto->smsgData.lastMatched <= m_last_changed) {
-
-            std::map<int64_t, SecMsgBucket>::iterator it;
-
-            /*
-            Get time before loop and after looping through messages set nLastMatched to time before loop.
-            This prevents scenario where:
-                Loop()
-                    message = locked and  thus skipped
-                   message become free and nTimeChanged is updated
-                End loop
-
-                nLastMatched = GetTime()
-                => bucket that became free in loop is now skipped :/
-
-            Scenario 2:
-                Same as one but time is updated before
-
-                    bucket nTimeChanged is updated but not unlocked yet
-                    now = GetTime()
-                    Loop of buckets skips message
-             */
-
-            for (it = buckets.begin(); it != buckets.end(); ++it) {
-                SecMsgBucket &bkt = it->second;
-
-                uint32_t nMessages = bkt.nActive;
+        // Only buckets changed since the last smsgInv to this peer are sent
+        for (auto it = m_changed_buckets.upper_bound(pto->smsgData.m_inv_seq); it != m_changed_buckets.end(); ++it) {
+            const auto itb = buckets.find(it->second);
+            if (itb == buckets.end()) {
+                continue;
+            }
+            const SecMsgBucket &bkt = itb->second;
 
-                if (bkt.timeChanged < pto->smsgData.lastMatched     // peer was last sent all buckets at time of lastMatched. It should have this bucket
-                    || nMessages < 1) {                             // this bucket is empty
-                    continue;
-                }
+            uint32_t nMessages = bkt.nActive;
+            if (nMessages < 1) { // this bucket is empty
+                continue;
+            }
 
-                uint32_t hash = bkt.hash;
+            uint32_t hash = bkt.GetHash(pto->smsgData.m_version);
 
-                if (LogAcceptCategory(BCLog::SMSG)) {
-                    LogPrintf("Preparing bucket with hash %d for transfer to node %d. timeChanged=%d > lastMatched=%d\n", hash, pto->GetId(), bkt.timeChanged, pto->smsgData.lastMatched);
-                }
+            if (LogAcceptCategory(BCLog::SMSG)) {
+                LogPrintf("Preparing bucket with hash %d for transfer to node %d. change=%d > last sent=%d\n", hash, pto->GetId(), it->first, pto->smsgData.m_inv_seq);
+            }
 
-                size_t sz = vchData.size();
-                try { vchData.resize(sz + 16 + (sz == 0 ? 4 : 0)); } catch (std::exception& e) {
-                    LogPrintf("vchData.resize %u threw: %s.\n", vchData.size() + 16 + (sz == 0 ? 4 : 0), e.what());
-                    continue;
-                }
-                if (sz == 0) {
-                    sz = 4;
-                }
+            size_t sz = vchData.size();
+            try { vchData.resize(sz + 16 + (sz == 0 ? 4 : 0)); } catch (std::exception& e) {
+                LogPrintf("vchData.resize %u threw: %s.\n", vchData.size() + 16 + (sz == 0 ? 4 : 0), e.what());
+                continue;
+            }
+            if (sz == 0) {
+                sz = 4;
+            }
 
-                uint8_t *p = &vchData[sz];
-                memcpy(p, &it->first, 8);
-                memcpy(p+8, &nMessages, 4);
-                memcpy(p+12, &hash, 4);
+            uint8_t *p = &vchData[sz];
+            memcpy(p, &itb->first, 8);
+            memcpy(p+8, &nMessages, 4);
+            memcpy(p+12, &hash, 4);
 
-                nBucketsShown++;
-            }
+            nBucketsShown++;
         }
+        pto->smsgData.m_inv_seq = m_change_seq;
     }
     if (nBucketsShown > 0) {
         memcpy(&vchData[0], &nBucketsShown, 4);
@@ -1835,7 +2057,6 @@ bool CSMSG::SendData(CNode *pto, bool fSendTrickle)
 
         g_connman->PushMessage(pto,
             CNetMsgMaker(INIT_PROTO_VERSION).Make(SMSGMsgType::INV, vchData));
-        pto->smsgData.lastMatched = now;
     }
     if (vchData.size() > 0) {
         vchData.clear();
@@ -1861,7 +2082,7 @@ bool CSMSG::SendData(CNode *pto, bool fSendTrickle)
             if (it_lb == buckets.end()
                 || (it_lb->second.nLockPeerId < 0 || it_lb->second.nLockPeerId == pto->GetId())) {
                 if (it_lb != buckets.end() &&
-                    (it_lb->second.nActive > bkt.m_active || (it_lb->second.nActive == bkt.m_active && it_lb->second.hash == bkt.m_hash))) {
+                    (it_lb->second.nActive > bkt.m_active || (it_lb->second.nActive == bkt.m_active && it_lb->second.GetHash(pto->smsgData.m_version) == bkt.m_hash))) {
                     LogPrint(BCLog::SMSG, "Not requesting list of bucket %d.\n", it->first);
                 } else {
                     LogPrint(BCLog::SMSG, "Requesting list of bucket %d from peer %d.\n", it->first, pto->GetId());
@@ -2152,6 +2373,11 @@ bool CSMSG::ScanBuckets(bool scan_all)
             LogPrintf("Dropping file %s, expired.\n", fileName);
             try {
                 fs::remove(itd->path());
+                fs::path pathIndex = itd->path();
+                pathIndex.replace_extension(".idx");
+                if (fs::exists(pathIndex)) {
+                    fs::remove(pathIndex);
+                }
             } catch (const fs::filesystem_error &ex) {
                 LogPrintf("Error removing bucket file %s, %s.\n", fileName, ex.what());
             }
@@ -2266,6 +2492,15 @@ int CSMSG::ManageLocalKey(CKeyID &keyId, ChangeType mode)
     return SMSG_NO_ERROR;
 };
 
+/** Wallet was locked
+  * Drop the receiving keys copied from the wallets, they're fetched again for the next message.
+  * Called with cs_wallet possibly held, cs_trial_keys is taken before cs_wallet in UpdateTrialKeys.
+  */
+void CSMSG::WalletLocked(CWallet *pwallet)
+{
+    m_trial_keys_dirty = true;
+}
+
 /** Wallet was unlocked
   * Scan messages received while wallet was locked.
   */
@@ -2278,6 +2513,7 @@ int CSMSG::WalletUnlocked(CWallet *pwallet)
     }
 
     LogPrintf("SecureMsgWalletUnlocked()\n");
+    m_meta_keys_changed = true;
 
     int64_t  now            = GetTime();
     uint32_t nFiles         = 0;
@@ -2436,95 +2672,193 @@ int CSMSG::WalletKeyChanged(CKeyID &keyId, const std::string &sLabel, ChangeType
   * if !reportToGui don't fire NotifySecMsgInboxChanged
   *  - loads messages received when wallet locked in bulk.
   */
-int CSMSG::ScanMessage(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, bool reportToGui, bool &fOwnMessage, bool unlocking)
+static bool CheckMAC(const secp256k1_context *ctx, const secp256k1_pubkey &R, const CKey &keyDest,
+    const SecureMessage *psmsg, const uint8_t *pPayload, uint32_t nPayload)
 {
-    LogPrint(BCLog::SMSG, "%s\n", __func__);
+    uint256 P;
+    if (!secp256k1_ecdh(ctx, P.begin(), &R, keyDest.begin(), nullptr, nullptr)) {
+        return false;
+    }
 
-    fOwnMessage = false;
-    MessageData msg; // placeholder
-    CKeyID addressTo;
-    for (auto &p : smsgModule.keyStore.mapKeys) {
-        auto &address = p.first;
-        auto &key = p.second;
+    // Only key_m, the last 32 bytes of H, is needed to check the MAC
+    uint8_t hashed[64];
+    CSHA512().Write(P.begin(), 32).Finalize(hashed);
 
-        if (!(key.nFlags & SMK_RECEIVE_ON)) {
+    uint8_t MAC[32];
+    CHMAC_SHA256 ctx_mac(&hashed[32], 32);
+    ctx_mac.Write((uint8_t*) &psmsg->timestamp, sizeof(psmsg->timestamp));
+    ctx_mac.Write((uint8_t*) psmsg->iv, sizeof(psmsg->iv));
+    ctx_mac.Write(pPayload, nPayload);
+    ctx_mac.Finalize(MAC);
+    memory_cleanse(hashed, 64);
+
+    return part::memcmp_nta(MAC, psmsg->mac, 32) == 0;
+};
+
+bool SecMsgTrialCheck::operator()()
+{
+    if (nBegin > pnFound->load()) {
+        return true; // A key earlier in the set matched
+    }
+    for (size_t i = nBegin; i < nEnd; ++i) {
+        if (!CheckMAC(ctx, *pR, pKeys->vKeys[i].key, psmsg, pPayload, nPayload)) {
             continue;
         }
+        size_t nPrev = pnFound->load();
+        while (i < nPrev && !pnFound->compare_exchange_weak(nPrev, i)) {}
+        break;
+    }
+    return true;
+};
 
-        if (!(key.nFlags & SMK_RECEIVE_ANON)) {
-            // Have to do full decrypt to see address from
-            if (Decrypt(false, key.key, address, pHeader, pPayload, nPayload, msg) == 0) {
-                if (LogAcceptCategory(BCLog::SMSG)) {
-                    LogPrintf("Decrypted message with %s.\n", EncodeDestination(PKHash(addressTo)));
-                }
-                if (msg.sFromAddress.compare("anon") != 0) {
-                    fOwnMessage = true;
-                }
-                addressTo = address;
-                break;
-            }
-        } else {
-            if (Decrypt(true, key.key, address, pHeader, pPayload, nPayload, msg) == 0) {
-                if (LogAcceptCategory(BCLog::SMSG)) {
-                    LogPrintf("Decrypted message with %s.\n", EncodeDestination(PKHash(addressTo)));
-                }
-                fOwnMessage = true;
-                addressTo = address;
-                break;
-            }
+int SecMsgTrialKeys::Match(const secp256k1_context *ctx, const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload,
+    CCheckQueue<SecMsgTrialCheck> *pqueue) const
+{
+    const SecureMessage *psmsg = (const SecureMessage*) pHeader;
+    if (psmsg->version[0] == 3) {
+        if (nPayload < 32) {
+            return -1;
         }
+        nPayload -= 32; // Exclude funding txid
+    } else
+    if (psmsg->version[0] != 2) {
+        return -1;
     }
 
-    bool was_locked = false;
-    if (!fOwnMessage) {
+    secp256k1_pubkey R;
+    if (vKeys.empty()
+        || !secp256k1_ec_pubkey_parse(ctx, &R, psmsg->cpkR, 33)) {
+        return -1;
+    }
+
+    const size_t nKeys = vKeys.size();
+    const size_t nBatches = (nKeys + SMSG_TRIAL_BATCH_SIZE - 1) / SMSG_TRIAL_BATCH_SIZE;
+    std::atomic<size_t> nFound(nKeys);
+
+    // The queue takes checks from the back, add the last batch first so the keys are tested in order
+    std::vector<SecMsgTrialCheck> vChecks;
+    vChecks.reserve(nBatches);
+    for (size_t b = nBatches; b-- > 0;) {
+        size_t nBegin = b * SMSG_TRIAL_BATCH_SIZE;
+        size_t nEnd = std::min(nBegin + SMSG_TRIAL_BATCH_SIZE, nKeys);
+        vChecks.emplace_back(this, ctx, &R, psmsg, pPayload, nPayload, nBegin, nEnd, &nFound);
+    }
+
+    if (pqueue && nBatches > 1) {
+        CCheckQueueControl<SecMsgTrialCheck> control(pqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (auto it = vChecks.rbegin(); it != vChecks.rend(); ++it) {
+            (*it)();
+        }
+    }
+
+    return nFound < nKeys ? (int) nFound : -1;
+};
+
+void CSMSG::UpdateTrialKeys()
+{
+    // Keys are only fetched again when the receiving addresses or wallet lock states change
+    CSHA256 hasher;
+    for (const auto &p : keyStore.mapKeys) {
+        hasher.Write(p.first.begin(), 20);
+        hasher.Write((const uint8_t*) &p.second.nFlags, sizeof(p.second.nFlags));
+    }
 #ifdef ENABLE_WALLET
+    for (const auto &addr : addresses) {
+        uint8_t flags = (addr.fReceiveEnabled ? 1 : 0) | (addr.fReceiveAnon ? 2 : 0);
+        hasher.Write(addr.address.begin(), 20);
+        hasher.Write(&flags, 1);
+    }
+    for (const auto &pw : m_vpwallets) {
+        uint64_t nWallet = (uint64_t)(uintptr_t) pw.get();
+        uint8_t locked = pw->IsLocked() ? 1 : 0;
+        hasher.Write((const uint8_t*) &nWallet, sizeof(nWallet));
+        hasher.Write(&locked, 1);
+    }
+#endif
+    uint256 hashState;
+    hasher.Finalize(hashState.begin());
 
-        for (std::vector<SecMsgAddress>::iterator it = addresses.begin(); it != addresses.end(); ++it) {
-            if (!it->fReceiveEnabled) {
-                continue;
-            }
+    if (!m_trial_keys_dirty.exchange(false)
+        && m_trial_keys.fBuilt && m_trial_keys.hashState == hashState) {
+        return;
+    }
 
-            addressTo = it->address;
+    m_trial_keys.Clear();
+    for (const auto &p : keyStore.mapKeys) {
+        const SecMsgKey &key = p.second;
+        if (!(key.nFlags & SMK_RECEIVE_ON)) {
+            continue;
+        }
+        m_trial_keys.Add(p.first, key.key, key.nFlags & SMK_RECEIVE_ANON);
+    }
 
-            CKey keyDest;
-            for (const auto &pw : m_vpwallets) {
-                if (pw->IsLocked()) {
-                    if (pw->HaveKey(addressTo)) {
-                        was_locked = true;
-                    }
-                    continue;
-                }
-                if (pw->GetKey(addressTo, keyDest)) {
-                    break;
+#ifdef ENABLE_WALLET
+    for (const auto &addr : addresses) {
+        if (!addr.fReceiveEnabled) {
+            continue;
+        }
+
+        CKey keyDest;
+        for (const auto &pw : m_vpwallets) {
+            if (pw->IsLocked()) {
+                if (pw->HaveKey(addr.address)) {
+                    m_trial_keys.fWasLocked = true;
                 }
-            }
-            if (!keyDest.IsValid()) {
                 continue;
             }
+            if (pw->GetKey(addr.address, keyDest)) {
+                break;
+            }
+        }
+        if (!keyDest.IsValid()) {
+            continue;
+        }
+        m_trial_keys.Add(addr.address, keyDest, addr.fReceiveAnon);
+    }
+#endif
 
-            if (!it->fReceiveAnon) {
-                // Have to do full decrypt to see address from
-                if (Decrypt(false, keyDest, addressTo, pHeader, pPayload, nPayload, msg) == 0) {
-                    if (LogAcceptCategory(BCLog::SMSG)) {
-                        LogPrintf("Decrypted message with %s.\n", EncodeDestination(PKHash(addressTo)));
-                    }
-                    if (msg.sFromAddress.compare("anon") != 0) {
-                        fOwnMessage = true;
-                    }
-                    break;
-                }
-            } else {
-                if (Decrypt(true, keyDest, addressTo, pHeader, pPayload, nPayload, msg) == 0) {
-                    if (LogAcceptCategory(BCLog::SMSG)) {
-                        LogPrintf("Decrypted message with %s.\n", EncodeDestination(PKHash(addressTo)));
-                    }
+    m_trial_keys.hashState = hashState;
+    m_trial_keys.fBuilt = true;
+    LogPrint(BCLog::SMSG, "%s: %u receiving keys.\n", __func__, m_trial_keys.size());
+};
+
+int CSMSG::ScanMessage(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, bool reportToGui, bool &fOwnMessage, bool unlocking)
+{
+    LogPrint(BCLog::SMSG, "%s\n", __func__);
+
+    fOwnMessage = false;
+    MessageData msg;
+    bool fDecrypted = false;
+    CKeyID addressTo;
+    bool was_locked = false;
+    {
+        LOCK(cs_trial_keys);
+        UpdateTrialKeys();
+        was_locked = m_trial_keys.fWasLocked;
+
+        int nMatch = m_trial_keys.Match(secp256k1_context_smsg, pHeader, pPayload, nPayload, m_scan_threads > 1 ? &m_scan_queue : nullptr);
+        if (nMatch > -1) {
+            const SecMsgTrialKeys::Key &key = m_trial_keys.vKeys[nMatch];
+            addressTo = key.address;
+            // Decrypt with the matched key, the metadata index and notifications reuse the result
+            fDecrypted = Decrypt(false, key.key, addressTo, pHeader, pPayload, nPayload, msg) == 0;
+            if (!key.fReceiveAnon) {
+                // Reject anonymous senders
+                if (fDecrypted
+                    && msg.sFromAddress.compare("anon") != 0) {
                     fOwnMessage = true;
-                    break;
                 }
+            } else {
+                fOwnMessage = true;
+            }
+            if (fOwnMessage && LogAcceptCategory(BCLog::SMSG)) {
+                LogPrintf("Decrypted message with %s.\n", EncodeDestination(PKHash(addressTo)));
             }
         }
-#endif
-    }
+    } // cs_trial_keys
 
     if (!fOwnMessage && was_locked && !unlocking) {
         LogPrint(BCLog::SMSG, "%s: Wallet is locked, storing message to scan later.\n", __func__);
@@ -2572,6 +2906,7 @@ int CSMSG::ScanMessage(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t
                     LogPrint(BCLog::SMSG, "Message already exists in inbox db.\n");
                 } else {
                     dbInbox.WriteSmesg(chKey, smsgInbox);
+                    IndexMessage(dbInbox, chKey, smsgInbox, fDecrypted ? &msg : nullptr);
                     if (reportToGui) {
                         NotifySecMsgInboxChanged(smsgInbox);
                     }
@@ -2592,6 +2927,7 @@ int CSMSG::ScanMessage(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t
             }
 
             GetMainSignals().NewSecureMessage(psmsg, hash);
+            GetMainSignals().NewSecureMessageData(pHeader, pPayload, nPayload, &addressTo, fDecrypted ? &msg : nullptr);
         }
     }
 
@@ -2767,6 +3103,7 @@ int CSMSG::ImportPrivkey(const CBitcoinSecret &vchSecret, const std::string &sLa
     }
 
     keyStore.AddKey(idk, key);
+    m_meta_keys_changed = true;
 
     return SMSG_NO_ERROR;
 };
@@ -2884,44 +3221,16 @@ int CSMSG::Retrieve(const SecMsgToken &token, std::vector<uint8_t> &vchData)
     LogPrint(BCLog::SMSG, "%s: %d.\n", __func__, token.timestamp);
     AssertLockHeld(cs_smsg);
 
-    fs::path pathSmsgDir = GetDataDir() / STORE_DIR;
-
     int64_t bucket = token.timestamp - (token.timestamp % SMSG_BUCKET_LEN);
-    std::string fileName = std::to_string(bucket) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
-
-    FILE *fp;
-    errno = 0;
-    if (!(fp = fopen(fullpath.string().c_str(), "rb"))) {
-        return errorN(SMSG_GENERAL_ERROR, "%s - Can't open file: %s\nPath %s.", __func__, strerror(errno), fullpath.string());
-    }
-
-    errno = 0;
-    if (fseek(fp, token.offset, SEEK_SET) != 0) {
-        fclose(fp);
-        return errorN(SMSG_GENERAL_ERROR, "%s - fseek, strerror: %s.", __func__, strerror(errno));
-    }
-
-    SecureMessage smsg;
-    errno = 0;
-    if (fread(smsg.data(), sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN) {
-        fclose(fp);
-        return errorN(SMSG_GENERAL_ERROR, "%s - read header failed, strerror: %s.", __func__, strerror(errno));
-    }
 
-    try {vchData.resize(SMSG_HDR_LEN + smsg.nPayload);} catch (std::exception &e) {
-        fclose(fp);
-        return errorN(SMSG_ALLOCATE_FAILED, "%s - Could not resize vchData, %u, %s.", __func__, SMSG_HDR_LEN + smsg.nPayload, e.what());
-    }
-
-    memcpy(vchData.data(), smsg.data(), SMSG_HDR_LEN);
-    errno = 0;
-    if (fread(&vchData[SMSG_HDR_LEN], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload) {
-        fclose(fp);
-        return errorN(SMSG_GENERAL_ERROR, "%s - fread data failed: %s. Wanted %u bytes.", __func__, strerror(errno), smsg.nPayload);
+    vchData.clear();
+    try {
+        if (!m_bucket_store.Get(bucket, token.m_file, token.offset, vchData)) {
+            return errorN(SMSG_GENERAL_ERROR, "%s - Message not found in bucket %d at offset %d.", __func__, bucket, token.offset);
+        }
+    } catch (std::exception &e) {
+        return errorN(SMSG_ALLOCATE_FAILED, "%s - Could not resize vchData, %s.", __func__, e.what());
     }
-
-    fclose(fp);
     return SMSG_NO_ERROR;
 };
 
@@ -2930,11 +3239,8 @@ int CSMSG::Remove(const SecMsgToken &token)
     LogPrint(BCLog::SMSG, "%s: %d.\n", __func__, token.timestamp);
     AssertLockHeld(cs_smsg);
 
-    fs::path pathSmsgDir = GetDataDir() / STORE_DIR;
-
     int64_t bucket = token.timestamp - (token.timestamp % SMSG_BUCKET_LEN);
-    std::string fileName = std::to_string(bucket) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
+    fs::path fullpath = CBucketStore::DataPath(bucket, token.m_file);
 
     FILE *fp;
     errno = 0;
@@ -2977,6 +3283,10 @@ int CSMSG::Remove(const SecMsgToken &token)
     }
 
     fclose(fp);
+
+    if (!m_bucket_store.SetIndexTTL(bucket, token.m_file, token.offset, 0)) {
+        LogPrintf("%s: Failed to update index for bucket %d.\n", __func__, bucket);
+    }
     return SMSG_NO_ERROR;
 };
 
@@ -3121,7 +3431,7 @@ int CSMSG::Receive(CNode *pfrom, std::vector<uint8_t> &vchData)
 
         itb->second.nLockCount  = 0; // This node has received data from peer, release lock
         itb->second.nLockPeerId = -1;
-        itb->second.hashBucket(itb->first);
+        SetBucketChanged(itb->first, itb->second);
     } // cs_smsg
 
     return SMSG_NO_ERROR;
@@ -3266,23 +3576,33 @@ int CSMSG::Store(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayl
         return SMSG_GENERAL_ERROR;
     }
 
-    std::string fileName = std::to_string(bucketTime) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
-
     FILE *fp;
-    errno = 0;
-    if (!(fp = fopen(fullpath.string().c_str(), "ab"))) {
-        return errorN(SMSG_GENERAL_ERROR, "fopen failed: %s.", strerror(errno));
-    }
+    for (;;) {
+        fs::path fullpath = CBucketStore::DataPath(bucketTime, bucket.nLastFile);
+        errno = 0;
+        if (!(fp = fopen(fullpath.string().c_str(), "ab"))) {
+            return errorN(SMSG_GENERAL_ERROR, "fopen failed: %s.", strerror(errno));
+        }
 
-    // On windows ftell will always return 0 after fopen(ab), call fseek to set.
-    errno = 0;
-    if (fseek(fp, 0, SEEK_END) != 0) {
-        fclose(fp);
-        return errorN(SMSG_GENERAL_ERROR, "fseek failed: %s.", strerror(errno));
+        // On windows ftell will always return 0 after fopen(ab), call fseek to set.
+        errno = 0;
+        if (fseek(fp, 0, SEEK_END) != 0) {
+            fclose(fp);
+            return errorN(SMSG_GENERAL_ERROR, "fseek failed: %s.", strerror(errno));
+        }
+
+        ofs = ftell(fp);
+        if (ofs > 0 && (uint64_t)ofs + SMSG_HDR_LEN + nPayload > m_max_file_size) {
+            // Roll over to a new file
+            fclose(fp);
+            bucket.nLastFile++;
+            LogPrint(BCLog::SMSG, "Starting bucket %d file %d.\n", bucketTime, bucket.nLastFile);
+            continue;
+        }
+        break;
     }
+    token.m_file = bucket.nLastFile;
 
-    ofs = ftell(fp);
     if (fwrite(pHeader,  sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN
         || fwrite(pPayload, sizeof(uint8_t), nPayload, fp) != nPayload) {
         fclose(fp);
@@ -3291,21 +3611,26 @@ int CSMSG::Store(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayl
 
     fclose(fp);
 
-    token.offset = ofs;
-    tokenSet.insert(token);
-
-    if (nTTL > 0 && (bucket.nLeastTTL == 0 || nTTL < bucket.nLeastTTL)) {
-        bucket.nLeastTTL = nTTL;
+    SecMsgIndexRecord record;
+    record.timestamp = psmsg->timestamp;
+    memcpy(record.sample, token.sample, 8);
+    record.offset = ofs;
+    record.ttl = nTTL;
+    record.nPayload = nPayload;
+    if (!m_bucket_store.AppendIndex(bucketTime, token.m_file, record)) {
+        LogPrintf("%s: Failed to update index for bucket %d.\n", __func__, bucketTime);
     }
 
+    token.offset = ofs;
+    bucket.InsertToken(token, now);
+    GetMainSignals().NewSecureMessageData(pHeader, pPayload, nPayload, nullptr, nullptr);
+
     if (fHashBucket) {
-        bucket.hashBucket(bucketTime);
+        SetBucketChanged(bucketTime, bucket);
     }
 
     LogPrint(BCLog::SMSG, "SecureMsg added to bucket %d.\n", bucketTime);
 
-    m_last_changed = GetTime();
-
     return SMSG_NO_ERROR;
 };
 
@@ -3363,7 +3688,8 @@ int CSMSG::Purge(std::vector<uint8_t> &vMsgId, std::string &sError)
             break;
         }
         memcpy(purged.sample, vchOne.data() + SMSG_HDR_LEN, 8);
-        it->ttl = 0;
+        bucket.PurgeToken(it);
+        SetBucketChanged(bucketTime, bucket);
         LogPrint(BCLog::SMSG, "Purged message %s in bucket %d\n", it->ToString(), bucketTime);
         memcpy(purged.sample, it->sample, 8);
 
@@ -3457,79 +3783,66 @@ int CSMSG::Validate(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nP
             return SMSG_GENERAL_ERROR;
         }
 
-        CTransactionRef txOut;
-        uint256 hashBlock;
+        std::shared_ptr<const SecMsgFundingTx> funding_tx = m_funding_cache.Get(txid);
         {
             LOCK(cs_main);
-            if (!GetTransaction(txid, txOut, consensusParams, hashBlock) || hashBlock.IsNull()) {
-                return errorN(SMSG_GENERAL_ERROR, "%s: Transaction %s not found for message %s.\n", __func__, txid.ToString(), msgId.ToString());
-            }
-            if (txOut->IsCoinStake()) {
-                return errorN(SMSG_GENERAL_ERROR, "%s: Transaction %s for message %s, is coinstake.\n", __func__, txid.ToString(), msgId.ToString());
-            }
+            // Disconnected blocks are removed from the cache asynchronously
+            if (!funding_tx || !::ChainActive().Contains(funding_tx->pindex)) {
+                CTransactionRef txOut;
+                uint256 hashBlock;
+                if (!GetTransaction(txid, txOut, consensusParams, hashBlock) || hashBlock.IsNull()) {
+                    return errorN(SMSG_GENERAL_ERROR, "%s: Transaction %s not found for message %s.\n", __func__, txid.ToString(), msgId.ToString());
+                }
+                if (txOut->IsCoinStake()) {
+                    return errorN(SMSG_GENERAL_ERROR, "%s: Transaction %s for message %s, is coinstake.\n", __func__, txid.ToString(), msgId.ToString());
+                }
+                const CBlockIndex *pindex = LookupBlockIndex(hashBlock);
+                if (!pindex || !::ChainActive().Contains(pindex)) {
+                    return errorN(SMSG_GENERAL_ERROR, "%s: Transaction %s for message %s, low depth %d.\n", __func__, txid.ToString(), msgId.ToString(), -1);
+                }
 
-            int blockDepth = -1;
-            const CBlockIndex *pindex = nullptr;
-            BlockMap::iterator mi = ::BlockIndex().find(hashBlock);
-            int64_t nMsgFeePerKPerDay = 0;
-            if (mi != ::BlockIndex().end()) {
-                pindex = mi->second;
-                if (pindex && ::ChainActive().Contains(pindex)) {
-                    blockDepth = ::ChainActive().Height() - pindex->nHeight + 1;
-                    nMsgFeePerKPerDay = GetSmsgFeeRate(pindex);
+                std::shared_ptr<SecMsgFundingTx> new_funding_tx = std::make_shared<SecMsgFundingTx>();
+                new_funding_tx->pindex = pindex;
+                new_funding_tx->nFeeRate = GetSmsgFeeRate(pindex);
+                if (pindex->nHeight % consensusParams.smsg_fee_period < 10) {
+                    new_funding_tx->nFeeRateLast = GetSmsgFeeRate(pindex, true);
                 }
+
+                // Find all msg pairs
+                new_funding_tx->AddFundedMessages(*txOut);
+
+                funding_tx = new_funding_tx;
+                m_funding_cache.Insert(txid, funding_tx);
             }
 
+            const CBlockIndex *pindex = funding_tx->pindex;
+            int blockDepth = ::ChainActive().Height() - pindex->nHeight + 1;
             if (blockDepth < 1) {
                 return errorN(SMSG_GENERAL_ERROR, "%s: Transaction %s for message %s, low depth %d.\n", __func__, txid.ToString(), msgId.ToString(), blockDepth);
             }
 
-            // blockDepth >= 1 -> nMsgFeePerKPerDay must have been set
-            int64_t nExpectFee = ((nMsgFeePerKPerDay * nMsgBytes) / 1000) * nDaysRetention;
-
-            bool fFound = false;
-            // Find all msg pairs
-            // Message funding is enforced in tx_verify.cpp
-            for (const auto &v : txOut->vpout) {
-                if (!v->IsType(OUTPUT_DATA)) {
-                    continue;
-                }
-                const std::vector<uint8_t> &vData = *v->GetPData();
-                if (vData.size() < 25 || vData[0] != DO_FUND_MSG) {
-                    continue;
-                }
+            const auto mi = funding_tx->mapFunded.find(msgId);
+            if (mi == funding_tx->mapFunded.end()) {
+                return errorN(SMSG_FUND_FAILED, "%s: Transaction %s does not fund message %s.\n", __func__, txid.ToString(), msgId.ToString());
+            }
 
-                size_t n = (vData.size()-1) / 24;
-                for (size_t k = 0; k < n; ++k) {
-                    const uint8_t *pMsgIdTxStart = &vData[1+k*24];
-                    if (memcmp(pMsgIdTxStart, msgId.begin(), 20) == 0) {
-                        uint32_t nAmount;
-                        memcpy(&nAmount, &vData[1+k*24+20], 4);
-
-                        if (nAmount < nExpectFee) {
-                            // Grace period after fee period transition where prev fee is still allowed
-                            bool matched_last_fee = false;
-                            if (pindex->nHeight % consensusParams.smsg_fee_period < 10) {
-                                int64_t nMsgFeePerKPerDayLast = GetSmsgFeeRate(pindex, true);
-                                int64_t nExpectFeeLast = ((nMsgFeePerKPerDayLast * nMsgBytes) / 1000) * nDaysRetention;
-
-                                if (nAmount >= nExpectFeeLast) {
-                                    matched_last_fee = true;
-                                }
-                            }
+            int64_t nExpectFee = ((funding_tx->nFeeRate * nMsgBytes) / 1000) * nDaysRetention;
+            uint32_t nAmount = mi->second;
+            if (nAmount < nExpectFee) {
+                // Grace period after fee period transition where prev fee is still allowed
+                bool matched_last_fee = false;
+                if (pindex->nHeight % consensusParams.smsg_fee_period < 10) {
+                    int64_t nExpectFeeLast = ((funding_tx->nFeeRateLast * nMsgBytes) / 1000) * nDaysRetention;
 
-                            if (!matched_last_fee) {
-                                LogPrintf("%s: Transaction %s underfunded message %s, expected %d paid %d.\n", __func__, txid.ToString(), msgId.ToString(), nExpectFee, nAmount);
-                                return SMSG_FUND_FAILED;
-                            }
-                        }
-                        fFound = true;
+                    if (nAmount >= nExpectFeeLast) {
+                        matched_last_fee = true;
                     }
                 }
-            }
 
-            if (!fFound) {
-                return errorN(SMSG_FUND_FAILED, "%s: Transaction %s does not fund message %s.\n", __func__, txid.ToString(), msgId.ToString());
+                if (!matched_last_fee) {
+                    LogPrintf("%s: Transaction %s underfunded message %s, expected %d paid %d.\n", __func__, txid.ToString(), msgId.ToString(), nExpectFee, nAmount);
+                    return SMSG_FUND_FAILED;
+                }
             }
         }
 
@@ -3578,62 +3891,84 @@ int CSMSG::SetHash(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload)
     SecureMessage *psmsg = (SecureMessage*) pHeader;
 
     int64_t nStart = GetTimeMillis();
-    uint8_t civ[32];
-
-    bool found = false;
 
-    uint32_t nonce = 0;
-    memcpy(&nonce, &psmsg->nonce[0], 4);
+    uint32_t nonce_start = 0;
+    memcpy(&nonce_start, &psmsg->nonce[0], 4);
 
-    uint256 msg_hash;
     arith_uint256 target_difficulty;
     {
     LOCK(cs_main);
     target_difficulty.SetCompact(GetSmsgDifficulty(psmsg->timestamp));
     }
 
-    // Break for HMAC_CTX_cleanup
-    for (;;) {
-        if (!fSecMsgEnabled) {
-           break;
-        }
-
-        memcpy(&psmsg->nonce[0], &nonce, 4);
-
-        for (int i = 0; i < 32; i+=4) {
-            memcpy(civ+i, &nonce, 4);
-        }
+    // The nonce is both the HMAC key and the first bytes hashed, so no midstate can be kept between nonces.
+    // Thread k tests nonces nonce_start + k, nonce_start + k + nThreads, ... on its own copy of the header.
+    const uint64_t nRange = (uint64_t) 0xFFFFFFFFU - nonce_start + 1;
+    const int nThreads = (int) std::min((uint64_t) std::max(m_pow_threads, 1), nRange);
+    std::atomic<bool> found(false);
+    std::atomic<uint64_t> nTried(0);
+    uint32_t nonce_found = 0;
+    uint256 hash_found;
+    Mutex cs_found;
+
+    auto worker = [&](int nOffset) {
+        uint8_t header[SMSG_HDR_LEN];
+        memcpy(header, pHeader, SMSG_HDR_LEN);
+        uint8_t civ[32];
+        uint256 msg_hash;
+        uint64_t n = nOffset;
+        for (; n < nRange; n += nThreads) {
+            if (found.load(std::memory_order_relaxed) || !fSecMsgEnabled) {
+                break;
+            }
 
-        CHMAC_SHA256 ctx(&civ[0], 32);
-        ctx.Write((uint8_t*) pHeader+4, SMSG_HDR_LEN-4);
-        ctx.Write((uint8_t*) pPayload, nPayload);
-        ctx.Finalize(msg_hash.begin());
+            uint32_t nonce = nonce_start + (uint32_t) n;
+            memcpy(&header[4], &nonce, 4);
+            for (int i = 0; i < 32; i+=4) {
+                memcpy(civ+i, &nonce, 4);
+            }
 
-        if (UintToArith256(msg_hash) <= target_difficulty) {
-            found = true;
-            break;
+            CHMAC_SHA256 ctx(&civ[0], 32);
+            ctx.Write(&header[4], SMSG_HDR_LEN-4);
+            ctx.Write((uint8_t*) pPayload, nPayload);
+            ctx.Finalize(msg_hash.begin());
+
+            if (UintToArith256(msg_hash) <= target_difficulty) {
+                LOCK(cs_found);
+                if (!found) {
+                    nonce_found = nonce;
+                    hash_found = msg_hash;
+                    found = true;
+                }
+                break;
+            }
         }
+        nTried += (n - nOffset) / nThreads;
+    };
 
-        if (nonce >= 0xFFFFFFFFU) {
-            LogPrint(BCLog::SMSG, "No match %u\n", nonce);
-            break;
-        }
-        nonce++;
+    std::vector<std::thread> vThreads;
+    for (int k = 1; k < nThreads; ++k) {
+        vThreads.emplace_back(worker, k);
+    }
+    worker(0);
+    for (auto &t : vThreads) {
+        t.join();
     }
 
-    if (!fSecMsgEnabled) {
+    if (!found && !fSecMsgEnabled) {
         LogPrint(BCLog::SMSG, "%s: Stopped, shutdown detected.\n", __func__);
         return SMSG_SHUTDOWN_DETECTED;
     }
 
     if (!found) {
-        LogPrint(BCLog::SMSG, "%s: Failed, took %d ms, nonce %u\n", __func__, GetTimeMillis() - nStart, nonce);
+        LogPrint(BCLog::SMSG, "%s: Failed, took %d ms, tried %u nonces\n", __func__, GetTimeMillis() - nStart, nTried.load());
         return SMSG_GENERAL_ERROR;
     }
 
-    memcpy(psmsg->hash, msg_hash.begin(), 4);
+    memcpy(&psmsg->nonce[0], &nonce_found, 4);
+    memcpy(psmsg->hash, hash_found.begin(), 4);
 
-    LogPrint(BCLog::SMSG, "%s: Took %d ms, nonce %u\n", __func__, GetTimeMillis() - nStart, nonce);
+    LogPrint(BCLog::SMSG, "%s: Took %d ms, nonce %u, %d threads\n", __func__, GetTimeMillis() - nStart, nonce_found, nThreads);
 
     return SMSG_NO_ERROR;
 };
@@ -3803,7 +4138,7 @@ int CSMSG::Encrypt(SecureMessage &smsg, const CKeyID &addressFrom, const CKeyID
     return SMSG_NO_ERROR;
 };
 
-int CSMSG::Import(SecureMessage *psmsg, std::string &sError, bool setread, bool submitmsg)
+int CSMSG::Import(SecureMessage *psmsg, std::string &sError, bool setread, bool submitmsg, bool async)
 {
     if (psmsg->IsPaidVersion() && psmsg->nPayload < 33) {
         sError = "Payload too short.";
@@ -3832,14 +4167,22 @@ int CSMSG::Import(SecureMessage *psmsg, std::string &sError, bool setread, bool
     if (!submitmsg) {
         return SMSG_NO_ERROR;
     }
-    LOCK(cs_smsg);
 
+    if (async) {
+        // Proof of work is set and the message stored by ThreadSecureMsgPow
+        uint160 msgId;
+        HashMsg(*psmsg, psmsg->pPayload, psmsg->nPayload-(psmsg->IsPaidVersion() ? 32 : 0), msgId);
+        return Queue(*psmsg, CKeyID(), msgId, sError);
+    }
+
+    // cs_smsg is not held while searching for the proof of work
     int rv = SetHash(psmsg->data(), psmsg->pPayload, psmsg->nPayload);
     if (rv != SMSG_NO_ERROR) {
         sError = "SetHash failed " + std::string(GetString(rv));
         return rv;
     }
 
+    LOCK(cs_smsg);
     rv = Validate(psmsg->data(), psmsg->pPayload, psmsg->nPayload);
     if (rv != SMSG_NO_ERROR) {
         sError = "Validation failed " + std::string(GetString(rv));
@@ -3851,6 +4194,43 @@ int CSMSG::Import(SecureMessage *psmsg, std::string &sError, bool setread, bool
     return SMSG_NO_ERROR;
 };
 
+int CSMSG::Queue(const SecureMessage &smsg, const CKeyID &addressTo, const uint160 &msgId, std::string &sError)
+{
+    uint8_t chKey[30];
+    int64_t timestamp_be = bswap_64(smsg.timestamp);
+    memcpy(&chKey[0], DBK_QUEUED.data(), 2);
+    memcpy(&chKey[2], &timestamp_be, 8);
+    memcpy(&chKey[10], msgId.begin(), 20);
+
+    SecMsgStored smsgSQ;
+    smsgSQ.timeReceived  = GetTime();
+    smsgSQ.addrTo        = addressTo;
+
+    try { smsgSQ.vchMessage.resize(SMSG_HDR_LEN + smsg.nPayload); } catch (std::exception &e) {
+        LogPrintf("smsgSQ.vchMessage.resize %u threw: %s.\n", SMSG_HDR_LEN + smsg.nPayload, e.what());
+        sError = "Could not allocate memory.";
+        return SMSG_ALLOCATE_FAILED;
+    }
+
+    memcpy(&smsgSQ.vchMessage[0], smsg.data(), SMSG_HDR_LEN);
+    memcpy(&smsgSQ.vchMessage[SMSG_HDR_LEN], smsg.pPayload, smsg.nPayload);
+
+    {
+        LOCK(cs_smsgDB);
+        SecMsgDB dbSendQueue;
+        if (dbSendQueue.Open("cw")) {
+            dbSendQueue.WriteSmesg(chKey, smsgSQ);
+            //NotifySecMsgSendQueueChanged(smsgOutbox);
+        }
+    } // cs_smsgDB
+
+    if (LogAcceptCategory(BCLog::SMSG)) {
+        LogPrintf("Secure message queued for sending to %s.\n", addressTo.IsNull() ? "unknown" : EncodeDestination(PKHash(addressTo)));
+    }
+
+    return SMSG_NO_ERROR;
+};
+
 /** Encrypt secure message, and place it on the network
   * Make a copy of the message to sender's first address and place in send queue db
   * proof of work thread will pick up messages from  send queue db
@@ -3941,36 +4321,8 @@ int CSMSG::Send(CKeyID &addressFrom, CKeyID &addressTo, std::string &message,
 
     if (submit_msg) {
         // Place message in send queue, proof of work will happen in a thread.
-        uint8_t chKey[30];
-        int64_t timestamp_be = bswap_64(smsg.timestamp);
-        memcpy(&chKey[0], DBK_QUEUED.data(), 2);
-        memcpy(&chKey[2], &timestamp_be, 8);
-        memcpy(&chKey[10], msgId.begin(), 20);
-
-        SecMsgStored smsgSQ;
-        smsgSQ.timeReceived  = GetTime();
-        smsgSQ.addrTo        = addressTo;
-
-        try { smsgSQ.vchMessage.resize(SMSG_HDR_LEN + smsg.nPayload); } catch (std::exception &e) {
-            LogPrintf("smsgSQ.vchMessage.resize %u threw: %s.\n", SMSG_HDR_LEN + smsg.nPayload, e.what());
-            sError = "Could not allocate memory.";
-            return SMSG_ALLOCATE_FAILED;
-        }
-
-        memcpy(&smsgSQ.vchMessage[0], smsg.data(), SMSG_HDR_LEN);
-        memcpy(&smsgSQ.vchMessage[SMSG_HDR_LEN], smsg.pPayload, smsg.nPayload);
-
-        {
-            LOCK(cs_smsgDB);
-            SecMsgDB dbSendQueue;
-            if (dbSendQueue.Open("cw")) {
-                dbSendQueue.WriteSmesg(chKey, smsgSQ);
-                //NotifySecMsgSendQueueChanged(smsgOutbox);
-            }
-        } // cs_smsgDB
-
-        if (LogAcceptCategory(BCLog::SMSG)) {
-            LogPrintf("Secure message queued for sending to %s.\n", EncodeDestination(PKHash(addressTo)));
+        if ((rv = Queue(smsg, addressTo, msgId, sError)) != 0) {
+            return rv;
         }
     }
 
@@ -4053,6 +4405,7 @@ int CSMSG::Send(CKeyID &addressFrom, CKeyID &addressTo, std::string &message,
 
                 if (dbSent.Open("cw")) {
                     dbSent.WriteSmesg(chKey, smsgOutbox);
+                    IndexMessage(dbSent, chKey, smsgOutbox);
                     NotifySecMsgOutboxChanged(smsgOutbox);
                 }
             } // cs_smsgDB
@@ -4432,6 +4785,84 @@ int CSMSG::Decrypt(bool fTestOnly, const CKeyID &address, const SecureMessage &s
     return CSMSG::Decrypt(fTestOnly, address, smsg.data(), smsg.pPayload, smsg.nPayload, msg);
 };
 
+int CSMSG::IndexMessage(SecMsgDB &db, const uint8_t *chKey, const SecMsgStored &smsgStored, const MessageData *pMsg)
+{
+    if (smsgStored.vchMessage.size() < SMSG_HDR_LEN) {
+        return errorN(SMSG_GENERAL_ERROR, "%s: Message too short.", __func__);
+    }
+
+    const uint8_t *pHeader = smsgStored.vchMessage.data();
+    const SecureMessage *psmsg = (const SecureMessage*) pHeader;
+    uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
+    bool fInbox = chKey[0] == DBK_INBOX[0];
+
+    SecMsgMeta meta;
+    meta.timeReceived = smsgStored.timeReceived;
+    meta.status = smsgStored.status;
+    meta.version[0] = psmsg->version[0];
+    meta.version[1] = psmsg->version[1];
+    meta.ttl = psmsg->m_ttl;
+    meta.nPayload = nPayload;
+    meta.addrTo = smsgStored.addrTo;
+
+    MessageData msg;
+    int rv = 0;
+    if (!pMsg) {
+        rv = Decrypt(false, fInbox ? smsgStored.addrTo : smsgStored.addrOutbox, pHeader, pHeader + SMSG_HDR_LEN, nPayload, msg);
+        pMsg = &msg;
+    }
+    if (rv == 0) {
+        meta.timeSent = pMsg->timestamp;
+        meta.sFromAddress = pMsg->sFromAddress;
+    }
+    meta.nDecryptError = rv;
+
+    if (!db.WriteMeta(chKey, meta)) {
+        m_meta_indexed = false;
+        return errorN(SMSG_GENERAL_ERROR, "%s: WriteMeta failed.", __func__);
+    }
+    if (rv == SMSG_WALLET_LOCKED) {
+        m_meta_indexed = false;
+    }
+
+    return rv;
+};
+
+bool CSMSG::IndexMessages(SecMsgDB &db)
+{
+    // Messages that can't be decrypted with the keys known are only retried when keys are added
+    bool fRetryFailed = m_meta_keys_changed.exchange(false);
+    if (m_meta_indexed && !fRetryFailed) {
+        return true;
+    }
+
+    m_meta_indexed = true;
+    size_t nIndexed = 0;
+    uint8_t chKey[30];
+    SecMsgStored smsgStored;
+    SecMsgMeta meta;
+    for (const auto &prefix : {DBK_INBOX, DBK_OUTBOX}) {
+        leveldb::Iterator *it = db.pdb->NewIterator(leveldb::ReadOptions());
+        while (db.NextSmesgKey(it, prefix, chKey)) {
+            if (db.ReadMeta(chKey, meta)
+                && (meta.nDecryptError == 0
+                    || (meta.nDecryptError != SMSG_WALLET_LOCKED && !fRetryFailed))) {
+                continue;
+            }
+            if (!db.ReadSmesg(chKey, smsgStored)) {
+                m_meta_indexed = false;
+                continue;
+            }
+            IndexMessage(db, chKey, smsgStored);
+            nIndexed++;
+        }
+        delete it;
+    }
+
+    LogPrint(BCLog::SMSG, "%s: Indexed %u messages, complete %d.\n", __func__, nIndexed, m_meta_indexed);
+    return m_meta_indexed;
+};
+
 double GetDifficulty(uint32_t compact)
 {
     int nShift = (compact >> 24) & 0xff;
@@ -6,12 +6,20 @@
 #ifndef PARTICL_SMSG_SMESSAGE_H
 #define PARTICL_SMSG_SMESSAGE_H
 
+#include <checkqueue.h>
 #include <key_io.h>
 #include <serialize.h>
 #include <ui_interface.h>
 #include <lz4/lz4.h>
+#include <smsg/bucketstore.h>
+#include <smsg/fundingcache.h>
 #include <smsg/keystore.h>
 #include <interfaces/handler.h>
+#include <secp256k1.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <atomic>
 
 #include <boost/signals2/signal.hpp>
 
@@ -24,7 +32,8 @@ typedef int64_t NodeId;
 
 namespace smsg {
 
-const int SMSG_VERSION = 1;
+const int SMSG_VERSION = 2;
+const int SMSG_VERSION_SUM_HASH = 2;                    // peers from this version hash buckets with SecMsgBucket::hash
 
 enum SecureMessageCodes {
     SMSG_NO_ERROR = 0,
@@ -82,6 +91,17 @@ const uint32_t SMSG_TIME_IGNORE    = 90;                // seconds a peer is ign
 const uint32_t SMSG_DEFAULT_BANTIME = 8 * 60 * 60;
 const uint32_t SMSG_DEFAULT_MAXRCV = 4000;
 
+const size_t SMSG_TRIAL_BATCH_SIZE = 128;               // receiving keys tested together by a scan thread
+const int SMSG_MAX_SCAN_THREADS    = 16;
+const int SMSG_DEFAULT_SCAN_THREADS = 0;                // 0 = number of cores
+const int SMSG_MAX_POW_THREADS     = 16;
+const int SMSG_DEFAULT_POW_THREADS = 0;                 // 0 = number of cores
+
+const uint32_t SMSG_DEFAULT_MAX_FILE_SIZE = 256;        // MiB, a new bucket file is started when the last reaches this size
+const uint32_t SMSG_COMPACT_INTERVAL = 10 * 60;         // seconds between compaction runs
+const uint32_t SMSG_COMPACT_MIN_BYTES = 64 * 1024;      // bucket files are rewritten when they hold at least this many bytes
+const uint32_t SMSG_COMPACT_MIN_PERCENT = 25;           // and this proportion of removed or expired messages
+
 const uint32_t SMSG_MAX_MSG_BYTES  = 24000;             // the user input part
 const uint32_t SMSG_MAX_AMSG_BYTES = 512;               // the user input part (ANON)
 const uint32_t SMSG_MAX_MSG_BYTES_PAID = 512 * 1024;    // the user input part (Paid)
@@ -97,6 +117,7 @@ extern const std::string STORE_DIR;
 #define SMSG_MASK_UNREAD (1 << 0)
 
 class SecMsgStored;
+class SecMsgDB;
 
 // Inbox db changed, called with lock cs_smsgDB held.
 extern boost::signals2::signal<void (SecMsgStored &inboxHdr)> NotifySecMsgInboxChanged;
@@ -191,6 +212,92 @@ public:
     std::vector<uint8_t>  vchMessage; // null terminated plaintext
 };
 
+class SecMsgTrialKeys;
+
+/** Tests a batch of receiving keys against a message on the smsg scan threads, see SecMsgTrialKeys::Match. */
+class SecMsgTrialCheck
+{
+private:
+    const SecMsgTrialKeys *pKeys = nullptr;
+    const secp256k1_context *ctx = nullptr;
+    const secp256k1_pubkey *pR = nullptr;
+    const SecureMessage *psmsg = nullptr;
+    const uint8_t *pPayload = nullptr;
+    uint32_t nPayload = 0;
+    size_t nBegin = 0;
+    size_t nEnd = 0;
+    std::atomic<size_t> *pnFound = nullptr; // lowest matching index
+
+public:
+    SecMsgTrialCheck() {};
+    SecMsgTrialCheck(const SecMsgTrialKeys *pKeysIn, const secp256k1_context *ctxIn, const secp256k1_pubkey *pRIn, const SecureMessage *psmsgIn,
+        const uint8_t *pPayloadIn, uint32_t nPayloadIn, size_t nBeginIn, size_t nEndIn, std::atomic<size_t> *pnFoundIn)
+        : pKeys(pKeysIn), ctx(ctxIn), pR(pRIn), psmsg(psmsgIn), pPayload(pPayloadIn), nPayload(nPayloadIn),
+          nBegin(nBeginIn), nEnd(nEndIn), pnFound(pnFoundIn) {};
+
+    //! Always succeeds, a match is reported through pnFound
+    bool operator()();
+
+    void swap(SecMsgTrialCheck &check)
+    {
+        std::swap(pKeys, check.pKeys);
+        std::swap(ctx, check.ctx);
+        std::swap(pR, check.pR);
+        std::swap(psmsg, check.psmsg);
+        std::swap(pPayload, check.pPayload);
+        std::swap(nPayload, check.nPayload);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(pnFound, check.pnFound);
+    };
+};
+
+/** Receiving keys prepared for trial decryption.
+ *  Built once from the smsg keystore and the wallets and reused for every scanned message,
+ *  so keys are not fetched from the wallets per message.
+ */
+class SecMsgTrialKeys
+{
+public:
+    class Key
+    {
+    public:
+        Key(const CKeyID &address_, const CKey &key_, bool fReceiveAnon_)
+            : address(address_), key(key_), fReceiveAnon(fReceiveAnon_) {};
+
+        CKeyID address;
+        CKey key;
+        bool fReceiveAnon;
+    };
+
+    void Add(const CKeyID &address, const CKey &key, bool fReceiveAnon)
+    {
+        vKeys.emplace_back(address, key, fReceiveAnon);
+    };
+
+    void Clear()
+    {
+        vKeys.clear();
+        hashState.SetNull();
+        fBuilt = false;
+        fWasLocked = false;
+    };
+
+    size_t size() const { return vKeys.size(); };
+
+    /** Find the key a message was encrypted to, returns the lowest matching index or -1.
+     *  R is parsed once, the ECDH and MAC test of each key runs in batches of SMSG_TRIAL_BATCH_SIZE,
+     *  spread over the threads of pqueue if set. Only the matched key needs a full Decrypt.
+     */
+    int Match(const secp256k1_context *ctx, const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload,
+        CCheckQueue<SecMsgTrialCheck> *pqueue = nullptr) const;
+
+    std::vector<Key> vKeys;
+    uint256 hashState;          // fingerprint of the addresses and wallet states the set was built from
+    bool fBuilt = false;
+    bool fWasLocked = false;    // a locked wallet holds a receiving address
+};
+
 class SecMsgToken
 {
 public:
@@ -206,6 +313,7 @@ public:
         }
         offset = o;
         ttl = ttl_;
+        nPayload = np;
     };
 
     bool operator <(const SecMsgToken &y) const
@@ -220,9 +328,11 @@ public:
 
     int64_t timestamp;
     uint8_t sample[8];      // first 8 bytes of payload
-    int64_t offset;         // offset in file
+    mutable int64_t offset; // offset in file
     int m_changed = 0;          // time changed relative to timestamp
     mutable uint32_t ttl;   // seconds
+    uint32_t nPayload = 0;
+    int m_file = 1;         // bucket file number
 };
 
 class SecMsgPurged // Purged token marker
@@ -271,23 +381,43 @@ public:
     {
         timeChanged     = 0;
         hash            = 0;
-        nLeastTTL       = 0;
         nActive         = 0;
         nLockCount      = 0;
         nLockPeerId     = -1;
     };
+    SecMsgBucket(const SecMsgBucket&) = delete;
+    SecMsgBucket &operator=(const SecMsgBucket&) = delete;
+
+    /** setTokens must only be modified through these functions to keep hash and nActive up to date.
+     *  A token is active until timestamp + ttl has passed, purged tokens have ttl 0. */
+    bool InsertToken(const SecMsgToken &token, int64_t now);
+    std::set<SecMsgToken>::iterator EraseToken(std::set<SecMsgToken>::iterator it);
+    void PurgeToken(std::set<SecMsgToken>::iterator it);
+    /** Drop tokens that expired before now from the hash, returns true if any were dropped. */
+    bool ExpireTokens(int64_t now);
 
-    void hashBucket(int64_t bucket_time);
     size_t CountActive() const;
+    /** The hash to send to and compare with a peer of version nVersion. */
+    uint32_t GetHash(int nVersion) const;
 
     int64_t               timeChanged;
-    uint32_t              hash;           // token set should get ordered the same on each node
-    uint32_t              nLeastTTL;      // lowest ttl in seconds of messages in bucket
+    uint32_t              hash;           // sum of the hashes of the active tokens, independent of order
     uint32_t              nActive;        // Number of untimedout messages in bucket
     uint32_t              nLockCount;     // set when smsgWant first sent, unset at end of smsgMsg, ticks down in ThreadSecureMsg()
     NodeId                nLockPeerId;    // id of peer that bucket is locked for
+    int                   nLastFile = 1;  // file new messages are appended to
+    uint64_t              nChangeSeq = 0; // key in CSMSG::m_changed_buckets
 
     std::set<SecMsgToken> setTokens;
+
+private:
+    void Activate(const SecMsgToken &token);
+    void Deactivate(const SecMsgToken &token);
+    uint32_t LegacyHash() const;
+
+    std::set<std::pair<int64_t, const SecMsgToken*> > m_expiry; // active tokens by expiry time
+    mutable uint32_t m_hash_legacy = 0;
+    mutable bool m_hash_legacy_valid = false;
 };
 
 class SecMsgAddress
@@ -378,6 +508,43 @@ public:
     };
 };
 
+/** Decrypted metadata of an inbox or outbox message, lets the message lists be filtered and paged without decrypting every message. */
+class SecMsgMeta
+{
+public:
+    int64_t              timeReceived = 0;
+    int64_t              timeSent = 0;       // timestamp in the decrypted payload
+    uint8_t              status = 0;         // copy of SecMsgStored::status
+    int32_t              nDecryptError = 0;  // SecureMessageCodes, SMSG_WALLET_LOCKED is retried on the next listing
+    uint8_t              version[2] = {0, 0};
+    uint32_t             ttl = 0;
+    uint32_t             nPayload = 0;
+    CKeyID               addrTo;
+    std::string          sFromAddress;
+
+    bool IsPaidVersion() const
+    {
+        return version[0] == 3;
+    };
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action)
+    {
+        READWRITE(timeReceived);
+        READWRITE(timeSent);
+        READWRITE(status);
+        READWRITE(nDecryptError);
+        READWRITE(version[0]);
+        READWRITE(version[1]);
+        READWRITE(ttl);
+        READWRITE(nPayload);
+        READWRITE(addrTo);
+        READWRITE(sFromAddress);
+    };
+};
+
 void AddOptions();
 const char *GetString(size_t errorCode);
 
@@ -386,6 +553,11 @@ class CSMSG
 {
 public:
     int BuildBucketSet();
+    /** Queue the bucket for the next smsgInv to each peer. */
+    void SetBucketChanged(int64_t bucket_time, SecMsgBucket &bucket) EXCLUSIVE_LOCKS_REQUIRED(cs_smsg);
+    void EraseBucket(std::map<int64_t, SecMsgBucket>::iterator it) EXCLUSIVE_LOCKS_REQUIRED(cs_smsg);
+    /** Rewrite bucket files holding many removed or expired messages, called from the scheduler. */
+    int CompactBuckets();
     int BuildPurgedSets();
     int AddWalletAddresses();
     int LoadKeyStore();
@@ -419,9 +591,11 @@ public:
 
     int ManageLocalKey(CKeyID &keyId, ChangeType mode);
     int WalletUnlocked(CWallet *pwallet);
+    void WalletLocked(CWallet *pwallet);
     int WalletKeyChanged(CKeyID &keyId, const std::string &sLabel, ChangeType mode);
 
     int ScanMessage(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, bool reportToGui, bool &received_msg, bool unlocking=false);
+    void UpdateTrialKeys() EXCLUSIVE_LOCKS_REQUIRED(cs_trial_keys);
 
     int GetStoredKey(const CKeyID &ckid, CPubKey &cpkOut);
     int GetLocalKey(const CKeyID &ckid, CPubKey &cpkOut);
@@ -454,8 +628,9 @@ public:
 
     int AdjustDifficulty(int64_t time);
 
-    int Import(SecureMessage *psmsg, std::string &sError, bool setread, bool submitmsg);
+    int Import(SecureMessage *psmsg, std::string &sError, bool setread, bool submitmsg, bool async=false);
 
+    int Queue(const SecureMessage &smsg, const CKeyID &addressTo, const uint160 &msgId, std::string &sError);
     int Send(CKeyID &addressFrom, CKeyID &addressTo, std::string &message,
         SecureMessage &smsg, std::string &sError, bool fPaid, size_t nRetention,
         bool fTestFee=false, CAmount *nFee=nullptr, size_t *nTxBytes=nullptr, bool fFromFile=false, bool submit_msg=true, bool add_to_outbox=true, bool fund_from_rct=false, size_t nRingSize=5, CCoinControl *coin_control=nullptr);
@@ -478,10 +653,22 @@ public:
     int Decrypt(bool fTestOnly, const CKeyID &address, const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, MessageData &msg);
     int Decrypt(bool fTestOnly, const CKeyID &address, const SecureMessage &smsg, MessageData &msg);
 
+    /** Decrypt an inbox or outbox message and write its metadata, called with cs_smsgDB held.
+     *  pMsg can pass the message when it was already decrypted. */
+    int IndexMessage(SecMsgDB &db, const uint8_t *chKey, const SecMsgStored &smsgStored, const MessageData *pMsg = nullptr);
+    /** Index inbox and outbox messages without metadata or that were received while their wallet was locked.
+     *  Other decrypt failures are only retried after keys are added. Returns false if any message is left to retry. */
+    bool IndexMessages(SecMsgDB &db);
+
     CCriticalSection cs_smsg; // All except inbox and outbox
+    CCriticalSection cs_trial_keys;
 
     SecMsgKeyStore keyStore;
     std::map<int64_t, SecMsgBucket> buckets;
+    uint64_t m_change_seq = 0;                       // incremented when a bucket changes
+    std::map<uint64_t, int64_t> m_changed_buckets;   // last change of each bucket, change sequence -> bucket time
+    CBucketStore m_bucket_store; // Mapped bucket files, cs_smsg
+    CFundingTxCache m_funding_cache; // Funding transactions of paid messages
     std::vector<SecMsgAddress> addresses;
     std::set<SecMsgPurged> setPurged;
     std::set<int64_t> setPurgedTimestamps;
@@ -492,12 +679,20 @@ public:
     std::unique_ptr<interfaces::Handler> m_wallet_load_handler;
 
     int64_t start_time = 0;
-    int64_t m_last_changed = 0;  // Updated whenever a message is stored
     int64_t nLastProcessedPurged = 0;
     CAmount m_absurd_smsg_fee = 500 * COIN;
     uint16_t m_smsg_max_receive_count = SMSG_DEFAULT_MAXRCV;
 
     std::map<int64_t, int64_t> m_show_requests;
+
+    SecMsgTrialKeys m_trial_keys GUARDED_BY(cs_trial_keys);
+    std::atomic<bool> m_trial_keys_dirty{false}; // A wallet was locked, rebuild m_trial_keys
+    CCheckQueue<SecMsgTrialCheck> m_scan_queue{1}; // Workers run on threadGroupSmsg, each check is already a batch of keys
+    int m_scan_threads = 1;
+    int m_pow_threads = 1;
+    uint64_t m_max_file_size = SMSG_DEFAULT_MAX_FILE_SIZE * 1024 * 1024;
+    bool m_meta_indexed = false; // All inbox and outbox messages have metadata and none are waiting for a wallet unlock, cs_smsgDB
+    std::atomic<bool> m_meta_keys_changed{false}; // Retry messages that failed to decrypt
 };
 
 double GetDifficulty(uint32_t compact);
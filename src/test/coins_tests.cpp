@@ -5,9 +5,11 @@
 #include <attributes.h>
 #include <clientversion.h>
 #include <coins.h>
+#include <node/coinstats.h>
 #include <script/standard.h>
 #include <streams.h>
 #include <test/setup_common.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <util/strencodings.h>
@@ -864,4 +866,50 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+
+BOOST_AUTO_TEST_CASE(scan_utxo_set_ranges)
+{
+    CCoinsViewDB db("scan_utxo_set_test", 1 << 20, true, false);
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 500; ++i) {
+            uint256 txid = InsecureRand256();
+            for (uint32_t n = 0; n < 1 + InsecureRandBits(2); ++n) {
+                cache.AddCoin(COutPoint(txid, n), Coin(CTxOut(InsecureRandRange(1000), CScript()), i, false), false);
+            }
+        }
+        cache.SetBestBlock(InsecureRand256(), 1);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    std::vector<COutPoint> expect;
+    std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        BOOST_CHECK(pcursor->GetKey(key));
+        expect.push_back(key);
+    }
+
+    // Ranges are visited by one thread each, in key order
+    std::vector<std::vector<COutPoint> > ranges(UTXO_SCAN_RANGES);
+    uint256 hashBlock;
+    BOOST_CHECK(ScanUTXOSet(&db, hashBlock, [&ranges](size_t nRange, const COutPoint &key, Coin &&coin) {
+        ranges[nRange].push_back(key);
+        return true;
+    }));
+    BOOST_CHECK(hashBlock == db.GetBestBlock());
+
+    std::vector<COutPoint> scanned;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        for (const auto &key : ranges[i]) {
+            BOOST_CHECK_EQUAL(GetUTXOScanRange(key.hash), i);
+        }
+        scanned.insert(scanned.end(), ranges[i].begin(), ranges[i].end());
+    }
+    BOOST_CHECK(scanned == expect);
+
+    // Stops when the visitor fails
+    BOOST_CHECK(!ScanUTXOSet(&db, hashBlock, [](size_t nRange, const COutPoint &key, Coin &&coin) { return false; }));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
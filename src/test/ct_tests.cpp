@@ -276,6 +276,76 @@ BOOST_AUTO_TEST_CASE(ct_test_bulletproofs)
     secp256k1_context_destroy(ctx);
 }
 
+BOOST_AUTO_TEST_CASE(ct_test_bulletproof_batch)
+{
+    SeedInsecureRand();
+    ECC_Start_Blinding();
+
+    const size_t nOutputs = 5;
+    std::vector<CTxOutValueTest> txouts(nOutputs);
+    for (size_t k = 0; k < nOutputs; ++k) {
+        CTxOutValueTest &txout = txouts[k];
+        uint64_t nValue = (k + 1) * COIN;
+        uint8_t blind[32], nonce[32];
+        InsecureRandBytes(blind, 32);
+        InsecureRandBytes(nonce, 32);
+        BOOST_CHECK(secp256k1_pedersen_commit(secp256k1_ctx_blind, &txout.commitment, blind, nValue, &secp256k1_generator_const_h, &secp256k1_generator_const_g));
+
+        size_t nRangeProofLen = 5134;
+        txout.vchRangeproof.resize(nRangeProofLen);
+        const uint8_t *blindptrs[] = {blind};
+        BOOST_CHECK(secp256k1_bulletproof_rangeproof_prove(secp256k1_ctx_blind, blind_scratch, blind_gens, txout.vchRangeproof.data(), &nRangeProofLen,
+            &nValue, nullptr, blindptrs, 1, &secp256k1_generator_const_h, 64, nonce, nullptr, 0) == 1);
+        txout.vchRangeproof.resize(nRangeProofLen);
+    }
+
+    CBulletproofBatch batch;
+    for (const auto &txout : txouts) {
+        batch.Add(&txout.commitment, txout.vchRangeproof);
+    }
+    BOOST_CHECK(batch.size() == nOutputs);
+
+    std::vector<CBulletproofCheck> vChecks;
+    batch.Split(vChecks);
+    BOOST_CHECK(vChecks.size() == 1);
+    BOOST_CHECK(vChecks[0].size() == nOutputs);
+    BOOST_CHECK(vChecks[0]());
+
+    vChecks.clear();
+    batch.Split(vChecks, MAX_BULLETPROOF_BATCH, 2);
+    BOOST_CHECK(vChecks.size() == 2);
+    for (auto &check : vChecks) {
+        BOOST_CHECK(check());
+    }
+
+    // Proofs added to the proof cache are skipped
+    for (const auto &txout : txouts) {
+        uint256 entry;
+        ComputeRangeProofCacheEntry(entry, txout.commitment, txout.vchRangeproof);
+        ProofCacheSet(entry);
+    }
+    CBulletproofBatch cached_batch;
+    for (const auto &txout : txouts) {
+        cached_batch.Add(&txout.commitment, txout.vchRangeproof);
+    }
+    BOOST_CHECK(cached_batch.size() == 0);
+
+    // Lookups leave the entries in the cache
+    CBulletproofBatch cached_again;
+    for (const auto &txout : txouts) {
+        cached_again.Add(&txout.commitment, txout.vchRangeproof);
+    }
+    BOOST_CHECK(cached_again.size() == 0);
+
+    // A single bad proof fails the whole batch
+    txouts[3].vchRangeproof[10] ^= 1;
+    vChecks.clear();
+    batch.Split(vChecks);
+    BOOST_CHECK(!vChecks[0]());
+
+    ECC_Stop_Blinding();
+}
+
 BOOST_AUTO_TEST_CASE(ct_parameters_test)
 {
     //for (size_t k = 0; k < 10000; ++k)
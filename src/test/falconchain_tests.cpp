@@ -15,6 +15,7 @@
 
 #include <script/sign.h>
 #include <policy/policy.h>
+#include <undo.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -361,4 +362,106 @@ BOOST_AUTO_TEST_CASE(blockreward_at_year_test)
     BOOST_CHECK_EQUAL(Params().GetProofOfStakeRewardAtYear(50), 200000000);
 }
 
+BOOST_AUTO_TEST_CASE(stake_kernel_search_test)
+{
+    SeedInsecureRand();
+
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 1000;
+    indexPrev.nTime = 1500000000;
+    indexPrev.bnStakeModifier = InsecureRand256();
+    uint32_t nBits = 0x1b7fffff;
+
+    CStakeKernelSearch search;
+    BOOST_REQUIRE(search.Init(&indexPrev, nBits));
+
+    std::vector<CAmount> vValues;
+    std::vector<uint32_t> vBlockTimes;
+    for (size_t i = 0; i < 200; ++i) {
+        COutPoint prevout(InsecureRand256(), InsecureRandRange(10));
+        vValues.push_back(1 + InsecureRandRange(1000 * COIN));
+        vBlockTimes.push_back(indexPrev.nTime - InsecureRandRange(100000));
+        search.AddCoin(prevout, vValues.back(), vBlockTimes.back());
+    }
+    BOOST_CHECK_EQUAL(search.Size(), 200U);
+
+    // Must match CheckStakeKernelHash for every coin and slot
+    size_t nFound = 0;
+    for (uint32_t nTime = indexPrev.nTime; nTime < indexPrev.nTime + 16 * 20; nTime += 16) {
+        int nFirst = -1;
+        for (size_t i = 0; i < search.Size(); ++i) {
+            uint256 hashProofOfStake, hashProofOfStakeCheck, targetProofOfStake;
+            bool fKernel = search.CheckCoin(i, nTime, hashProofOfStake);
+            bool fKernelCheck = CheckStakeKernelHash(&indexPrev, nBits, vBlockTimes[i], vValues[i], search.GetPrevout(i), nTime,
+                hashProofOfStakeCheck, targetProofOfStake);
+            BOOST_CHECK(fKernel == fKernelCheck);
+            BOOST_CHECK(hashProofOfStake == hashProofOfStakeCheck);
+            if (fKernel) {
+                nFound++;
+                if (nFirst < 0) {
+                    nFirst = i;
+                }
+            }
+        }
+        BOOST_CHECK_EQUAL(search.Search(nTime), nFirst);
+    }
+    BOOST_CHECK(nFound > 0);
+
+    search.Clear();
+    BOOST_CHECK_EQUAL(search.Size(), 0U);
+    BOOST_CHECK(search.Search(indexPrev.nTime) == -1);
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_cache_test)
+{
+    SeedInsecureRand();
+    LOCK(cs_main);
+
+    // Chain of MAX_REORG_DEPTH + 2 blocks, each spending one standard output
+    std::vector<CBlockIndex> vIndex(MAX_REORG_DEPTH + 2);
+    std::vector<COutPoint> vPrevouts;
+    CStakeKernelCache cache;
+    for (size_t i = 0; i < vIndex.size(); ++i) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i > 0 ? &vIndex[i - 1] : nullptr;
+
+        CMutableTransaction txn;
+        txn.nVersion = FALCON_TXN_VERSION;
+        txn.vin.push_back(CTxIn(COutPoint(InsecureRand256(), 1)));
+        vPrevouts.push_back(txn.vin[0].prevout);
+        CBlock block;
+        block.vtx.push_back(MakeTransactionRef(txn));
+
+        CBlockUndo blockundo;
+        blockundo.vtxundo.emplace_back();
+        blockundo.vtxundo.back().vprevout.emplace_back(CTxOut(i + 1, CScript() << OP_TRUE), i / 2, false);
+
+        cache.ConnectBlock(block, blockundo, &vIndex[i]);
+        BOOST_CHECK_EQUAL(cache.GetLowestHeight(&vIndex[i]), std::max(0, (int)i - MAX_REORG_DEPTH + 1));
+    }
+    const CBlockIndex *pindexTip = &vIndex.back();
+    BOOST_CHECK_EQUAL(cache.Size(), (size_t)MAX_REORG_DEPTH);
+
+    // Spends deeper than MAX_REORG_DEPTH are evicted
+    BOOST_CHECK(!cache.GetSpent(vPrevouts[0]));
+    BOOST_CHECK(!cache.GetSpent(vPrevouts[1]));
+    const CStakeKernelCache::SpentKernel *pspent = cache.GetSpent(vPrevouts[10]);
+    BOOST_REQUIRE(pspent);
+    BOOST_CHECK_EQUAL(pspent->nValue, 11);
+    BOOST_CHECK_EQUAL(pspent->nHeight, 5);
+    BOOST_CHECK_EQUAL(pspent->nSpendHeight, 10);
+    BOOST_CHECK(pspent->scriptPubKey == CScript() << OP_TRUE);
+
+    // Disconnecting the tip drops its spends
+    cache.DisconnectBlock(pindexTip);
+    BOOST_CHECK(!cache.GetSpent(vPrevouts.back()));
+    BOOST_CHECK_EQUAL(cache.GetLowestHeight(pindexTip), -1);
+    BOOST_CHECK_EQUAL(cache.GetLowestHeight(pindexTip->pprev), 2);
+
+    // A block not connecting to the cached tip resets the cache
+    cache.DisconnectBlock(pindexTip->pprev->pprev);
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    BOOST_CHECK_EQUAL(cache.GetLowestHeight(pindexTip->pprev->pprev), -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
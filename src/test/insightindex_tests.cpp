@@ -0,0 +1,202 @@
+// Copyright (c) 2020 The Particl Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <index/insightindex.h>
+#include <insight/addressindex.h>
+#include <miner.h>
+#include <pow.h>
+#include <script/standard.h>
+#include <test/setup_common.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+struct InsightIndexTestingSetup : public TestChain100Setup {
+    InsightIndexTestingSetup()
+    {
+        key.MakeNewKey(true);
+        CKeyID id = key.GetPubKey().GetID();
+        script = GetScriptForDestination(PKHash(id));
+        hashAddress = uint256(id.begin(), id.size());
+    }
+
+    // The insight indexes only hold the outputs of particl txns, pay the coinbase to script in one
+    CBlock CreateAndProcessIndexedBlock()
+    {
+        const CChainParams &chainparams = Params();
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(script);
+        CBlock &block = pblocktemplate->block;
+
+        // The extra nonce keeps blocks replacing a disconnected block different from it
+        CMutableTransaction txCoinbase;
+        txCoinbase.nVersion = FALCON_TXN_VERSION;
+        txCoinbase.SetType(TXN_COINBASE);
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].prevout.SetNull();
+        txCoinbase.vin[0].scriptSig = CScript() << WITH_LOCK(cs_main, return ::ChainActive().Height() + 1) << CScriptNum(++nExtraNonce);
+        txCoinbase.vpout.push_back(MAKE_OUTPUT<CTxOutStandard>(nValue, script));
+        block.vtx.resize(1);
+        block.vtx[0] = MakeTransactionRef(txCoinbase);
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+
+        std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
+        BOOST_CHECK(ProcessNewBlock(chainparams, shared_pblock, true, nullptr));
+        return block;
+    }
+
+    void CheckAddress(const InsightIndex &index, size_t nOutputs)
+    {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        BOOST_CHECK(index.ReadAddressIndex(hashAddress, ADDR_INDT_PUBKEY_ADDRESS, addressIndex));
+        BOOST_CHECK_EQUAL(addressIndex.size(), nOutputs);
+
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+        BOOST_CHECK(index.ReadAddressUnspentIndex(hashAddress, ADDR_INDT_PUBKEY_ADDRESS, unspentOutputs));
+        BOOST_CHECK_EQUAL(unspentOutputs.size(), nOutputs);
+
+        CAddressBalanceValue balance;
+        BOOST_CHECK(index.ReadAddressBalance(hashAddress, ADDR_INDT_PUBKEY_ADDRESS, balance));
+        BOOST_CHECK_EQUAL(balance.balance, (CAmount)nOutputs * nValue);
+        BOOST_CHECK_EQUAL(balance.received, (CAmount)nOutputs * nValue);
+        BOOST_CHECK_EQUAL(balance.txCount, nOutputs);
+    }
+
+    CKey key;
+    CScript script;
+    uint256 hashAddress;
+    CAmount nValue = 1 * COIN;
+    int nExtraNonce = 0;
+};
+
+static void WaitForSync(InsightIndex &index)
+{
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+}
+
+static size_t CountTimestamps(const InsightIndex &index)
+{
+    std::vector<std::pair<uint256, unsigned int> > hashes;
+    BOOST_CHECK(index.ReadTimestampIndex(std::numeric_limits<unsigned int>::max(), 0, false, hashes));
+    return hashes.size();
+}
+
+BOOST_FIXTURE_TEST_SUITE(insightindex_tests, InsightIndexTestingSetup)
+
+BOOST_AUTO_TEST_CASE(insightindex_initial_sync)
+{
+    for (int i = 0; i < 5; i++) {
+        CreateAndProcessIndexedBlock();
+    }
+
+    InsightIndex index(1 << 20, InsightIndex::ADDRESS_INDEX | InsightIndex::SPENT_INDEX | InsightIndex::TIMESTAMP_INDEX, true);
+
+    // Nothing is indexed and the index isn't synced before it's started
+    CheckAddress(index, 0);
+    BOOST_CHECK(CountTimestamps(index) == 0);
+    BOOST_CHECK(!index.BlockUntilSyncedToCurrentChain());
+
+    index.Start();
+    WaitForSync(index);
+    CheckAddress(index, 5);
+    BOOST_CHECK(CountTimestamps(index) == (size_t)::ChainActive().Height() + 1);
+
+    // New blocks are indexed once synced
+    for (int i = 0; i < 5; i++) {
+        CreateAndProcessIndexedBlock();
+        BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+        CheckAddress(index, 6 + i);
+    }
+
+    index.Stop();
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(insightindex_disconnect)
+{
+    const CChainParams &chainparams = Params();
+    for (int i = 0; i < 3; i++) {
+        CreateAndProcessIndexedBlock();
+    }
+
+    InsightIndex index(1 << 20, InsightIndex::ADDRESS_INDEX | InsightIndex::SPENT_INDEX, true);
+    index.Start();
+    WaitForSync(index);
+    CheckAddress(index, 3);
+
+    // Disconnected blocks are erased from the index
+    CValidationState state;
+    CBlockIndex *pindex_tip = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+    BOOST_CHECK(InvalidateBlock(state, chainparams, pindex_tip->pprev));
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+    CheckAddress(index, 1);
+
+    CreateAndProcessIndexedBlock();
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+    CheckAddress(index, 2);
+
+    // Blocks that left the active chain while the index was stopped are rewound on start
+    index.Stop();
+    pindex_tip = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+    BOOST_CHECK(InvalidateBlock(state, chainparams, pindex_tip));
+    for (int i = 0; i < 3; i++) {
+        CreateAndProcessIndexedBlock();
+    }
+    SyncWithValidationInterfaceQueue();
+
+    index.Start();
+    WaitForSync(index);
+    CheckAddress(index, 4);
+
+    index.Stop();
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(insightindex_toggle)
+{
+    for (int i = 0; i < 3; i++) {
+        CreateAndProcessIndexedBlock();
+    }
+
+    auto index = MakeUnique<InsightIndex>(1 << 20, InsightIndex::ADDRESS_INDEX);
+    index->Start();
+    WaitForSync(*index);
+    CheckAddress(*index, 3);
+    index->Stop();
+    index.reset();
+
+    // Reopened with the same indexes, the entries are kept
+    index = MakeUnique<InsightIndex>(1 << 20, InsightIndex::ADDRESS_INDEX);
+    CheckAddress(*index, 3);
+    index.reset();
+
+    // Enabling another index without -reindex rebuilds all of them
+    index = MakeUnique<InsightIndex>(1 << 20, InsightIndex::ADDRESS_INDEX | InsightIndex::TIMESTAMP_INDEX);
+    CheckAddress(*index, 0);
+    BOOST_CHECK(CountTimestamps(*index) == 0);
+    index->Start();
+    WaitForSync(*index);
+    CheckAddress(*index, 3);
+    BOOST_CHECK(CountTimestamps(*index) == (size_t)::ChainActive().Height() + 1);
+    index->Stop();
+    index.reset();
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 
 #include <crypto/sha256.h>
 #include <key/stealth.h>
+#include <txdb.h>
 
 #include <secp256k1.h>
 #include <secp256k1_rangeproof.h>
@@ -720,5 +721,51 @@ BOOST_AUTO_TEST_CASE(ringct_test_set_have)
     BOOST_CHECK(setHaveI.insert(2).second == true);
 }
 
+BOOST_AUTO_TEST_CASE(ringct_test_anon_output_cache)
+{
+    CAnonOutput ao;
+    CAnonOutputCache cache;
+    cache.SetMaxSize(4 * CAnonOutputCache::EntryUsage());
+
+    for (int64_t i = 1; i <= 5; ++i) {
+        ao.nBlockHeight = i;
+        cache.Insert(i, ao);
+    }
+    BOOST_CHECK(cache.GetStats().nEntries == 4);
+    BOOST_CHECK(!cache.Get(1, ao)); // Least recently used entry was evicted
+    BOOST_CHECK(cache.Get(2, ao));
+    BOOST_CHECK(ao.nBlockHeight == 2);
+
+    cache.Erase(2);
+    BOOST_CHECK(!cache.Get(2, ao));
+
+    std::vector<int64_t> vIndices{5, 3, 9, 3};
+    std::map<int64_t, CAnonOutput> mapFound;
+    cache.Lookup(vIndices, mapFound);
+    BOOST_CHECK(mapFound.size() == 2);
+    BOOST_CHECK(vIndices.size() == 1 && vIndices[0] == 9);
+
+    AnonOutputCacheStats stats = cache.GetStats();
+    BOOST_CHECK(stats.nHits == 3);
+    BOOST_CHECK(stats.nMisses == 3);
+
+    // Batched reads fall through to the db and fill the cache
+    CBlockTreeDB db(1 << 20, true);
+    for (int64_t i = 1; i <= 300; ++i) {
+        ao.nBlockHeight = i;
+        BOOST_CHECK(db.WriteRCTOutput(i, ao));
+    }
+    db.AnonOutputCache().Clear();
+
+    std::vector<int64_t> vRing{299, 7, 256, 1, 512};
+    std::map<int64_t, CAnonOutput> mapOutputs;
+    BOOST_CHECK(db.ReadRCTOutputs(vRing, mapOutputs) == 4);
+    BOOST_CHECK(mapOutputs[256].nBlockHeight == 256);
+    BOOST_CHECK(db.AnonOutputCache().GetStats().nPrefetched == 4);
+    BOOST_CHECK(db.AnonOutputCache().Get(299, ao) && ao.nBlockHeight == 299);
+
+    BOOST_CHECK(db.EraseRCTOutput(299));
+    BOOST_CHECK(!db.ReadRCTOutput(299, ao));
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -60,6 +60,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName, bool fParticl
     SetupEnvironment();
     SetupNetworking();
     InitSignatureCache();
+    InitProofCache();
     InitScriptExecutionCache();
     fCheckBlockIndex = true;
 
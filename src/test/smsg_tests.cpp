@@ -3,15 +3,28 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <smsg/smessage.h>
+#include <smsg/db.h>
 
 #include <test/setup_common.h>
 #include <net.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <arith_uint256.h>
 #ifdef ENABLE_WALLET
 #include <wallet/wallet.h>
 #endif
 #include <xxhash/xxhash.h>
+#include <random.h>
+#include <crypto/hmac_sha256.h>
+#include <crypto/sha512.h>
+
+#include <secp256k1_ecdh.h>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+extern void UpdateNumPeers(int num_peers);
+extern void UpdateNumBlocksOfPeers(NodeId id, int height);
 
 struct SmsgTestingSetup : public TestingSetup {
     SmsgTestingSetup() : TestingSetup(CBaseChainParams::MAIN, true) {}
@@ -37,6 +50,407 @@ BOOST_AUTO_TEST_CASE(smsg_test_ckeyId_inits_null)
     BOOST_CHECK(k.IsNull());
 }
 
+BOOST_AUTO_TEST_CASE(smsg_test_trial_keys)
+{
+    secp256k1_context *ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN);
+
+    const size_t nKeys = 300, nTo = 200;
+    smsg::SecMsgTrialKeys trial_keys;
+    for (size_t i = 0; i < nKeys; ++i) {
+        CKey key;
+        InsecureNewKey(key, true);
+        trial_keys.Add(key.GetPubKey().GetID(), key, i % 2);
+    }
+
+    // Encrypt to key nTo, only the MAC is checked
+    smsg::SecureMessage smsg;
+    std::vector<uint8_t> vchPayload = g_insecure_rand_ctx.randbytes(256);
+    smsg.timestamp = GetTime();
+    GetRandBytes(smsg.iv, 16);
+
+    CKey keyR;
+    InsecureNewKey(keyR, true);
+    memcpy(smsg.cpkR, keyR.GetPubKey().begin(), 33);
+
+    CPubKey cpkTo = trial_keys.vKeys[nTo].key.GetPubKey();
+    secp256k1_pubkey pubkey;
+    BOOST_REQUIRE(secp256k1_ec_pubkey_parse(ctx, &pubkey, cpkTo.begin(), cpkTo.size()));
+    uint256 P;
+    BOOST_REQUIRE(secp256k1_ecdh(ctx, P.begin(), &pubkey, keyR.begin(), nullptr, nullptr));
+    uint8_t hashed[64];
+    CSHA512().Write(P.begin(), 32).Finalize(hashed);
+    CHMAC_SHA256(&hashed[32], 32)
+        .Write((uint8_t*) &smsg.timestamp, sizeof(smsg.timestamp))
+        .Write(smsg.iv, sizeof(smsg.iv))
+        .Write(vchPayload.data(), vchPayload.size())
+        .Finalize(smsg.mac);
+
+    BOOST_CHECK(trial_keys.Match(ctx, smsg.data(), vchPayload.data(), vchPayload.size()) == (int)nTo);
+
+    CCheckQueue<smsg::SecMsgTrialCheck> queue(1);
+    boost::thread_group tg;
+    for (int i = 0; i < 3; ++i) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+    BOOST_CHECK(trial_keys.Match(ctx, smsg.data(), vchPayload.data(), vchPayload.size(), &queue) == (int)nTo);
+
+    vchPayload[10] ^= 1;
+    BOOST_CHECK(trial_keys.Match(ctx, smsg.data(), vchPayload.data(), vchPayload.size(), &queue) == -1);
+
+    tg.interrupt_all();
+    tg.join_all();
+
+    secp256k1_context_destroy(ctx);
+}
+
+BOOST_AUTO_TEST_CASE(smsg_test_sethash_threads)
+{
+    smsg::SecureMessage smsg;
+    smsg.timestamp = GetTime();
+    std::vector<uint8_t> vchPayload = g_insecure_rand_ctx.randbytes(512);
+
+    arith_uint256 target;
+    {
+        LOCK(cs_main);
+        target.SetCompact(GetSmsgDifficulty(smsg.timestamp));
+    }
+
+    smsg::fSecMsgEnabled = true; // SetHash stops when smsg is disabled
+    for (int nThreads : {1, 3}) {
+        smsgModule.m_pow_threads = nThreads;
+        memset(smsg.nonce, 0, 4);
+        BOOST_CHECK(smsgModule.SetHash(smsg.data(), vchPayload.data(), vchPayload.size()) == smsg::SMSG_NO_ERROR);
+
+        uint256 hash;
+        smsgModule.GetPowHash(&smsg, vchPayload.data(), vchPayload.size(), hash);
+        BOOST_CHECK(memcmp(hash.begin(), smsg.hash, 4) == 0);
+        BOOST_CHECK(UintToArith256(hash) <= target);
+    }
+    smsg::fSecMsgEnabled = false;
+    smsgModule.m_pow_threads = 1;
+}
+
+BOOST_AUTO_TEST_CASE(smsg_test_bucket_hash)
+{
+    int64_t now = GetTime();
+    std::vector<smsg::SecMsgToken> vTokens;
+    for (int i = 0; i < 20; ++i) {
+        uint8_t sample[8];
+        GetRandBytes(sample, 8);
+        vTokens.emplace_back(now - 100 + i, sample, 8, 0, i < 5 ? 50 : 1000); // First 5 tokens have expired
+    }
+
+    // Hash doesn't depend on insertion order
+    smsg::SecMsgBucket bucket_a, bucket_b;
+    for (const auto &token : vTokens) {
+        BOOST_CHECK(bucket_a.InsertToken(token, now));
+    }
+    for (auto it = vTokens.rbegin(); it != vTokens.rend(); ++it) {
+        BOOST_CHECK(bucket_b.InsertToken(*it, now));
+    }
+    BOOST_CHECK(!bucket_a.InsertToken(vTokens[10], now));
+    BOOST_CHECK(bucket_a.nActive == 15);
+    BOOST_CHECK(bucket_a.nActive == bucket_a.CountActive());
+    BOOST_CHECK(bucket_a.hash == bucket_b.hash);
+    BOOST_CHECK(bucket_a.GetHash(smsg::SMSG_VERSION_SUM_HASH - 1) == bucket_b.GetHash(smsg::SMSG_VERSION_SUM_HASH - 1));
+
+    // Legacy hash covers the samples of the active tokens in set order
+    XXH32_state_t *state = XXH32_createState();
+    XXH32_reset(state, 1);
+    for (const auto &token : bucket_a.setTokens) {
+        if (token.timestamp + token.ttl >= now) {
+            XXH32_update(state, token.sample, 8);
+        }
+    }
+    BOOST_CHECK(bucket_a.GetHash(1) == XXH32_digest(state));
+    XXH32_freeState(state);
+
+    // Purging and expiring tokens matches a bucket built without them
+    uint32_t hash_before = bucket_a.hash;
+    bucket_a.PurgeToken(bucket_a.setTokens.find(vTokens[12]));
+    BOOST_CHECK(bucket_a.nActive == 14);
+    BOOST_CHECK(bucket_a.hash != hash_before);
+    BOOST_CHECK(!bucket_a.ExpireTokens(now));
+    BOOST_CHECK(bucket_a.ExpireTokens(now - 100 + 15 + 1000 + 1)); // Tokens 5 to 15 expire
+    BOOST_CHECK(bucket_a.nActive == 4);
+
+    smsg::SecMsgBucket bucket_c;
+    for (size_t i = 16; i < vTokens.size(); ++i) {
+        bucket_c.InsertToken(vTokens[i], now);
+    }
+    BOOST_CHECK(bucket_a.hash == bucket_c.hash);
+
+    auto it = bucket_a.EraseToken(bucket_a.setTokens.find(vTokens[19]));
+    BOOST_CHECK(it == bucket_a.setTokens.end());
+    BOOST_CHECK(bucket_a.nActive == 3);
+    BOOST_CHECK(bucket_a.setTokens.size() == 19);
+}
+
+static void AppendTestMessage(const fs::path &path, int64_t timestamp, uint32_t nPayload, std::vector<uint8_t> &vchMessage)
+{
+    smsg::SecureMessage smsg;
+    smsg.timestamp = timestamp;
+    smsg.m_ttl = 2 * smsg::SMSG_SECONDS_IN_DAY;
+    smsg.nPayload = nPayload;
+    vchMessage.resize(smsg::SMSG_HDR_LEN + nPayload);
+    memcpy(vchMessage.data(), smsg.data(), smsg::SMSG_HDR_LEN);
+    std::vector<uint8_t> vchPayload = g_insecure_rand_ctx.randbytes(nPayload);
+    memcpy(vchMessage.data() + smsg::SMSG_HDR_LEN, vchPayload.data(), nPayload);
+
+    FILE *fp = fsbridge::fopen(path, "ab");
+    BOOST_REQUIRE(fp);
+    BOOST_REQUIRE(fwrite(vchMessage.data(), 1, vchMessage.size(), fp) == vchMessage.size());
+    fclose(fp);
+}
+
+BOOST_AUTO_TEST_CASE(smsg_test_bucket_index)
+{
+    int64_t bucket_time = GetTime() - (GetTime() % smsg::SMSG_BUCKET_LEN);
+    fs::create_directories(GetDataDir() / smsg::STORE_DIR);
+    fs::path path = smsg::CBucketStore::DataPath(bucket_time, 1);
+
+    std::vector<std::vector<uint8_t>> vMessages(4);
+    for (size_t i = 0; i < 3; ++i) {
+        AppendTestMessage(path, bucket_time + i, 100 + i, vMessages[i]);
+    }
+
+    // Index is built from the .dat file
+    smsg::CBucketStore store;
+    std::vector<smsg::SecMsgIndexRecord> vRecords;
+    BOOST_REQUIRE(store.LoadIndex(bucket_time, 1, vRecords));
+    BOOST_REQUIRE(vRecords.size() == 3);
+    BOOST_CHECK(fs::exists(smsg::CBucketStore::IndexPath(bucket_time, 1)));
+    for (size_t i = 0; i < 3; ++i) {
+        std::vector<uint8_t> vchData;
+        BOOST_REQUIRE(store.Get(bucket_time, 1, vRecords[i].offset, vchData));
+        BOOST_CHECK(vchData == vMessages[i]);
+        BOOST_CHECK(memcmp(vRecords[i].sample, vMessages[i].data() + smsg::SMSG_HDR_LEN, 8) == 0);
+    }
+
+    // Messages missing from the index are appended, the bucket is remapped when read
+    AppendTestMessage(path, bucket_time + 3, 200, vMessages[3]);
+    BOOST_REQUIRE(store.SetIndexTTL(bucket_time, 1, vRecords[1].offset, 0));
+    BOOST_REQUIRE(store.LoadIndex(bucket_time, 1, vRecords));
+    BOOST_REQUIRE(vRecords.size() == 4);
+    BOOST_CHECK(vRecords[1].ttl == 0);
+    BOOST_CHECK(vRecords[3].ttl == 2 * smsg::SMSG_SECONDS_IN_DAY);
+    std::vector<uint8_t> vchData;
+    BOOST_REQUIRE(store.Get(bucket_time, 1, vRecords[3].offset, vchData));
+    BOOST_CHECK(vchData == vMessages[3]);
+
+    // A store that hasn't loaded the index reads the offsets from the .idx file
+    {
+        smsg::CBucketStore store_new;
+        BOOST_REQUIRE(store_new.SetIndexTTL(bucket_time, 1, vRecords[3].offset, 0));
+        BOOST_CHECK(!store_new.SetIndexTTL(bucket_time, 1, vRecords[3].offset + 1, 0));
+        BOOST_REQUIRE(store_new.LoadIndex(bucket_time, 1, vRecords));
+        BOOST_CHECK(vRecords[3].ttl == 0);
+    }
+
+    // An index that doesn't match the .dat file is rebuilt
+    store.Close(bucket_time, 1);
+    FILE *fp = fsbridge::fopen(smsg::CBucketStore::IndexPath(bucket_time, 1), "rb+");
+    BOOST_REQUIRE(fp);
+    uint8_t junk[8] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    BOOST_REQUIRE(fseek(fp, smsg::SMSG_INDEX_RECORD_LEN + 16, SEEK_SET) == 0);
+    BOOST_REQUIRE(fwrite(junk, 1, 8, fp) == 8);
+    fclose(fp);
+    BOOST_REQUIRE(store.LoadIndex(bucket_time, 1, vRecords));
+    BOOST_REQUIRE(vRecords.size() == 4);
+    BOOST_CHECK(vRecords[1].offset == (int64_t)vMessages[0].size());
+
+    // Compacting drops the messages not listed and moves the rest
+    std::vector<int64_t> vOffsets{vRecords[0].offset, vRecords[2].offset, vRecords[3].offset}, vNewOffsets;
+    BOOST_REQUIRE(smsg::CBucketStore::WriteCompacted(bucket_time, 1, vOffsets, vNewOffsets));
+    BOOST_REQUIRE(store.SwapCompacted(bucket_time, 1));
+    BOOST_CHECK(!fs::exists(smsg::CBucketStore::TempPath(path)));
+    BOOST_REQUIRE(store.LoadIndex(bucket_time, 1, vRecords));
+    BOOST_REQUIRE(vRecords.size() == 3);
+    BOOST_CHECK(fs::file_size(path) == vMessages[0].size() + vMessages[2].size() + vMessages[3].size());
+    for (size_t i = 0; i < 3; ++i) {
+        const std::vector<uint8_t> &vchMessage = vMessages[i == 0 ? 0 : i + 1];
+        BOOST_CHECK(vRecords[i].offset == vNewOffsets[i]);
+        vchData.clear();
+        BOOST_REQUIRE(store.Get(bucket_time, 1, vNewOffsets[i], vchData));
+        BOOST_CHECK(vchData == vchMessage);
+    }
+
+    // Files are numbered from 1, all are erased with the bucket
+    AppendTestMessage(smsg::CBucketStore::DataPath(bucket_time, 2), bucket_time + 4, 100, vMessages[0]);
+    BOOST_REQUIRE(store.LoadIndex(bucket_time, 2, vRecords));
+    BOOST_CHECK(vRecords.size() == 1);
+
+    BOOST_CHECK(store.EraseFiles(bucket_time));
+    BOOST_CHECK(!fs::exists(path));
+    BOOST_CHECK(!fs::exists(smsg::CBucketStore::IndexPath(bucket_time, 1)));
+    BOOST_CHECK(!fs::exists(smsg::CBucketStore::DataPath(bucket_time, 2)));
+}
+
+BOOST_AUTO_TEST_CASE(smsg_test_funding_cache)
+{
+    smsg::CFundingTxCache cache;
+    cache.SetMaxEntries(2);
+
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        vtx.push_back(MakeTransactionRef(mtx));
+        cache.Insert(vtx.back()->GetHash(), std::make_shared<smsg::SecMsgFundingTx>());
+    }
+
+    // Least recently used entry is evicted
+    BOOST_CHECK(!cache.Get(vtx[0]->GetHash()));
+    BOOST_CHECK(cache.Get(vtx[1]->GetHash()));
+    BOOST_CHECK(cache.Get(vtx[2]->GetHash()));
+    cache.Insert(vtx[0]->GetHash(), std::make_shared<smsg::SecMsgFundingTx>());
+    BOOST_CHECK(!cache.Get(vtx[1]->GetHash()));
+    BOOST_CHECK(cache.Get(vtx[2]->GetHash()));
+
+    smsg::FundingCacheStats stats = cache.GetStats();
+    BOOST_CHECK(stats.nEntries == 2);
+    BOOST_CHECK(stats.nHits == 3);
+    BOOST_CHECK(stats.nMisses == 2);
+
+    // Transactions of disconnected blocks are erased
+    RegisterValidationInterface(&cache);
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+    block->vtx.push_back(vtx[2]);
+    GetMainSignals().BlockDisconnected(block);
+    SyncWithValidationInterfaceQueue();
+    UnregisterValidationInterface(&cache);
+
+    BOOST_CHECK(!cache.Get(vtx[2]->GetHash()));
+    BOOST_CHECK(cache.Get(vtx[0]->GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(smsg_test_funding_validate)
+{
+    // Paid messages are validated by their funding transaction only, the payload needn't decrypt
+    smsg::SecureMessage smsg(true, smsg::SMSG_SECONDS_IN_DAY);
+    smsg.timestamp = GetTime();
+    smsg.nPayload = 200;
+    smsg.pPayload = new uint8_t[smsg.nPayload];
+    std::vector<uint8_t> vchPayload = g_insecure_rand_ctx.randbytes(smsg.nPayload);
+    memcpy(smsg.pPayload, vchPayload.data(), smsg.nPayload);
+    uint256 txid;
+    BOOST_REQUIRE(smsg.GetFundingTxid(txid));
+    uint160 msgId;
+    BOOST_REQUIRE(0 == smsgModule.HashMsg(smsg, smsg.pPayload, smsg.nPayload - 32, msgId));
+
+    // Expected fee is one unit per message byte
+    uint32_t nMsgBytes = smsg::SMSG_HDR_LEN + smsg.nPayload;
+    auto MakeFundingTx = [&](const std::vector<uint32_t> &vAmounts, const CBlockIndex *pindex) {
+        CMutableTransaction mtx;
+        mtx.nVersion = FALCON_TXN_VERSION;
+        OUTPUT_PTR<CTxOutData> out = MAKE_OUTPUT<CTxOutData>();
+        out->vData.push_back(DO_FUND_MSG);
+        for (const auto nAmount : vAmounts) {
+            out->vData.insert(out->vData.end(), msgId.begin(), msgId.end());
+            const uint8_t *p = (const uint8_t*)&nAmount;
+            out->vData.insert(out->vData.end(), p, p + 4);
+        }
+        mtx.vpout.push_back(out);
+
+        std::shared_ptr<smsg::SecMsgFundingTx> funding_tx = std::make_shared<smsg::SecMsgFundingTx>();
+        funding_tx->pindex = pindex;
+        funding_tx->nFeeRate = 1000;
+        funding_tx->nFeeRateLast = 1000;
+        funding_tx->AddFundedMessages(CTransaction(mtx));
+        return funding_tx;
+    };
+
+    const CBlockIndex *pindexTip = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+
+    // A message funded twice is only paid the lower amount
+    std::shared_ptr<smsg::SecMsgFundingTx> funding_tx = MakeFundingTx({nMsgBytes * 2, nMsgBytes / 2}, pindexTip);
+    BOOST_CHECK(funding_tx->mapFunded[msgId] == nMsgBytes / 2);
+    smsgModule.m_funding_cache.Insert(txid, funding_tx);
+    BOOST_CHECK(smsg::SMSG_FUND_FAILED == smsgModule.Validate(smsg.data(), smsg.pPayload, smsg.nPayload));
+
+    smsgModule.m_funding_cache.Insert(txid, MakeFundingTx({nMsgBytes * 2}, pindexTip));
+    BOOST_CHECK(smsg::SMSG_NO_ERROR == smsgModule.Validate(smsg.data(), smsg.pPayload, smsg.nPayload));
+
+    // A cached funding transaction in a block that left the active chain is looked up again
+    CBlockIndex index_stale;
+    index_stale.nHeight = pindexTip->nHeight + 1;
+    index_stale.pprev = const_cast<CBlockIndex*>(pindexTip);
+    smsgModule.m_funding_cache.Insert(txid, MakeFundingTx({nMsgBytes * 2}, &index_stale));
+    BOOST_CHECK(smsg::SMSG_GENERAL_ERROR == smsgModule.Validate(smsg.data(), smsg.pPayload, smsg.nPayload));
+
+    smsgModule.m_funding_cache.Clear();
+}
+
+static bool GetSentPong(CNode &node, int &nVersion)
+{
+    LOCK(node.cs_vSend);
+    for (size_t i = 0; i < node.vSendMsg.size(); ++i) {
+        CMessageHeader hdr(Params().MessageStart());
+        CDataStream ssHeader(node.vSendMsg[i], SER_NETWORK, INIT_PROTO_VERSION);
+        ssHeader >> hdr;
+        if (hdr.nMessageSize > 0) {
+            i++;
+        }
+        if (hdr.GetCommand() != SMSGMsgType::PONG) {
+            continue;
+        }
+        if (hdr.nMessageSize < 4) {
+            return false;
+        }
+        CDataStream ssPong(node.vSendMsg[i], SER_NETWORK, INIT_PROTO_VERSION);
+        ssPong >> nVersion;
+        return true;
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(smsg_test_pong_version)
+{
+    std::vector<std::shared_ptr<CWallet>> temp_vpwallets;
+    BOOST_CHECK(smsgModule.Start(nullptr, temp_vpwallets, false));
+
+    CAddress addr(CService(CNetAddr(), 0), NODE_NONE);
+    CNode node(0, ServiceFlags(NODE_NETWORK | NODE_SMSG), 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+    CNode peer(1, ServiceFlags(NODE_NETWORK | NODE_SMSG), 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+    node.nVersion = PROTOCOL_VERSION;
+    peer.nVersion = PROTOCOL_VERSION;
+
+    // A ping received while the chain syncs is answered by SendData once synced
+    BOOST_REQUIRE(::ChainstateActive().IsInitialBlockDownload());
+    CDataStream ssPing(SER_NETWORK, INIT_PROTO_VERSION);
+    smsgModule.ReceiveData(&node, SMSGMsgType::PING, ssPing);
+    BOOST_CHECK(WITH_LOCK(node.smsgData.cs_smsg_net, return node.smsgData.lastSeen) == -1);
+
+    UpdateNumPeers(1);
+    {
+        LOCK(cs_main);
+        UpdateNumBlocksOfPeers(node.GetId(), 0);
+    }
+    BOOST_REQUIRE(!::ChainstateActive().IsInitialBlockDownload());
+
+    // The late pong must carry the version, or the peer compares bucket hashes using the legacy hash
+    BOOST_CHECK(smsgModule.SendData(&node, false));
+    int nVersion = 0;
+    BOOST_REQUIRE(GetSentPong(node, nVersion));
+    BOOST_CHECK(nVersion == smsg::SMSG_VERSION);
+
+    CDataStream ssPong(SER_NETWORK, INIT_PROTO_VERSION);
+    ssPong << nVersion;
+    smsgModule.ReceiveData(&peer, SMSGMsgType::PONG, ssPong);
+    {
+        LOCK(peer.smsgData.cs_smsg_net);
+        BOOST_CHECK(peer.smsgData.fEnabled);
+        BOOST_CHECK(peer.smsgData.m_version == smsg::SMSG_VERSION);
+    }
+
+    UpdateNumPeers(0);
+    {
+        LOCK(cs_main);
+        UpdateNumBlocksOfPeers(node.GetId(), std::numeric_limits<int>::max());
+    }
+    smsgModule.Shutdown();
+}
+
 #ifdef ENABLE_WALLET
 
 void CheckValid(smsg::SecureMessage &smsg, CKeyID &kFrom, CKeyID &kTo, bool expect_pass)
@@ -124,6 +538,110 @@ BOOST_AUTO_TEST_CASE(smsg_test)
 
     smsgModule.Shutdown();
 }
+
+BOOST_AUTO_TEST_CASE(smsg_test_meta_index)
+{
+    SeedInsecureRand();
+
+    int rv = 0;
+    auto chain = interfaces::MakeChain();
+    std::shared_ptr<CWallet> wallet = std::make_shared<CWallet>(chain.get(), WalletLocation(), WalletDatabase::CreateDummy());
+    CKey keyFrom, keyTo;
+    InsecureNewKey(keyFrom, true);
+    InsecureNewKey(keyTo, true);
+    {
+        LOCK(wallet->cs_wallet);
+        wallet->AddKey(keyFrom);
+        wallet->AddKey(keyTo);
+    }
+    CKeyID kFrom = keyFrom.GetPubKey().GetID();
+    CKeyID kTo = keyTo.GetPubKey().GetID();
+
+    std::vector<std::shared_ptr<CWallet>> temp_vpwallets;
+    BOOST_CHECK(true == smsgModule.Start(wallet, temp_vpwallets, false));
+
+    const int nMessages = 3;
+    std::vector<std::array<uint8_t, 30>> vKeys(nMessages);
+    {
+        LOCK(smsg::cs_smsgDB);
+        smsg::SecMsgDB db;
+        BOOST_REQUIRE(db.Open("cw"));
+
+        for (int i = 0; i < nMessages; i++) {
+            smsg::SecureMessage smsg;
+            smsg.m_ttl = smsg::SMSG_SECONDS_IN_DAY;
+            BOOST_CHECK_MESSAGE(0 == (rv = smsgModule.Encrypt(smsg, kFrom, kTo, sTestMessage)), "SecureMsgEncrypt " << rv);
+
+            smsg::SecMsgStored stored;
+            stored.timeReceived = smsg.timestamp;
+            stored.status = SMSG_MASK_UNREAD;
+            stored.addrTo = kTo;
+            stored.vchMessage.resize(smsg::SMSG_HDR_LEN + smsg.nPayload);
+            memcpy(&stored.vchMessage[0], smsg.data(), smsg::SMSG_HDR_LEN);
+            memcpy(&stored.vchMessage[smsg::SMSG_HDR_LEN], smsg.pPayload, smsg.nPayload);
+
+            uint8_t *chKey = vKeys[i].data();
+            memcpy(chKey, smsg::DBK_INBOX.data(), 2);
+            memset(&chKey[2], 0, 8);
+            chKey[9] = i + 1; // timestamp orders the keys
+            GetStrongRandBytes(&chKey[10], 20);
+
+            BOOST_CHECK(db.WriteSmesg(chKey, stored));
+            BOOST_CHECK(0 == smsgModule.IndexMessage(db, chKey, stored));
+        }
+
+        smsg::SecMsgMeta meta;
+        BOOST_REQUIRE(db.ReadMeta(vKeys[0].data(), meta));
+        BOOST_CHECK(meta.nDecryptError == 0);
+        BOOST_CHECK(meta.sFromAddress == EncodeDestination(PKHash(kFrom)));
+        BOOST_CHECK(meta.addrTo == kTo);
+        BOOST_CHECK(meta.ttl == smsg::SMSG_SECONDS_IN_DAY);
+        BOOST_CHECK(meta.status & SMSG_MASK_UNREAD);
+
+        // Status changes are copied to the index
+        smsg::SecMsgStored stored;
+        BOOST_REQUIRE(db.ReadSmesg(vKeys[0].data(), stored));
+        stored.status &= ~SMSG_MASK_UNREAD;
+        BOOST_CHECK(db.WriteSmesg(vKeys[0].data(), stored));
+        BOOST_REQUIRE(db.ReadMeta(vKeys[0].data(), meta));
+        BOOST_CHECK(!(meta.status & SMSG_MASK_UNREAD));
+
+        // Iterate after a cursor
+        uint8_t chKey[30];
+        leveldb::Iterator *it = db.pdb->NewIterator(leveldb::ReadOptions());
+        BOOST_CHECK(db.NextMeta(it, smsg::DBK_INBOX_META, chKey, meta, &vKeys[0][2]));
+        BOOST_CHECK(memcmp(chKey, vKeys[1].data(), 30) == 0);
+        BOOST_CHECK(db.NextMeta(it, smsg::DBK_INBOX_META, chKey, meta));
+        BOOST_CHECK(memcmp(chKey, vKeys[2].data(), 30) == 0);
+        delete it;
+
+        // A message that can't be decrypted is indexed and not retried while no keys are added
+        {
+            smsg::SecMsgStored stored;
+            BOOST_REQUIRE(db.ReadSmesg(vKeys[1].data(), stored));
+            CKey keyOther;
+            InsecureNewKey(keyOther, true);
+            stored.addrTo = keyOther.GetPubKey().GetID();
+            std::array<uint8_t, 30> key = vKeys[1];
+            key[9] = nMessages + 1;
+            BOOST_CHECK(db.WriteSmesg(key.data(), stored));
+            BOOST_CHECK(smsg::SMSG_UNKNOWN_KEY == smsgModule.IndexMessage(db, key.data(), stored));
+            vKeys.push_back(key);
+        }
+        BOOST_CHECK(smsgModule.IndexMessages(db));
+        BOOST_REQUIRE(db.ReadMeta(vKeys.back().data(), meta));
+        BOOST_CHECK(meta.nDecryptError == smsg::SMSG_UNKNOWN_KEY);
+        BOOST_CHECK(smsgModule.IndexMessages(db));
+
+        // Erasing a message erases its metadata
+        for (const auto &key : vKeys) {
+            BOOST_CHECK(db.EraseSmesg(key.data()));
+            BOOST_CHECK(!db.ReadMeta(key.data(), meta));
+        }
+    }
+
+    smsgModule.Shutdown();
+}
 #endif
 
 BOOST_AUTO_TEST_SUITE_END()
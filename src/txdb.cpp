@@ -5,6 +5,8 @@
 
 #include <txdb.h>
 
+#include <compat/byteswap.h>
+#include <memusage.h>
 #include <pow.h>
 #include <random.h>
 #include <shutdown.h>
@@ -18,6 +20,8 @@
 #include <chainparams.h>
 
 #include <stdint.h>
+#include <set>
+#include <tuple>
 
 #include <boost/thread.hpp>
 
@@ -30,6 +34,8 @@ static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_BLOCKHASHINDEX = 'z';
 static const char DB_SPENTINDEX = 'p';
+static const char DB_ADDRESSBALANCEINDEX = 'w';
+static const char DB_ADDRESSBALANCEHEIGHT = 'W';
 //static const char DB_TXINDEX_BLOCK = 'T';
 static const char DB_BLOCK_INDEX = 'b';
 
@@ -164,6 +170,7 @@ size_t CCoinsViewDB::EstimateSize() const
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, bool compression, int maxOpenFiles) : CDBWrapper(gArgs.IsArgSet("-blocksdir") ? GetDataDir() / "blocks" / "index" : GetBlocksDir() / "index", nCacheSize, fMemory, fWipe, false, compression, maxOpenFiles)
 {
+    m_anon_output_cache.SetMaxSize(std::max((int64_t)0, gArgs.GetArg("-anonoutputcache", DEFAULT_ANON_OUTPUT_CACHE)) << 20);
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -186,12 +193,17 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
+{
+    return CursorAt(uint256());
+}
+
+CCoinsViewCursor *CCoinsViewDB::CursorAt(const uint256 &hashFrom) const
 {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
+    i->pcursor->Seek(std::make_pair(DB_COIN, hashFrom));
     // Cache key of first record
     if (i->pcursor->Valid()) {
         CoinEntry entry(&i->keyTmp.second);
@@ -251,12 +263,13 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(std::make_pair(DB_SPENTINDEX, key), value);
+namespace insightdb {
+
+bool ReadSpentIndex(CDBWrapper &db, CSpentIndexKey &key, CSpentIndexValue &value) {
+    return db.Read(std::make_pair(DB_SPENTINDEX, key), value);
 }
 
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(*this);
+void UpdateSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(std::make_pair(DB_SPENTINDEX, it->first));
@@ -264,11 +277,9 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(std::make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
-    CDBBatch batch(*this);
+void UpdateAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -276,12 +287,11 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
             batch.Write(std::make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint256 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
-    const std::unique_ptr<CDBIterator> pcursor(NewIterator());
+bool ReadAddressUnspentIndex(CDBWrapper &db, uint256 addressHash, int type,
+                             std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+    const std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
 
     pcursor->Seek(std::make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
 
@@ -304,31 +314,93 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint256 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
+/** Add the deltas of the address index entries of one block being connected or disconnected to the address totals in batch.
+ *  The height of the last block counted is kept with the totals, a block connected again after an unclean shutdown
+ *  isn't counted twice. */
+static void UpdateAddressBalances(CDBWrapper &db, CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase)
+{
+    if (vect.empty()) {
+        return;
+    }
+    int nHeight = vect.front().first.blockHeight;
+    int nCountedHeight = -1;
+    db.Read(DB_ADDRESSBALANCEHEIGHT, nCountedHeight);
+    if (fErase ? nHeight > nCountedHeight : nHeight <= nCountedHeight) {
+        return;
+    }
+    batch.Write(DB_ADDRESSBALANCEHEIGHT, fErase ? nHeight - 1 : nHeight);
+
+    // All entries of a txn are in its block, counting it once per batch counts it once
+    std::map<std::pair<unsigned int, uint256>, CAddressBalanceValue> mapBalances;
+    std::set<std::tuple<unsigned int, uint256, uint256> > setTxns;
+    for (const auto &it : vect) {
+        const CAddressIndexKey &key = it.first;
+        auto mi = mapBalances.find(std::make_pair(key.type, key.hashBytes));
+        if (mi == mapBalances.end()) {
+            mi = mapBalances.emplace(std::make_pair(key.type, key.hashBytes), CAddressBalanceValue()).first;
+            db.Read(std::make_pair(DB_ADDRESSBALANCEINDEX, CAddressIndexIteratorKey(key.type, key.hashBytes)), mi->second);
+        }
+        CAddressBalanceValue &balance = mi->second;
+        int nSign = fErase ? -1 : 1;
+        balance.balance += nSign * it.second;
+        if (it.second > 0) {
+            balance.received += nSign * it.second;
+        }
+        if (setTxns.insert(std::make_tuple(key.type, key.hashBytes, key.txhash)).second) {
+            balance.txCount += nSign;
+        }
+    }
+
+    for (const auto &it : mapBalances) {
+        auto key = std::make_pair(DB_ADDRESSBALANCEINDEX, CAddressIndexIteratorKey(it.first.first, it.first.second));
+        if (it.second.IsNull()) {
+            batch.Erase(key);
+        } else {
+            batch.Write(key, it.second);
+        }
+    }
+}
+
+void WriteAddressIndex(CDBWrapper &db, CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+    UpdateAddressBalances(db, batch, vect, false);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(std::make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
-    CDBBatch batch(*this);
+void EraseAddressIndex(CDBWrapper &db, CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+    UpdateAddressBalances(db, batch, vect, true);
     for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(std::make_pair(DB_ADDRESSINDEX, it->first));
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(uint256 addressHash, int type,
-                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
-    const std::unique_ptr<CDBIterator> pcursor(NewIterator());
+bool ReadAddressBalance(CDBWrapper &db, uint256 addressHash, int type, CAddressBalanceValue &balance)
+{
+    balance.SetNull();
+    if (!db.Read(std::make_pair(DB_ADDRESSBALANCEINDEX, CAddressIndexIteratorKey(type, addressHash)), balance)
+        && db.Exists(std::make_pair(DB_ADDRESSBALANCEINDEX, CAddressIndexIteratorKey(type, addressHash)))) {
+        return error("failed to read address balance");
+    }
+    return true;
+}
 
-    if (start > 0 && end > 0) {
-        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
+bool ReadAddressIndex(CDBWrapper &db, uint256 addressHash, int type,
+                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                      int start, int end,
+                      const CAddressIndexPosition *pAfter, size_t nMaxTxns) {
+    const std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+
+    int nSeekHeight = start > 0 && end > 0 ? start : 0;
+    if (pAfter && pAfter->blockHeight > nSeekHeight) {
+        nSeekHeight = pAfter->blockHeight;
+    }
+    if (nSeekHeight > 0) {
+        pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, nSeekHeight)));
     } else {
         pcursor->Seek(std::make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
+    size_t nTxns = 0;
+    CAddressIndexPosition lastPosition(-1, 0);
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
@@ -336,6 +408,18 @@ bool CBlockTreeDB::ReadAddressIndex(uint256 addressHash, int type,
             if (end > 0 && key.second.blockHeight > end) {
                 break;
             }
+            CAddressIndexPosition position(key.second);
+            if (pAfter && !(*pAfter < position)) {
+                pcursor->Next();
+                continue;
+            }
+            if (position != lastPosition) {
+                if (nMaxTxns > 0 && nTxns >= nMaxTxns) {
+                    break;
+                }
+                nTxns++;
+                lastPosition = position;
+            }
             CAmount nValue;
             if (pcursor->GetValue(nValue)) {
                 addressIndex.push_back(std::make_pair(key.second, nValue));
@@ -351,16 +435,14 @@ bool CBlockTreeDB::ReadAddressIndex(uint256 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex)
+void WriteTimestampIndex(CDBBatch &batch, const CTimestampIndexKey &timestampIndex)
 {
-    CDBBatch batch(*this);
     batch.Write(std::make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
+bool ReadTimestampIndex(CDBWrapper &db, const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
-    const std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    const std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
 
     pcursor->Seek(std::make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
 
@@ -395,16 +477,14 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts) {
-    CDBBatch batch(*this);
+void WriteTimestampBlockIndex(CDBBatch &batch, const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts) {
     batch.Write(std::make_pair(DB_BLOCKHASHINDEX, blockhashIndex), logicalts);
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp) {
+bool ReadTimestampBlockIndex(CDBWrapper &db, const uint256 &hash, unsigned int &ltimestamp) {
 
     CTimestampBlockIndexValue lts;
-    if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts)) {
+    if (!db.Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts)) {
         return false;
     }
 
@@ -412,6 +492,146 @@ bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &lt
     return true;
 }
 
+} // namespace insightdb
+
+bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+    return insightdb::ReadSpentIndex(*this, key, value);
+}
+
+bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
+    CDBBatch batch(*this);
+    insightdb::UpdateSpentIndex(batch, vect);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
+    CDBBatch batch(*this);
+    insightdb::UpdateAddressUnspentIndex(batch, vect);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(uint256 addressHash, int type,
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+    return insightdb::ReadAddressUnspentIndex(*this, addressHash, type, unspentOutputs);
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+    CDBBatch batch(*this);
+    insightdb::WriteAddressIndex(*this, batch, vect);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+    CDBBatch batch(*this);
+    insightdb::EraseAddressIndex(*this, batch, vect);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressBalance(uint256 addressHash, int type, CAddressBalanceValue &balance)
+{
+    return insightdb::ReadAddressBalance(*this, addressHash, type, balance);
+}
+
+bool CBlockTreeDB::BuildAddressBalances()
+{
+    LogPrintf("Building address balances from the address index...\n");
+
+    const std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_ADDRESSINDEX);
+
+    CDBBatch batch(*this);
+    size_t nAddresses = 0;
+    bool fHaveAddress = false;
+    CAddressIndexIteratorKey addressKey;
+    CAddressBalanceValue balance;
+    uint256 lastTxid;
+    int nMaxHeight = -1;
+    auto flush_address = [&]() {
+        if (fHaveAddress && !balance.IsNull()) {
+            batch.Write(std::make_pair(DB_ADDRESSBALANCEINDEX, addressKey), balance);
+            nAddresses++;
+        }
+    };
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) return false;
+        std::pair<char, CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESSINDEX) {
+            break;
+        }
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue)) {
+            return error("%s: failed to get address index value", __func__);
+        }
+
+        if (!fHaveAddress || key.second.type != addressKey.type || key.second.hashBytes != addressKey.hashBytes) {
+            flush_address();
+            if (batch.SizeEstimate() > (1 << 24)) {
+                if (!WriteBatch(batch)) {
+                    return error("%s: failed to write address balances", __func__);
+                }
+                batch.Clear();
+            }
+            fHaveAddress = true;
+            addressKey = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            balance.SetNull();
+            lastTxid.SetNull();
+        }
+
+        balance.balance += nValue;
+        if (nValue > 0) {
+            balance.received += nValue;
+        }
+        // Entries of an address are sorted by height and position in block, a txn's entries are adjacent
+        if (key.second.txhash != lastTxid) {
+            balance.txCount++;
+            lastTxid = key.second.txhash;
+        }
+        nMaxHeight = std::max(nMaxHeight, key.second.blockHeight);
+        pcursor->Next();
+    }
+    flush_address();
+    if (nMaxHeight >= 0) {
+        batch.Write(DB_ADDRESSBALANCEHEIGHT, nMaxHeight);
+    }
+
+    if (!WriteBatch(batch)) {
+        return error("%s: failed to write address balances", __func__);
+    }
+    LogPrintf("Built balances of %u addresses.\n", nAddresses);
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressIndex(uint256 addressHash, int type,
+                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                    int start, int end,
+                                    const CAddressIndexPosition *pAfter, size_t nMaxTxns) {
+    return insightdb::ReadAddressIndex(*this, addressHash, type, addressIndex, start, end, pAfter, nMaxTxns);
+}
+
+bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex)
+{
+    CDBBatch batch(*this);
+    insightdb::WriteTimestampIndex(batch, timestampIndex);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
+{
+    return insightdb::ReadTimestampIndex(*this, high, low, fActiveOnly, hashes);
+}
+
+bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts) {
+    CDBBatch batch(*this);
+    insightdb::WriteTimestampBlockIndex(batch, blockhashIndex, logicalts);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp) {
+    return insightdb::ReadTimestampBlockIndex(*this, hash, ltimestamp);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -489,25 +709,192 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
     return true;
 }
 
+size_t CAnonOutputCache::EntryUsage()
+{
+    return memusage::MallocUsage(sizeof(lru_list::value_type) + 2 * sizeof(void*))
+        + memusage::MallocUsage(sizeof(memusage::unordered_node<std::pair<const int64_t, lru_list::iterator> >))
+        + sizeof(void*);
+};
+
+void CAnonOutputCache::EvictExcess()
+{
+    while (m_lru.size() > m_max_entries) {
+        m_index.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+};
+
+void CAnonOutputCache::SetMaxSize(size_t nMaxBytes)
+{
+    LOCK(cs);
+    m_max_entries = nMaxBytes / EntryUsage();
+    EvictExcess();
+};
+
+bool CAnonOutputCache::Get(int64_t nIndex, CAnonOutput &ao)
+{
+    LOCK(cs);
+    auto mi = m_index.find(nIndex);
+    if (mi == m_index.end()) {
+        m_misses++;
+        return false;
+    }
+    m_hits++;
+    m_lru.splice(m_lru.begin(), m_lru, mi->second);
+    ao = mi->second->second;
+    return true;
+};
+
+void CAnonOutputCache::Insert(int64_t nIndex, const CAnonOutput &ao)
+{
+    LOCK(cs);
+    if (m_max_entries < 1) {
+        return;
+    }
+    auto mi = m_index.find(nIndex);
+    if (mi != m_index.end()) {
+        mi->second->second = ao;
+        m_lru.splice(m_lru.begin(), m_lru, mi->second);
+        return;
+    }
+    m_lru.emplace_front(nIndex, ao);
+    m_index.emplace(nIndex, m_lru.begin());
+    EvictExcess();
+};
+
+void CAnonOutputCache::Erase(int64_t nIndex)
+{
+    LOCK(cs);
+    auto mi = m_index.find(nIndex);
+    if (mi == m_index.end()) {
+        return;
+    }
+    m_lru.erase(mi->second);
+    m_index.erase(mi);
+};
+
+void CAnonOutputCache::Clear()
+{
+    LOCK(cs);
+    m_lru.clear();
+    m_index.clear();
+};
+
+void CAnonOutputCache::Lookup(std::vector<int64_t> &vIndices, std::map<int64_t, CAnonOutput> &mapFound)
+{
+    std::sort(vIndices.begin(), vIndices.end());
+    vIndices.erase(std::unique(vIndices.begin(), vIndices.end()), vIndices.end());
+
+    LOCK(cs);
+    size_t nMissing = 0;
+    for (const auto i : vIndices) {
+        auto mi = m_index.find(i);
+        if (mi == m_index.end()) {
+            vIndices[nMissing++] = i;
+            continue;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, mi->second);
+        mapFound[i] = mi->second->second;
+    }
+    m_hits += vIndices.size() - nMissing;
+    m_misses += nMissing;
+    vIndices.resize(nMissing);
+};
+
+void CAnonOutputCache::AddPrefetched(size_t n)
+{
+    LOCK(cs);
+    m_prefetched += n;
+};
+
+AnonOutputCacheStats CAnonOutputCache::GetStats() const
+{
+    AnonOutputCacheStats stats;
+    LOCK(cs);
+    stats.nEntries = m_lru.size();
+    stats.nUsage = m_lru.size() * EntryUsage() + memusage::MallocUsage(sizeof(void*) * m_index.bucket_count());
+    stats.nMaxUsage = m_max_entries * EntryUsage();
+    stats.nHits = m_hits;
+    stats.nMisses = m_misses;
+    stats.nPrefetched = m_prefetched;
+    return stats;
+};
+
 bool CBlockTreeDB::ReadRCTOutput(int64_t i, CAnonOutput &ao)
 {
-    return Read(std::make_pair(DB_RCTOUTPUT, i), ao);
+    if (m_anon_output_cache.Get(i, ao)) {
+        return true;
+    }
+    if (!Read(std::make_pair(DB_RCTOUTPUT, i), ao)) {
+        return false;
+    }
+    m_anon_output_cache.Insert(i, ao);
+    return true;
 };
 
 bool CBlockTreeDB::WriteRCTOutput(int64_t i, const CAnonOutput &ao)
 {
     CDBBatch batch(*this);
     batch.Write(std::make_pair(DB_RCTOUTPUT, i), ao);
-    return WriteBatch(batch);
+    if (!WriteBatch(batch)) {
+        return false;
+    }
+    m_anon_output_cache.Insert(i, ao);
+    return true;
 };
 
 bool CBlockTreeDB::EraseRCTOutput(int64_t i)
 {
+    m_anon_output_cache.Erase(i);
     CDBBatch batch(*this);
     batch.Erase(std::make_pair(DB_RCTOUTPUT, i));
     return WriteBatch(batch);
 };
 
+size_t CBlockTreeDB::ReadRCTOutputs(const std::vector<int64_t> &vIndices, std::map<int64_t, CAnonOutput> &mapOutputs)
+{
+    std::vector<int64_t> vMissing(vIndices);
+    m_anon_output_cache.Lookup(vMissing, mapOutputs);
+    if (vMissing.empty()) {
+        return mapOutputs.size();
+    }
+
+    // Keys are serialised little endian, visit them in db order
+    std::sort(vMissing.begin(), vMissing.end(), [](int64_t a, int64_t b) {
+        return bswap_64((uint64_t)a) < bswap_64((uint64_t)b);
+    });
+
+    size_t nRead = 0;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    std::pair<char, int64_t> key;
+    for (const auto i : vMissing) {
+        pcursor->Seek(std::make_pair(DB_RCTOUTPUT, i));
+        if (!pcursor->Valid()
+            || !pcursor->GetKey(key)
+            || key.first != DB_RCTOUTPUT
+            || key.second != i) {
+            continue;
+        }
+        CAnonOutput ao;
+        if (!pcursor->GetValue(ao)) {
+            continue;
+        }
+        m_anon_output_cache.Insert(i, ao);
+        mapOutputs[i] = ao;
+        nRead++;
+    }
+    m_anon_output_cache.AddPrefetched(nRead);
+
+    return mapOutputs.size();
+};
+
+void CBlockTreeDB::CacheRCTOutputs(const std::vector<std::pair<int64_t, CAnonOutput> > &vOutputs)
+{
+    for (const auto &it : vOutputs) {
+        m_anon_output_cache.Insert(it.first, it.second);
+    }
+};
+
 
 bool CBlockTreeDB::ReadRCTOutputLink(const CCmpPubKey &pk, int64_t &i)
 {
@@ -14,10 +14,13 @@
 #include <insight/timestampindex.h>
 #include <rctindex.h>
 #include <primitives/block.h>
+#include <sync.h>
 
+#include <list>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -51,6 +54,8 @@ static const int64_t nMaxTxIndexCache = 1024;
 static const int64_t max_filter_index_cache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -anonoutputcache default (MiB)
+static const int64_t DEFAULT_ANON_OUTPUT_CACHE = 32;
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB final : public CCoinsView
@@ -69,6 +74,7 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    CCoinsViewCursor *CursorAt(const uint256 &hashFrom) const override;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
@@ -97,9 +103,82 @@ private:
     friend class CCoinsViewDB;
 };
 
+struct AnonOutputCacheStats
+{
+    size_t nEntries = 0;
+    size_t nUsage = 0;
+    size_t nMaxUsage = 0;
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+    uint64_t nPrefetched = 0;
+};
+
+/** Memory-bounded LRU cache of anon output records, keyed by anon index.
+ *  Entries are immutable once written, so the cache only has to follow
+ *  erases from the block tree db when blocks are disconnected.
+ */
+class CAnonOutputCache
+{
+private:
+    typedef std::list<std::pair<int64_t, CAnonOutput> > lru_list;
+
+    mutable Mutex cs;
+    lru_list m_lru GUARDED_BY(cs);
+    std::unordered_map<int64_t, lru_list::iterator> m_index GUARDED_BY(cs);
+    size_t m_max_entries GUARDED_BY(cs) = 0;
+    uint64_t m_hits GUARDED_BY(cs) = 0;
+    uint64_t m_misses GUARDED_BY(cs) = 0;
+    uint64_t m_prefetched GUARDED_BY(cs) = 0;
+
+    void EvictExcess() EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+public:
+    //! Approximate memory used per cached record
+    static size_t EntryUsage();
+
+    void SetMaxSize(size_t nMaxBytes);
+
+    bool Get(int64_t nIndex, CAnonOutput &ao);
+    void Insert(int64_t nIndex, const CAnonOutput &ao);
+    void Erase(int64_t nIndex);
+    void Clear();
+
+    //! Split vIndices into cached entries and misses, misses are returned in vIndices
+    void Lookup(std::vector<int64_t> &vIndices, std::map<int64_t, CAnonOutput> &mapFound);
+    void AddPrefetched(size_t n);
+
+    AnonOutputCacheStats GetStats() const;
+};
+
+/** Reads and batched writes of the insight indexes, in the block tree database or the insight index database. */
+namespace insightdb {
+bool ReadSpentIndex(CDBWrapper &db, CSpentIndexKey &key, CSpentIndexValue &value);
+void UpdateSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+void UpdateAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+bool ReadAddressUnspentIndex(CDBWrapper &db, uint256 addressHash, int type,
+                             std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+/** Address totals are updated with the entries written or erased, entries already present or missing are skipped. */
+void WriteAddressIndex(CDBWrapper &db, CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+void EraseAddressIndex(CDBWrapper &db, CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+bool ReadAddressBalance(CDBWrapper &db, uint256 addressHash, int type, CAddressBalanceValue &balance);
+/** Entries of an address, in chain order. If pAfter is set only entries after that position are read,
+ *  if nMaxTxns is set reading stops before the entries of the nMaxTxns+1th transaction. */
+bool ReadAddressIndex(CDBWrapper &db, uint256 addressHash, int type,
+                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                      int start = 0, int end = 0,
+                      const CAddressIndexPosition *pAfter = nullptr, size_t nMaxTxns = 0);
+void WriteTimestampIndex(CDBBatch &batch, const CTimestampIndexKey &timestampIndex);
+bool ReadTimestampIndex(CDBWrapper &db, const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
+void WriteTimestampBlockIndex(CDBBatch &batch, const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts);
+bool ReadTimestampBlockIndex(CDBWrapper &db, const uint256 &hash, unsigned int &logicalTS);
+} // namespace insightdb
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
+private:
+    CAnonOutputCache m_anon_output_cache;
+
 public:
     explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool compression = true, int maxOpenFiles = 1000);
 
@@ -118,7 +197,12 @@ public:
     bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool ReadAddressIndex(uint256 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                          int start = 0, int end = 0);
+                          int start = 0, int end = 0,
+                          const CAddressIndexPosition *pAfter = nullptr, size_t nMaxTxns = 0);
+    /** Totals of an address, kept with the address index. Returns true with a null value for an unknown address. */
+    bool ReadAddressBalance(uint256 addressHash, int type, CAddressBalanceValue &balance);
+    /** Compute the totals of all addresses from the address index, for databases created without them. */
+    bool BuildAddressBalances();
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
     bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex, const CTimestampBlockIndexValue &logicalts);
@@ -133,6 +217,12 @@ public:
     bool WriteRCTOutput(int64_t i, const CAnonOutput &ao);
     bool EraseRCTOutput(int64_t i);
 
+    /** Read many anon outputs at once, seeking in key order with a single iterator.
+     *  Found records are added to the anon output cache, returns the number found. */
+    size_t ReadRCTOutputs(const std::vector<int64_t> &vIndices, std::map<int64_t, CAnonOutput> &mapOutputs);
+    void CacheRCTOutputs(const std::vector<std::pair<int64_t, CAnonOutput> > &vOutputs);
+    CAnonOutputCache &AnonOutputCache() { return m_anon_output_cache; }
+
     bool ReadRCTOutputLink(const CCmpPubKey &pk, int64_t &i);
     bool WriteRCTOutputLink(const CCmpPubKey &pk, int64_t i);
     bool EraseRCTOutputLink(const CCmpPubKey &pk);
@@ -431,6 +431,22 @@ static void UpdateMempoolForReorg(DisconnectedBlockTransactions& disconnectpool,
     LimitMempoolSize(mempool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 }
 
+/** Add the bulletproofs of a transaction accepted to the mempool to the proof cache.
+ *  Entries are only added after acceptance so rejected transactions can't fill the cache. */
+static void CacheRangeProofs(const CTransaction &tx)
+{
+    for (const auto &txout : tx.vpout) {
+        const secp256k1_pedersen_commitment *commitment = txout->GetPCommitment();
+        const std::vector<uint8_t> *pRangeproof = txout->GetPRangeproof();
+        if (!commitment || !pRangeproof) {
+            continue;
+        }
+        uint256 entry;
+        ComputeRangeProofCacheEntry(entry, *commitment, *pRangeproof);
+        ProofCacheSet(entry);
+    }
+}
+
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
 static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, const CTxMemPool& pool,
@@ -470,7 +486,8 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
         }
     }
 
-    return CheckInputs(tx, state, view, flags, cacheSigStore, true, txdata);
+    // Ring signatures don't depend on the script flags and were verified by PolicyScriptChecks
+    return CheckInputs(tx, state, view, flags, cacheSigStore, true, txdata, nullptr, false);
 }
 
 namespace {
@@ -609,11 +626,27 @@ bool MemPoolAccept::PreChecks(ATMPArgs& args, Workspace& ws)
         *pfMissingInputs = false;
     }
 
+    // CheckTransaction passed in PreVerifyBlindedTransaction, it's only repeated if an activation time was crossed since
+    const bool fPreVerified = !state.m_bulletproofs_verified.IsNull()
+        && state.m_bulletproofs_verified == tx.GetWitnessHash();
+    const bool fPreEnforceSmsgFees = state.fEnforceSmsgFees, fPreIncDataOutputs = state.fIncDataOutputs;
+
     const Consensus::Params &consensus = Params().GetConsensus();
     state.SetStateInfo(nAcceptTime, ::ChainActive().Height(), consensus);
 
-    if (!CheckTransaction(tx, state))
-        return false; // state filled in by CheckTransaction
+    if (!fPreVerified
+        || fPreEnforceSmsgFees != state.fEnforceSmsgFees
+        || fPreIncDataOutputs != state.fIncDataOutputs) {
+        // Bulletproofs checked by PreVerifyBlindedTransaction are collected and dropped
+        CBulletproofBatch verified_bulletproofs;
+        if (fPreVerified) {
+            state.m_bulletproofs = &verified_bulletproofs;
+        }
+        bool fCheckTransaction = CheckTransaction(tx, state);
+        state.m_bulletproofs = nullptr;
+        if (!fCheckTransaction)
+            return false; // state filled in by CheckTransaction
+    }
 
     // Coinbase is only valid in a block, not as a loose transaction
     if (tx.IsCoinBase())
@@ -1144,6 +1177,10 @@ bool MemPoolAccept::AcceptSingleTransaction(const CTransactionRef& ptx, ATMPArgs
 
     if (!Finalize(args, workspace)) return false;
 
+    if (args.m_state.fBulletproofsActive) {
+        CacheRangeProofs(*ptx);
+    }
+
     GetMainSignals().TransactionAddedToMempool(ptx);
 
     return true;
@@ -1744,6 +1781,12 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
 }
 
 bool CScriptCheck::operator()() {
+    if (!m_mlsag.IsNull()) {
+        return m_mlsag();
+    }
+    if (!m_bulletproofs.IsNull()) {
+        return m_bulletproofs();
+    }
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
 
@@ -1779,7 +1822,7 @@ void InitScriptExecutionCache() {
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
  *
- * If pvChecks is not nullptr, script checks are pushed onto it instead of being performed inline. Any
+ * If pvChecks is not nullptr, script checks and MLSAG ring signature checks are pushed onto it instead of being performed inline. Any
  * script checks which are not necessary (eg due to script execution cache hits) are, obviously,
  * not pushed onto pvChecks/run.
  *
@@ -1878,9 +1921,14 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         }
     }
 
-    if (fHasAnonInput && fAnonChecks
-        && !VerifyMLSAG(tx, state)) {
+    if (fHasAnonInput && fAnonChecks) {
+        std::vector<CMLSAGCheck> vMLSAGChecks;
+        if (!VerifyMLSAG(tx, state, pvChecks ? &vMLSAGChecks : nullptr)) {
             return false;
+        }
+        for (auto &check : vMLSAGChecks) {
+            pvChecks->emplace_back(check);
+        }
     }
 
     if (cacheFullScriptStore && !pvChecks) {
@@ -2121,7 +2169,7 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 }
             }
 
-            if (!fAddressIndex
+            if (!fLegacyAddressIndex
                 || (!out->IsType(OUTPUT_STANDARD)
                 && !out->IsType(OUTPUT_CT))) {
                 continue;
@@ -2177,11 +2225,11 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
 
                     const CTxIn input = tx.vin[j];
 
-                    if (fSpentIndex) { // undo and delete the spent index
+                    if (fLegacySpentIndex) { // undo and delete the spent index
                         view.spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
                     }
 
-                    if (fAddressIndex) {
+                    if (fLegacyAddressIndex) {
                         const Coin &coin = view.AccessCoin(tx.vin[j].prevout);
                         const CScript *pScript = &coin.out.scriptPubKey;
 
@@ -2288,12 +2336,92 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
 }
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+/** Proofs of loose transactions are checked on their own threads, ConnectBlock doesn't wait for mempool work to take scriptcheckqueue */
+static CCheckQueue<CScriptCheck> mempoolcheckqueue(128);
+
+/** Verify the collected bulletproofs in multi-proof batches, spread over the threads of queue */
+static bool VerifyBulletproofBatch(const CBulletproofBatch &batch, CCheckQueue<CScriptCheck> &queue)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CBulletproofCheck> vBatches;
+    batch.Split(vBatches, MAX_BULLETPROOF_BATCH, std::max(nScriptCheckThreads, 1));
+
+    bool fValid = true;
+    if (nScriptCheckThreads) {
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        std::vector<CScriptCheck> vChecks;
+        vChecks.reserve(vBatches.size());
+        for (auto &check : vBatches) {
+            vChecks.emplace_back(check);
+        }
+        control.Add(vChecks);
+        fValid = control.Wait();
+    } else {
+        for (auto &check : vBatches) {
+            if (!check()) {
+                fValid = false;
+                break;
+            }
+        }
+    }
+
+    LogPrint(BCLog::BENCH, "    - Verify %u bulletproofs in %u batches: %.2fms\n", (unsigned)batch.size(), (unsigned)vBatches.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+    return fValid;
+}
+
+bool HasBlindedOutputs(const CTransaction &tx)
+{
+    if (!fParticlMode || !tx.IsFalconVersion()) {
+        return false;
+    }
+    for (const auto &txout : tx.vpout) {
+        if (txout->IsType(OUTPUT_CT) || txout->IsType(OUTPUT_RINGCT)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PreVerifyBlindedTransaction(const CTransaction &tx, CValidationState &state)
+{
+    if (!HasBlindedOutputs(tx)) {
+        return false;
+    }
+
+    CValidationState check_state;
+    check_state.SetStateInfo(GetTime(), -1, Params().GetConsensus());
+    if (!check_state.fBulletproofsActive) {
+        return false;
+    }
+
+    CBulletproofBatch bulletproofs;
+    check_state.m_bulletproofs = &bulletproofs;
+    bool fCheckTransaction = CheckTransaction(tx, check_state);
+    check_state.m_bulletproofs = nullptr;
+
+    // Failures are left for AcceptToMemoryPool to report,
+    // an empty batch means every proof was found in the proof cache
+    if (!fCheckTransaction
+        || (bulletproofs.size() > 0 && !VerifyBulletproofBatch(bulletproofs, mempoolcheckqueue))) {
+        return false;
+    }
+
+    state.m_bulletproofs_verified = tx.GetWitnessHash();
+    state.fEnforceSmsgFees = check_state.fEnforceSmsgFees;
+    state.fIncDataOutputs = check_state.fIncDataOutputs;
+    return true;
+}
 
 void ThreadScriptCheck(int worker_num) {
     util::ThreadRename(strprintf("scriptch.%i", worker_num));
     scriptcheckqueue.Thread();
 }
 
+void ThreadMempoolCheck(int worker_num) {
+    util::ThreadRename(strprintf("mempoolch.%i", worker_num));
+    mempoolcheckqueue.Thread();
+}
+
 VersionBitsCache versionbitscache GUARDED_BY(cs_main);
 
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
@@ -2659,7 +2787,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             }
 
             if (tx.IsFalconVersion()
-                && (fAddressIndex || fSpentIndex)) {
+                && (fLegacyAddressIndex || fLegacySpentIndex)) {
                 // Update spent inputs for insight
                 for (size_t j = 0; j < tx.vin.size(); j++) {
                     const CTxIn input = tx.vin[j];
@@ -2684,14 +2812,14 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                     if (scriptType > 0)
                         hashAddress = uint256(hashBytes.data(), hashBytes.size());
 
-                    if (fAddressIndex && scriptType > 0) {
+                    if (fLegacyAddressIndex && scriptType > 0) {
                         // record spending activity
                         view.addressIndex.push_back(std::make_pair(CAddressIndexKey(scriptType, hashAddress, pindex->nHeight, i, txhash, j, true), nValue * -1));
                         // remove address from unspent index
                         view.addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(scriptType, hashAddress, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
                     }
 
-                    if (fSpentIndex) {
+                    if (fLegacySpentIndex) {
                         CAmount nValue = coin.nType == OUTPUT_CT ? -1 : coin.out.nValue;
                         // add the spent index to determine the txid and input that spent an output
                         // and to find the amount and address from an input
@@ -2805,7 +2933,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             }
         }
 
-        if (fAddressIndex) {
+        if (fLegacyAddressIndex) {
             // Update outputs for insight
             for (unsigned int k = 0; k < tx.vpout.size(); k++) {
                 const CTxOutBase *out = tx.vpout[k].get();
@@ -2992,13 +3120,17 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
      && !WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
         return false;
 
+    if (fParticlMode) {
+        g_stake_kernel_cache.ConnectBlock(block, blockundo, pindex);
+    }
+
     if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
         setDirtyBlockIndex.insert(pindex);
     }
 
 
-    if (fTimestampIndex) {
+    if (fLegacyTimestampIndex) {
         unsigned int logicalTS = pindex->nTime;
         unsigned int prevLogicalTS = 0;
 
@@ -3183,7 +3315,7 @@ bool FlushView(CCoinsViewCache *view, CValidationState& state, bool fDisconnecti
     if (!view->Flush())
         return false;
 
-    if (fAddressIndex) {
+    if (fLegacyAddressIndex) {
         if (fDisconnecting) {
             if (!pblocktree->EraseAddressIndex(view->addressIndex)) {
                 return AbortNode(state, "Failed to delete address index");
@@ -3199,7 +3331,7 @@ bool FlushView(CCoinsViewCache *view, CValidationState& state, bool fDisconnecti
         }
     }
 
-    if (fSpentIndex) {
+    if (fLegacySpentIndex) {
         if (!pblocktree->UpdateSpentIndex(view->spentIndex)) {
             return AbortNode(state, "Failed to write transaction index");
         }
@@ -3245,6 +3377,7 @@ bool FlushView(CCoinsViewCache *view, CValidationState& state, bool fDisconnecti
         if (!pblocktree->WriteBatch(batch)) {
             return error("%s: Write RCT outputs failed.", __func__);
         }
+        pblocktree->CacheRCTOutputs(view->anonOutputs);
     }
 
     view->nLastRCTOutput = 0;
@@ -3347,6 +3480,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = FlushView(&view, state, true);
         assert(flushed);
+        g_stake_kernel_cache.DisconnectBlock(pindexDelete);
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
@@ -4369,10 +4503,25 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check transactions
     // Must check for duplicate inputs (see CVE-2018-17144)
+    // Bulletproofs are collected and verified in batches once all transactions pass the other checks
+    CBulletproofBatch bulletproofs;
+    state.m_bulletproofs = fParticlMode ? &bulletproofs : nullptr;
     for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, true)) // Check for duplicate inputs, TODO: UpdateCoins should return a bool, db/coinsview txn should be undone
+        if (!CheckTransaction(*tx, state, true)) { // Check for duplicate inputs, TODO: UpdateCoins should return a bool, db/coinsview txn should be undone
+            state.m_bulletproofs = nullptr;
             return state.Invalid(state.GetReason(), false, state.GetRejectCode(), state.GetRejectReason(),
                                  strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+        }
+    state.m_bulletproofs = nullptr;
+
+    if (bulletproofs.size() > 0 && !VerifyBulletproofBatch(bulletproofs, scriptcheckqueue)) {
+        // Verify each output separately to find the invalid proof
+        for (const auto& tx : block.vtx)
+            if (!CheckTransaction(*tx, state, true))
+                return state.Invalid(state.GetReason(), false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+        LogPrintf("%s: Bulletproof batch verification failed but all outputs passed individually, block %s\n", __func__, block.GetHash().ToString());
+    }
 
     unsigned int nSigOps = 0;
     for (const auto& tx : block.vtx)
@@ -5653,17 +5802,30 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-    // Check whether we have an address index
-    pblocktree->ReadFlag("addressindex", fAddressIndex);
-    LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    // Check whether the block tree database has an address index
+    pblocktree->ReadFlag("addressindex", fLegacyAddressIndex);
+    fAddressIndex = fLegacyAddressIndex;
+    LogPrintf("%s: address index %s\n", __func__, fLegacyAddressIndex ? "enabled" : "disabled");
+    if (fLegacyAddressIndex) {
+        // Address balances are kept with the address index, build them for an index created without
+        bool fAddressBalances = false;
+        if (!pblocktree->ReadFlag("addressbalances", fAddressBalances) || !fAddressBalances) {
+            if (!pblocktree->BuildAddressBalances()) {
+                return error("%s: Failed to build address balances", __func__);
+            }
+            pblocktree->WriteFlag("addressbalances", true);
+        }
+    }
 
-    // Check whether we have a timestamp index
-    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
-    LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
+    // Check whether the block tree database has a timestamp index
+    pblocktree->ReadFlag("timestampindex", fLegacyTimestampIndex);
+    fTimestampIndex = fLegacyTimestampIndex;
+    LogPrintf("%s: timestamp index %s\n", __func__, fLegacyTimestampIndex ? "enabled" : "disabled");
 
-    // Check whether we have a spent index
-    pblocktree->ReadFlag("spentindex", fSpentIndex);
-    LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
+    // Check whether the block tree database has a spent index
+    pblocktree->ReadFlag("spentindex", fLegacySpentIndex);
+    fSpentIndex = fLegacySpentIndex;
+    LogPrintf("%s: spent index %s\n", __func__, fLegacySpentIndex ? "enabled" : "disabled");
 
     return true;
 }
@@ -6107,19 +6269,19 @@ bool LoadBlockIndex(const CChainParams& chainparams)
         LogPrintf("Initializing databases...\n");
         pblocktree->WriteFlag("v1", true);
 
-        // Use the provided setting for -addressindex in the new database
-        fAddressIndex = gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
-        pblocktree->WriteFlag("addressindex", fAddressIndex);
-        LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+        // New databases keep the insight indexes out of the block tree, see InsightIndex
+        fLegacyAddressIndex = false;
+        fLegacyTimestampIndex = false;
+        fLegacySpentIndex = false;
+        pblocktree->WriteFlag("addressindex", false);
+        pblocktree->WriteFlag("timestampindex", false);
+        pblocktree->WriteFlag("spentindex", false);
 
-        // Use the provided setting for -timestampindex in the new database
+        fAddressIndex = gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
         fTimestampIndex = gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
-        pblocktree->WriteFlag("timestampindex", fTimestampIndex);
-        LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
-
-        // Use the provided setting for -spentindex in the new database
         fSpentIndex = gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
-        pblocktree->WriteFlag("spentindex", fSpentIndex);
+        LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+        LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
         LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
     }
     return true;
@@ -6162,10 +6324,6 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
     static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
-    fAddressIndex = gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
-    fTimestampIndex = gArgs.GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
-    fSpentIndex = gArgs.GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
-
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
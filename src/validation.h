@@ -12,6 +12,8 @@
 #endif
 
 #include <amount.h>
+#include <anon.h>
+#include <blind.h>
 #include <coins.h>
 #include <crypto/common.h> // for ReadLE64
 #include <fs.h>
@@ -121,6 +123,7 @@ static const bool DEFAULT_CSINDEX = false;
 static const bool DEFAULT_ADDRESSINDEX = false;
 static const bool DEFAULT_TIMESTAMPINDEX = false;
 static const bool DEFAULT_SPENTINDEX = false;
+static const bool DEFAULT_STEALTHINDEX = false;
 static const unsigned int DEFAULT_DB_MAX_OPEN_FILES = 64; // set to 1000 for insight
 static const bool DEFAULT_DB_COMPRESSION = false; // set to true for insight
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
@@ -266,6 +269,8 @@ bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(int worker_num);
+/** Run an instance of the check thread for the proofs of loose transactions */
+void ThreadMempoolCheck(int worker_num);
 /** Return the median number of blocks that other nodes claim to have */
 int GetNumBlocksOfPeers();
 /** Return the median number of connected nodes */
@@ -310,6 +315,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false, bool ignore_locks=false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/** Returns true if tx has CT or RingCT outputs, PreVerifyBlindedTransaction checks their bulletproofs. */
+bool HasBlindedOutputs(const CTransaction &tx);
+/** Verify the bulletproofs of a CT/RingCT transaction without holding cs_main, spread over the mempool check threads.
+ *  On success state is marked so a following AcceptToMemoryPool with the same state skips them and CheckTransaction. */
+bool PreVerifyBlindedTransaction(const CTransaction &tx, CValidationState &state) LOCKS_EXCLUDED(cs_main);
+
 /** Get the BIP9 state for a given deployment at the current tip. */
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos);
 
@@ -366,6 +377,8 @@ private:
     bool cacheStore;
     ScriptError error;
     PrecomputedTransactionData *txdata;
+    CMLSAGCheck m_mlsag; // Set when this entry verifies an anon input's ring signature
+    CBulletproofCheck m_bulletproofs; // Set when this entry verifies a batch of rangeproofs
 public:
     CScriptCheck(const CScript& scriptPubKeyIn, const std::vector<uint8_t> &vchAmountIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
         scriptPubKey(scriptPubKeyIn), vchAmount(vchAmountIn),
@@ -387,6 +400,18 @@ public:
         scriptPubKey = m_tx_out.scriptPubKey;
     };
 
+    explicit CScriptCheck(CMLSAGCheck &mlsagIn) :
+        amount(0), ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(nullptr)
+    {
+        m_mlsag.swap(mlsagIn);
+    };
+
+    explicit CScriptCheck(CBulletproofCheck &bulletproofsIn) :
+        amount(0), ptxTo(nullptr), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(nullptr)
+    {
+        m_bulletproofs.swap(bulletproofsIn);
+    };
+
     bool operator()();
 
     void swap(CScriptCheck &check) {
@@ -400,6 +425,8 @@ public:
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
         std::swap(txdata, check.txdata);
+        m_mlsag.swap(check.m_mlsag);
+        m_bulletproofs.swap(check.m_bulletproofs);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -28,6 +28,7 @@ struct ValidationInterfaceConnections {
 
     boost::signals2::scoped_connection TransactionAddedToWallet;
     boost::signals2::scoped_connection NewSecureMessage;
+    boost::signals2::scoped_connection NewSecureMessageData;
 };
 
 struct MainSignalsInstance {
@@ -42,6 +43,7 @@ struct MainSignalsInstance {
 
     boost::signals2::signal<void (const std::string &, const CTransactionRef &)> TransactionAddedToWallet;
     boost::signals2::signal<void (const smsg::SecureMessage *psmsg, const uint160 &)> NewSecureMessage;
+    boost::signals2::signal<void (const uint8_t *, const uint8_t *, uint32_t, const CKeyID *, const smsg::MessageData *)> NewSecureMessageData;
 
     // We are not allowed to assume the scheduler only runs in one thread,
     // but must ensure all callbacks happen in-order, so we end up creating
@@ -108,6 +110,7 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
 
     conns.TransactionAddedToWallet = g_signals.m_internals->TransactionAddedToWallet.connect(std::bind(&CValidationInterface::TransactionAddedToWallet, pwalletIn, std::placeholders::_1, std::placeholders::_2));
     conns.NewSecureMessage = g_signals.m_internals->NewSecureMessage.connect(std::bind(&CValidationInterface::NewSecureMessage, pwalletIn, std::placeholders::_1, std::placeholders::_2));
+    conns.NewSecureMessageData = g_signals.m_internals->NewSecureMessageData.connect(std::bind(&CValidationInterface::NewSecureMessageData, pwalletIn, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
@@ -194,3 +197,7 @@ void CMainSignals::TransactionAddedToWallet(const std::string &sWalletName, cons
 void CMainSignals::NewSecureMessage(const smsg::SecureMessage *psmsg, const uint160 &hash) {
     m_internals->NewSecureMessage(psmsg, hash);
 }
+
+void CMainSignals::NewSecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg) {
+    m_internals->NewSecureMessageData(pHeader, pPayload, nPayload, pAddressTo, pMsg);
+}
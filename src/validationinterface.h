@@ -22,8 +22,10 @@ class CValidationState;
 class uint256;
 class CScheduler;
 class CTxMemPool;
+class CKeyID;
 namespace smsg {
 class SecureMessage;
+class MessageData;
 }
 enum class MemPoolRemovalReason;
 
@@ -152,6 +154,12 @@ protected:
 
     virtual void TransactionAddedToWallet(const std::string &sWalletName, const CTransactionRef& tx) {};
     virtual void NewSecureMessage(const smsg::SecureMessage *psmsg, const uint160 &hash) {};
+    /**
+     * Notifies listeners of a full secure message, the pointers are only valid during the call.
+     * pAddressTo is null when the message was stored in a bucket, and set to the receiving
+     * address when the message was added to the inbox. pMsg is the decrypted inbox message,
+     * null if it could not be decrypted. */
+    virtual void NewSecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg) {};
 };
 
 struct MainSignalsInstance;
@@ -191,6 +199,7 @@ public:
 
     void TransactionAddedToWallet(const std::string &sWalletName, const CTransactionRef& tx);
     void NewSecureMessage(const smsg::SecureMessage *psmsg, const uint160 &hash);
+    void NewSecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg);
 };
 
 CMainSignals& GetMainSignals();
@@ -97,6 +97,8 @@ void CHDWallet::AddOptions()
 
     gArgs.AddArg("-staking", "Stake your coins to support network and gain reward (default: true)", ArgsManager::ALLOW_ANY, OptionsCategory::PART_STAKING);
     gArgs.AddArg("-stakingthreads", "Number of threads to start for staking, max 1 per active wallet, will divide wallets evenly between threads (default: 1)", ArgsManager::ALLOW_ANY, OptionsCategory::PART_STAKING);
+    gArgs.AddArg("-stakelookahead=<n>", strprintf("Number of timestamp slots searched for kernels after each new block, a winning slot is signed before it starts (default: %u)", DEFAULT_STAKE_LOOKAHEAD), ArgsManager::ALLOW_ANY, OptionsCategory::PART_STAKING);
+    gArgs.AddArg("-stakesearchthreads=<n>", "Number of threads searching for kernels over the coins of all staking wallets, 0 = number of cores (default: 1)", ArgsManager::ALLOW_ANY, OptionsCategory::PART_STAKING);
     gArgs.AddArg("-minstakeinterval=<n>", "Minimum time in seconds between successful stakes (default: 0)", ArgsManager::ALLOW_ANY, OptionsCategory::PART_STAKING);
     gArgs.AddArg("-minersleep=<n>", "Milliseconds between stake attempts. Lowering this param will not result in more stakes. (default: 500)", ArgsManager::ALLOW_ANY, OptionsCategory::PART_STAKING);
     gArgs.AddArg("-reservebalance=<amount>", "Ensure available balance remains above reservebalance. (default: 0)", ArgsManager::ALLOW_ANY, OptionsCategory::PART_STAKING);
@@ -1007,7 +1009,12 @@ bool CHDWallet::Lock()
         ExtKeyLock();
     }
 
-    return CWallet::Lock();
+    if (!CWallet::Lock()) {
+        return false;
+    }
+    smsgModule.WalletLocked(this);
+
+    return true;
 };
 
 bool CHDWallet::Unlock(const SecureString &strWalletPassphrase, bool accept_no_keys)
@@ -5535,6 +5542,24 @@ void CHDWallet::ClearCachedBalances()
     // Clear cache when a new txn is added to the wallet or a block is added or removed from the chain.
     m_have_spendable_balance_cached = false;
     m_have_cached_stakeable_coins = false;
+    m_have_stake_search = false;
+    return;
+}
+
+void CHDWallet::UpdateStakeCandidates(const uint256 &txid)
+{
+    LOCK(cs_wallet);
+    if (m_have_stake_candidates) {
+        m_stake_candidates_changed.insert(txid);
+    }
+    return;
+}
+
+void CHDWallet::ResetStakeCandidates()
+{
+    LOCK(cs_wallet);
+    m_have_stake_candidates = false;
+    m_stake_candidates_changed.clear();
     return;
 }
 
@@ -5627,6 +5652,7 @@ int CHDWallet::UnloadTransaction(const uint256 &hash)
         WalletLogPrintf("Warning: %s - tx not found in wallet! %s.\n", __func__, hash.ToString());
         return 1;
     }
+    UpdateStakeCandidates(hash);
 
     NotifyTransactionChanged(this, hash, CT_DELETED);
     return 0;
@@ -9012,20 +9038,6 @@ bool CHDWallet::CountRecords(std::string sPrefix, int64_t rv)
     return true;
 };
 
-inline bool MatchPrefix(uint32_t nAddrBits, uint32_t addrPrefix, uint32_t outputPrefix, bool fHavePrefix)
-{
-    if (nAddrBits < 1) { // addresses without prefixes scan all incoming stealth outputs
-        return true;
-    }
-    if (!fHavePrefix) { // don't check when address has a prefix and no prefix on output
-        return false;
-    }
-
-    uint32_t mask = SetStealthMask(nAddrBits);
-
-    return (addrPrefix & mask) == (outputPrefix & mask);
-};
-
 void CHDWallet::ProcessStealthLookahead(CExtKeyAccount *ea, const CEKAStealthKey &aks, bool v2)
 {
     auto &use_set = v2 ? ea->setLookAheadStealthV2 : ea->setLookAheadStealth;
@@ -10501,6 +10513,7 @@ bool CHDWallet::AddToRecord(CTransactionRecord &rtxIn, const CTransaction &tx,
 
     std::string sName = GetName();
     GetMainSignals().TransactionAddedToWallet(sName, MakeTransactionRef(tx));
+    UpdateStakeCandidates(txhash);
     ClearCachedBalances();
 
     return true;
@@ -10569,6 +10582,7 @@ CWallet::ScanResult CHDWallet::ScanForWalletTransactions(const uint256& first_bl
     }
 
     ScanResult rv = CWallet::ScanForWalletTransactions(first_block, last_block, reserver, fUpdate);
+    ResetStakeCandidates();
 
     // Remove lookahead keys
     if (sea) {
@@ -12219,121 +12233,170 @@ uint64_t CHDWallet::GetStakeWeight() const
     return nWeight;
 };
 
-void CHDWallet::AvailableCoinsForStaking(std::vector<COutput> &vCoins, int64_t nTime, int nHeight) const
+void CHDWallet::AddStakeCandidates(interfaces::Chain::Lock& locked_chain, const uint256 &txid) const
 {
-    vCoins.clear();
+    AssertLockHeld(cs_wallet);
 
-    m_greatest_txn_depth = 0;
+    int nDepth;
+    std::vector<std::pair<uint32_t, const CScript*> > vOutputs;
 
-    {
-        auto locked_chain = chain().lock();
-        LOCK(cs_wallet);
+    MapWallet_t::const_iterator mwi;
+    MapRecords_t::const_iterator mri;
+    if ((mwi = mapWallet.find(txid)) != mapWallet.end()) {
+        const CWalletTx &wtx = mwi->second;
+        if ((nDepth = wtx.GetDepthInMainChain(locked_chain)) < 1) {
+            return;
+        }
+        for (size_t i = 0; i < wtx.tx->vpout.size(); ++i) {
+            const auto &txout = wtx.tx->vpout[i];
+            if (txout->IsType(OUTPUT_STANDARD)) {
+                vOutputs.emplace_back(i, txout->GetPScriptPubKey());
+            }
+        }
+    } else
+    if ((mri = mapRecords.find(txid)) != mapRecords.end()) {
+        const CTransactionRecord &rtx = mri->second;
+        if ((nDepth = GetDepthInMainChain(locked_chain, rtx.blockHash, rtx.nIndex)) < 1) {
+            return;
+        }
+        for (const auto &r : rtx.vout) {
+            if (r.nType == OUTPUT_STANDARD
+                && (r.nFlags & ORF_OWNED || r.nFlags & ORF_STAKEONLY)) {
+                vOutputs.emplace_back(r.n, &r.scriptPubKey);
+            }
+        }
+    } else {
+        return;
+    }
 
-        int nHeight = ::ChainActive().Tip()->nHeight;
-        int min_stake_confirmations = Params().GetStakeMinConfirmations();
-        int nRequiredDepth = std::min(min_stake_confirmations-1, (int)(nHeight / 2));
+    int nHeight = locked_chain.getHeight().get_value_or(0) - nDepth + 1;
+    for (const auto &output : vOutputs) {
+        CKeyID keyID;
+        if (!ExtractStakingKeyID(*output.second, keyID)) {
+            continue;
+        }
+        isminetype mine = IsMine(keyID);
+        if (!(mine & ISMINE_SPENDABLE)
+            || (mine & ISMINE_HARDWARE_DEVICE)) {
+            continue;
+        }
+        COutPoint prevout(txid, output.first);
+        m_stake_candidates[prevout] = nHeight;
+        m_stake_candidates_by_height.insert(std::make_pair(nHeight, prevout));
+    }
+    return;
+};
 
-        for (const auto &walletEntry : mapWallet) {
-            const CWalletTx *pcoin = &walletEntry.second;
-            CTransactionRef tx = pcoin->tx;
+void CHDWallet::EraseStakeCandidates(const uint256 &txid) const
+{
+    AssertLockHeld(cs_wallet);
 
-            int nDepth = pcoin->GetDepthInMainChain(*locked_chain);
+    auto it = m_stake_candidates.lower_bound(COutPoint(txid, 0));
+    while (it != m_stake_candidates.end() && it->first.hash == txid) {
+        m_stake_candidates_by_height.erase(std::make_pair(it->second, it->first));
+        it = m_stake_candidates.erase(it);
+    }
+    return;
+};
 
-            if (nDepth > m_greatest_txn_depth) {
-                m_greatest_txn_depth = nDepth;
-            }
+void CHDWallet::SyncStakeCandidates(interfaces::Chain::Lock& locked_chain) const
+{
+    AssertLockHeld(cs_wallet);
 
-            if (nDepth < nRequiredDepth) {
-                continue;
-            }
+    if (m_have_stake_candidates) {
+        for (const auto &txid : m_stake_candidates_changed) {
+            EraseStakeCandidates(txid);
+            AddStakeCandidates(locked_chain, txid);
+        }
+        m_stake_candidates_changed.clear();
+        return;
+    }
 
-            if (pcoin->IsCoinStake() && min_stake_confirmations < COINBASE_MATURITY) {
-                // min_stake_confirmations is only less than COINBASE_MATURITY in regtest mode
-                if (nDepth < std::min(COINBASE_MATURITY, (int)(nHeight / 2))) {
-                    continue;
-                }
-            }
+    m_stake_candidates.clear();
+    m_stake_candidates_by_height.clear();
+    m_stake_candidates_changed.clear();
+    for (const auto &wi : mapWallet) {
+        AddStakeCandidates(locked_chain, wi.first);
+    }
+    for (const auto &ri : mapRecords) {
+        AddStakeCandidates(locked_chain, ri.first);
+    }
+    m_have_stake_candidates = true;
 
-            const uint256 &wtxid = walletEntry.first;
-            for (size_t i = 0; i < tx->vpout.size(); ++i) {
-                const auto &txout = tx->vpout[i];
-                if (!txout->IsType(OUTPUT_STANDARD)) {
-                    continue;
-                }
+    if (LogAcceptCategory(BCLog::POS)) {
+        WalletLogPrintf("%s: %u staking candidates.\n", __func__, m_stake_candidates.size());
+    }
+    return;
+};
 
-                COutPoint kernel(wtxid, i);
-                if (!CheckStakeUnused(kernel)
-                     || IsSpent(*locked_chain, wtxid, i)
-                     || IsLockedCoin(wtxid, i)) {
-                    continue;
-                }
+void CHDWallet::AvailableCoinsForStaking(std::vector<COutput> &vCoins, int64_t nTime, int nHeight) const
+{
+    vCoins.clear();
 
-                const CScript *pscriptPubKey = txout->GetPScriptPubKey();
-                CKeyID keyID;
-                if (!ExtractStakingKeyID(*pscriptPubKey, keyID)) {
-                    continue;
-                }
+    m_greatest_txn_depth = 0;
 
-                isminetype mine = IsMine(keyID);
-                if (!(mine & ISMINE_SPENDABLE)) {
-                    continue;
-                }
+    {
+        auto locked_chain = chain().lock();
+        LOCK(cs_wallet);
 
-                bool fSpendableIn = true;
-                bool fSolvableIn = true;
-                bool fNeedHardwareKey = (mine & ISMINE_HARDWARE_DEVICE);
+        SyncStakeCandidates(*locked_chain);
 
-                if (fNeedHardwareKey) {
-                    continue;
-                }
+        int nHeight = ::ChainActive().Tip()->nHeight;
+        int min_stake_confirmations = Params().GetStakeMinConfirmations();
+        int nRequiredDepth = std::min(min_stake_confirmations-1, (int)(nHeight / 2));
 
-                vCoins.emplace_back(pcoin, i, nDepth, fSpendableIn, fSolvableIn, true, true, fNeedHardwareKey, false);
-            }
+        if (!m_stake_candidates_by_height.empty()) {
+            m_greatest_txn_depth = nHeight - m_stake_candidates_by_height.begin()->first + 1;
         }
 
-        for (const auto &ri : mapRecords) {
-            const uint256 &txid = ri.first;
-            const CTransactionRecord &rtx = ri.second;
-
-            int nDepth = GetDepthInMainChain(*locked_chain, rtx.blockHash, rtx.nIndex);
-            if (nDepth > m_greatest_txn_depth) {
-                m_greatest_txn_depth = nDepth;
+        // Only candidates confirmed at or below nMaxHeight can be deep enough
+        int nMaxHeight = nHeight + 1 - nRequiredDepth;
+        for (const auto &candidate : m_stake_candidates_by_height) {
+            if (candidate.first > nMaxHeight) {
+                break;
             }
+            const COutPoint &kernel = candidate.second;
+            const uint256 &txid = kernel.hash;
 
-            if (nDepth < nRequiredDepth) {
+            if (!CheckStakeUnused(kernel)
+                || IsSpent(*locked_chain, txid, kernel.n)
+                || IsLockedCoin(txid, kernel.n)) {
                 continue;
             }
 
-            MapWallet_t::const_iterator twi = mapTempWallet.end();
-            for (const auto &r : rtx.vout) {
-                if (r.nType != OUTPUT_STANDARD) {
-                    continue;
-                }
+            MapWallet_t::const_iterator mwi;
+            MapRecords_t::const_iterator mri;
+            if ((mwi = mapWallet.find(txid)) != mapWallet.end()) {
+                const CWalletTx *pcoin = &mwi->second;
 
-                if (!(r.nFlags & ORF_OWNED || r.nFlags & ORF_STAKEONLY)) {
+                // The height is stale if the block was disconnected
+                int nDepth = pcoin->GetDepthInMainChain(*locked_chain);
+                if (nDepth < nRequiredDepth) {
                     continue;
                 }
 
-                if (IsSpent(*locked_chain, txid, r.n)
-                    || IsLockedCoin(txid, r.n)) {
-                    continue;
+                if (pcoin->IsCoinStake() && min_stake_confirmations < COINBASE_MATURITY) {
+                    // min_stake_confirmations is only less than COINBASE_MATURITY in regtest mode
+                    if (nDepth < std::min(COINBASE_MATURITY, (int)(nHeight / 2))) {
+                        continue;
+                    }
                 }
 
-                CKeyID keyID;
-                if (!ExtractStakingKeyID(r.scriptPubKey, keyID)) {
-                    continue;
-                }
+                bool fSpendableIn = true;
+                bool fSolvableIn = true;
+                bool fNeedHardwareKey = false;
+                vCoins.emplace_back(pcoin, kernel.n, nDepth, fSpendableIn, fSolvableIn, true, true, fNeedHardwareKey, false);
+            } else
+            if ((mri = mapRecords.find(txid)) != mapRecords.end()) {
+                const CTransactionRecord &rtx = mri->second;
 
-                isminetype mine = IsMine(keyID);
-                if (!(mine & ISMINE_SPENDABLE)) {
-                    continue;
-                }
-                if ((mine & ISMINE_HARDWARE_DEVICE)) {
+                int nDepth = GetDepthInMainChain(*locked_chain, rtx.blockHash, rtx.nIndex);
+                if (nDepth < nRequiredDepth) {
                     continue;
                 }
 
-                if (twi == mapTempWallet.end()
-                    && (twi = mapTempWallet.find(txid)) == mapTempWallet.end()) {
+                MapWallet_t::const_iterator twi = mapTempWallet.find(txid);
+                if (twi == mapTempWallet.end()) {
                     if (0 != InsertTempTxn(txid, &rtx)
                         || (twi = mapTempWallet.find(txid)) == mapTempWallet.end()) {
                         WalletLogPrintf("ERROR: %s - InsertTempTxn failed %s.\n", __func__, txid.ToString());
@@ -12343,7 +12406,7 @@ void CHDWallet::AvailableCoinsForStaking(std::vector<COutput> &vCoins, int64_t n
 
                 bool fSpendableIn = true;
                 bool fNeedHardwareKey = false;
-                vCoins.emplace_back(&twi->second, r.n, nDepth, fSpendableIn, true, true, true, fNeedHardwareKey, false);
+                vCoins.emplace_back(&twi->second, kernel.n, nDepth, fSpendableIn, true, true, true, fNeedHardwareKey, false);
             }
         }
     }
@@ -12396,7 +12459,65 @@ bool CHDWallet::SelectCoinsForStaking(int64_t nTargetValue, int64_t nTime, int n
     return true;
 };
 
-bool CHDWallet::CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHeight, int64_t nFees, CMutableTransaction &txNew, CKey &key)
+bool CHDWallet::BuildStakeSearch(const CBlockIndex *pindexPrev, unsigned int nBits, int64_t nTime, int nHeight)
+{
+    m_have_stake_search = true; // Set first, ClearCachedBalances during the build invalidates the snapshot
+    m_stake_search_coins.clear();
+    if (!m_stake_search.Init(pindexPrev, nBits)) {
+        return false;
+    }
+
+    CAmount nBalance = GetSpendableBalance();
+    std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
+    CAmount nValueIn = 0;
+
+    // Select coins with suitable depth
+    if (nBalance <= nReserveBalance
+        || !SelectCoinsForStaking(nBalance - nReserveBalance, nTime, nHeight, setCoins, nValueIn)) {
+        return false;
+    }
+
+    int nRequiredDepth = std::min((int)(Params().GetStakeMinConfirmations()-1), (int)(pindexPrev->nHeight / 2));
+
+    LOCK(::cs_main);
+    const CCoinsViewCache &view = ::ChainstateActive().CoinsTip();
+    for (const auto &pcoin : setCoins) {
+        COutPoint prevout(pcoin.first->GetHash(), pcoin.second);
+        Coin coin;
+        if (!view.GetCoin(prevout, coin)
+            || coin.nType != OUTPUT_STANDARD
+            || coin.IsSpent()) {
+            continue;
+        }
+        if (pindexPrev->nHeight - (int)coin.nHeight < nRequiredDepth) {
+            continue;
+        }
+        const CBlockIndex *pindex = pindexPrev->GetAncestor(coin.nHeight);
+        if (!pindex) {
+            continue;
+        }
+        m_stake_search.AddCoin(prevout, coin.out.nValue, pindex->GetBlockTime());
+        m_stake_search_coins.push_back(pcoin);
+    }
+
+    if (LogAcceptCategory(BCLog::POS)) {
+        WalletLogPrintf("%s: %u of %u coins at height %d.\n", __func__, m_stake_search.Size(), setCoins.size(), pindexPrev->nHeight);
+    }
+
+    return true;
+};
+
+bool CHDWallet::PrepareStakeSearch(const CBlockIndex *pindexPrev, unsigned int nBits, int64_t nTime, int nHeight)
+{
+    if (m_have_stake_search
+        && m_stake_search.GetTip() == pindexPrev
+        && m_stake_search.GetBits() == nBits) {
+        return true;
+    }
+    return BuildStakeSearch(pindexPrev, nBits, nTime, nHeight);
+};
+
+bool CHDWallet::CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHeight, int64_t nFees, CMutableTransaction &txNew, CKey &key, size_t nKernelStart, uint64_t nSnapshotId)
 {
     CBlockIndex *pindexPrev = ::ChainActive().Tip();
     arith_uint256 bnTargetPerCoinDay;
@@ -12407,35 +12528,31 @@ bool CHDWallet::CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHei
         return false;
     }
 
-    // Choose coins to use
+    // Choose coins to use, the snapshot is rebuilt when the tip or the wallet changes
     std::vector<const CWalletTx*> vwtxPrev;
-    std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
-    CAmount nValueIn = 0;
-
-    // Select coins with suitable depth
-    if (!SelectCoinsForStaking(nBalance - nReserveBalance, nTime, nBlockHeight, setCoins, nValueIn)) {
+    if (!PrepareStakeSearch(pindexPrev, nBits, nTime, nBlockHeight)) {
         return false;
     }
 
-    if (setCoins.empty()) {
+    if (m_stake_search.Size() < 1) {
         return false;
     }
+    if (m_stake_search.GetId() != nSnapshotId) {
+        nKernelStart = 0; // Index is into an older snapshot
+    }
+
+    std::set<std::pair<const CWalletTx*,unsigned int> > setCoins(m_stake_search_coins.begin(), m_stake_search_coins.end());
 
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
 
-    std::set<std::pair<const CWalletTx*,unsigned int> >::iterator it = setCoins.begin();
-
-    for (; it != setCoins.end(); ++it) {
-        auto pcoin = *it;
+    for (int k = m_stake_search.Search(nTime, nKernelStart); k >= 0; k = m_stake_search.Search(nTime, k + 1)) {
+        auto pcoin = m_stake_search_coins[k];
         if (ThreadStakeMinerStopped()) { // interruption_point
             return false;
         }
 
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-
-        int64_t nBlockTime;
-        if (CheckKernel(pindexPrev, nBits, nTime, prevoutStake, &nBlockTime)) {
+        {
             LOCK(cs_wallet);
             // Found a kernel
             if (LogAcceptCategory(BCLog::POS)) {
@@ -12571,7 +12688,7 @@ bool CHDWallet::CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHei
                 WalletLogPrintf("%s: Added kernel.\n", __func__);
             }
 
-            setCoins.erase(it);
+            setCoins.erase(pcoin);
             break;
         }
     }
@@ -12583,7 +12700,7 @@ bool CHDWallet::CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHei
     // Attempt to add more inputs
     // Only advantage here is to setup the next stake using this output as a kernel to have a higher chance of staking
     size_t nStakesCombined = 0;
-    it = setCoins.begin();
+    auto it = setCoins.begin();
     while (it != setCoins.end()) {
         if (nStakesCombined >= nMaxStakeCombine) {
             break;
@@ -12847,7 +12964,7 @@ bool CHDWallet::CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHei
     return true;
 };
 
-bool CHDWallet::SignBlock(CBlockTemplate *pblocktemplate, int nHeight, int64_t nSearchTime)
+bool CHDWallet::SignBlock(CBlockTemplate *pblocktemplate, int nHeight, int64_t nSearchTime, size_t nKernelStart, uint64_t nSnapshotId)
 {
     if (LogAcceptCategory(BCLog::POS)) {
         WalletLogPrintf("%s, Height %d\n", __func__, nHeight);
@@ -12871,7 +12988,7 @@ bool CHDWallet::SignBlock(CBlockTemplate *pblocktemplate, int nHeight, int64_t n
     }
 
     CMutableTransaction txCoinStake;
-    if (CreateCoinStake(pblock->nBits, nSearchTime, nHeight, nFees, txCoinStake, key)) {
+    if (CreateCoinStake(pblock->nBits, nSearchTime, nHeight, nFees, txCoinStake, key, nKernelStart, nSnapshotId)) {
         if (LogAcceptCategory(BCLog::POS)) {
             WalletLogPrintf("%s: Kernel found.\n", __func__);
         }
@@ -12,6 +12,7 @@
 #include <key_io.h>
 #include <key/extkey.h>
 #include <key/stealth.h>
+#include <pos/kernel.h>
 
 static const size_t DEFAULT_STEALTH_LOOKAHEAD_SIZE = 5;
 
@@ -244,6 +245,8 @@ public:
 
 
     void ClearCachedBalances() override;
+    void UpdateStakeCandidates(const uint256 &txid) override;
+    void ResetStakeCandidates() override;
     void LoadToWallet(CWalletTx& wtxIn) override EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     void LoadToWallet(const uint256 &hash, const CTransactionRecord &rtx) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
@@ -454,8 +457,20 @@ public:
     uint64_t GetStakeWeight() const;
     void AvailableCoinsForStaking(std::vector<COutput> &vCoins, int64_t nTime, int nHeight) const;
     bool SelectCoinsForStaking(int64_t nTargetValue, int64_t nTime, int nHeight, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const;
-    bool CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHeight, int64_t nFees, CMutableTransaction &txNew, CKey &key);
-    bool SignBlock(CBlockTemplate *pblocktemplate, int nHeight, int64_t nSearchTime);
+    /** Insert the outputs of txid that can stake once deep enough into m_stake_candidates. */
+    void AddStakeCandidates(interfaces::Chain::Lock& locked_chain, const uint256 &txid) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    void EraseStakeCandidates(const uint256 &txid) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Scan mapWallet and mapRecords when the candidates were reset, else re-evaluate the changed transactions only. */
+    void SyncStakeCandidates(interfaces::Chain::Lock& locked_chain) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /** Snapshot the coins selected for staking with their values and block times into m_stake_search. */
+    bool BuildStakeSearch(const CBlockIndex *pindexPrev, unsigned int nBits, int64_t nTime, int nHeight);
+    /** Rebuild m_stake_search if the tip, the difficulty or the wallet changed, returns false if it could not be built. */
+    bool PrepareStakeSearch(const CBlockIndex *pindexPrev, unsigned int nBits, int64_t nTime, int nHeight);
+    const CStakeKernelSearch &GetStakeSearch() const { return m_stake_search; };
+    /** nKernelStart is the index to start the kernel search from in the snapshot nSnapshotId, set when a kernel was already found.
+     *  The search starts from 0 if m_stake_search was rebuilt since. */
+    bool CreateCoinStake(unsigned int nBits, int64_t nTime, int nBlockHeight, int64_t nFees, CMutableTransaction &txNew, CKey &key, size_t nKernelStart = 0, uint64_t nSnapshotId = 0);
+    bool SignBlock(CBlockTemplate *pblocktemplate, int nHeight, int64_t nSearchTime, size_t nKernelStart = 0, uint64_t nSnapshotId = 0);
 
     boost::signals2::signal<void (CAmount nReservedBalance)> NotifyReservedBalanceChanged;
 
@@ -509,6 +524,17 @@ public:
     mutable std::atomic_bool m_have_cached_stakeable_coins {false};
     mutable std::vector<COutput> m_cached_stakeable_coins;
 
+    // Owned standard outputs with a staking key, by the height of the block that confirmed them.
+    // Spent, locked and reorged out outputs are skipped when the stakeable coins are listed.
+    mutable std::map<COutPoint, int> m_stake_candidates GUARDED_BY(cs_wallet);
+    mutable std::set<std::pair<int, COutPoint> > m_stake_candidates_by_height GUARDED_BY(cs_wallet);
+    mutable std::set<uint256> m_stake_candidates_changed GUARDED_BY(cs_wallet);
+    mutable bool m_have_stake_candidates GUARDED_BY(cs_wallet) = false;
+
+    std::atomic_bool m_have_stake_search {false};
+    CStakeKernelSearch m_stake_search;
+    std::vector<std::pair<const CWalletTx*, unsigned int> > m_stake_search_coins; // Coin of each m_stake_search entry
+
     bool fUnlockForStakingOnly = false; // Use coldstaking instead
 
     int64_t nRCTOutSelectionGroup1 = 5000;
@@ -2504,6 +2504,7 @@ static UniValue clearwallettransactions(const JSONRPCRequest &request)
     {
         LOCK2(cs_main, pwallet->cs_wallet);
 
+        pwallet->ResetStakeCandidates();
         pwallet->ClearCachedBalances(); // Clear stakeable coins cache
 
         CHDWalletDB wdb(pwallet->GetDBHandle());
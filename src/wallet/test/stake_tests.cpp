@@ -9,6 +9,7 @@
 #include <wallet/test/hdwallet_test_fixture.h>
 #include <chainparams.h>
 #include <miner.h>
+#include <pos/diffalgo.h>
 #include <pos/miner.h>
 #include <timedata.h>
 #include <coins.h>
@@ -139,6 +140,66 @@ static void DisconnectTip(CBlock &block, CBlockIndex *pindexDelete, CCoinsViewCa
     UpdateTip(pindexDelete->pprev, chainparams);
 };
 
+static void CheckStakeCandidates(CHDWallet *pwallet)
+{
+    auto locked_chain = pwallet->chain().lock();
+    LockAssertion lock(::cs_main);
+    LOCK(pwallet->cs_wallet);
+
+    // Candidates kept up to date since the last full scan must match a new scan of mapWallet and mapRecords
+    pwallet->SyncStakeCandidates(*locked_chain);
+    std::map<COutPoint, int> candidates = pwallet->m_stake_candidates;
+    std::set<std::pair<int, COutPoint> > candidates_by_height = pwallet->m_stake_candidates_by_height;
+
+    pwallet->ResetStakeCandidates();
+    pwallet->SyncStakeCandidates(*locked_chain);
+    BOOST_CHECK(pwallet->m_have_stake_candidates);
+    BOOST_CHECK(candidates == pwallet->m_stake_candidates);
+    BOOST_CHECK(candidates_by_height == pwallet->m_stake_candidates_by_height);
+    BOOST_CHECK_EQUAL(candidates.size(), candidates_by_height.size());
+
+    // Heights are of the blocks confirming the outputs
+    for (const auto &candidate : candidates) {
+        const uint256 &txid = candidate.first.hash;
+        uint256 blockHash;
+        MapWallet_t::const_iterator mwi;
+        MapRecords_t::const_iterator mri;
+        if ((mwi = pwallet->mapWallet.find(txid)) != pwallet->mapWallet.end()) {
+            blockHash = mwi->second.m_confirm.hashBlock;
+        } else
+        if ((mri = pwallet->mapRecords.find(txid)) != pwallet->mapRecords.end()) {
+            blockHash = mri->second.blockHash;
+        }
+        const CBlockIndex *pindex = LookupBlockIndex(blockHash);
+        BOOST_REQUIRE(pindex);
+        BOOST_CHECK(::ChainActive().Contains(pindex));
+        BOOST_CHECK_EQUAL(candidate.second, pindex->nHeight);
+        BOOST_CHECK(candidates_by_height.count(std::make_pair(candidate.second, candidate.first)));
+    }
+}
+
+static std::vector<COutPoint> GetRecordStakeCandidates(CHDWallet *pwallet)
+{
+    LOCK(pwallet->cs_wallet);
+    std::vector<COutPoint> vRecordCandidates;
+    for (const auto &candidate : pwallet->m_stake_candidates) {
+        if (pwallet->mapRecords.count(candidate.first.hash)) {
+            vRecordCandidates.push_back(candidate.first);
+        }
+    }
+    return vRecordCandidates;
+}
+
+static bool HaveStakeableCoin(const std::vector<COutput> &vCoins, const COutPoint &prevout)
+{
+    for (const auto &coin : vCoins) {
+        if (coin.tx->GetHash() == prevout.hash && (uint32_t)coin.i == prevout.n) {
+            return true;
+        }
+    }
+    return false;
+}
+
 BOOST_AUTO_TEST_CASE(stake_test)
 {
     SeedInsecureRand();
@@ -366,4 +427,334 @@ BOOST_AUTO_TEST_CASE(stake_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(stake_candidates_test)
+{
+    SeedInsecureRand();
+    CHDWallet *pwallet = pwalletMain.get();
+    UniValue rv;
+
+    BOOST_CHECK_NO_THROW(rv = CallRPC("extkeyimportmaster tprv8ZgxMBicQKsPeK5mCpvMsd1cwyT1JZsrBN82XkoYuZY1EVK7EwDaiL9sDfqUU5SntTfbRfnRedFWjg5xkDG5i3iwd3yP7neX5F2dtdCojk4"));
+    // Import the key to the last 5 outputs in the regtest genesis coinbase
+    BOOST_CHECK_NO_THROW(rv = CallRPC("extkeyimportmaster tprv8ZgxMBicQKsPe3x7bUzkHAJZzCuGqN6y28zFFyg5i7Yqxqm897VCnmMJz6QScsftHDqsyWW5djx6FzrbkF9HSD3ET163z1SzRhfcWxvwL4G"));
+
+    CheckStakeCandidates(pwallet);
+    BOOST_CHECK(!WITH_LOCK(pwallet->cs_wallet, return pwallet->m_stake_candidates.empty()));
+
+    // Coinstakes received
+    StakeNBlocks(pwallet, 2);
+    SyncWithValidationInterfaceQueue();
+    CheckStakeCandidates(pwallet);
+
+    // Spend to an external key, and a received anon txn with its standard change in mapRecords
+    CKey kRecv;
+    InsecureNewKey(kRecv, true);
+    CTransactionRef tx_new;
+    CAmount nFeeRequired;
+    std::string strError;
+    int nChangePosRet = -1;
+    std::vector<CRecipient> vecSend{{GetScriptForDestination(PKHash(kRecv.GetPubKey())), 10000, false}};
+    CCoinControl coinControl;
+    {
+        auto locked_chain = pwallet->chain().lock();
+        BOOST_REQUIRE(pwallet->CreateTransaction(*locked_chain, vecSend, tx_new, nFeeRequired, nChangePosRet, strError, coinControl));
+    }
+    {
+        CValidationState state;
+        pwallet->SetBroadcastTransactions(true);
+        mapValue_t mapValue;
+        BOOST_REQUIRE(pwallet->CommitTransaction(tx_new, std::move(mapValue), {} /* orderForm */, state));
+    }
+    BOOST_CHECK_NO_THROW(rv = CallRPC("getnewstealthaddress"));
+    CBitcoinAddress address(StripQuotes(rv.write()));
+    AddAnonTxn(pwallet, address, 10 * COIN);
+
+    // Unconfirmed txns have no candidates
+    CheckStakeCandidates(pwallet);
+    BOOST_CHECK(GetRecordStakeCandidates(pwallet).empty());
+
+    StakeNBlocks(pwallet, 1);
+    SyncWithValidationInterfaceQueue();
+    CheckStakeCandidates(pwallet);
+    BOOST_CHECK(!GetRecordStakeCandidates(pwallet).empty());
+
+    // Disconnect the block confirming the txns and stake a replacement block, the txns return to the mempool
+    {
+        CValidationState state;
+        CBlockIndex *pindexTip = WITH_LOCK(cs_main, return ::ChainActive().Tip());
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), pindexTip));
+    }
+    SyncWithValidationInterfaceQueue();
+    CheckStakeCandidates(pwallet);
+    BOOST_CHECK(GetRecordStakeCandidates(pwallet).empty());
+
+    StakeNBlocks(pwallet, 1);
+    SyncWithValidationInterfaceQueue();
+    CheckStakeCandidates(pwallet);
+
+    // Lock the record based candidates so they are not staked while growing deep enough to stake
+    std::vector<COutPoint> vRecordCandidates = GetRecordStakeCandidates(pwallet);
+    BOOST_REQUIRE(!vRecordCandidates.empty());
+    {
+        LOCK(pwallet->cs_wallet);
+        for (const auto &prevout : vRecordCandidates) {
+            pwallet->LockCoin(prevout);
+        }
+    }
+    StakeNBlocks(pwallet, 3);
+    SyncWithValidationInterfaceQueue();
+    {
+        LOCK(pwallet->cs_wallet);
+        for (const auto &prevout : vRecordCandidates) {
+            pwallet->UnlockCoin(prevout);
+        }
+    }
+    CheckStakeCandidates(pwallet);
+
+    // A rescan resets the candidates
+    {
+        WalletRescanReserver reserver(pwallet);
+        BOOST_REQUIRE(reserver.reserve());
+        CWallet::ScanResult result = pwallet->ScanForWalletTransactions(WITH_LOCK(cs_main, return ::ChainActive().Genesis()->GetBlockHash()), {} /* stop_block */, reserver, true /* update */);
+        BOOST_CHECK_EQUAL(result.status, CWallet::ScanResult::SUCCESS);
+    }
+    BOOST_CHECK(!WITH_LOCK(pwallet->cs_wallet, return pwallet->m_have_stake_candidates));
+    CheckStakeCandidates(pwallet);
+
+    int nHeight = WITH_LOCK(cs_main, return ::ChainActive().Height());
+    std::vector<COutput> vCoins;
+    pwallet->AvailableCoinsForStaking(vCoins, GetAdjustedTime(), nHeight);
+    BOOST_CHECK(!vCoins.empty());
+    {
+        LOCK(pwallet->cs_wallet);
+        // The genesis outputs are the deepest candidates
+        BOOST_REQUIRE(!pwallet->m_stake_candidates_by_height.empty());
+        BOOST_CHECK_EQUAL(pwallet->m_stake_candidates_by_height.begin()->first, 0);
+        BOOST_CHECK_EQUAL(pwallet->m_greatest_txn_depth, nHeight + 1);
+    }
+
+    // Record based coins used as a kernel are filtered
+    const COutPoint kernel = vRecordCandidates[0];
+    BOOST_REQUIRE(HaveStakeableCoin(vCoins, kernel));
+    {
+        LOCK(cs_main);
+        AddToMapStakeSeen(kernel, ::ChainActive().Tip()->GetBlockHash());
+    }
+    pwallet->AvailableCoinsForStaking(vCoins, GetAdjustedTime(), nHeight);
+    BOOST_CHECK(!HaveStakeableCoin(vCoins, kernel));
+    {
+        LOCK(cs_main);
+        mapStakeSeen.erase(kernel);
+        listStakeSeen.remove(kernel);
+    }
+    pwallet->AvailableCoinsForStaking(vCoins, GetAdjustedTime(), nHeight);
+    BOOST_CHECK(HaveStakeableCoin(vCoins, kernel));
+}
+
+BOOST_AUTO_TEST_CASE(stake_search_pool_test)
+{
+    SeedInsecureRand();
+
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 1000;
+    indexPrev.nTime = 1500000000;
+    indexPrev.bnStakeModifier = InsecureRand256();
+    uint32_t nBits = 0x1a7fffff;
+
+    std::vector<CStakeKernelSearch> vSnapshots(3);
+    std::vector<const CStakeKernelSearch*> vSearch;
+    for (size_t s = 0; s < vSnapshots.size(); ++s) {
+        BOOST_REQUIRE(vSnapshots[s].Init(&indexPrev, nBits));
+        for (size_t i = 0; i < 1000 * (s + 1); ++i) {
+            vSnapshots[s].AddCoin(COutPoint(InsecureRand256(), 0), 1 + InsecureRandRange(1000 * COIN), indexPrev.nTime - 1000);
+        }
+        vSearch.push_back(&vSnapshots[s]);
+    }
+
+    StakeSearchPool pool;
+    pool.Start(4);
+    BOOST_CHECK_EQUAL(pool.NumThreads(), 4U);
+
+    size_t nFound = 0;
+    for (uint32_t nTime = indexPrev.nTime; nTime < indexPrev.nTime + 16 * 50; nTime += 16) {
+        bool fHaveKernel = false;
+        for (const auto &snapshot : vSnapshots) {
+            fHaveKernel |= snapshot.Search(nTime) >= 0;
+        }
+
+        size_t nKernel = 0;
+        int nSearch = pool.Search(vSearch, nTime, nKernel);
+        BOOST_CHECK_EQUAL(nSearch >= 0, fHaveKernel);
+        if (nSearch >= 0) {
+            uint256 hashProofOfStake;
+            BOOST_CHECK(vSnapshots[nSearch].CheckCoin(nKernel, nTime, hashProofOfStake));
+            nFound++;
+        }
+    }
+    BOOST_CHECK(nFound > 0);
+
+    std::vector<const CStakeKernelSearch*> vEmpty;
+    size_t nKernel = 0;
+    BOOST_CHECK(pool.Search(vEmpty, indexPrev.nTime, nKernel) == -1);
+    pool.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(stake_lookahead_test)
+{
+    CHDWallet *pwallet = pwalletMain.get();
+    UniValue rv;
+
+    BOOST_CHECK_NO_THROW(rv = CallRPC("extkeyimportmaster tprv8ZgxMBicQKsPeK5mCpvMsd1cwyT1JZsrBN82XkoYuZY1EVK7EwDaiL9sDfqUU5SntTfbRfnRedFWjg5xkDG5i3iwd3yP7neX5F2dtdCojk4"));
+    // Import the key to the last 5 outputs in the regtest genesis coinbase
+    BOOST_CHECK_NO_THROW(rv = CallRPC("extkeyimportmaster tprv8ZgxMBicQKsPe3x7bUzkHAJZzCuGqN6y28zFFyg5i7Yqxqm897VCnmMJz6QScsftHDqsyWW5djx6FzrbkF9HSD3ET163z1SzRhfcWxvwL4G"));
+
+    const CBlockIndex *pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = ::ChainActive().Tip();
+    }
+    int nHeight = pindexPrev->nHeight + 1;
+    int64_t nSlotLen = Params().GetStakeTimestampMask(nHeight) + 1;
+    int64_t nSearchTime = GetAdjustedTime() & ~Params().GetStakeTimestampMask(nHeight);
+    int64_t nHorizon = nSearchTime + 10000 * nSlotLen;
+
+    CScript coinbaseScript;
+    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript, false));
+    BOOST_REQUIRE(pblocktemplate.get());
+    uint32_t nBits;
+    {
+        LOCK(cs_main);
+        nBits = GetNextTargetRequired(pindexPrev, &pblocktemplate->block);
+    }
+
+    BOOST_REQUIRE(pwallet->PrepareStakeSearch(pindexPrev, nBits, nSearchTime, nHeight));
+    const CStakeKernelSearch &search = pwallet->GetStakeSearch();
+    BOOST_REQUIRE(search.Size() > 0);
+    std::vector<CHDWallet*> vWallets{pwallet};
+    std::vector<const CStakeKernelSearch*> vSearch{&search};
+
+    StakeSearchPool pool;
+    pool.Start(2);
+
+    StakeLookahead lookahead;
+    BOOST_CHECK(lookahead.Update(pindexPrev, nBits, {search.GetId()}, nSearchTime));
+    lookahead.Search(pool, vWallets, vSearch, nHorizon, nSlotLen);
+    BOOST_CHECK_EQUAL(lookahead.nSearchedTo, nHorizon);
+    BOOST_REQUIRE(!lookahead.vWins.empty());
+    for (const auto &win : lookahead.vWins) {
+        uint256 hashProofOfStake;
+        BOOST_CHECK(win.pwallet == pwallet);
+        BOOST_CHECK(win.nSnapshotId == search.GetId());
+        BOOST_CHECK(search.CheckCoin(win.nKernel, win.nTime, hashProofOfStake));
+    }
+
+    // Nothing changed, the slots searched are kept
+    size_t nWins = lookahead.vWins.size();
+    BOOST_CHECK(!lookahead.Update(pindexPrev, nBits, {search.GetId()}, nSearchTime));
+    lookahead.Search(pool, vWallets, vSearch, nHorizon, nSlotLen);
+    BOOST_CHECK_EQUAL(lookahead.vWins.size(), nWins);
+
+    // Sign the block of the first winning slot before the slot starts
+    StakeSlotWin win = lookahead.vWins.front();
+    BOOST_CHECK_EQUAL(lookahead.GetWakeTime(nSearchTime, nSlotLen), win.nTime - nSlotLen);
+    BOOST_REQUIRE(lookahead.SignNext(MakeUnique<CBlockTemplate>(*pblocktemplate), nHeight));
+    BOOST_REQUIRE(lookahead.pblocktemplate);
+    BOOST_CHECK_EQUAL(lookahead.nBuiltTime, win.nTime);
+    BOOST_CHECK_EQUAL(lookahead.GetWakeTime(nSearchTime, nSlotLen), win.nTime);
+    CBlock block = lookahead.pblocktemplate->block;
+    BOOST_CHECK(block.IsProofOfStake());
+    BOOST_CHECK_EQUAL((int64_t)block.nTime, win.nTime);
+
+    // Submit it when the slot starts
+    SetMockTime(win.nTime);
+    BOOST_REQUIRE(CheckStake(&block));
+    SetMockTime(0);
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(::ChainActive().Tip()->GetBlockHash() == block.GetHash());
+        pindexPrev = ::ChainActive().Tip();
+    }
+
+    // The new tip drops the slots found and the block signed for the previous tip
+    BOOST_CHECK(lookahead.Update(pindexPrev, nBits, {search.GetId()}, win.nTime + nSlotLen));
+    BOOST_CHECK(lookahead.vWins.empty());
+    BOOST_CHECK(!lookahead.pblocktemplate);
+    BOOST_CHECK_EQUAL(lookahead.nBuiltTime, 0);
+    BOOST_CHECK_EQUAL(lookahead.nSearchedTo, win.nTime + nSlotLen);
+    pool.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(stake_template_cache_test)
+{
+    CHDWallet *pwallet = pwalletMain.get();
+    UniValue rv;
+
+    BOOST_CHECK_NO_THROW(rv = CallRPC("extkeyimportmaster tprv8ZgxMBicQKsPeK5mCpvMsd1cwyT1JZsrBN82XkoYuZY1EVK7EwDaiL9sDfqUU5SntTfbRfnRedFWjg5xkDG5i3iwd3yP7neX5F2dtdCojk4"));
+    // Import the key to the last 5 outputs in the regtest genesis coinbase
+    BOOST_CHECK_NO_THROW(rv = CallRPC("extkeyimportmaster tprv8ZgxMBicQKsPe3x7bUzkHAJZzCuGqN6y28zFFyg5i7Yqxqm897VCnmMJz6QScsftHDqsyWW5djx6FzrbkF9HSD3ET163z1SzRhfcWxvwL4G"));
+
+    StakeBlockTemplateCache cache;
+    RegisterValidationInterface(&cache);
+
+    const CBlockIndex *pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = ::ChainActive().Tip();
+    }
+    BOOST_CHECK(cache.IsStale());
+    std::unique_ptr<CBlockTemplate> pblocktemplate = cache.Get(pindexPrev, false);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(!cache.IsStale());
+    size_t nTxns = pblocktemplate->block.vtx.size();
+
+    // A transaction added to the mempool marks the template stale
+    CKey kRecv;
+    InsecureNewKey(kRecv, true);
+    CTransactionRef tx_new;
+    CAmount nFeeRequired;
+    std::string strError;
+    int nChangePosRet = -1;
+    std::vector<CRecipient> vecSend{{GetScriptForDestination(PKHash(kRecv.GetPubKey())), 10000, false}};
+    CCoinControl coinControl;
+    {
+        auto locked_chain = pwallet->chain().lock();
+        BOOST_REQUIRE(pwallet->CreateTransaction(*locked_chain, vecSend, tx_new, nFeeRequired, nChangePosRet, strError, coinControl));
+    }
+    {
+        CValidationState state;
+        pwallet->SetBroadcastTransactions(true);
+        mapValue_t mapValue;
+        BOOST_REQUIRE(pwallet->CommitTransaction(tx_new, std::move(mapValue), {} /* orderForm */, state));
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK(cache.IsStale());
+
+    // Kept until a caller asks for a refresh
+    pblocktemplate = cache.Get(pindexPrev, false);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), nTxns);
+    BOOST_CHECK(cache.IsStale());
+
+    pblocktemplate = cache.Get(pindexPrev, true);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(!cache.IsStale());
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), nTxns + 1);
+    BOOST_CHECK(pblocktemplate->block.vtx.back()->GetHash() == tx_new->GetHash());
+
+    // A new tip marks the template stale, it is rebuilt on the new tip
+    StakeNBlocks(pwallet, 1);
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK(cache.IsStale());
+    {
+        LOCK(cs_main);
+        pindexPrev = ::ChainActive().Tip();
+    }
+    pblocktemplate = cache.Get(pindexPrev, false);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(!cache.IsStale());
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == pindexPrev->GetBlockHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), nTxns);
+
+    UnregisterValidationInterface(&cache);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1214,6 +1214,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     std::string sName = GetName();
     GetMainSignals().TransactionAddedToWallet(sName, wtxIn.tx);
+    UpdateStakeCandidates(hash);
     ClearCachedBalances();
 
     return true;
@@ -1499,6 +1500,7 @@ void CWallet::BlockDisconnected(const CBlock& block) {
     for (const CTransactionRef& ptx : block.vtx) {
         SyncTransaction(ptx, CWalletTx::Status::UNCONFIRMED, {} /* block hash */, 0 /* position in block */);
     }
+    ResetStakeCandidates();
     ClearCachedBalances();
 }
 
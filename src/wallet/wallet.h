@@ -1147,6 +1147,10 @@ public:
 
     //! For ParticlWallet, clear cached balances from wallet called at new block and adding new transaction
     virtual void ClearCachedBalances() {};
+    //! For ParticlWallet, re-evaluate the outputs of a transaction for staking after it was added, confirmed or removed
+    virtual void UpdateStakeCandidates(const uint256 &txid) {};
+    //! For ParticlWallet, rebuild the staking candidates from all transactions
+    virtual void ResetStakeCandidates() {};
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose=true);
     virtual void LoadToWallet(CWalletTx& wtxIn) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
@@ -30,3 +30,8 @@ bool CZMQAbstractNotifier::NotifySecureMessage(const smsg::SecureMessage *psmsg,
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifySecureMessageData(const uint8_t */*pHeader*/, const uint8_t */*pPayload*/, uint32_t /*nPayload*/, const CKeyID */*pAddressTo*/, const smsg::MessageData */*pMsg*/)
+{
+    return true;
+}
@@ -8,8 +8,10 @@
 #include <zmq/zmqconfig.h>
 
 class CBlockIndex;
+class CKeyID;
 namespace smsg {
 class SecureMessage;
+class MessageData;
 }
 class CZMQAbstractNotifier;
 
@@ -48,6 +50,7 @@ public:
 
     virtual bool NotifyTransaction(const std::string &sWalletName, const CTransaction &transaction);
     virtual bool NotifySecureMessage(const smsg::SecureMessage *psmsg, const uint160 &hash);
+    virtual bool NotifySecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg);
 
 protected:
     void *psocket;
@@ -106,6 +106,20 @@ std::list<const CZMQAbstractNotifier*> CZMQNotificationInterface::GetActiveNotif
     return result;
 }
 
+int CZMQNotificationInterface::ResendSecureMessages(const std::string &type, uint32_t nFrom, uint32_t &nFirst)
+{
+    int nSent = 0;
+    nFirst = 0;
+    for (auto *n : notifiers) {
+        CZMQAbstractPublishSMSGNotifier *notifier = dynamic_cast<CZMQAbstractPublishSMSGNotifier*>(n);
+        if (!notifier || notifier->GetType() != type) {
+            continue;
+        }
+        nSent += notifier->Resend(nFrom, nFirst);
+    }
+    return nSent;
+}
+
 CZMQNotificationInterface* CZMQNotificationInterface::Create()
 {
     CZMQNotificationInterface* notificationInterface = nullptr;
@@ -119,6 +133,8 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
 
     factories["pubhashwtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashWalletTransactionNotifier>;
     factories["pubsmsg"] = CZMQAbstractNotifier::Create<CZMQPublishSMSGNotifier>;
+    factories["pubsmsginbox"] = CZMQAbstractNotifier::Create<CZMQPublishSMSGInboxNotifier>;
+    factories["pubrawsmsg"] = CZMQAbstractNotifier::Create<CZMQPublishRawSMSGNotifier>;
 
     for (const auto& entry : factories)
     {
@@ -328,4 +344,17 @@ void CZMQNotificationInterface::NewSecureMessage(const smsg::SecureMessage *psms
     }
 }
 
+void CZMQNotificationInterface::NewSecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); ) {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifySecureMessageData(pHeader, pPayload, nPayload, pAddressTo, pMsg)) {
+            i++;
+        } else {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
 CZMQNotificationInterface* g_zmq_notification_interface = nullptr;
@@ -26,6 +26,10 @@ public:
 
     std::list<const CZMQAbstractNotifier*> GetActiveNotifiers() const;
 
+    /** Republish the backlogged secure messages of notifiers of type from sequence nFrom.
+     *  Returns the number of messages sent, nFirst is set to the oldest sequence still available. */
+    int ResendSecureMessages(const std::string &type, uint32_t nFrom, uint32_t &nFirst);
+
     static CZMQNotificationInterface* Create();
 
 protected:
@@ -40,6 +44,7 @@ protected:
 
     void TransactionAddedToWallet(const std::string &sWalletName, const CTransactionRef& tx) override;
     void NewSecureMessage(const smsg::SecureMessage *psmsg, const uint160 &hash) override;
+    void NewSecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg) override;
 
 private:
     CZMQNotificationInterface();
@@ -12,6 +12,7 @@
 #include <util/strencodings.h>
 #include <smsg/smessage.h>
 #include <compat/byteswap.h>
+#include <crypto/common.h>
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
@@ -21,6 +22,8 @@ static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_HASHWTX   = "hashwtx";
 static const char *MSG_SMSG      = "smsg";
+static const char *MSG_SMSGINBOX = "smsginbox";
+static const char *MSG_RAWSMSG   = "rawsmsg";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -66,6 +69,42 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+// Initialise a frame and write the data straight into the zmq message buffer
+static bool zmq_frame_init(zmq_msg_t &msg, const void *data, size_t size, const void *data2 = nullptr, size_t size2 = 0)
+{
+    if (zmq_msg_init_size(&msg, size + size2) != 0) {
+        zmqError("Unable to initialize ZMQ msg");
+        zmq_msg_init(&msg);
+        return false;
+    }
+    uint8_t *buf = (uint8_t*)zmq_msg_data(&msg);
+    if (size > 0) {
+        memcpy(buf, data, size);
+    }
+    if (size2 > 0) {
+        memcpy(buf + size, data2, size2);
+    }
+    return true;
+}
+
+static bool zmq_frame_send(void *sock, zmq_msg_t &msg, int flags)
+{
+    if (zmq_msg_send(&msg, sock, flags) == -1) {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
+        return false;
+    }
+    return true;
+}
+
+static void zmq_frames_close(std::vector<zmq_msg_t> &frames)
+{
+    for (auto &frame : frames) {
+        zmq_msg_close(&frame);
+    }
+    frames.clear();
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -264,3 +303,160 @@ bool CZMQPublishSMSGNotifier::NotifySecureMessage(const smsg::SecureMessage *psm
     ss << hash;
     return SendMessage(MSG_SMSG, &(*ss.begin()), ss.size());
 }
+
+CZMQAbstractPublishSMSGNotifier::~CZMQAbstractPublishSMSGNotifier()
+{
+    ClearBacklog();
+}
+
+bool CZMQAbstractPublishSMSGNotifier::Initialize(void *pcontext)
+{
+    m_max_backlog = std::max((int64_t)0, gArgs.GetArg("-zmqsmsgbacklog", DEFAULT_ZMQ_SMSG_BACKLOG));
+    return CZMQAbstractPublishNotifier::Initialize(pcontext);
+}
+
+void CZMQAbstractPublishSMSGNotifier::Shutdown()
+{
+    ClearBacklog();
+    CZMQAbstractPublishNotifier::Shutdown();
+}
+
+void CZMQAbstractPublishSMSGNotifier::ClearBacklog()
+{
+    LOCK(cs_backlog);
+    for (auto &entry : m_backlog) {
+        zmq_frames_close(entry.second);
+    }
+    m_backlog.clear();
+}
+
+bool CZMQAbstractPublishSMSGNotifier::SendParts(std::vector<zmq_msg_t> &frames, uint32_t nSeq)
+{
+    assert(psocket);
+
+    zmq_msg_t msg;
+    if (!zmq_frame_init(msg, m_command, strlen(m_command))
+        || !zmq_frame_send(psocket, msg, ZMQ_SNDMORE)) {
+        return false;
+    }
+    for (auto &frame : frames) {
+        // Large frames are reference counted, the copy shares the buffer
+        if (zmq_msg_init(&msg) != 0
+            || zmq_msg_copy(&msg, &frame) != 0) {
+            zmqError("Unable to copy ZMQ msg");
+            zmq_msg_close(&msg);
+            return false;
+        }
+        if (!zmq_frame_send(psocket, msg, ZMQ_SNDMORE)) {
+            return false;
+        }
+    }
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], nSeq);
+    return zmq_frame_init(msg, msgseq, sizeof(msgseq))
+        && zmq_frame_send(psocket, msg, 0);
+}
+
+bool CZMQAbstractPublishSMSGNotifier::SendFrames(std::vector<zmq_msg_t> &frames)
+{
+    LOCK(cs_backlog);
+    if (!SendParts(frames, nSequence)) {
+        zmq_frames_close(frames);
+        return false;
+    }
+
+    if (m_max_backlog > 0) {
+        if (m_backlog.size() >= m_max_backlog) {
+            zmq_frames_close(m_backlog.front().second);
+            m_backlog.pop_front();
+        }
+        m_backlog.emplace_back(nSequence, std::move(frames));
+    } else {
+        zmq_frames_close(frames);
+    }
+    nSequence++;
+
+    return true;
+}
+
+int CZMQAbstractPublishSMSGNotifier::Resend(uint32_t nFrom, uint32_t &nFirst)
+{
+    LOCK(cs_backlog);
+    nFirst = m_backlog.empty() ? nSequence : m_backlog.front().first;
+
+    int nSent = 0;
+    for (auto &entry : m_backlog) {
+        if (entry.first < nFrom) {
+            continue;
+        }
+        if (!SendParts(entry.second, entry.first)) {
+            break;
+        }
+        nSent++;
+    }
+    LogPrint(BCLog::ZMQ, "zmq: Resent %d %s messages from %u\n", nSent, m_command, nFrom);
+
+    return nSent;
+}
+
+CZMQPublishSMSGInboxNotifier::CZMQPublishSMSGInboxNotifier() : CZMQAbstractPublishSMSGNotifier(MSG_SMSGINBOX)
+{
+}
+
+bool CZMQPublishSMSGInboxNotifier::NotifySecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg)
+{
+    if (!pAddressTo) {
+        return true;
+    }
+    if (!pMsg) {
+        LogPrint(BCLog::ZMQ, "zmq: Not publishing smsginbox, message was not decrypted\n");
+        return true;
+    }
+    const smsg::MessageData &msg = *pMsg;
+
+    const smsg::SecureMessage *psmsg = (const smsg::SecureMessage*) pHeader;
+
+    uint160 hash;
+    smsgModule.HashMsg(*psmsg, pPayload, nPayload-(psmsg->IsPaidVersion() ? 32 : 0), hash);
+    uint8_t msgid[28];
+    WriteBE64(&msgid[0], psmsg->timestamp);
+    memcpy(&msgid[8], hash.begin(), 20);
+    LogPrint(BCLog::ZMQ, "zmq: Publish smsginbox %s\n", HexStr(msgid, msgid + 28));
+
+    std::string sAddrTo = EncodeDestination(PKHash(*pAddressTo));
+    size_t nText = strnlen((const char*)msg.vchMessage.data(), msg.vchMessage.size());
+
+    /* frames: msgid, from address, to address, text */
+    std::vector<zmq_msg_t> frames(4);
+    for (auto &frame : frames) {
+        zmq_msg_init(&frame);
+    }
+    if (!zmq_frame_init(frames[0], msgid, sizeof(msgid))
+        || !zmq_frame_init(frames[1], msg.sFromAddress.data(), msg.sFromAddress.size())
+        || !zmq_frame_init(frames[2], sAddrTo.data(), sAddrTo.size())
+        || !zmq_frame_init(frames[3], msg.vchMessage.data(), nText)) {
+        zmq_frames_close(frames);
+        return false;
+    }
+    return SendFrames(frames);
+}
+
+CZMQPublishRawSMSGNotifier::CZMQPublishRawSMSGNotifier() : CZMQAbstractPublishSMSGNotifier(MSG_RAWSMSG)
+{
+}
+
+bool CZMQPublishRawSMSGNotifier::NotifySecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg)
+{
+    if (pAddressTo) {
+        return true;
+    }
+
+    LogPrint(BCLog::ZMQ, "zmq: Publish rawsmsg, %u bytes\n", nPayload);
+
+    /* frames: header and payload */
+    std::vector<zmq_msg_t> frames(1);
+    if (!zmq_frame_init(frames[0], pHeader, smsg::SMSG_HDR_LEN, pPayload, nPayload)) {
+        return false;
+    }
+    return SendFrames(frames);
+}
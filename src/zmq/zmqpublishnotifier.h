@@ -6,12 +6,16 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include <zmq/zmqabstractnotifier.h>
+#include <sync.h>
+
+#include <deque>
+#include <vector>
 
 class CBlockIndex;
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
-private:
+protected:
     uint32_t nSequence {0U}; //!< upcounting per message sequence number
 
 public:
@@ -64,5 +68,56 @@ public:
     bool NotifySecureMessage(const smsg::SecureMessage *psmsg, const uint160 &hash) override;
 };
 
+/** Publishes full secure messages and keeps the last messages sent so a subscriber can resume from a sequence number. */
+class CZMQAbstractPublishSMSGNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    static const int DEFAULT_ZMQ_SMSG_BACKLOG {1000};
+
+    explicit CZMQAbstractPublishSMSGNotifier(const char *command) : m_command(command) {}
+    ~CZMQAbstractPublishSMSGNotifier();
+
+    bool Initialize(void *pcontext) override;
+    void Shutdown() override;
+
+    /* send zmq multipart message
+       parts:
+          * command
+          * frames
+          * message sequence number
+       Takes ownership of the frames, which are kept in the backlog and shared with zmq without copying.
+    */
+    bool SendFrames(std::vector<zmq_msg_t> &frames);
+
+    /** Send the backlogged messages from sequence nFrom again with their original sequence numbers.
+     *  nFirst is set to the oldest sequence in the backlog. */
+    int Resend(uint32_t nFrom, uint32_t &nFirst);
+
+private:
+    bool SendParts(std::vector<zmq_msg_t> &frames, uint32_t nSeq);
+    void ClearBacklog();
+
+    Mutex cs_backlog;
+    const char *m_command;
+    size_t m_max_backlog = DEFAULT_ZMQ_SMSG_BACKLOG;
+    std::deque<std::pair<uint32_t, std::vector<zmq_msg_t>>> m_backlog;
+};
+
+/** Publishes decrypted messages as they are added to the inbox. */
+class CZMQPublishSMSGInboxNotifier : public CZMQAbstractPublishSMSGNotifier
+{
+public:
+    CZMQPublishSMSGInboxNotifier();
+    bool NotifySecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg) override;
+};
+
+/** Publishes the encrypted envelope of every message stored in the buckets. */
+class CZMQPublishRawSMSGNotifier : public CZMQAbstractPublishSMSGNotifier
+{
+public:
+    CZMQPublishRawSMSGNotifier();
+    bool NotifySecureMessageData(const uint8_t *pHeader, const uint8_t *pPayload, uint32_t nPayload, const CKeyID *pAddressTo, const smsg::MessageData *pMsg) override;
+};
+
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
@@ -79,11 +79,57 @@ UniValue getnewzmqserverkeypair(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue resendzmqsmsg(const JSONRPCRequest& request)
+{
+            RPCHelpMan{"resendzmqsmsg",
+                "\nPublish the secure messages kept in the backlog of a smsg notifier again, starting from sequence number.\n"
+                "Messages are sent with their original sequence numbers to all subscribers.\n",
+                {
+                    {"type", RPCArg::Type::STR, RPCArg::Optional::NO, "Notifier type, \"pubsmsginbox\" or \"pubrawsmsg\"."},
+                    {"sequence", RPCArg::Type::NUM, RPCArg::Optional::NO, "Sequence number of the first message to resend."},
+                },
+                RPCResult{
+            "{\n"
+            "  \"numsent\": n,          (numeric) Number of messages resent\n"
+            "  \"firstsequence\": n,    (numeric) Oldest sequence number in the backlog, earlier messages must be read from smsginbox\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("resendzmqsmsg", "\"pubsmsginbox\" 10")
+            + HelpExampleRpc("resendzmqsmsg", "\"pubsmsginbox\", 10")
+                },
+            }.Check(request);
+
+    RPCTypeCheck(request.params, {UniValue::VSTR, UniValue::VNUM});
+
+    std::string type = request.params[0].get_str();
+    if (type != "pubsmsginbox" && type != "pubrawsmsg") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown notifier type.");
+    }
+    int64_t nFrom = request.params[1].get_int64();
+    if (nFrom < 0 || nFrom > std::numeric_limits<uint32_t>::max()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "sequence out of range.");
+    }
+
+    uint32_t nFirst = 0;
+    int nSent = 0;
+    if (g_zmq_notification_interface != nullptr) {
+        nSent = g_zmq_notification_interface->ResendSecureMessages(type, nFrom, nFirst);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("numsent", nSent);
+    result.pushKV("firstsequence", (int64_t)nFirst);
+
+    return result;
+}
+
 const CRPCCommand commands[] =
 { //  category              name                                actor (function)                argNames
   //  -----------------     ------------------------            -----------------------         ----------
     { "zmq",                "getzmqnotifications",              &getzmqnotifications,           {} },
     { "zmq",                "getnewzmqserverkeypair",           &getnewzmqserverkeypair,        {} },
+    { "zmq",                "resendzmqsmsg",                    &resendzmqsmsg,                 {"type", "sequence"} },
 };
 
 } // anonymous namespace
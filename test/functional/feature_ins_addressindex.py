@@ -11,7 +11,7 @@
 import time
 
 from test_framework.test_particl import ParticlTestFramework, connect_nodes_bi
-from test_framework.util import assert_equal
+from test_framework.util import assert_equal, assert_raises_rpc_error
 
 
 
@@ -131,6 +131,16 @@ class AddressIndexTest(ParticlTestFramework):
         assert_equal(multitxids[4], txid2)
         assert_equal(multitxids[5], txidb2)
 
+        # Check that txids can be paged with a cursor
+        self.log.info("Testing paging txids..")
+        addresses = ["r8L81gLiWg46j5EGfZSp2JHmA9hBgLbHuf", "pqZDE7YNWv5PJWidiaEG8tqfebkd6PNZDV"]
+        page = self.nodes[1].getaddresstxids({"addresses": addresses, "limit": 4})
+        assert_equal(page['txids'], multitxids[:4])
+        page = self.nodes[1].getaddresstxids({"addresses": addresses, "limit": 4, "cursor": page['cursor']})
+        assert_equal(page['txids'], multitxids[4:])
+        assert('cursor' not in page)
+        assert_raises_rpc_error(-8, 'Invalid cursor', self.nodes[1].getaddresstxids, {"addresses": addresses, "limit": 4, "cursor": "00"})
+
         # Check that balances are correct
         balance0 = self.nodes[1].getaddressbalance("r8L81gLiWg46j5EGfZSp2JHmA9hBgLbHuf")
         assert_equal(balance0["balance"], 45 * 100000000)
@@ -204,6 +214,20 @@ class AddressIndexTest(ParticlTestFramework):
         deltasAll = self.nodes[1].getaddressdeltas({"addresses": [address2]})
         assert_equal(len(deltasAll), 4)
 
+        # Check that deltas can be paged with a cursor
+        pages = []
+        cursor = None
+        while True:
+            params = {"addresses": [address2], "limit": 1}
+            if cursor:
+                params['cursor'] = cursor
+            page = self.nodes[1].getaddressdeltas(params)
+            pages += page['deltas']
+            if 'cursor' not in page:
+                break
+            cursor = page['cursor']
+        assert_equal(pages, deltasAll)
+
         # Check that deltas can be returned from range of block heights
         deltas = self.nodes[1].getaddressdeltas({"addresses": [address2], "start": 3, "end": 3})
         assert_equal(len(deltas), 1)
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Particl Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test stealthindex watches and fetching
+#
+
+from test_framework.test_particl import ParticlTestFramework, connect_nodes_bi
+from test_framework.util import assert_equal, assert_raises_rpc_error
+
+
+class StealthIndexTest(ParticlTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.extra_args = [
+            ['-debug', '-noacceptnonstdtxn', '-reservebalance=10000000'],
+            ['-debug', '-noacceptnonstdtxn', '-reservebalance=10000000'],
+            ['-debug', '-noacceptnonstdtxn', '-reservebalance=10000000', '-stealthindex'],]
+
+    def skip_test_if_missing_module(self):
+        self.skip_if_no_wallet()
+
+    def setup_network(self, split=False):
+        self.add_nodes(self.num_nodes, extra_args=self.extra_args)
+        self.start_nodes()
+
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+        self.sync_all()
+
+    def run_test(self):
+        nodes = self.nodes
+
+        nodes[0].extkeyimportmaster('abandon baby cabbage dad eager fabric gadget habit ice kangaroo lab absorb')
+        assert(nodes[0].getwalletinfo()['total_balance'] == 100000)
+
+        nodes[1].extkeyimportmaster('drip fog service village program equip minute dentist series hawk crop sphere olympic lazy garbage segment fox library good alley steak jazz force inmate')
+        sxAddr = nodes[1].getnewstealthaddress('lblsx11')
+        scanSecret = nodes[1].liststealthaddresses(True)[0]['Stealth Addresses'][0]['Scan Secret']
+
+        assert_equal(nodes[2].getindexinfo()['stealthindex'], True)
+        assert_raises_rpc_error(-8, 'Scan secret does not match', nodes[2].addstealthwatch, sxAddr, nodes[0].dumpprivkey(nodes[0].getnewaddress()))
+
+        self.log.info('Testing rescan of indexed blocks..')
+        txnHashAnon = nodes[0].sendfalcontoanon(sxAddr, 1, '', '', False, 'node0 -> node1 p->a')
+        txnHashBlind = nodes[0].sendfalcontoblind(sxAddr, 2, '', '', False, 'node0 -> node1 p->b')
+        for h in [txnHashAnon, txnHashBlind]:
+            assert(self.wait_for_mempool(nodes[0], h))
+        self.stakeBlocks(1)
+
+        ro = nodes[2].addstealthwatch(sxAddr, scanSecret)
+        assert_equal(ro['address'], sxAddr)
+        assert_equal(ro['found'], 2)
+        assert_equal(nodes[2].liststealthwatches(), [sxAddr])
+        assert_raises_rpc_error(-1, 'already watched', nodes[2].addstealthwatch, sxAddr, scanSecret)
+
+        outputs = nodes[2].getstealthwatchoutputs(sxAddr)
+        assert_equal(len(outputs), 2)
+        types = {o['txid']: o['type'] for o in outputs}
+        assert_equal(types[txnHashAnon], 'anon')
+        assert_equal(types[txnHashBlind], 'blind')
+
+        self.log.info('Testing new blocks..')
+        txnHash = nodes[0].sendfalcontoblind(sxAddr, 3, '', '', False, 'node0 -> node1 p->b 2')
+        assert(self.wait_for_mempool(nodes[0], txnHash))
+        self.stakeBlocks(1)
+        self.sync_all()
+
+        outputs = nodes[2].getstealthwatchoutputs(sxAddr)
+        assert_equal(len(outputs), 3)
+        assert_equal(outputs[2]['txid'], txnHash)
+        height = nodes[2].getblockcount()
+        assert_equal(outputs[2]['height'], height)
+        assert_equal(len(nodes[2].getstealthwatchoutputs(sxAddr, height, height)), 1)
+
+        self.log.info('Testing watches are kept over restarts..')
+        self.restart_node(2, self.extra_args[2])
+        connect_nodes_bi(self.nodes, 0, 2)
+        assert_equal(nodes[2].liststealthwatches(), [sxAddr])
+        assert_equal(len(nodes[2].getstealthwatchoutputs(sxAddr)), 3)
+
+        self.log.info('Testing removing watches..')
+        assert_equal(nodes[2].removestealthwatch(sxAddr), True)
+        assert_equal(nodes[2].removestealthwatch(sxAddr), False)
+        assert_equal(nodes[2].liststealthwatches(), [])
+        assert_raises_rpc_error(-5, 'not watched', nodes[2].getstealthwatchoutputs, sxAddr)
+
+        ro = nodes[2].addstealthwatch(sxAddr, scanSecret, -1)
+        assert_equal(ro['found'], 0)
+        assert_equal(len(nodes[2].getstealthwatchoutputs(sxAddr)), 0)
+
+
+if __name__ == '__main__':
+    StealthIndexTest().main()
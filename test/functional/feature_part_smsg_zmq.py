@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Particl Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the smsginbox and rawsmsg ZMQ notifiers and resendzmqsmsg."""
+import configparser
+import os
+import struct
+import time
+
+from test_framework.test_particl import ParticlTestFramework
+from test_framework.test_framework import SkipTest
+from test_framework.authproxy import JSONRPCException
+
+SMSG_HDR_LEN = 108
+
+
+class SmsgZMQTest(ParticlTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def skip_test_if_missing_module(self):
+        self.skip_if_no_wallet()
+
+    def setup_nodes(self):
+        # Try to import python3-zmq. Skip this test if the import fails.
+        try:
+            import zmq
+        except ImportError:
+            raise SkipTest("python3-zmq module not available.")
+
+        # Check that particl has been built with ZMQ enabled
+        config = configparser.ConfigParser()
+        if not self.options.configfile:
+            self.options.configfile = os.path.dirname(__file__) + "/../config.ini"
+        config.read_file(open(self.options.configfile))
+
+        if not config["components"].getboolean("ENABLE_ZMQ"):
+            raise SkipTest("falcond has not been built with zmq enabled.")
+
+        self.zmq = zmq
+        self.zmqContext = zmq.Context()
+        self.zmqSubSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqPending = []
+
+        self.zmqSubSocket.set(zmq.RCVTIMEO, 60000)
+        self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"smsginbox")
+        self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"rawsmsg")
+
+        ip_address = "tcp://127.0.0.1:28334"
+        self.zmqSubSocket.connect(ip_address)
+
+        self.extra_args = [['-smsgsaddnewkeys',
+                            '-zmqpubsmsginbox=%s' % ip_address,
+                            '-zmqpubrawsmsg=%s' % ip_address,
+                            '-zmqsmsgbacklog=2'],
+                           ['-smsgsaddnewkeys']]
+        self.add_nodes(self.num_nodes, self.extra_args)
+        self.start_nodes()
+
+    def run_test(self):
+        try:
+            self._zmq_test()
+        finally:
+            # Destroy the zmq context
+            self.log.debug("Destroying zmq context")
+            self.zmqContext.destroy(linger=None)
+
+    def waitForZmqTopic(self, topic):
+        # Messages of other topics are kept for later calls
+        for i, msg in enumerate(self.zmqPending):
+            if msg[0].decode('utf-8') == topic:
+                del self.zmqPending[i]
+                return msg[1:-1], struct.unpack('<I', msg[-1])[-1]
+        for count in range(0, 100):
+            try:
+                msg = self.zmqSubSocket.recv_multipart(self.zmq.NOBLOCK)
+            except self.zmq.ZMQError:
+                time.sleep(0.25)
+                continue
+
+            if msg[0].decode('utf-8') == topic:
+                return msg[1:-1], struct.unpack('<I', msg[-1])[-1]
+            self.zmqPending.append(msg)
+        assert False, 'No %s message received' % (topic)
+
+    def sendMessage(self, addrFrom, addrTo, text, nMessages):
+        nodes = self.nodes
+        ro = nodes[1].smsgsend(addrFrom, addrTo, text)
+        assert(ro['result'] == 'Sent.')
+        self.waitForSmsgExchange(nMessages, 1, 0)
+        return ro['msgid']
+
+    def checkInbox(self, frames, msgid, addrFrom, addrTo, text):
+        assert(len(frames) == 4)
+        assert(frames[0].hex() == msgid)
+        assert(frames[1].decode('utf-8') == addrFrom)
+        assert(frames[2].decode('utf-8') == addrTo)
+        assert(frames[3].decode('utf-8') == text)
+
+    def _zmq_test(self):
+        nodes = self.nodes
+
+        nodes[0].extkeyimportmaster(nodes[0].mnemonic('new')['master'])
+        nodes[1].extkeyimportmaster('abandon baby cabbage dad eager fabric gadget habit ice kangaroo lab absorb')
+
+        address0 = nodes[0].getnewaddress()  # Will be different each run
+        address1 = nodes[1].getnewaddress()
+
+        ro = nodes[0].smsglocalkeys()
+        assert(len(ro['wallet_keys']) == 1)
+        ro = nodes[1].smsgaddaddress(address0, ro['wallet_keys'][0]['public_key'])
+        assert(ro['result'] == 'Public key added to db.')
+
+        self.log.info('Publish received messages')
+        msgids = []
+        texts = ['Test zmq 1->0. %d' % (i) for i in range(3)]
+        msgids.append(self.sendMessage(address1, address0, texts[0], 1))
+
+        frames, seq = self.waitForZmqTopic('rawsmsg')
+        assert(seq == 0)
+        assert(len(frames) == 1)
+        assert(len(frames[0]) > SMSG_HDR_LEN)
+
+        frames, seq = self.waitForZmqTopic('smsginbox')
+        assert(seq == 0)
+        self.checkInbox(frames, msgids[0], address1, address0, texts[0])
+
+        msgids.append(self.sendMessage(address1, address0, texts[1], 2))
+        frames, seq = self.waitForZmqTopic('smsginbox')
+        assert(seq == 1)
+        self.checkInbox(frames, msgids[1], address1, address0, texts[1])
+
+        self.log.info('Resend the backlog')
+        ro = nodes[0].resendzmqsmsg('pubsmsginbox', 0)
+        assert(ro['numsent'] == 2)
+        assert(ro['firstsequence'] == 0)
+        for i in range(2):
+            frames, seq = self.waitForZmqTopic('smsginbox')
+            assert(seq == i)
+            self.checkInbox(frames, msgids[i], address1, address0, texts[i])
+
+        ro = nodes[0].resendzmqsmsg('pubsmsginbox', 1)
+        assert(ro['numsent'] == 1)
+        frames, seq = self.waitForZmqTopic('smsginbox')
+        assert(seq == 1)
+        self.checkInbox(frames, msgids[1], address1, address0, texts[1])
+
+        self.log.info('Backlog is bounded by -zmqsmsgbacklog')
+        msgids.append(self.sendMessage(address1, address0, texts[2], 3))
+        frames, seq = self.waitForZmqTopic('smsginbox')
+        assert(seq == 2)
+        self.checkInbox(frames, msgids[2], address1, address0, texts[2])
+
+        ro = nodes[0].resendzmqsmsg('pubsmsginbox', 0)
+        assert(ro['numsent'] == 2)
+        assert(ro['firstsequence'] == 1)
+        for i in range(1, 3):
+            frames, seq = self.waitForZmqTopic('smsginbox')
+            assert(seq == i)
+            self.checkInbox(frames, msgids[i], address1, address0, texts[i])
+
+        ro = nodes[0].resendzmqsmsg('pubrawsmsg', 100)
+        assert(ro['numsent'] == 0)
+
+        try:
+            nodes[0].resendzmqsmsg('pubsmsg', 0)
+            assert(False), 'resendzmqsmsg with unknown type.'
+        except JSONRPCException as e:
+            assert('Unknown notifier type.' in e.error['message'])
+
+
+if __name__ == '__main__':
+    SmsgZMQTest().main()
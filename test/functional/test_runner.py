@@ -237,6 +237,7 @@ PARTICL_SCRIPTS = [
     'rpc_part_filtertransactions.py',
     'feature_part_vote.py',
     'feature_part_zmq_test.py',
+    'feature_part_smsg_zmq.py',
     'rpc_part_wallet.py',
     'rpc_part_burn.py',
     'feature_part_usbdevice.py',
@@ -257,6 +258,7 @@ INSIGHT_SCRIPTS = [
     'feature_ins_spentindex.py',
     'feature_ins_txindex.py',
     'feature_ins_csindex.py',
+    'feature_ins_stealthindex.py',
 ]
 
 # Place EXTENDED_SCRIPTS first since it has the 3 longest running tests